@@ -0,0 +1,136 @@
+#include "stdafx.h"
+#include "ArgList.h"
+
+/**
+ * @return Returns true if the character separates arguments.
+ */
+static bool IsArgSeparator( wchar_t c ) {
+    return L' ' == c || L'\t' == c || L'\r' == c || L'\n' == c;
+}
+
+/**
+ * @return Returns true if the character may start a key.
+ */
+static bool IsKeyStart( wchar_t c ) {
+    return ( c >= L'a' && c <= L'z' ) || ( c >= L'A' && c <= L'Z' );
+}
+
+/**
+ * @return Returns true if the character may appear in a key.
+ */
+static bool IsKeyChar( wchar_t c ) {
+    return IsKeyStart( c ) || ( c >= L'0' && c <= L'9' ) || L'_' == c;
+}
+
+void SplitCustomActionData( __inout LPWSTR data, __out std::vector<LPWSTR>& argv ) {
+
+    argv.clear();
+    if ( NULL == data ) {
+        return;
+    }
+
+    // Characters are read at "in" and written back at "out".  Since "out"
+    // never passes "in", the argument text can be compacted in place.
+    LPWSTR in = data;
+    LPWSTR out = data;
+
+    for ( ;; ) {
+        while ( IsArgSeparator( *in ) ) {
+            ++in;
+        }
+        if ( L'\0' == *in ) {
+            break;
+        }
+
+        argv.push_back( out );
+        bool quoted = false;
+        for ( ; L'\0' != *in; ++in ) {
+            if ( L'"' == *in ) {
+                if ( quoted && L'"' == in[1] ) {
+                    *out++ = *++in;
+                } else {
+                    quoted = !quoted;
+                }
+            } else if ( !quoted && IsArgSeparator( *in ) ) {
+                break;
+            } else {
+                *out++ = *in;
+            }
+        }
+
+        // "out" may have caught up with "in", so step "in" past the
+        // separator before it is overwritten by the terminator.
+        if ( L'\0' != *in ) {
+            ++in;
+        }
+        *out++ = L'\0';
+    }
+} // SplitCustomActionData
+
+ArgList::ArgList( int argc, LPWSTR* argv ) {
+
+    for ( int i = 0; i < argc; ++i ) {
+        LPCWSTR arg = ( NULL == argv[i] ? L"" : argv[i] );
+
+        LPCWSTR ptr = arg;
+        if ( IsKeyStart( *ptr ) ) {
+            while ( IsKeyChar( *ptr ) ) {
+                ++ptr;
+            }
+        }
+
+        if ( ptr != arg && L'=' == *ptr ) {
+            NamedArg named = { arg, static_cast<size_t>( ptr - arg ), ptr + 1 };
+            m_named.push_back( named );
+        } else {
+            m_positional.push_back( arg );
+        }
+    }
+}
+
+bool ArgList::KeyMatches( __in const NamedArg& arg, __in LPCWSTR key ) const {
+    return wcslen( key ) == arg.keyLength
+        && 0 == _wcsnicmp( arg.key, key, arg.keyLength );
+}
+
+LPCWSTR ArgList::Named( __in LPCWSTR key ) const {
+    for ( auto iter = m_named.rbegin(); iter != m_named.rend(); ++iter ) {
+        if ( KeyMatches( *iter, key ) ) {
+            return iter->value;
+        }
+    }
+    return NULL;
+}
+
+void ArgList::NamedList( __in LPCWSTR key, __inout std::vector<LPCWSTR>& values ) const {
+    for ( auto iter = m_named.begin(); iter != m_named.end(); ++iter ) {
+        if ( KeyMatches( *iter, key ) ) {
+            values.push_back( iter->value );
+        }
+    }
+}
+
+DWORD ArgList::NamedNumber( __in LPCWSTR key, __in DWORD defaultValue ) const {
+    LPCWSTR value = Named( key );
+    if ( NULL == value ) {
+        return defaultValue;
+    }
+
+    wchar_t* end = NULL;
+    unsigned long number = wcstoul( value, &end, 10 );
+    if ( value == end || L'\0' != *end ) {
+        HRESULT hr = E_INVALIDARG;
+        LogResult( hr, "Argument '%ls=%ls' is not a number.", key, value );
+        throw hr;
+    }
+    return static_cast<DWORD>( number );
+}
+
+bool ArgList::NamedFlag( __in LPCWSTR key ) const {
+    LPCWSTR value = Named( key );
+    return NULL != value
+        && 0 != _wcsicmp( value, L"0" )
+        && 0 != _wcsicmp( value, L"no" )
+        && 0 != _wcsicmp( value, L"false" )
+        && 0 != _wcsicmp( value, L"off" );
+}
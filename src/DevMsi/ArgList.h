@@ -0,0 +1,93 @@
+/**
+ * Header file for splitting CustomActionData into arguments and for
+ * looking up named ("key=value") arguments.
+ */
+#pragma once
+#include <vector>
+
+/**
+ * Split a CustomActionData string into arguments, in place.
+ *
+ * The string is split in a single pass without copying.  Separators are
+ * overwritten with null characters and quotes are squeezed out, so each
+ * argument in argv points into the original buffer, which must outlive argv.
+ *
+ * The rules are deliberately simpler than CommandLineToArgvW():
+ * 1)  Arguments are separated by spaces, tabs, carriage returns or line feeds.
+ * 2)  Double quotes group text containing separators into one argument.
+ *     Inside quotes, a doubled quote ("") stands for one literal quote.
+ * 3)  Backslashes are always literal, so "\root\foo" is passed as-is.
+ *
+ * @param data The CustomActionData string.  It will be modified.
+ * @param argv The output list of arguments.  It will be cleared prior to use.
+ */
+void SplitCustomActionData( __inout LPWSTR data, __out std::vector<LPWSTR>& argv );
+
+/**
+ * A view of argc/argv that separates positional and named arguments.
+ *
+ * An argument of the form "key=value", where the key is made of letters,
+ * digits and underscores and starts with a letter, is a named argument.
+ * Keys are case-insensitive.  A key may be repeated to pass a list of values.
+ * Every other argument is positional.
+ *
+ * Nothing is copied:  the keys and values refer to the argv strings, which
+ * must outlive the ArgList.
+ */
+class ArgList {
+public:
+    ArgList( int argc, LPWSTR* argv );
+
+    /**
+     * @return Returns the positional arguments, in order.
+     */
+    const std::vector<LPCWSTR>& Positional() const { return m_positional; }
+
+    /**
+     * Look up a named argument.
+     *
+     * @param key The key to be found (e.g. L"timeout").
+     * @return Returns the value of the last argument with that key, or NULL if there is none.
+     */
+    LPCWSTR Named( __in LPCWSTR key ) const;
+
+    /**
+     * Look up every value of a repeated named argument.
+     *
+     * @param key The key to be found.
+     * @param values The output list of values, in order.  Values are appended.
+     */
+    void NamedList( __in LPCWSTR key, __inout std::vector<LPCWSTR>& values ) const;
+
+    /**
+     * Look up a named argument holding an unsigned decimal number.
+     *
+     * An exception will be thrown if the value is not a number.
+     *
+     * @param key The key to be found.
+     * @param defaultValue The value to be returned if the key is absent.
+     * @return Returns the number.
+     */
+    DWORD NamedNumber( __in LPCWSTR key, __in DWORD defaultValue ) const;
+
+    /**
+     * Look up a named on/off argument.
+     *
+     * @param key The key to be found.
+     * @return Returns true if the key is present with any value other than
+     *         "0", "no", "false" or "off".
+     */
+    bool NamedFlag( __in LPCWSTR key ) const;
+
+private:
+    struct NamedArg {
+        LPCWSTR key;        //*< The start of the key
+        size_t keyLength;   //*< The length of the key, which is not null-terminated
+        LPCWSTR value;      //*< The value, which is null-terminated
+    };
+
+    bool KeyMatches( __in const NamedArg& arg, __in LPCWSTR key ) const;
+
+    std::vector<LPCWSTR> m_positional;
+    std::vector<NamedArg> m_named;
+};
@@ -68,7 +68,7 @@ public:
 
     void Close() {
         if ( IsValid() ) {
-            SetupDiDestroyDeviceInfoList( m_handle );
+            CloseServiceHandle( m_handle );
             m_handle = NULL;
         }
     }
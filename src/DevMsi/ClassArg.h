@@ -0,0 +1,34 @@
+/**
+ * Header file for classifying the class argument of DoCreateDevnode().
+ */
+#pragma once
+#include <string>
+
+/**
+* An enumeration of the valid types of class arguments provided to DoCreateDevnode().
+*
+* @see DoCreateDevnode
+* @see GetClassArgType
+*/
+typedef enum { 
+    evClassName,        //*< The argument is a class name (e.g. "System")
+    evClassGuidString,  //*< The argument is a class GUID in string form
+    evInfPath,          //*< The argument is a path to a relevant INF file
+    evInvalidClassArg   //*< The argument type is unknown
+} etClassArgType;
+
+/**
+* Examine the classArg and return the argument type.
+*
+* The argument is classified from its text alone, without touching the
+* file system:
+* 1)  A string of the form "{XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX}" with
+*     valid hex digits is a class GUID.
+* 2)  Anything containing a path separator, drive colon or dot is an INF path.
+*     Setup class names never contain these characters.
+* 3)  Anything else is a class name.
+*
+* @param classArg the argument to be inspected.
+* @return Returns the type of argument parsed.
+*/
+etClassArgType GetClassArgType( const std::wstring& classArg );
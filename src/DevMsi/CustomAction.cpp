@@ -1,10 +1,59 @@
 #include "stdafx.h"
 #include "devmsi.h"
+#include "ArgList.h"
+#include "LogResult.h"
+#include "Trace.h"
+#include <vector>
 
 // WiX Header Files:
 #include <wcautil.h>
 #include <strutil.h>
 
+/**
+ *  Set up the log sinks, asynchronous logging and tracing from the custom
+ *  action's named arguments.  These are:
+ *
+ *    logfile=<path>        Also log to this file.
+ *    logfilesize=<bytes>   Roll the log file over at this size (default 1 MB).
+ *    logfiles=<count>      Keep this many rolled-over log files (default 3).
+ *    logoverflow=drop      Drop messages, rather than wait, when the log queue is full.
+ *    trace=<path>          Write the time taken by each step to this file,
+ *                          in Chrome trace-event format.
+ *
+ *  @param argv The arguments split from CustomActionData.
+ *  @return Returns S_OK, or the error from a malformed argument.
+ */
+HRESULT StartCustomActionLogging( __in std::vector<LPWSTR>& argv )
+{
+    HRESULT hr = S_OK;
+
+    try
+    {
+        ArgList args( static_cast<int>( argv.size() ), argv.empty() ? NULL : &argv[0] );
+
+        const wchar_t* logFile = args.Named( L"logfile" );
+        if ( NULL != logFile ) {
+            LogAddSink( CreateRotatingFileLogSink( logFile
+                , args.NamedNumber( L"logfilesize", 1024 * 1024 )
+                , args.NamedNumber( L"logfiles", 3 ) ) );
+        }
+
+        const wchar_t* overflow = args.Named( L"logoverflow" );
+        LogStartAsync( ( NULL != overflow && 0 == _wcsicmp( overflow, L"drop" ) ) ? evLogOverflowDrop : evLogOverflowBlock );
+
+        const wchar_t* traceFile = args.Named( L"trace" );
+        if ( NULL != traceFile ) {
+            TraceStart( traceFile );
+        }
+    }
+    catch( HRESULT& _error )
+    {
+        hr = _error;
+    }
+
+    return hr;
+} // HRESULT StartCustomActionLogging( std::vector<LPWSTR>& argv )
+
 /**
  *  Sets up logging for MSIs and then calls the appropriate custom action with argc/argv parameters.
  * 
@@ -15,15 +64,19 @@
  *  a list of parameter(s) that we need.
  * 
  *  For this implementation, it made sense to treat the single string provided in CustomActionData
- *  as if it were a command line, and then parse it out just as if it were a command line.  Obviously,
- *  the "program name" isn't going to be the first argument unless the MSI writer is pedantic, but
- *  otherwise it seems to be a good way to do it.
+ *  as if it were a command line, and then split it up much like a command line.  Unlike
+ *  CommandLineToArgvW(), the split is done in place and backslashes are never treated as escapes,
+ *  so hardware IDs like "\root\foo" pass through untouched.  See SplitCustomActionData().
+ *  Arguments of the form "key=value" are passed through as-is, for the called function to pick
+ *  out with ArgList.
  * 
  *  Since all entry points need to do this same work, it was easiest to have a single function that
  *  would do the setup, pull the CustomActionData parameter, split it into an argc/argv style of
  *  argument list, and then pass that argument list into a function that actually does something
  *  interesting.
  *
+ *  Logging options in CustomActionData are handled here; see StartCustomActionLogging().
+ *
  *  @param hInstall The hInstall parameter provided by MSI/WiX.
  *  @param func The function to be called with argc/argv parameters.
  *  @param actionName The text description of the function.  It will be put in the log.
@@ -34,8 +87,7 @@ UINT CustomActionArgcArgv( MSIHANDLE hInstall, CUSTOM_ACTION_ARGC_ARGV func, LPC
 	HRESULT hr = S_OK;
 	UINT er = ERROR_SUCCESS;
     LPWSTR pszCustomActionData = NULL;
-    int argc = 0;
-    LPWSTR* argv = NULL;
+    std::vector<LPWSTR> argv;
 
 	hr = WcaInitialize(hInstall, actionName);
 	ExitOnFailure(hr, "Failed to initialize");
@@ -53,22 +105,23 @@ UINT CustomActionArgcArgv( MSIHANDLE hInstall, CUSTOM_ACTION_ARGC_ARGV func, LPC
 
     // Convert the string retrieved into a standard argc/arg layout
     // (ignoring the fact that the first parameter is whatever was
-    // passed, not necessarily the application name/path).
-    argv = CommandLineToArgvW( pszCustomActionData, &argc );
-    if ( NULL == argv )
-    {
-        hr = HRESULT_FROM_WIN32( GetLastError() );
-        ExitOnFailure(hr, "Failed to convert Custom Action Data to argc/argv.");
-    }
+    // passed, not necessarily the application name/path).  The
+    // arguments point into pszCustomActionData.
+    SplitCustomActionData( pszCustomActionData, argv );
+
+    hr = StartCustomActionLogging( argv );
+    ExitOnFailure(hr, "Failed to start logging");
 
-    hr = (func)( argc, argv );
+    hr = (func)( static_cast<int>( argv.size() ), argv.empty() ? NULL : &argv[0] );
     ExitOnFailure(hr, "Custom action failed");
 
 LExit:
     // Resource freeing here!
+    // A trace that cannot be written does not fail the install.
+    TraceStop();
+    // Deliver any queued log messages while the MSI session is still valid.
+    LogStopAsync();
     ReleaseStr(pszCustomActionData);
-    if ( NULL != argv )
-        LocalFree( argv );
 
 	er = SUCCEEDED(hr) ? ERROR_SUCCESS : ERROR_INSTALL_FAILURE;
 	return WcaFinalize(er);
@@ -79,6 +132,11 @@ UINT __stdcall CreateDevnode(MSIHANDLE hInstall)
     return CustomActionArgcArgv( hInstall, DoCreateDevnode, "CreateDevnode" );
 }
 
+UINT __stdcall CreateDevnodes(MSIHANDLE hInstall)
+{
+    return CustomActionArgcArgv( hInstall, DoCreateDevnodes, "CreateDevnodes" );
+}
+
 UINT __stdcall RemoveDevnode(MSIHANDLE hInstall)
 {
     return CustomActionArgcArgv( hInstall, DoRemoveDevnode, "RemoveDevnode" );
@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "Deadline.h"
+#include <SetupAPI.h>
+#include <algorithm>
+
+Deadline::Deadline( __in DWORD budgetMs )
+    : m_start( GetTickCount() ), m_budgetMs( budgetMs )
+    , m_firstDelayMs( RETRY_FIRST_DELAY_MS ), m_maxDelayMs( RETRY_MAX_DELAY_MS )
+    , m_random( GetTickCount() ^ GetCurrentThreadId() ) {
+}
+
+bool Deadline::Expired() const {
+    return 0 != m_budgetMs && Elapsed() >= m_budgetMs;
+}
+
+DWORD Deadline::Remaining() const {
+    if ( 0 == m_budgetMs ) {
+        return INFINITE;
+    }
+    DWORD elapsed = Elapsed();
+    return elapsed >= m_budgetMs ? 0 : m_budgetMs - elapsed;
+}
+
+DWORD Deadline::Elapsed() const {
+    return GetTickCount() - m_start;
+}
+
+HRESULT Deadline::Check( __in const char* work ) const {
+    if ( !Expired() ) {
+        return S_OK;
+    }
+    HRESULT hr = HRESULT_FROM_WIN32( ERROR_TIMEOUT );
+    LogResult( hr, "The time budget of %u ms is spent after %u ms; %s.", m_budgetMs, Elapsed(), work );
+    return hr;
+}
+
+DWORD Deadline::Jitter( __in DWORD limit ) const {
+    return static_cast<DWORD>( m_random() % ( static_cast<unsigned long long>( limit ) + 1 ) );
+}
+
+void Deadline::Seed( __in DWORD seed ) {
+    m_random.seed( seed );
+}
+
+void Deadline::SetBackoff( __in DWORD firstMs, __in DWORD maxMs ) {
+    m_firstDelayMs = firstMs;
+    m_maxDelayMs = maxMs;
+}
+
+/**
+ * The errors that IsTransientError() accepts, as Win32 error codes.
+ * SetupAPI errors are kept in the form GetLastError() returns them,
+ * which HRESULT_FROM_WIN32() leaves as they are.
+ */
+static const DWORD s_transientErrors[] = {
+    ERROR_BUSY,
+    ERROR_SHARING_VIOLATION,
+    ERROR_LOCK_VIOLATION,
+    ERROR_SERVICE_DATABASE_LOCKED,
+    RPC_S_SERVER_UNAVAILABLE,
+    RPC_S_SERVER_TOO_BUSY,
+    ERROR_DEVICE_INSTALLER_NOT_READY,
+};
+
+bool IsTransientError( __in HRESULT hr ) {
+    for ( size_t i = 0; i < _countof( s_transientErrors ); ++i ) {
+        if ( HRESULT_FROM_WIN32( s_transientErrors[i] ) == hr ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+DWORD RetryDelay( __in DWORD attempt, __in const Deadline& deadline ) {
+    // Half of the backoff is fixed and half is random ("equal jitter").
+    DWORD backoff = deadline.FirstDelay() << std::min<DWORD>( attempt - 1, 5 );
+    backoff = std::min<DWORD>( backoff, deadline.MaxDelay() );
+    DWORD delay = backoff / 2 + deadline.Jitter( backoff / 2 );
+    return std::min<DWORD>( delay, deadline.Remaining() );
+}
@@ -0,0 +1,134 @@
+/**
+ * Header file for the time budget of a function, and for retrying steps
+ * that fail for a moment while Plug and Play or the SCM is busy.
+ */
+#pragma once
+#include <random>
+
+//* The delay before the second attempt of a step, in milliseconds.
+#define RETRY_FIRST_DELAY_MS 100
+
+//* The longest delay between attempts, in milliseconds.
+#define RETRY_MAX_DELAY_MS 3200
+
+/**
+ * The time by which a function must finish, from its "budget=" argument.
+ *
+ * A deadline also draws the random jitter of its function's retries.
+ * Each call has its own deadline, so threads share no generator; a
+ * deadline itself is used by one thread at a time.
+ */
+class Deadline {
+public:
+    /**
+     * @param budgetMs The time allowed from now, in milliseconds, or 0 for no limit.
+     */
+    explicit Deadline( __in DWORD budgetMs );
+
+    //* Return true if the budget is spent.
+    bool Expired() const;
+
+    //* Return the time left, in milliseconds, or INFINITE if there is no limit.
+    DWORD Remaining() const;
+
+    //* Return the time since the deadline was set, in milliseconds.
+    DWORD Elapsed() const;
+
+    /**
+     * Check the deadline before starting more work.
+     *
+     * @param work What will not be done if the budget is spent, for the log.
+     * @return Returns S_OK, or HRESULT_FROM_WIN32(ERROR_TIMEOUT) if the budget
+     *         is spent.  The latter is logged.
+     */
+    HRESULT Check( __in const char* work ) const;
+
+    /**
+     * Return a pseudo-random number, for the jitter of a retry delay.
+     *
+     * @param limit The largest number to be returned.
+     * @return Returns a number from 0 to limit.
+     */
+    DWORD Jitter( __in DWORD limit ) const;
+
+    //* Restart the sequence of Jitter() from a seed, so that it can be repeated.
+    void Seed( __in DWORD seed );
+
+    /**
+     * Set the backoff of the retries under this deadline; see RetryDelay().
+     * It is RETRY_FIRST_DELAY_MS to RETRY_MAX_DELAY_MS unless set.
+     *
+     * @param firstMs The delay before the second attempt of a step.
+     * @param maxMs The longest delay between attempts.
+     */
+    void SetBackoff( __in DWORD firstMs, __in DWORD maxMs );
+
+    //* Return the delay before the second attempt of a step, in milliseconds.
+    DWORD FirstDelay() const { return m_firstDelayMs; }
+
+    //* Return the longest delay between attempts, in milliseconds.
+    DWORD MaxDelay() const { return m_maxDelayMs; }
+
+private:
+    DWORD m_start;                      //*< GetTickCount() when the deadline was set
+    DWORD m_budgetMs;                   //*< The time allowed, or 0 for no limit
+    DWORD m_firstDelayMs;               //*< The delay before the second attempt of a step
+    DWORD m_maxDelayMs;                 //*< The longest delay between attempts
+    mutable std::minstd_rand m_random;  //*< The generator of Jitter()
+};
+
+//* The most times RetryTransient() runs a step.
+#define RETRY_MAX_ATTEMPTS 8
+
+/**
+ * Return true if an error is one that goes away by itself, such as the SCM
+ * database being locked by another installer, or the PnP manager being busy.
+ */
+bool IsTransientError( __in HRESULT hr );
+
+/**
+ * Return how long to wait before the next attempt of a step:  an
+ * exponential backoff from the deadline's first delay to its longest,
+ * with random jitter so that installers that failed together do not
+ * retry together, cut short to what is left of the budget.
+ *
+ * @param attempt The number of attempts made so far.
+ * @param deadline The deadline of the function.
+ * @return Returns the delay in milliseconds.
+ */
+DWORD RetryDelay( __in DWORD attempt, __in const Deadline& deadline );
+
+/**
+ * Run a step, and run it again while it fails with a transient error,
+ * up to RETRY_MAX_ATTEMPTS times and while the budget lasts.  A step that
+ * needed more than one attempt, or gave up, is logged with its attempts
+ * and elapsed time.
+ *
+ * @param stepName The name of the step, for the log.
+ * @param deadline The deadline of the function.
+ * @param step Called for each attempt; returns an HRESULT.
+ * @return Returns the result of the last attempt.
+ */
+template<typename Step>
+HRESULT RetryTransient( __in const char* stepName, __in const Deadline& deadline, __in Step step )
+{
+    DWORD start = GetTickCount();
+    for ( DWORD attempt = 1; ; ++attempt ) {
+        HRESULT hr = step();
+        if ( SUCCEEDED( hr ) || !IsTransientError( hr ) ) {
+            if ( 1 < attempt ) {
+                LogResult( hr, "%s finished after %u attempt(s) in %u ms.", stepName, attempt, GetTickCount() - start );
+            }
+            return hr;
+        }
+
+        DWORD delay = RetryDelay( attempt, deadline );
+        if ( RETRY_MAX_ATTEMPTS <= attempt || 0 == delay ) {
+            LogResult( hr, "%s failed after %u attempt(s) in %u ms; giving up%s.", stepName, attempt
+                , GetTickCount() - start, deadline.Expired() ? " as the time budget is spent" : "" );
+            return hr;
+        }
+        LogResult( hr, "%s failed on attempt %u; retrying in %u ms.", stepName, attempt, delay );
+        Sleep( delay );
+    }
+} // HRESULT RetryTransient( const char* stepName, const Deadline& deadline, Step step )
@@ -0,0 +1,121 @@
+#include "stdafx.h"
+#include "DeviceProperty.h"
+#include "ErrorText.h"
+
+/**
+ * Zeroed bytes kept after the property data, so that a REG_MULTI_SZ
+ * value that is missing its terminators (even with an odd byte count)
+ * still ends in two null characters.
+ */
+static const DWORD PROPERTY_TAIL_BYTES = 3 * sizeof(wchar_t);
+
+/**
+ * The initial buffer size, which is large enough for the hardware and
+ * compatible IDs of most devices.
+ */
+static const DWORD PROPERTY_INITIAL_BYTES = 512;
+
+DevicePropertyBuffer::DevicePropertyBuffer() : m_buffer( PROPERTY_INITIAL_BYTES ) {
+}
+
+void DevicePropertyBuffer::Get( __out DevicePropertyList& items, __in HDEVINFO Devs, __in SP_DEVINFO_DATA& DevInfo, __in DWORD Prop ) {
+
+    DWORD reqSize = 0;
+    DWORD dataType = REG_NONE;
+    items.clear();
+
+    for ( ;; ) {
+        DWORD available = static_cast<DWORD>( m_buffer.size() ) - PROPERTY_TAIL_BYTES;
+        if ( SetupDiGetDeviceRegistryPropertyW( Devs, &DevInfo, Prop, &dataType, &m_buffer[0], available, &reqSize ) ) {
+            break;
+        }
+
+        DWORD lastError = GetLastError();
+        switch ( lastError ) {
+        case ERROR_INSUFFICIENT_BUFFER:
+            // Grow to fit, and keep the larger buffer for later devices.
+            m_buffer.resize( reqSize + PROPERTY_TAIL_BYTES );
+            continue;
+        case ERROR_INVALID_DATA:
+            // According to MSDN,
+            // "SetupDiGetDeviceRegistryProperty returns the ERROR_INVALID_DATA 
+            // error code if the requested property does not exist for a device 
+            // or if the property data is not valid."
+            return;
+        default:
+            LogResult( HRESULT_FROM_WIN32( lastError ), "SetupDiGetDeviceRegistryProperty() failed" );
+            return;
+        }
+    }
+
+    Split( items, reqSize, dataType );
+
+} // DevicePropertyBuffer::Get
+
+void DevicePropertyBuffer::GetDevNode( __out DevicePropertyList& items, __in DEVINST DevInst, __in ULONG Prop, __in HMACHINE Machine ) {
+
+    ULONG length = 0;
+    ULONG dataType = REG_NONE;
+    items.clear();
+
+    for ( ;; ) {
+        length = static_cast<ULONG>( m_buffer.size() ) - PROPERTY_TAIL_BYTES;
+        CONFIGRET status = CM_Get_DevNode_Registry_Property_ExW( DevInst, Prop, &dataType, &m_buffer[0], &length, 0, Machine );
+        if ( CR_SUCCESS == status ) {
+            break;
+        }
+
+        switch ( status ) {
+        case CR_BUFFER_SMALL:
+            // Grow to fit, and keep the larger buffer for later devices.
+            m_buffer.resize( length + PROPERTY_TAIL_BYTES );
+            continue;
+        case CR_NO_SUCH_VALUE:
+            // The property does not exist for this device.
+            return;
+        default:
+            LogResult( E_FAIL, "CM_Get_DevNode_Registry_Property() failed with %s.", ConfigRetName( status ) );
+            return;
+        }
+    }
+
+    Split( items, length, dataType );
+
+} // DevicePropertyBuffer::GetDevNode
+
+void DevicePropertyBuffer::Assign( __out DevicePropertyList& items, __in const void* data, __in DWORD dataSize, __in DWORD dataType ) {
+
+    items.clear();
+    if ( m_buffer.size() < dataSize + PROPERTY_TAIL_BYTES ) {
+        m_buffer.resize( dataSize + PROPERTY_TAIL_BYTES );
+    }
+    if ( 0 < dataSize ) {
+        memcpy( &m_buffer[0], data, dataSize );
+    }
+    Split( items, dataSize, dataType );
+
+} // DevicePropertyBuffer::Assign
+
+void DevicePropertyBuffer::Split( __out DevicePropertyList& items, __in DWORD dataSize, __in DWORD dataType ) {
+
+    ZeroMemory( &m_buffer[dataSize], PROPERTY_TAIL_BYTES );
+    LPCWSTR ptr = reinterpret_cast<LPCWSTR>( &m_buffer[0] );
+
+    switch ( dataType ) {
+    case REG_SZ:
+        if ( L'\0' != *ptr ) {
+            items.push_back( ptr );
+        }
+        break;
+    case REG_MULTI_SZ:
+        while ( L'\0' != *ptr ) {
+            items.push_back( ptr );
+            ptr += 1 + wcslen( ptr );
+        }
+        break;
+    default:
+        // Invalid data type, there's nothing to do here.
+        LogResult( S_OK, "Invalid registry property data type %d, ignored.", dataType );
+    }
+
+} // DevicePropertyBuffer::Split
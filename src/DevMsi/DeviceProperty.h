@@ -0,0 +1,88 @@
+/**
+ * Header file for reading device registry properties without
+ * allocating per device.
+ */
+#pragma once
+#include <vector>
+#include <SetupAPI.h>
+#include <cfgmgr32.h>
+
+/**
+ * A list of pointers to strings held by a DevicePropertyBuffer.
+ */
+typedef std::vector<LPCWSTR> DevicePropertyList;
+
+/**
+ * A growable buffer for reading string device registry properties.
+ *
+ * The buffer is meant to live for a whole device enumeration.  It grows
+ * to fit the largest property seen so far and is then reused, so that
+ * reading a property from each device does not touch the heap once the
+ * buffer and the caller's DevicePropertyList are large enough.  While the
+ * buffer is large enough, the usual size-probe call is skipped as well.
+ */
+class DevicePropertyBuffer {
+public:
+    DevicePropertyBuffer();
+
+    /**
+     * Return a device registry property as a list of strings.
+     *
+     * Provided a device, interrogate it with SetupDiGetDeviceRegistryProperty() and
+     * return pointers to each string in the property.  The pointers refer to this
+     * buffer and remain valid until the next call to Get().
+     *
+     * This method will handle both REG_SZ and REG_MULTI_SZ values.  If the data type
+     * in the registry is something else, then an error is not returned, but the
+     * list of strings is empty.  Data that is not properly terminated is cut off at
+     * the end of the value.
+     *
+     * If the registry property does not exist for the device, or cannot be read,
+     * an error is not returned, but the list of strings is empty.
+     *
+     * @param items The output list of items.  It will be cleared prior to use.
+     * @param Devs  The HDEVINFO to be passed to SetupDiGetDeviceRegistryProperty.
+     * @param DevInfo the SP_DEVINFO_DATA to be passed to SetupDiGetDeviceRegistryProperty.
+     * @param Prop The property to be retrieved from SetupDiGetDeviceRegistryProperty.
+     */
+    void Get( __out DevicePropertyList& items, __in HDEVINFO Devs, __in SP_DEVINFO_DATA& DevInfo, __in DWORD Prop );
+
+    /**
+     * Return a device registry property as a list of strings, reading it
+     * straight from the device node.
+     *
+     * This is the same as Get(), but goes through the configuration
+     * manager rather than a device information set.  SetupAPI serializes
+     * calls on a device information set, so this is the one to use when
+     * several threads read properties of devices from the same set.
+     *
+     * @param items The output list of items.  It will be cleared prior to use.
+     * @param DevInst The device node, e.g. from SP_DEVINFO_DATA::DevInst.
+     * @param Prop The property to be retrieved, e.g. CM_DRP_HARDWAREID.
+     * @param Machine The machine handle of the device information set, or NULL.
+     */
+    void GetDevNode( __out DevicePropertyList& items, __in DEVINST DevInst, __in ULONG Prop, __in HMACHINE Machine );
+
+    /**
+     * Return property data that was read elsewhere as a list of strings,
+     * split as Get() splits it.  The data is copied into this buffer.
+     *
+     * @param items The output list of items.  It will be cleared prior to use.
+     * @param data The property data.
+     * @param dataSize The number of bytes of data.
+     * @param dataType The registry data type of the property, e.g. REG_MULTI_SZ.
+     */
+    void Assign( __out DevicePropertyList& items, __in const void* data, __in DWORD dataSize, __in DWORD dataType );
+
+private:
+    /**
+     * Split the property data now in the buffer into strings.
+     *
+     * @param items The output list of items.
+     * @param dataSize The number of bytes of data in the buffer.
+     * @param dataType The registry data type of the property.
+     */
+    void Split( __out DevicePropertyList& items, __in DWORD dataSize, __in DWORD dataType );
+
+    std::vector<BYTE> m_buffer;
+};
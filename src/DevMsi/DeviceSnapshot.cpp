@@ -0,0 +1,355 @@
+#include "stdafx.h"
+#include "DeviceSnapshot.h"
+#include "ciwstring.h"
+#include <algorithm>
+
+/**
+ * Fold a string to upper case with ci_fold().
+ *
+ * @param text The string to be folded.
+ * @param folded The folded string.
+ */
+static void FoldId( __in const wchar_t* text, __out std::wstring& folded )
+{
+    folded.clear();
+    for ( ; L'\0' != *text; ++text ) {
+        folded.push_back( ci_fold( *text ) );
+    }
+}
+
+DeviceSnapshotWriter::DeviceSnapshotWriter() : m_hasCreated( false )
+{
+}
+
+DWORD DeviceSnapshotWriter::AddString( __in const wchar_t* text )
+{
+    // IDs repeat across devices (compatible IDs in particular), so each
+    // distinct string is stored once.
+    std::wstring key( text );
+    auto found = m_offsets.find( key );
+    if ( m_offsets.end() != found ) {
+        return found->second;
+    }
+    DWORD offset = static_cast<DWORD>( m_strings.size() * sizeof(wchar_t) );
+    m_strings.insert( m_strings.end(), key.begin(), key.end() );
+    m_strings.push_back( L'\0' );
+    m_offsets[key] = offset;
+    return offset;
+}
+
+void DeviceSnapshotWriter::BeginDevice( __in const wchar_t* instanceId )
+{
+    Device device = { AddString( instanceId ), static_cast<DWORD>( m_ids.size() ), false };
+    m_devices.push_back( device );
+}
+
+void DeviceSnapshotWriter::AddIds( __in const DevicePropertyList& ids )
+{
+    for ( auto iter = ids.begin(); iter != ids.end(); ++iter ) {
+        FoldId( *iter, m_folded );
+        m_ids.push_back( AddString( m_folded.c_str() ) );
+    }
+}
+
+void DeviceSnapshotWriter::Exclude( __in const wchar_t* instanceId )
+{
+    auto found = m_offsets.find( instanceId );
+    if ( m_offsets.end() == found ) {
+        return;
+    }
+    for ( auto iter = m_devices.begin(); iter != m_devices.end(); ++iter ) {
+        if ( iter->instanceId == found->second ) {
+            iter->excluded = true;
+        }
+    }
+}
+
+void DeviceSnapshotWriter::Append( __in const DeviceSnapshotWriter& other )
+{
+    const wchar_t* strings = other.m_strings.empty() ? NULL : &other.m_strings[0];
+    for ( size_t i = 0; i < other.m_devices.size(); ++i ) {
+        const Device& device = other.m_devices[i];
+        size_t lastId = ( i + 1 < other.m_devices.size() ) ? other.m_devices[i + 1].firstId : other.m_ids.size();
+
+        BeginDevice( strings + device.instanceId / sizeof(wchar_t) );
+        m_devices.back().excluded = device.excluded;
+        for ( size_t id = device.firstId; id < lastId; ++id ) {
+            m_ids.push_back( AddString( strings + other.m_ids[id] / sizeof(wchar_t) ) );
+        }
+    }
+}
+
+void DeviceSnapshotWriter::SetCreated( __in const FILETIME& created )
+{
+    m_created = created;
+    m_hasCreated = true;
+}
+
+HRESULT DeviceSnapshotWriter::Write( __in const wchar_t* path ) const
+{
+    HRESULT hr = S_OK;
+    std::vector<DWORD> devices;
+    std::vector<DeviceSnapshotId> ids;
+
+    // Number the devices that are kept, and index their IDs.
+    for ( size_t i = 0; i < m_devices.size(); ++i ) {
+        if ( m_devices[i].excluded ) {
+            continue;
+        }
+        size_t lastId = ( i + 1 < m_devices.size() ) ? m_devices[i + 1].firstId : m_ids.size();
+        for ( size_t id = m_devices[i].firstId; id < lastId; ++id ) {
+            DeviceSnapshotId entry = { m_ids[id], static_cast<DWORD>( devices.size() ) };
+            ids.push_back( entry );
+        }
+        devices.push_back( m_devices[i].instanceId );
+    }
+
+    const wchar_t* strings = m_strings.empty() ? L"" : &m_strings[0];
+    std::sort( ids.begin(), ids.end(), [strings]( const DeviceSnapshotId& left, const DeviceSnapshotId& right ) -> bool {
+        int diff = wcscmp( strings + left.id / sizeof(wchar_t), strings + right.id / sizeof(wchar_t) );
+        return diff < 0 || ( 0 == diff && left.device < right.device );
+    } );
+
+    DeviceSnapshotHeader header;
+    ZeroMemory( &header, sizeof(header) );
+    header.magic = DEVICE_SNAPSHOT_MAGIC;
+    header.version = DEVICE_SNAPSHOT_VERSION;
+    if ( m_hasCreated ) {
+        header.created = m_created;
+    } else {
+        GetSystemTimeAsFileTime( &header.created );
+    }
+    header.deviceCount = static_cast<DWORD>( devices.size() );
+    header.idCount = static_cast<DWORD>( ids.size() );
+    header.devicesOffset = sizeof(header);
+    header.idsOffset = header.devicesOffset + header.deviceCount * sizeof(DWORD);
+    header.stringsOffset = header.idsOffset + header.idCount * sizeof(DeviceSnapshotId);
+    header.stringsBytes = static_cast<DWORD>( m_strings.size() * sizeof(wchar_t) );
+
+    std::vector<BYTE> image( header.stringsOffset + header.stringsBytes );
+    memcpy( &image[0], &header, sizeof(header) );
+    if ( !devices.empty() ) {
+        memcpy( &image[header.devicesOffset], &devices[0], devices.size() * sizeof(DWORD) );
+    }
+    if ( !ids.empty() ) {
+        memcpy( &image[header.idsOffset], &ids[0], ids.size() * sizeof(DeviceSnapshotId) );
+    }
+    if ( !m_strings.empty() ) {
+        memcpy( &image[header.stringsOffset], &m_strings[0], header.stringsBytes );
+    }
+
+    // Write a temporary file and move it over the snapshot.
+    std::wstring tempPath( path );
+    tempPath += L".tmp";
+    HANDLE file = CreateFileW( tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( INVALID_HANDLE_VALUE == file ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        LogResult( hr, "Unable to create device snapshot '%ls'.", tempPath.c_str() );
+        return hr;
+    }
+    DWORD written = 0;
+    if ( !WriteFile( file, &image[0], static_cast<DWORD>( image.size() ), &written, NULL ) ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+    } else if ( written != image.size() ) {
+        // A short write (e.g. the disk filled up) would leave a snapshot that Open() rejects.
+        hr = HRESULT_FROM_WIN32( ERROR_WRITE_FAULT );
+    }
+    CloseHandle( file );
+    if ( SUCCEEDED( hr ) && !MoveFileExW( tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING ) ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+    }
+    if ( FAILED( hr ) ) {
+        LogResult( hr, "Unable to write device snapshot '%ls'.", path );
+        DeleteFileW( tempPath.c_str() );
+        return hr;
+    }
+
+    LogResult( S_OK, "Wrote device snapshot '%ls' of %u device(s) and %u ID(s), %u bytes."
+        , path, header.deviceCount, header.idCount, static_cast<DWORD>( image.size() ) );
+    return hr;
+} // HRESULT DeviceSnapshotWriter::Write( const wchar_t* path ) const
+
+DeviceSnapshot::DeviceSnapshot() :
+    m_file( INVALID_HANDLE_VALUE ), m_mapping( NULL ), m_view( NULL ),
+    m_header( NULL ), m_devices( NULL ), m_ids( NULL )
+{
+}
+
+DeviceSnapshot::~DeviceSnapshot()
+{
+    Close();
+}
+
+void DeviceSnapshot::Close()
+{
+    if ( NULL != m_view ) {
+        UnmapViewOfFile( m_view );
+    }
+    if ( NULL != m_mapping ) {
+        CloseHandle( m_mapping );
+    }
+    if ( INVALID_HANDLE_VALUE != m_file ) {
+        CloseHandle( m_file );
+    }
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+    m_view = NULL;
+    m_header = NULL;
+    m_devices = NULL;
+    m_ids = NULL;
+}
+
+bool DeviceSnapshot::Open( __in const wchar_t* path, __in DWORD maxAgeSeconds )
+{
+    Close();
+
+    m_file = CreateFileW( path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if ( INVALID_HANDLE_VALUE == m_file ) {
+        LogResult( S_OK, "No device snapshot '%ls', devices will be scanned.", path );
+        return false;
+    }
+
+    DWORD sizeHigh = 0;
+    DWORD size = GetFileSize( m_file, &sizeHigh );
+    if ( 0 != sizeHigh || size < sizeof(DeviceSnapshotHeader) ) {
+        LogResult( S_OK, "Device snapshot '%ls' is not valid, devices will be scanned.", path );
+        Close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingW( m_file, NULL, PAGE_READONLY, 0, 0, NULL );
+    if ( NULL != m_mapping ) {
+        m_view = static_cast<const BYTE*>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+    }
+    if ( NULL == m_view ) {
+        LogResult( HRESULT_FROM_WIN32( GetLastError() ), "Unable to map device snapshot '%ls', devices will be scanned.", path );
+        Close();
+        return false;
+    }
+
+    // Check that every part of the file lies within it, and that the
+    // string table ends with a terminator, so that lookups need no checks.
+    const DeviceSnapshotHeader* header = reinterpret_cast<const DeviceSnapshotHeader*>( m_view );
+    ULONGLONG devicesEnd = header->devicesOffset + static_cast<ULONGLONG>( header->deviceCount ) * sizeof(DWORD);
+    ULONGLONG idsEnd = header->idsOffset + static_cast<ULONGLONG>( header->idCount ) * sizeof(DeviceSnapshotId);
+    ULONGLONG stringsEnd = header->stringsOffset + static_cast<ULONGLONG>( header->stringsBytes );
+    bool valid = DEVICE_SNAPSHOT_MAGIC == header->magic
+        && DEVICE_SNAPSHOT_VERSION == header->version
+        && 0 == header->devicesOffset % sizeof(DWORD) && devicesEnd <= size
+        && 0 == header->idsOffset % sizeof(DWORD) && idsEnd <= size
+        && 0 == header->stringsOffset % sizeof(wchar_t) && stringsEnd <= size
+        && 0 == header->stringsBytes % sizeof(wchar_t)
+        && sizeof(wchar_t) <= header->stringsBytes
+        && L'\0' == *reinterpret_cast<const wchar_t*>( m_view + stringsEnd - sizeof(wchar_t) );
+    if ( !valid ) {
+        LogResult( S_OK, "Device snapshot '%ls' is not valid, devices will be scanned.", path );
+        Close();
+        return false;
+    }
+
+    FILETIME now;
+    GetSystemTimeAsFileTime( &now );
+    ULARGE_INTEGER nowTime, createdTime;
+    nowTime.LowPart = now.dwLowDateTime;
+    nowTime.HighPart = now.dwHighDateTime;
+    createdTime.LowPart = header->created.dwLowDateTime;
+    createdTime.HighPart = header->created.dwHighDateTime;
+    // FILETIME counts 100 ns intervals.
+    if ( nowTime.QuadPart < createdTime.QuadPart
+        || ( nowTime.QuadPart - createdTime.QuadPart ) / 10000000 > maxAgeSeconds ) {
+        LogResult( S_OK, "Device snapshot '%ls' is out of date, devices will be scanned.", path );
+        Close();
+        return false;
+    }
+
+    m_header = header;
+    m_devices = reinterpret_cast<const DWORD*>( m_view + header->devicesOffset );
+    m_ids = reinterpret_cast<const DeviceSnapshotId*>( m_view + header->idsOffset );
+    LogResult( S_OK, "Using device snapshot '%ls' of %u device(s).", path, header->deviceCount );
+    return true;
+} // bool DeviceSnapshot::Open( const wchar_t* path, DWORD maxAgeSeconds )
+
+const wchar_t* DeviceSnapshot::String( __in DWORD offset ) const
+{
+    if ( offset >= m_header->stringsBytes || 0 != offset % sizeof(wchar_t) ) {
+        return L"";
+    }
+    return reinterpret_cast<const wchar_t*>( m_view + m_header->stringsOffset + offset );
+}
+
+DWORD DeviceSnapshot::LowerBound( __in const std::wstring& folded ) const
+{
+    // Find the first entry not less than the folded ID.
+    DWORD low = 0, high = m_header->idCount;
+    while ( low < high ) {
+        DWORD middle = low + ( high - low ) / 2;
+        if ( wcscmp( String( m_ids[middle].id ), folded.c_str() ) < 0 ) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void DeviceSnapshot::Find( __in const wchar_t* id, __inout std::vector<const wchar_t*>& instanceIds )
+{
+    if ( NULL == m_header ) {
+        return;
+    }
+
+    FoldId( id, m_folded );
+    for ( DWORD index = LowerBound( m_folded );
+          index < m_header->idCount && 0 == wcscmp( String( m_ids[index].id ), m_folded.c_str() );
+          ++index ) {
+        if ( m_ids[index].device < m_header->deviceCount ) {
+            instanceIds.push_back( String( m_devices[m_ids[index].device] ) );
+        }
+    }
+} // void DeviceSnapshot::Find( const wchar_t* id, std::vector<const wchar_t*>& instanceIds )
+
+void DeviceSnapshot::CopyTo( __inout DeviceSnapshotWriter& writer ) const
+{
+    if ( NULL == m_header ) {
+        return;
+    }
+
+    // The index is sorted by ID, so gather each device's IDs first.
+    // They are already folded, and folding them again leaves them as they are.
+    std::vector<DevicePropertyList> deviceIds( m_header->deviceCount );
+    for ( DWORD index = 0; index < m_header->idCount; ++index ) {
+        if ( m_ids[index].device < m_header->deviceCount ) {
+            deviceIds[m_ids[index].device].push_back( String( m_ids[index].id ) );
+        }
+    }
+    for ( DWORD device = 0; device < m_header->deviceCount; ++device ) {
+        writer.BeginDevice( String( m_devices[device] ) );
+        writer.AddIds( deviceIds[device] );
+    }
+    writer.SetCreated( m_header->created );
+} // void DeviceSnapshot::CopyTo( DeviceSnapshotWriter& writer ) const
+
+void DeviceSnapshot::FindPrefix( __in const wchar_t* prefix, __inout std::vector<const wchar_t*>& instanceIds )
+{
+    if ( NULL == m_header ) {
+        return;
+    }
+
+    FoldId( prefix, m_folded );
+    for ( DWORD index = LowerBound( m_folded );
+          index < m_header->idCount && 0 == wcsncmp( String( m_ids[index].id ), m_folded.c_str(), m_folded.size() );
+          ++index ) {
+        if ( m_ids[index].device < m_header->deviceCount ) {
+            instanceIds.push_back( String( m_devices[m_ids[index].device] ) );
+        }
+    }
+} // void DeviceSnapshot::FindPrefix( const wchar_t* prefix, std::vector<const wchar_t*>& instanceIds )
+
+void InvalidateDeviceSnapshot( __in const wchar_t* path )
+{
+    if ( DeleteFileW( path ) ) {
+        LogResult( S_OK, "Device snapshot '%ls' deleted, since devices have changed.", path );
+    } else if ( ERROR_FILE_NOT_FOUND != GetLastError() ) {
+        LogResult( HRESULT_FROM_WIN32( GetLastError() ), "Unable to delete device snapshot '%ls'.", path );
+    }
+}
@@ -0,0 +1,208 @@
+/**
+ * Header file for a snapshot of the device inventory, shared by the
+ * custom actions of one install.
+ *
+ * Every RemoveDevnode action would otherwise read the hardware and
+ * compatible IDs of every device again.  Instead, the first action
+ * writes what it read to a snapshot file, and later actions map the
+ * file and look IDs up in it directly, with no parsing.
+ *
+ * The file is laid out as:
+ *
+ *   DeviceSnapshotHeader
+ *   DWORD[deviceCount]             String offset of each device's instance ID
+ *   DeviceSnapshotId[idCount]      Each (folded ID, device) pair, sorted by folded ID
+ *   wchar_t[]                      String table:  zero-terminated strings
+ *
+ * IDs in the index are folded to upper case with ci_fold(), so that a
+ * case-insensitive lookup is a binary search with an ordinal compare.
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "DeviceProperty.h"
+
+//* "DMSS", the first DWORD of a snapshot file.
+#define DEVICE_SNAPSHOT_MAGIC   0x53534D44
+//* The version of the snapshot layout.
+#define DEVICE_SNAPSHOT_VERSION 1
+
+/**
+ * The start of a snapshot file.  Offsets are in bytes from the start of the file.
+ */
+struct DeviceSnapshotHeader {
+    DWORD magic;            //*< DEVICE_SNAPSHOT_MAGIC
+    DWORD version;          //*< DEVICE_SNAPSHOT_VERSION
+    FILETIME created;       //*< When the snapshot was written, in UTC
+    DWORD deviceCount;      //*< The number of devices
+    DWORD idCount;          //*< The number of entries in the ID index
+    DWORD devicesOffset;    //*< The offset of the device records
+    DWORD idsOffset;        //*< The offset of the ID index
+    DWORD stringsOffset;    //*< The offset of the string table
+    DWORD stringsBytes;     //*< The size of the string table
+};
+
+/**
+ * An entry in the ID index.
+ */
+struct DeviceSnapshotId {
+    DWORD id;               //*< The string offset of the folded ID
+    DWORD device;           //*< The index of the device
+};
+
+/**
+ * Collects the devices seen by a scan, and writes them as a snapshot.
+ */
+class DeviceSnapshotWriter {
+public:
+    DeviceSnapshotWriter();
+
+    /**
+     * Start recording a device.  Its IDs are added with AddIds().
+     *
+     * @param instanceId The device instance ID.
+     */
+    void BeginDevice( __in const wchar_t* instanceId );
+
+    /**
+     * Add IDs (hardware or compatible) to the device last begun.
+     *
+     * @param ids The IDs.
+     */
+    void AddIds( __in const DevicePropertyList& ids );
+
+    /**
+     * Leave a device out of the snapshot, e.g. because it has been removed.
+     *
+     * @param instanceId The device instance ID.
+     */
+    void Exclude( __in const wchar_t* instanceId );
+
+    /**
+     * Add the devices recorded by another writer, e.g. by another scan thread.
+     *
+     * @param other The other writer.
+     */
+    void Append( __in const DeviceSnapshotWriter& other );
+
+    /**
+     * Stamp the snapshot with the time the devices were read, rather than
+     * the time it is written, e.g. when an older snapshot is written again.
+     *
+     * @param created When the devices were read, in UTC.
+     */
+    void SetCreated( __in const FILETIME& created );
+
+    /**
+     * Write the snapshot.  The file is replaced in one step, so that a
+     * reader never sees a partial snapshot.
+     *
+     * @param path The path of the snapshot file.
+     * @return Returns S_OK, or the error from writing the file.  The error is also logged.
+     */
+    HRESULT Write( __in const wchar_t* path ) const;
+
+    //* Return the number of devices recorded.
+    DWORD DeviceCount() const { return static_cast<DWORD>( m_devices.size() ); }
+
+private:
+    DWORD AddString( __in const wchar_t* text );
+
+    /**
+     * A recorded device.
+     */
+    struct Device {
+        DWORD instanceId;   //*< The string offset of the instance ID
+        DWORD firstId;      //*< The index in m_ids of the device's first ID
+        bool excluded;      //*< True if the device is to be left out
+    };
+
+    std::vector<wchar_t> m_strings;                     //*< The string table
+    std::unordered_map<std::wstring, DWORD> m_offsets;  //*< The offset of each string in the table
+    std::vector<Device> m_devices;                      //*< The devices, in the order recorded
+    std::vector<DWORD> m_ids;                           //*< String offsets of the folded IDs of each device
+    std::wstring m_folded;                              //*< Scratch space for folding an ID
+    FILETIME m_created;                                 //*< When the devices were read, if m_hasCreated
+    bool m_hasCreated;                                  //*< True if SetCreated() was called
+};
+
+/**
+ * A snapshot file, mapped for reading.
+ */
+class DeviceSnapshot {
+public:
+    DeviceSnapshot();
+    ~DeviceSnapshot();
+
+    /**
+     * Map a snapshot file.
+     *
+     * A snapshot that is missing, damaged, of another version, or older
+     * than maxAgeSeconds is not opened.  The reason is logged.
+     *
+     * @param path The path of the snapshot file.
+     * @param maxAgeSeconds The age beyond which a snapshot is not trusted.
+     * @return Returns true if the snapshot is open.
+     */
+    bool Open( __in const wchar_t* path, __in DWORD maxAgeSeconds );
+
+    /**
+     * Find the devices with an ID (hardware or compatible), ignoring case.
+     *
+     * @param id The ID to be found.
+     * @param instanceIds The instance IDs of the devices.  They are appended,
+     *                    and point into the snapshot, so they remain valid
+     *                    while it is open.
+     */
+    void Find( __in const wchar_t* id, __inout std::vector<const wchar_t*>& instanceIds );
+
+    /**
+     * Find the devices with an ID that starts with a prefix, ignoring case.
+     * A device is found once for each such ID.
+     *
+     * @param prefix The prefix.  An empty prefix finds every device.
+     * @param instanceIds As for Find().
+     */
+    void FindPrefix( __in const wchar_t* prefix, __inout std::vector<const wchar_t*>& instanceIds );
+
+    /**
+     * Record every device in the snapshot, with its IDs and the time it
+     * was written, so that it can be written again less some devices.
+     *
+     * @param writer The writer.  The devices are added to it.
+     */
+    void CopyTo( __inout DeviceSnapshotWriter& writer ) const;
+
+    //* Return the number of devices in the snapshot.
+    DWORD DeviceCount() const { return NULL != m_header ? m_header->deviceCount : 0; }
+
+    /**
+     * Unmap the snapshot, e.g. so that the file can be replaced.  The
+     * instance IDs found in it are no longer valid.
+     */
+    void Close();
+
+private:
+    DeviceSnapshot( const DeviceSnapshot& );
+    DeviceSnapshot& operator=( const DeviceSnapshot& );
+
+    const wchar_t* String( __in DWORD offset ) const;
+    DWORD LowerBound( __in const std::wstring& folded ) const;
+
+    HANDLE m_file;                          //*< The snapshot file
+    HANDLE m_mapping;                       //*< The file mapping
+    const BYTE* m_view;                     //*< The mapped file
+    const DeviceSnapshotHeader* m_header;   //*< The header, or NULL if not open
+    const DWORD* m_devices;                 //*< The device records
+    const DeviceSnapshotId* m_ids;          //*< The ID index
+    std::wstring m_folded;                  //*< Scratch space for folding an ID
+};
+
+/**
+ * Delete a snapshot file, because devices have been added or removed
+ * by other means than the snapshot knows about.
+ *
+ * @param path The path of the snapshot file.
+ */
+void InvalidateDeviceSnapshot( __in const wchar_t* path );
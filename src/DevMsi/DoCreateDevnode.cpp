@@ -1,78 +1,620 @@
 #include "stdafx.h"
 #include "devmsi.h"
 #include "CheckResult.h"
+#include "ErrorText.h"
 #include "ciwstring.h"
 #include <SetupAPI.h>
 #include <cfgmgr32.h>
 #include "AutoClose.h"
 #include "GuidStrHelpers.h"
+#include "ArgList.h"
+#include "Trace.h"
+#include "DeviceSnapshot.h"
+#include "DeviceProperty.h"
+#include "InfFingerprint.h"
+#include "InfParser.h"
+#include "ClassArg.h"
+#include "Deadline.h"
 #include <newdev.h>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
 
-/**
-* An enumeration of the valid types of class arguments provided to DoCreateDevnode().
-*
-* @see DoCreateDevnode
-* @see GetClassArgType
-*/
-typedef enum { 
-    evClassName,        //*< The argument is a class name (e.g. "System")
-    evClassGuidString,  //*< The argument is a class GUID in string form
-    evInfPath,          //*< The argument is a path to a relevant INF file
-    evInvalidClassArg   //*< The argument type is unknown
-} etClassArgType;
-
-/**
-* Examine the classArg and return the argument type.
-*
-* @param classArg the argument to be inspected.
-* @return Returns the type of argument parsed.
-*/
 etClassArgType GetClassArgType( const std::wstring& classArg ) {
 
     if ( classArg.empty() ) {
         return evInvalidClassArg;
     }
 
-    if ( classArg.length() == 38 
-        && L'{' == classArg[0]
-    && L'-' == classArg[9] 
-    && L'-' == classArg[14] 
-    && L'-' == classArg[19] 
-    && L'-' == classArg[24] 
-    && L'}' == classArg[37]
-    ) {
+    GUID guid;
+    if ( TryStr2GUID( classArg, guid ) ) {
         return evClassGuidString;
     }
 
-    WIN32_FIND_DATA FindFileData;
-    HANDLE handle = FindFirstFile(classArg.c_str(), &FindFileData) ;
-    if( handle != INVALID_HANDLE_VALUE ) {
-        FindClose( handle );
+    if ( std::wstring::npos != classArg.find_first_of( L"\\/:." ) ) {
         return evInfPath;
     }
     return evClassName;
 
 } // etClassArgType GetClassArgType( const std::wstring& classArg )
 
+/**
+ * A device setup class, resolved from a class argument.
+ */
+struct DeviceClass {
+    etClassArgType argType;     //*< The type of the class argument
+    GUID guid;                  //*< The class GUID
+    std::wstring name;          //*< The class name
+    std::wstring infPath;       //*< The full path of the INF file, for evInfPath
+    InfSummary inf;             //*< What was read from the INF file, for evInfPath
+};
+
+/**
+ * Resolve a class argument (a class name, class GUID or INF path) to
+ * the class GUID and name.
+ *
+ * An exception will be thrown on error.
+ *
+ * @param classArg The class argument.
+ * @param deviceClass The resolved class.
+ */
+void ResolveDeviceClass( __in const std::wstring& classArg, __out DeviceClass& deviceClass ) {
+
+    wchar_t ClassName[MAX_CLASS_NAME_LEN+1];
+    bool classNameValid = false;
+    HRESULT hr = S_OK;
+
+    deviceClass.argType = GetClassArgType( classArg );
+
+    switch ( deviceClass.argType ) {
+    case evClassName:
+        LogResult( S_OK, "Converting '%ls' from Class Name to GUID.", classArg.c_str() );
+        {
+            // Built-in classes need neither a registry walk nor
+            // a separate lookup of the class name.
+            const wchar_t* canonicalName = NULL;
+            if ( WellKnownClassName2GUID( classArg, deviceClass.guid, &canonicalName ) ) {
+                LogResult( S_OK, "'%ls' is a built-in setup class.", canonicalName );
+                deviceClass.name = canonicalName;
+                classNameValid = true;
+            } else {
+                TraceSpan span( "ClassName2GUID" );
+                deviceClass.guid = ClassName2GUID( classArg );
+            }
+        }
+        break;
+    case evClassGuidString:
+        LogResult( S_OK, "Converting '%ls' from String to GUID.", classArg.c_str() );
+        deviceClass.guid = Str2GUID( classArg );
+        break;
+    case evInfPath:
+        LogResult( S_OK, "Converting '%ls' from INF Path to Class GUID.", classArg.c_str() );
+        {
+            TraceSpan span( "ParseInfFile" );
+            deviceClass.infPath = FullPathName( classArg );
+            hr = ParseInfFile( deviceClass.infPath.c_str(), deviceClass.inf );
+            CheckResult( hr, "Unable to read the INF file." );
+            LogResult( S_OK, "INF class '%ls' %ls, DriverVer '%ls', %u model ID(s)."
+                , deviceClass.inf.className.c_str(), deviceClass.inf.classGuid.c_str()
+                , deviceClass.inf.driverVer.c_str(), static_cast<DWORD>( deviceClass.inf.hardwareIds.size() ) );
+        }
+        if ( deviceClass.inf.className.empty() || !TryStr2GUID( deviceClass.inf.classGuid, deviceClass.guid ) ) {
+            // An INF may name its class without the GUID, if the class
+            // is installed; let SetupAPI look it up.
+            TraceSpan span( "Inf2ClassGUID" );
+            deviceClass.guid = Inf2ClassGUID( deviceClass.infPath, deviceClass.name );
+        } else {
+            deviceClass.name = deviceClass.inf.className;
+        }
+        if ( MAX_CLASS_NAME_LEN < deviceClass.name.size() ) {
+            hr = E_FAIL;
+            LogResult( hr, "Class string '%ls' too long.", deviceClass.name.c_str() );
+            throw hr;
+        }
+        classNameValid = true;
+        break;
+    case evInvalidClassArg:
+        throw std::runtime_error( "Unable to determine classArg type." );
+        break;
+    }
+
+    LogResult( S_OK, "Class GUID %ls will be used.", GUID2Str( deviceClass.guid ).c_str() );
+
+    if ( !classNameValid ) {
+        //
+        // Get the class name from the class GUID.
+        //
+        TraceSpan span( "SetupDiClassNameFromGuid" );
+        ClassName[MAX_CLASS_NAME_LEN] = L'\0';
+        if (!(SetupDiClassNameFromGuidW( &deviceClass.guid, ClassName, MAX_CLASS_NAME_LEN, NULL ) ) ) {
+            hr = HRESULT_FROM_WIN32( ::GetLastError() );
+            CheckResult(hr, "Failed to retrieve class name from provided class GUID");
+        }
+        LogResult(hr, "SetupDiClassNameFromGuid() returned %ls.", ClassName);
+        deviceClass.name = ClassName;
+    }
+
+} // void ResolveDeviceClass( const std::wstring& classArg, DeviceClass& deviceClass )
+
+/**
+ * Check that a device can get its driver from the INF file of its
+ * class, i.e. that a model of the INF lists the hardware ID, and log a
+ * warning if not.  The device is still created:  the INF may list the
+ * ID in a way that InfParser does not follow, and if it really does
+ * not, UpdateDriverForPlugAndPlayDevices() reports that after.
+ *
+ * Classes that are not given by INF file always pass.
+ *
+ * @param deviceClass The class of the device.
+ * @param hwid The hardware ID.
+ */
+void CheckInfHardwareId( __in const DeviceClass& deviceClass, __in const std::wstring& hwid ) {
+
+    if ( evInfPath == deviceClass.argType && !InfListsHardwareId( deviceClass.inf, hwid.c_str() ) ) {
+        LogResult( S_OK, "INF file '%ls' has no model with hardware ID '%ls', the device is created anyway.", deviceClass.infPath.c_str(), hwid.c_str() );
+    }
+}
+
+/**
+ * Build the double zero-terminated list of hardware IDs for a device.
+ *
+ * An exception will be thrown if an ID is too long.
+ *
+ * @param hwIds The hardware IDs.
+ * @param hwIdList The list, in REG_MULTI_SZ form.
+ */
+void BuildHardwareIdList( __in const std::vector<std::wstring>& hwIds, __out std::vector<wchar_t>& hwIdList ) {
+
+    HRESULT hr = S_OK;
+    hwIdList.clear();
+    for ( auto iter = hwIds.begin(); iter != hwIds.end(); ++iter ) {
+        if ( LINE_LEN <= iter->size() ) {
+            hr = STRSAFE_E_INSUFFICIENT_BUFFER;
+            CheckResult( hr,  "Failed StringCchCopy(hwIdList,hwidArg)");
+        }
+        hwIdList.insert( hwIdList.end(), iter->begin(), iter->end() );
+        hwIdList.push_back( L'\0' );
+    }
+    hwIdList.push_back( L'\0' );
+
+} // void BuildHardwareIdList( const std::vector<std::wstring>& hwIds, std::vector<wchar_t>& hwIdList )
+
+/**
+ * Create a device node of a class with the given hardware IDs.
+ *
+ * This code will be very familiar to those who look at devcon in the WDK.
+ * The device will be in Device Manager, but without a driver.
+ *
+ * An exception will be thrown on error.
+ *
+ * @param DeviceInfoList The device information set, created for the device's class.
+ * @param deviceClass The class of the device.
+ * @param hwIdList The hardware IDs, double zero-terminated.
+ * @param DeviceInfoData The new device.
+ * @param deadline The deadline of the calling function, for retrying
+ *                 the class installer while PnP is busy.
+ */
+void RegisterDevnode( __in HDEVINFO DeviceInfoList,
+                      __in const DeviceClass& deviceClass,
+                      __in const std::vector<wchar_t>& hwIdList,
+                      __out SP_DEVINFO_DATA& DeviceInfoData,
+                      __in const Deadline& deadline ) {
+
+    HRESULT hr = S_OK;
+
+    //
+    // Now create the element.  Unlike DevCon, no INF file was needed
+    // since the user provided the class GUID or name.
+    //
+    TraceSpan createSpan( "SetupDiCreateDeviceInfo" );
+    DeviceInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+    if (!SetupDiCreateDeviceInfo(DeviceInfoList,
+        deviceClass.name.c_str(),
+        &deviceClass.guid,
+        NULL,
+        0,
+        DICD_GENERATE_ID,
+        &DeviceInfoData))
+    {
+        hr = HRESULT_FROM_WIN32( ::GetLastError() );
+        CheckResult( hr, "Unable to create DeviceInfoData element" );
+    }
+    createSpan.End();
+    LogResult(hr, "SetupDiCreateDeviceInfo() succeeded.");
+
+    //
+    // Add the HardwareID to the Device's HardwareID property.
+    //
+    TraceSpan propertySpan( "SetupDiSetDeviceRegistryProperty(SPDRP_HARDWAREID)" );
+    if(!SetupDiSetDeviceRegistryProperty(DeviceInfoList,
+        &DeviceInfoData,
+        SPDRP_HARDWAREID,
+        (LPBYTE)&hwIdList[0],
+        static_cast<DWORD>( hwIdList.size() * sizeof(wchar_t) )))
+    {
+        hr = HRESULT_FROM_WIN32( ::GetLastError() );
+        CheckResult( hr, "Unable to set HardwareID Property" );
+    }
+    propertySpan.End();
+    LogResult(hr, "SetupDiSetDeviceRegistryProperty() succeeded.");
+
+    //
+    // Transform the registry element into an actual devnode
+    // in the PnP HW tree.
+    //
+    TraceSpan registerSpan( "SetupDiCallClassInstaller(DIF_REGISTERDEVICE)" );
+    hr = RetryTransient( "SetupDiCallClassInstaller(DIF_REGISTERDEVICE)", deadline, [&]() -> HRESULT {
+        return SetupDiCallClassInstaller( DIF_REGISTERDEVICE, DeviceInfoList, &DeviceInfoData )
+            ? S_OK : HRESULT_FROM_WIN32( ::GetLastError() );
+    } );
+    CheckResult( hr, "Unable to call the class installer to create the devnode" );
+    registerSpan.End();
+    LogResult(hr, "SetupDiCallClassInstaller() succeeded.");
+
+} // void RegisterDevnode(...)
+
+/**
+ * Look for a device created by an earlier run, i.e. a present,
+ * root-enumerated device of the class that has the hardware ID.
+ *
+ * Only the devices of the class that ROOT enumerates are read, so this
+ * is much cheaper than creating a duplicate device.
+ *
+ * An exception will be thrown if the devices cannot be listed.
+ *
+ * @param deviceClass The class of the device.
+ * @param hwid The hardware ID.
+ * @param instanceId Set to the instance ID of the device, if one is found.
+ * @param devInst Set to the device node, if one is found.
+ * @return Returns true if a device was found.
+ */
+bool FindExistingDevnode( __in const DeviceClass& deviceClass,
+                          __in const std::wstring& hwid,
+                          __out std::wstring& instanceId,
+                          __out DEVINST& devInst ) {
+
+    AutoCloseDeviceInfoList devs;
+    SP_DEVINFO_DATA devInfo = { sizeof(SP_DEVINFO_DATA) };
+    DevicePropertyBuffer propBuffer;
+    DevicePropertyList ids;
+    TraceSpan span( "Find existing devnode" );
+
+    devs = SetupDiGetClassDevsEx( &deviceClass.guid, L"ROOT", NULL, DIGCF_PRESENT, NULL, NULL, NULL );
+    if ( INVALID_HANDLE_VALUE == devs ) {
+        HRESULT hr = HRESULT_FROM_WIN32( ::GetLastError() );
+        CheckResult( hr, "SetupDiGetClassDevsEx(ROOT, DIGCF_PRESENT) failed." );
+    }
+
+    for ( DWORD devIndex = 0; SetupDiEnumDeviceInfo( devs, devIndex, &devInfo ); ++devIndex ) {
+        propBuffer.Get( ids, devs, devInfo, SPDRP_HARDWAREID );
+        for ( auto iter = ids.begin(); iter != ids.end(); ++iter ) {
+            wchar_t devID[MAX_DEVICE_ID_LEN];
+            if ( 0 == _wcsicmp( *iter, hwid.c_str() )
+                && CR_SUCCESS == CM_Get_Device_ID( devInfo.DevInst, devID, MAX_DEVICE_ID_LEN, 0 ) ) {
+                instanceId = devID;
+                devInst = devInfo.DevInst;
+                return true;
+            }
+        }
+    }
+    return false;
+
+} // bool FindExistingDevnode(...)
+
+/**
+ * Install the driver from an INF file on the devices with a hardware ID.
+ *
+ * An exception will be thrown on error.
+ *
+ * @param hwid The hardware ID.
+ * @param infPath The full path of the INF file.
+ * @param deadline The deadline of the calling function, for retrying
+ *                 while PnP is busy.
+ */
+void InstallInfDriver( __in const std::wstring& hwid, __in const std::wstring& infPath, __in const Deadline& deadline ) {
+
+    // In this case, we have the path to the INF file.  So
+    // we can "do things the DevCon way" and just install
+    // the INF driver for our created device.
+    BOOL rebootRequired = FALSE;
+    TraceSpan span( "UpdateDriverForPlugAndPlayDevices" );
+
+    HRESULT hr = RetryTransient( "UpdateDriverForPlugAndPlayDevices", deadline, [&]() -> HRESULT {
+        BOOL success = UpdateDriverForPlugAndPlayDevices(
+            NULL,
+            hwid.c_str(),
+            infPath.c_str(),
+            0,
+            &rebootRequired
+            );
+        return success ? S_OK : HRESULT_FROM_WIN32( ::GetLastError() );
+    } );
+    CheckResult( hr, "Unable to UpdateDriverForPlugAndPlayDevices()" );
+
+} // void InstallInfDriver( const std::wstring& hwid, const std::wstring& infPath )
+
+/**
+ * Check whether the driver package in an INF file is the one installed
+ * for the devices with a hardware ID, so that installing it again can
+ * be skipped.
+ *
+ * It is, if at least one of the devices has a driver, and every device
+ * that has a driver has this package (by InfFingerprint).  Devices with
+ * no driver yet, such as one just created, then get it from the driver
+ * store when the device tree is re-enumerated, which is much quicker
+ * than UpdateDriverForPlugAndPlayDevices().
+ *
+ * Anything that cannot be checked counts as not installed.
+ *
+ * @param hwid The hardware ID.
+ * @param deviceClass The class of the devices, with the INF file.
+ * @return Returns true if the package is installed.
+ */
+bool DriverPackageInstalled( __in const std::wstring& hwid, __in const DeviceClass& deviceClass ) {
+
+    AutoCloseDeviceInfoList devs;
+    SP_DEVINFO_DATA devInfo = { sizeof(SP_DEVINFO_DATA) };
+    DevicePropertyBuffer propBuffer;
+    DevicePropertyList ids;
+    InfFingerprint package, installed;
+    DWORD current = 0;
+    TraceSpan span( "Fingerprint driver package" );
+
+    if ( FAILED( GetPackageFingerprint( deviceClass.infPath.c_str(), package ) ) ) {
+        return false;
+    }
+
+    devs = SetupDiGetClassDevsEx( &deviceClass.guid, NULL, NULL, DIGCF_PRESENT, NULL, NULL, NULL );
+    if ( INVALID_HANDLE_VALUE == devs ) {
+        LogResult( HRESULT_FROM_WIN32( ::GetLastError() ), "SetupDiGetClassDevsEx(DIGCF_PRESENT) failed." );
+        return false;
+    }
+
+    for ( DWORD devIndex = 0; SetupDiEnumDeviceInfo( devs, devIndex, &devInfo ); ++devIndex ) {
+        propBuffer.Get( ids, devs, devInfo, SPDRP_HARDWAREID );
+        bool matched = false;
+        for ( auto iter = ids.begin(); iter != ids.end() && !matched; ++iter ) {
+            matched = ( 0 == _wcsicmp( *iter, hwid.c_str() ) );
+        }
+        if ( !matched ) {
+            continue;
+        }
+
+        HRESULT hr = GetInstalledFingerprint( devs, devInfo, installed );
+        if ( S_FALSE == hr ) {
+            continue;
+        }
+        if ( FAILED( hr ) || !SameDriverPackage( package, installed ) ) {
+            LogResult( S_OK, "A device with hardware ID '%ls' has a different driver (version '%ls').", hwid.c_str(), installed.driverVersion.c_str() );
+            return false;
+        }
+        ++current;
+    }
+    return 0 < current;
+
+} // bool DriverPackageInstalled( const std::wstring& hwid, const DeviceClass& deviceClass )
+
+/**
+ * Re-enumerate the whole device tree, so that new devices get drivers.
+ *
+ * An exception will be thrown on error.
+ */
+void RescanDeviceTree() {
+
+    // Go and simulate "Scan For Hardware Changes"
+    // ( http://support.microsoft.com/kb/259697?wa=wsignin1.0 )
+    DEVINST     devInst;
+    CONFIGRET   status;
+    HRESULT     hr = S_OK;
+    TraceSpan span( "CM_Reenumerate_DevNode" );
+
+    status = CM_Locate_DevNode(&devInst, NULL, CM_LOCATE_DEVNODE_NORMAL);
+
+    if (status != CR_SUCCESS) {
+        hr = E_FAIL;
+        LogResult( hr, "CM_Locate_DevNode() failed with %s.", ConfigRetName( status ) );
+        throw hr;
+    }
+
+    status = CM_Reenumerate_DevNode(devInst, 0);
+
+    if (status != CR_SUCCESS) {
+        hr = E_FAIL;
+        LogResult( hr, "CM_Reenumerate_DevNode() failed with %s.", ConfigRetName( status ) );
+        throw hr;
+    }
+
+} // void RescanDeviceTree()
+
+/**
+ * How new devices without an INF are brought up, from the named arguments:
+ *
+ *   reenum=tree       Re-enumerate the whole device tree, and wait for it (the default).
+ *   reenum=subtree    Re-enumerate only the new devices themselves, and wait for them.
+ *   wait=<ms>         Then wait up to this long for the new devices to start.
+ */
+struct RescanOptions {
+    bool subtree;       //*< Re-enumerate only the new devices
+    DWORD waitMs;       //*< How long to wait for the new devices to start, or 0
+};
+
+/**
+ * Read the rescan options from the named arguments.
+ *
+ * An exception will be thrown if an option is not valid.
+ *
+ * @param args The arguments.
+ * @param options The options.
+ */
+void GetRescanOptions( __in const ArgList& args, __out RescanOptions& options ) {
+
+    const wchar_t* reenum = args.Named( L"reenum" );
+    options.subtree = false;
+    if ( NULL != reenum ) {
+        if ( 0 == _wcsicmp( reenum, L"subtree" ) ) {
+            options.subtree = true;
+        } else if ( 0 != _wcsicmp( reenum, L"tree" ) ) {
+            HRESULT hr = E_INVALIDARG;
+            LogResult( hr, "reenum='%ls' is not valid; use 'tree' or 'subtree'.", reenum );
+            throw hr;
+        }
+    }
+    options.waitMs = args.NamedNumber( L"wait", 0 );
+
+} // void GetRescanOptions( const ArgList& args, RescanOptions& options )
+
+/**
+ * Wait for device nodes to start, up to a deadline.
+ *
+ * The device nodes are polled, starting at 10 ms apart and backing off
+ * to 100 ms.  How long each device took, or the state of any device
+ * that did not start in time, is logged.  A device that does not start
+ * is not an error, since it may yet start, or need a reboot.
+ *
+ * @param devices The device nodes.
+ * @param waitMs How long to wait, in milliseconds.
+ */
+void WaitForDevnodesStarted( __in const std::vector<DEVINST>& devices, __in DWORD waitMs ) {
+
+    TraceSpan span( "Wait for devices to start" );
+    std::vector<bool> started( devices.size(), false );
+    size_t remaining = devices.size();
+    const DWORD start = GetTickCount();
+    DWORD elapsed = 0;
+    DWORD pause = 10;
+    wchar_t devID[MAX_DEVICE_ID_LEN];
+
+    for ( ;; ) {
+        for ( size_t i = 0; i < devices.size(); ++i ) {
+            ULONG status = 0, problem = 0;
+            if ( !started[i]
+                && CR_SUCCESS == CM_Get_DevNode_Status( &status, &problem, devices[i], 0 )
+                && 0 != ( status & DN_STARTED ) ) {
+                started[i] = true;
+                --remaining;
+                if ( CR_SUCCESS == CM_Get_Device_IDW( devices[i], devID, MAX_DEVICE_ID_LEN, 0 ) ) {
+                    LogResult( S_OK, "Device '%ls' started after %u ms.", devID, GetTickCount() - start );
+                }
+            }
+        }
+        // GetTickCount() wraps, but the difference does not.
+        elapsed = GetTickCount() - start;
+        if ( 0 == remaining || elapsed >= waitMs ) {
+            break;
+        }
+        Sleep( std::min<DWORD>( pause, waitMs - elapsed ) );
+        pause = std::min<DWORD>( pause * 2, 100 );
+    }
+
+    for ( size_t i = 0; i < devices.size(); ++i ) {
+        ULONG status = 0, problem = 0;
+        if ( !started[i] && CR_SUCCESS == CM_Get_Device_IDW( devices[i], devID, MAX_DEVICE_ID_LEN, 0 ) ) {
+            CONFIGRET cr = CM_Get_DevNode_Status( &status, &problem, devices[i], 0 );
+            LogResult( S_OK, "Device '%ls' did not start within %u ms (%s, status 0x%08X, problem %u)."
+                , devID, waitMs, ConfigRetName( cr ), status, problem );
+        }
+    }
+    LogResult( S_OK, "%u of %u new device(s) started in %u ms."
+        , static_cast<DWORD>( devices.size() - remaining ), static_cast<DWORD>( devices.size() ), elapsed );
+
+} // void WaitForDevnodesStarted( const std::vector<DEVINST>& devices, DWORD waitMs )
+
+/**
+ * Bring up new devices that have no INF:  re-enumerate the device tree,
+ * or just the devices, and optionally wait for them to start.
+ *
+ * An exception will be thrown if the re-enumeration fails.
+ *
+ * @param devices The new device nodes.
+ * @param options How to re-enumerate and how long to wait.
+ */
+void RescanDevnodes( __in const std::vector<DEVINST>& devices, __in const RescanOptions& options ) {
+
+    if ( !options.subtree ) {
+        RescanDeviceTree();
+    } else {
+        // The parent of a root-enumerated device is the root of the whole
+        // tree, so each new device node is re-enumerated itself:  that
+        // finds its driver and starts it, without visiting the rest of the
+        // tree.
+        TraceSpan span( "CM_Reenumerate_DevNode(CM_REENUMERATE_SYNCHRONOUS)" );
+        for ( auto iter = devices.begin(); iter != devices.end(); ++iter ) {
+            CONFIGRET status = CM_Reenumerate_DevNode( *iter, CM_REENUMERATE_SYNCHRONOUS );
+            if ( CR_SUCCESS != status ) {
+                HRESULT hr = E_FAIL;
+                LogResult( hr, "CM_Reenumerate_DevNode() failed with %s.", ConfigRetName( status ) );
+                throw hr;
+            }
+        }
+        LogResult( S_OK, "Re-enumerated %u new device node(s)."
+            , static_cast<DWORD>( devices.size() ) );
+    }
+
+    if ( 0 < options.waitMs ) {
+        WaitForDevnodesStarted( devices, options.waitMs );
+    }
+
+} // void RescanDevnodes( const std::vector<DEVINST>& devices, const RescanOptions& options )
+
+/**
+ * Delete the device snapshot named by "snapshot=<path>", if any, since
+ * it does not list the devices just created.
+ *
+ * @param args The custom action arguments.
+ */
+void InvalidateSnapshot( __in const ArgList& args ) {
+    const wchar_t* snapshotPath = args.Named( L"snapshot" );
+    if ( NULL != snapshotPath ) {
+        InvalidateDeviceSnapshot( snapshotPath );
+    }
+}
+
+/**
+ * Return the HRESULT for the exception being handled, logging it if it
+ * is not already an HRESULT.  Call only from within a catch block.
+ */
+HRESULT CaughtResult() {
+    try
+    {
+        throw;
+    }
+    catch( HRESULT& _error )
+    {
+        return _error;
+    }
+    catch( const std::exception& _error )
+    {
+        LogResult( E_FAIL, _error.what() );
+    }
+    catch( ... )
+    {
+        LogResult( E_FAIL, "Unhandled C++ exception" );
+    }
+    return E_FAIL;
+} // HRESULT CaughtResult()
+
 HRESULT DEVMSI_API DoCreateDevnode( int argc, LPWSTR* argv )
 {
     HRESULT hr = E_FAIL;
 
     try
     {
-        wchar_t hwIdList[LINE_LEN+4];
-        wchar_t ClassName[MAX_CLASS_NAME_LEN+1];
+        TraceSpan functionSpan( "DoCreateDevnode" );
         AutoCloseDeviceInfoList DeviceInfoList;
         SP_DEVINFO_DATA DeviceInfoData;
-        GUID ClassGUID;
-        std::wstring classArg, hwidArg, classStr;
-        bool classNameValid = false;
+        DeviceClass deviceClass;
+        RescanOptions rescanOptions;
+        std::vector<wchar_t> hwIdList;
+        std::wstring classArg, hwidArg;
 
-        switch( argc )
+        ArgList args( argc, argv );
+        Deadline deadline( args.NamedNumber( L"budget", 0 ) );
+        switch( args.Positional().size() )
         {
         case 2:
-            classArg = (NULL == argv[0] ? L"" : argv[0]);
-            hwidArg = (NULL == argv[1] ? L"" : argv[1]);
+            classArg = args.Positional()[0];
+            hwidArg = args.Positional()[1];
             break;
         case 1:
             throw std::runtime_error( "CreateDevnode() requires two parameters, only one provided" );
@@ -82,157 +624,333 @@ HRESULT DEVMSI_API DoCreateDevnode( int argc, LPWSTR* argv )
             throw std::runtime_error( "CreateDevnode() requires two parameters, too many provided" );
         }
         LogResult( S_OK, "hwid = '%ls', class = '%ls'.", hwidArg.c_str(), classArg.c_str() );
+        GetRescanOptions( args, rescanOptions );
 
-        etClassArgType classArgType = GetClassArgType( classArg );
+        ResolveDeviceClass( classArg, deviceClass );
+        CheckInfHardwareId( deviceClass, hwidArg );
 
-        switch ( classArgType ) {
-        case evClassName:
-            LogResult( S_OK, "Converting '%ls' from Class Name to GUID.", classArg.c_str() );
-            ClassGUID = ClassName2GUID( classArg );
-            break;
-        case evClassGuidString:
-            LogResult( S_OK, "Converting '%ls' from String to GUID.", classArg.c_str() );
-            ClassGUID = Str2GUID( classArg );
-            break;
-        case evInfPath:
-            LogResult( S_OK, "Converting '%ls' from INF Path to Class GUID.", classArg.c_str() );
-            ClassGUID = Inf2ClassGUID( classArg, classStr );
-            if ( MAX_CLASS_NAME_LEN < classStr.size() ) {
-                hr = E_FAIL;
-                LogResult( hr, "Class string '%ls' too long.", classStr.c_str() );
-                throw hr;
+        // "ensure=1" reuses a device created by an earlier run (e.g. by
+        // a repair or upgrade), rather than creating a duplicate.  Its
+        // driver is still brought up to date below.
+        bool present = false;
+        if ( args.NamedFlag( L"ensure" ) ) {
+            std::wstring instanceId;
+            present = FindExistingDevnode( deviceClass, hwidArg, instanceId, DeviceInfoData.DevInst );
+            if ( present ) {
+                LogResult( S_OK, "Device '%ls' already present as '%ls', not created.", hwidArg.c_str(), instanceId.c_str() );
             }
-            wcscpy_s( ClassName, classStr.c_str() );
-            classNameValid = true;
-            break;
-        case evInvalidClassArg:
-            throw std::runtime_error( "Unable to determine classArg type." );
-            break;
         }
 
-        LogResult( S_OK, "Class GUID %ls will be used.", GUID2Str( ClassGUID ).c_str() );
-
-        // At this point, we have hwidArg and ClassGUID, so we are ready
-        // to start working on creating the appropriate device.  This code
-        // will be very familiar to those who look at devcon in the WDK.
+        if ( !present ) {
+            // At this point, we have hwidArg and the class, so we are ready
+            // to start working on creating the appropriate device.
 
-        //
-        // List of hardware ID's must be double zero-terminated
-        //
-        ZeroMemory(hwIdList,sizeof(hwIdList));
-        hr = StringCchCopyW(hwIdList, LINE_LEN, hwidArg.c_str() );
-        CheckResult( hr,  "Failed StringCchCopy(hwIdList,hwidArg)");
+            //
+            // List of hardware ID's must be double zero-terminated
+            //
+            BuildHardwareIdList( std::vector<std::wstring>( 1, hwidArg ), hwIdList );
 
-        if ( !classNameValid ) {
             //
-            // Get the class name from the class GUID.
+            // Create the container for the to-be-created Device Information Element.
             //
-            ClassName[MAX_CLASS_NAME_LEN] = L'\0';
-            if (!(SetupDiClassNameFromGuidW( &ClassGUID, ClassName, MAX_CLASS_NAME_LEN, NULL ) ) ) {
+            DeviceInfoList = SetupDiCreateDeviceInfoList(&deviceClass.guid,0);
+            if(DeviceInfoList == INVALID_HANDLE_VALUE)
+            {
                 hr = HRESULT_FROM_WIN32( ::GetLastError() );
-                CheckResult(hr, "Failed to retrieve class name from provided class GUID");
+                CheckResult( hr, "Unable to create DeviceInfoList for new device" );
             }
-            LogResult(hr, "SetupDiClassNameFromGuid() returned %ls.", ClassName);
+            LogResult(S_OK, "SetupDiCreateDeviceInfoList() succeeded.");
+
+            RegisterDevnode( DeviceInfoList, deviceClass, hwIdList, DeviceInfoData, deadline );
+            InvalidateSnapshot( args );
         }
 
-        //
-        // Create the container for the to-be-created Device Information Element.
-        //
-        DeviceInfoList = SetupDiCreateDeviceInfoList(&ClassGUID,0);
-        if(DeviceInfoList == INVALID_HANDLE_VALUE)
-        {
-            hr = HRESULT_FROM_WIN32( ::GetLastError() );
-            CheckResult( hr, "Unable to create DeviceInfoList for new device" );
+        // We should now have a device in Device Manager
+        // that doesn't have a driver, or an existing one.
+
+        // "force=1" installs the INF driver even if it is already installed.
+        if ( evInfPath == deviceClass.argType
+            && ( args.NamedFlag( L"force" ) || !DriverPackageInstalled( hwidArg, deviceClass ) ) ) {
+            InstallInfDriver( hwidArg, deviceClass.infPath, deadline );
+        } else {
+            if ( evInfPath == deviceClass.argType ) {
+                LogResult( S_OK, "The driver in '%ls' is already installed, not updated.", deviceClass.infPath.c_str() );
+            }
+            rescanOptions.waitMs = std::min<DWORD>( rescanOptions.waitMs, deadline.Remaining() );
+            RescanDevnodes( std::vector<DEVINST>( 1, DeviceInfoData.DevInst ), rescanOptions );
         }
-        LogResult(hr, "SetupDiCreateDeviceInfoList() succeeded.");
 
-        //
-        // Now create the element.  Unlike DevCon, no INF file was needed
-        // since the user provided the class GUID or name.
-        //
-        DeviceInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-        if (!SetupDiCreateDeviceInfo(DeviceInfoList,
-            ClassName,
-            &ClassGUID,
-            NULL,
-            0,
-            DICD_GENERATE_ID,
-            &DeviceInfoData))
-        {
-            hr = HRESULT_FROM_WIN32( ::GetLastError() );
-            CheckResult( hr, "Unable to create DeviceInfoData element" );
+        hr = S_OK;
+        LogResult( hr, "DoCreateDevnode() Complete.");
+    }
+    catch( HRESULT& _error )
+    {
+        hr = _error;
+    }
+    catch( const std::exception& _error )
+    {
+        hr = E_FAIL;
+        LogResult( hr, _error.what() );
+    }
+    catch( ... )
+    {
+        hr = E_FAIL;
+        LogResult( hr, "Unhandled C++ exception" );
+    }
+
+    return hr;
+} // HRESULT DEVMSI_API DoCreateDevnode( int argc, LPWSTR* argv )
+
+/**
+ * One device to be created by DoCreateDevnodes().
+ */
+struct CreateEntry {
+    std::wstring classArg;              //*< The class argument as provided by the caller
+    std::wstring hwidArg;               //*< The hardware ID list as provided by the caller
+    std::vector<std::wstring> hwIds;    //*< The hardware IDs
+    size_t classSlot;                   //*< The index of the entry's class
+    bool present;                       //*< True if the device was already present
+    bool rescan;                        //*< True if the device gets its driver from the rescan
+    DEVINST devInst;                    //*< The new device
+    HRESULT hr;                         //*< The result of creating the device
+};
+
+/**
+ * A class used by DoCreateDevnodes(), and the device information set
+ * shared by the entries of that class.
+ */
+struct CreateClass {
+    DeviceClass deviceClass;    //*< The resolved class
+    HRESULT hr;                 //*< The result of resolving the class and creating the set
+};
+
+HRESULT DEVMSI_API DoCreateDevnodes( int argc, LPWSTR* argv )
+{
+    HRESULT hr = E_FAIL;
+
+    try
+    {
+        TraceSpan functionSpan( "DoCreateDevnodes" );
+        std::vector<CreateEntry> entries;
+        std::vector<CreateClass> classes;
+        std::unordered_map<ci_wstring, size_t, ci_wstring_hash> classSlots;
+        std::vector<DEVINST> rescanDevices;
+        RescanOptions rescanOptions;
+        bool force = false;
+
+        ArgList args( argc, argv );
+        Deadline deadline( args.NamedNumber( L"budget", 0 ) );
+        const std::vector<LPCWSTR>& positional = args.Positional();
+        if ( positional.empty() ) {
+            throw std::runtime_error( "CreateDevnodes() requires class and hardware ID pairs, zero parameters provided" );
         }
-        LogResult(hr, "SetupDiCreateDeviceInfo() succeeded.");
+        if ( 0 != positional.size() % 2 ) {
+            throw std::runtime_error( "CreateDevnodes() requires class and hardware ID pairs, an odd number of parameters provided" );
+        }
+        GetRescanOptions( args, rescanOptions );
+        force = args.NamedFlag( L"force" );
 
-        //
-        // Add the HardwareID to the Device's HardwareID property.
-        //
-        if(!SetupDiSetDeviceRegistryProperty(DeviceInfoList,
-            &DeviceInfoData,
-            SPDRP_HARDWAREID,
-            (LPBYTE)hwIdList,
-            (lstrlen(hwIdList)+1+1)*sizeof(TCHAR)))
-        {
-            hr = HRESULT_FROM_WIN32( ::GetLastError() );
-            CheckResult( hr, "Unable to set HardwareID Property" );
+        // Each class is resolved once, however many entries use it.
+        for ( size_t i = 0; i < positional.size(); i += 2 ) {
+            CreateEntry entry;
+            entry.classArg = positional[i];
+            entry.hwidArg = positional[i + 1];
+            entry.present = false;
+            entry.rescan = false;
+            entry.devInst = 0;
+            entry.hr = S_OK;
+            LogResult( S_OK, "hwid = '%ls', class = '%ls'.", entry.hwidArg.c_str(), entry.classArg.c_str() );
+
+            for ( size_t start = 0; start <= entry.hwidArg.size(); ) {
+                size_t end = entry.hwidArg.find( L';', start );
+                if ( std::wstring::npos == end ) {
+                    end = entry.hwidArg.size();
+                }
+                if ( end > start ) {
+                    entry.hwIds.push_back( entry.hwidArg.substr( start, end - start ) );
+                }
+                start = end + 1;
+            }
+            if ( entry.hwIds.empty() ) {
+                entry.hr = E_INVALIDARG;
+                LogResult( entry.hr, "No hardware ID given for class '%ls'.", entry.classArg.c_str() );
+            }
+
+            auto slot = classSlots.find( entry.classArg.c_str() );
+            if ( classSlots.end() == slot ) {
+                CreateClass createClass;
+                createClass.hr = S_OK;
+                try
+                {
+                    ResolveDeviceClass( entry.classArg, createClass.deviceClass );
+                }
+                catch( ... )
+                {
+                    createClass.hr = CaughtResult();
+                }
+                slot = classSlots.insert( std::make_pair( ci_wstring( entry.classArg.c_str() ), classes.size() ) ).first;
+                classes.push_back( createClass );
+            }
+            entry.classSlot = slot->second;
+            if ( SUCCEEDED( entry.hr ) ) {
+                entry.hr = classes[entry.classSlot].hr;
+            }
+            if ( SUCCEEDED( entry.hr ) ) {
+                CheckInfHardwareId( classes[entry.classSlot].deviceClass, entry.hwIds[0] );
+            }
+            entries.push_back( entry );
         }
-        LogResult(hr, "SetupDiSetDeviceRegistryProperty() succeeded.");
 
-        //
-        // Transform the registry element into an actual devnode
-        // in the PnP HW tree.
-        //
-        if (!SetupDiCallClassInstaller(DIF_REGISTERDEVICE,
-            DeviceInfoList,
-            &DeviceInfoData))
-        {
-            hr = HRESULT_FROM_WIN32( ::GetLastError() );
-            CheckResult( hr, "Unable to call the class installer to create the devnode" );
+        // "ensure=1" reuses devices created by an earlier run, rather than
+        // creating duplicates.  Their drivers are still installed and
+        // rescanned below, as for new devices.
+        if ( args.NamedFlag( L"ensure" ) ) {
+            for ( auto entry = entries.begin(); entry != entries.end(); ++entry ) {
+                if ( FAILED( entry->hr ) ) {
+                    continue;
+                }
+                try
+                {
+                    std::wstring instanceId;
+                    const DeviceClass& deviceClass = classes[entry->classSlot].deviceClass;
+                    entry->present = FindExistingDevnode( deviceClass, entry->hwIds[0], instanceId, entry->devInst );
+                    if ( entry->present ) {
+                        LogResult( S_OK, "Device '%ls' already present as '%ls'.", entry->hwIds[0].c_str(), instanceId.c_str() );
+                        entry->rescan = ( evInfPath != deviceClass.argType );
+                    }
+                }
+                catch( ... )
+                {
+                    entry->hr = CaughtResult();
+                }
+            }
         }
-        LogResult(hr, "SetupDiCallClassInstaller() succeeded.");
 
-        // We should now have a device in Device Manager
-        // that doesn't have a driver.  
-
-        if ( evInfPath == classArgType ) {
-
-            // In this case, we have the path to the INF file.  So
-            // we can "do things the DevCon way" and just install
-            // the INF driver for our created device.
-            BOOL rebootRequired = FALSE;
-
-            BOOL success = UpdateDriverForPlugAndPlayDevices(
-                NULL,
-                hwidArg.c_str(),
-                classArg.c_str(),
-                0,
-                &rebootRequired
-                );
-            if ( !success ) {
-                hr = HRESULT_FROM_WIN32( ::GetLastError() );
-                CheckResult( hr, "Unable to UpdateDriverForPlugAndPlayDevices()" );
+        // Entries of the same class share one device information set.
+        // The snapshot only goes stale if a devnode is registered.
+        std::unique_ptr<AutoCloseDeviceInfoList[]> deviceInfoLists( new AutoCloseDeviceInfoList[classes.size()] );
+        bool registered = false;
+
+        for ( auto entry = entries.begin(); entry != entries.end(); ++entry ) {
+            if ( FAILED( entry->hr ) || entry->present ) {
+                continue;
             }
-        } else {
-            // Go and simulate "Scan For Hardware Changes"
-            // ( http://support.microsoft.com/kb/259697?wa=wsignin1.0 )
-            DEVINST     devInst;
-            CONFIGRET   status;
+            try
+            {
+                const DeviceClass& deviceClass = classes[entry->classSlot].deviceClass;
+                AutoCloseDeviceInfoList& DeviceInfoList = deviceInfoLists[entry->classSlot];
+                SP_DEVINFO_DATA DeviceInfoData;
+                std::vector<wchar_t> hwIdList;
+
+                // Once the time budget is spent, the rest are not created.
+                hr = deadline.Check( "the device will not be created" );
+                if ( FAILED( hr ) ) {
+                    throw hr;
+                }
+                BuildHardwareIdList( entry->hwIds, hwIdList );
 
-            status = CM_Locate_DevNode(&devInst, NULL, CM_LOCATE_DEVNODE_NORMAL);
+                if ( !DeviceInfoList.IsValid() ) {
+                    DeviceInfoList = SetupDiCreateDeviceInfoList(&deviceClass.guid,0);
+                    if(DeviceInfoList == INVALID_HANDLE_VALUE)
+                    {
+                        hr = HRESULT_FROM_WIN32( ::GetLastError() );
+                        CheckResult( hr, "Unable to create DeviceInfoList for new device" );
+                    }
+                    LogResult(S_OK, "SetupDiCreateDeviceInfoList() succeeded.");
+                }
 
-            if (status != CR_SUCCESS) {
-                CheckResult( E_FAIL, "CM_Locate_DevNode() failed" );
+                RegisterDevnode( DeviceInfoList, deviceClass, hwIdList, DeviceInfoData, deadline );
+                registered = true;
+                entry->devInst = DeviceInfoData.DevInst;
+                entry->rescan = ( evInfPath != deviceClass.argType );
             }
+            catch( ... )
+            {
+                entry->hr = CaughtResult();
+            }
+        }
+        if ( registered ) {
+            InvalidateSnapshot( args );
+        }
 
-            status = CM_Reenumerate_DevNode(devInst, 0);
+        // Install drivers from INF files, once per INF and hardware ID.
+        // An INF driver that is already installed is left to the rescan.
+        for ( auto entry = entries.begin(); entry != entries.end(); ++entry ) {
+            const DeviceClass& deviceClass = classes[entry->classSlot].deviceClass;
+            if ( FAILED( entry->hr ) || evInfPath != deviceClass.argType ) {
+                continue;
+            }
+            auto earlier = entries.begin();
+            for ( ; earlier != entry; ++earlier ) {
+                if ( SUCCEEDED( earlier->hr )
+                    && earlier->classSlot == entry->classSlot
+                    && 0 == _wcsicmp( earlier->hwIds[0].c_str(), entry->hwIds[0].c_str() ) ) {
+                    break;
+                }
+            }
+            if ( earlier != entry ) {
+                entry->rescan = earlier->rescan;
+                continue;
+            }
+            try
+            {
+                if ( !force && DriverPackageInstalled( entry->hwIds[0], deviceClass ) ) {
+                    LogResult( S_OK, "The driver in '%ls' is already installed, not updated.", deviceClass.infPath.c_str() );
+                    entry->rescan = true;
+                } else {
+                    hr = deadline.Check( "the driver will not be installed" );
+                    if ( FAILED( hr ) ) {
+                        throw hr;
+                    }
+                    InstallInfDriver( entry->hwIds[0], deviceClass.infPath, deadline );
+                }
+            }
+            catch( ... )
+            {
+                entry->hr = CaughtResult();
+            }
+        }
 
-            if (status != CR_SUCCESS) {
-                CheckResult( E_FAIL, "CM_Reenumerate_DevNode() failed" );
+        // A single rescan finds every new or existing device that has no
+        // INF, or whose INF driver was already installed.
+        for ( auto entry = entries.begin(); entry != entries.end(); ++entry ) {
+            if ( SUCCEEDED( entry->hr ) && entry->rescan ) {
+                rescanDevices.push_back( entry->devInst );
+            }
+        }
+        HRESULT rescanHr = S_OK;
+        if ( !rescanDevices.empty() ) {
+            try
+            {
+                rescanOptions.waitMs = std::min<DWORD>( rescanOptions.waitMs, deadline.Remaining() );
+                RescanDevnodes( rescanDevices, rescanOptions );
+            }
+            catch( ... )
+            {
+                rescanHr = CaughtResult();
             }
+        }
 
+        // Report the outcome of each entry.  The overall result is
+        // the first failure, if any.
+        hr = S_OK;
+        for ( auto entry = entries.begin(); entry != entries.end(); ++entry ) {
+            if ( SUCCEEDED( entry->hr ) && entry->rescan ) {
+                entry->hr = rescanHr;
+            }
+            if ( SUCCEEDED( entry->hr ) && entry->present ) {
+                LogResult( S_OK, "Device '%ls' of class '%ls' already present, not created.", entry->hwidArg.c_str(), entry->classArg.c_str() );
+            } else if ( SUCCEEDED( entry->hr ) ) {
+                LogResult( S_OK, "Device '%ls' of class '%ls' created.", entry->hwidArg.c_str(), entry->classArg.c_str() );
+            } else {
+                LogResult( entry->hr, "Device '%ls' of class '%ls' was not created.", entry->hwidArg.c_str(), entry->classArg.c_str() );
+                if ( SUCCEEDED( hr ) ) {
+                    hr = entry->hr;
+                }
+            }
         }
 
-        LogResult( hr, "DoCreateDevnode() Complete.");
+        LogResult( hr, "DoCreateDevnodes() Complete.");
     }
     catch( HRESULT& _error )
     {
@@ -250,4 +968,4 @@ HRESULT DEVMSI_API DoCreateDevnode( int argc, LPWSTR* argv )
     }
 
     return hr;
-} // HRESULT DEVMSI_API DoCreateDevnode( int argc, LPWSTR* argv )
+} // HRESULT DEVMSI_API DoCreateDevnodes( int argc, LPWSTR* argv )
@@ -2,186 +2,692 @@
 #include "devmsi.h"
 #include "CheckResult.h"
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <stdio.h>
 #include "ciwstring.h"
 #include "AutoClose.h"
+#include "DeviceProperty.h"
+#include "ArgList.h"
+#include "Trace.h"
+#include "DeviceSnapshot.h"
+#include "HwIdPattern.h"
+#include "Deadline.h"
+#include "ScanPlan.h"
 #include <cfgmgr32.h>
 
 /**
- * An array of wide strings that do case-insensitive comparisons.
+ * The outcome of removing the device node(s) matching one hardware ID.
  */
-typedef std::vector<ci_wstring> ci_wstringList;
+struct RemoveOutcome {
+    std::wstring hwId;      //*< The hardware ID as provided by the caller
+    bool pattern;           //*< True if hwId came from pattern= or patterns=, rather than being an ID
+    DWORD matched;          //*< The number of device nodes that matched the ID
+    DWORD removed;          //*< The number of matched device nodes that were removed
+    HRESULT hr;             //*< The first failure seen while removing, or S_OK
+};
 
 /**
- * Return a device registry property as a list of strings.
+ * The requested IDs, each mapped to its outcome slot.
+ */
+struct RemoveTargets {
+    std::unordered_map<ci_wstring, size_t, ci_wstring_hash> ids;    //*< IDs matched exactly, ignoring case
+    HwIdPatternSet patterns;                                        //*< IDs with wildcards
+};
+
+/**
+ * Scratch space for MatchDeviceIds(), so that matching does not allocate
+ * once it has grown to fit.  Each thread needs its own.
+ */
+struct MatchScratch {
+    ci_wstring id;                      //*< The ID being looked up
+    HwIdPatternSet::State patterns;     //*< The state of the pattern match
+    std::vector<size_t> slots;          //*< The slots of the patterns that matched
+};
+
+/**
+ * Look for any of the IDs in the targets.
+ *
+ * @param ids The IDs reported by a device.
+ * @param targets The requested IDs.
+ * @param propName The name of the property, for logging.  If NULL,
+ *                 matches are not logged, so that this may be called from
+ *                 a worker thread.
+ * @param scratch Scratch space for the lookups.
+ * @param matches The outcome slots that matched.  Slots are appended.
+ */
+void MatchDeviceIds( __in const DevicePropertyList& ids,
+                     __in const RemoveTargets& targets,
+                     __in const char* propName,
+                     __inout MatchScratch& scratch,
+                     __inout std::vector<size_t>& matches ) {
+
+    for ( auto iter = ids.begin(); iter != ids.end(); ++iter ) {
+        scratch.slots.clear();
+        scratch.id.assign( *iter );
+        auto target = targets.ids.find( scratch.id );
+        if ( targets.ids.end() != target ) {
+            scratch.slots.push_back( target->second );
+        }
+        targets.patterns.Match( *iter, scratch.patterns, scratch.slots );
+
+        if ( !scratch.slots.empty() && NULL != propName ) {
+            LogResult( S_OK, "Device matched %s '%ls'.", propName, *iter );
+        }
+        for ( auto slot = scratch.slots.begin(); slot != scratch.slots.end(); ++slot ) {
+            if ( matches.end() == std::find( matches.begin(), matches.end(), *slot ) ) {
+                matches.push_back( *slot );
+            }
+        }
+    }
+}
+
+/**
+ * Remove a device node, and record the result against each ID that matched it.
  *
- * Provided a device, interrogate it with SetupDiGetDeviceRegistryProperty() and return
- * an array of strings from the registry.  
+ * A failure is logged and recorded, but not thrown, so that it does not
+ * stop the batch.  A transient failure is retried while the time budget
+ * lasts; once it is spent, the device is not removed.
  *
- * This method will handle both REG_SZ and REG_MULTI_SZ values.  If the data type
- * in the registry is something else, then an error is not returned, but the
- * list of strings is empty.
+ * @param devs The device information set.
+ * @param devInfo The device to be removed.
+ * @param devID The device instance ID, for logging.
+ * @param matches The outcome slots of the IDs that matched the device.
+ * @param outcomes The outcome of each requested ID.
+ * @param deadline The deadline of DoRemoveDevnode().
+ * @return Returns S_OK if the device was removed, otherwise the failure.
+ */
+HRESULT RemoveMatchedDevice( __in HDEVINFO devs,
+                          __in SP_DEVINFO_DATA& devInfo,
+                          __in const wchar_t* devID,
+                          __in const std::vector<size_t>& matches,
+                          __inout std::vector<RemoveOutcome>& outcomes,
+                          __in const Deadline& deadline ) {
+
+    SP_REMOVEDEVICE_PARAMS rmdParams;
+    rmdParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
+    rmdParams.ClassInstallHeader.InstallFunction = DIF_REMOVE;
+    rmdParams.Scope = DI_REMOVEDEVICE_GLOBAL;
+    rmdParams.HwProfile = 0;
+
+    HRESULT removeHr = deadline.Check( "the device will not be removed" );
+    TraceSpan removeSpan( "SetupDiCallClassInstaller(DIF_REMOVE)" );
+    if ( FAILED( removeHr ) ) {
+        LogResult(removeHr, "Device '%ls' not removed.", devID);
+    } else if(!SetupDiSetClassInstallParams(devs,&devInfo,&rmdParams.ClassInstallHeader,sizeof(rmdParams)) ) {
+        removeHr = HRESULT_FROM_WIN32(GetLastError());
+        LogResult(removeHr, "SetupDiSetClassInstallParams('%ls') failed.", devID);
+    } else {
+        removeHr = RetryTransient( "SetupDiCallClassInstaller(DIF_REMOVE)", deadline, [&]() -> HRESULT {
+            return SetupDiCallClassInstaller( DIF_REMOVE, devs, &devInfo ) ? S_OK : HRESULT_FROM_WIN32( GetLastError() );
+        } );
+        if ( FAILED( removeHr ) ) {
+            LogResult(removeHr, "SetupDiCallClassInstaller(DIF_REMOVE, '%ls') failed.", devID);
+        } else {
+            LogResult(S_OK, "Device '%ls' removed.", devID );
+        }
+    }
+    removeSpan.End();
+
+    // A failure on one device does not stop the batch;
+    // it is recorded against every ID that matched.
+    for ( auto iter = matches.begin(); iter != matches.end(); ++iter ) {
+        RemoveOutcome& outcome = outcomes[*iter];
+        ++outcome.matched;
+        if ( SUCCEEDED( removeHr ) ) {
+            ++outcome.removed;
+        } else if ( SUCCEEDED( outcome.hr ) ) {
+            outcome.hr = removeHr;
+        }
+    }
+    return removeHr;
+} // HRESULT RemoveMatchedDevice(...)
+
+/**
+ * Read the wildcard patterns listed in a file, one per line.
  *
- * If the registry property does not exist for the device, an error is not returned,
- * but the list of strings is empty.
+ * The file may be ANSI, or UTF-8 or UTF-16 with a byte order mark.
+ * Blank lines and lines that start with ';' are skipped.
  *
- * For an unexpected error, an exception will be thrown.
+ * An exception will be thrown if the file cannot be read.
  *
- * @param items The output list of items.  It will be cleared prior to use.
- * @param Devs  The HDEVINFO to be passed to SetupDiGetDeviceRegistryProperty.
- * @param DevInfo the SP_DEVINFO_DATA to be passed to SetupDiGetDeviceRegistryProperty.
- * @param Prop The property to be retrieved from SetupDiGetDeviceRegistryProperty.
+ * @param path The path of the file.
+ * @param patterns The patterns.  They are appended.
  */
-void GetDeviceRegistryProperty(__out ci_wstringList& items, __in HDEVINFO Devs, __in SP_DEVINFO_DATA& DevInfo, __in DWORD Prop) {
+void ReadPatternFile( __in const wchar_t* path, __inout std::vector<std::wstring>& patterns ) {
 
-    DWORD reqSize =0;
-    DWORD dataType = REG_NONE;
-    items.clear();
+    FILE* file = NULL;
+    if ( 0 != _wfopen_s( &file, path, L"rt, ccs=UNICODE" ) ) {
+        HRESULT hr = E_FAIL;
+        LogResult( hr, "Unable to open pattern file '%ls'.", path );
+        throw hr;
+    }
 
-    BOOL status = SetupDiGetDeviceRegistryPropertyW( Devs, &DevInfo, Prop, &dataType, NULL, 0, &reqSize );
-    if ( !status ) {
-        DWORD lastError = GetLastError();
-        switch ( lastError ) {
-        case ERROR_INSUFFICIENT_BUFFER:
-            break;
-        case ERROR_INVALID_DATA:
-            // According to MSDN,
-            // "SetupDiGetDeviceRegistryProperty returns the ERROR_INVALID_DATA 
-            // error code if the requested property does not exist for a device 
-            // or if the property data is not valid."
-            return;
-        default:
-            LogResult( HRESULT_FROM_WIN32( lastError ), "Size check for SetupDiGetDeviceRegistryProperty() failed" );
-            return;
+    size_t before = patterns.size();
+    wchar_t line[1024];
+    while ( NULL != fgetws( line, _countof(line), file ) ) {
+        const wchar_t* first = line + wcsspn( line, L" \t" );
+        size_t length = wcscspn( first, L"\r\n" );
+        while ( 0 < length && iswspace( first[length - 1] ) ) {
+            --length;
         }
+        if ( 0 < length && L';' != *first ) {
+            patterns.push_back( std::wstring( first, length ) );
+        }
+    }
+    bool failed = 0 != ferror( file );
+    fclose( file );
+    if ( failed ) {
+        HRESULT hr = E_FAIL;
+        LogResult( hr, "Unable to read pattern file '%ls'.", path );
+        throw hr;
     }
 
-    std::auto_ptr<BYTE> buffer ( new BYTE[++reqSize] );
-    wchar_t* ptr = (wchar_t*)buffer.get();
+    LogResult( S_OK, "Read %u pattern(s) from '%ls'.", static_cast<DWORD>( patterns.size() - before ), path );
+} // void ReadPatternFile( const wchar_t* path, std::vector<std::wstring>& patterns )
 
-    status = SetupDiGetDeviceRegistryPropertyW( Devs, &DevInfo, Prop, &dataType, buffer.get(), reqSize, &reqSize );
-    if ( !status ) {
-        HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
-        CheckResult( hr, "Data fetch for SetupDiGetDeviceRegistryProperty() failed" );
-    }
+/**
+ * A device whose IDs matched one or more of the requested IDs.
+ */
+struct DeviceMatch {
+    size_t device;                  //*< The index of the device in the device list
+    std::vector<size_t> matches;    //*< The outcome slots of the IDs that matched
+};
 
-    switch ( dataType ) {
-    case REG_SZ:
-        while ( L'\0' != *ptr ) {
-            items.push_back( ptr );
-            ptr += items.back().size();
+/**
+ * The work of one thread in a parallel scan.
+ */
+struct ScanWorker {
+    std::vector<DeviceMatch> found; //*< The devices that matched, in device order
+    DeviceSnapshotWriter snapshot;  //*< The devices scanned, if a snapshot is being written
+    HRESULT hr;                     //*< S_OK, or the reason the worker stopped
+};
+
+/**
+ * Join threads when the object goes out of scope.  A std::thread that
+ * is destroyed while still joinable calls std::terminate(), so this
+ * keeps an exception thrown while the scan threads are starting, or
+ * while the calling thread scans, from ending the process.
+ */
+class AutoJoinThreads {
+public:
+    explicit AutoJoinThreads( __inout std::vector<std::thread>& threads ) : m_threads( threads ) {}
+    ~AutoJoinThreads() { Join(); }
+
+    void Join() {
+        for ( auto iter = m_threads.begin(); iter != m_threads.end(); ++iter ) {
+            if ( iter->joinable() ) {
+                iter->join();
+            }
         }
-        break;
-    case REG_MULTI_SZ:
-        while ( L'\0' != *ptr ) {
-            items.push_back( ptr );
-            ptr += 1 + items.back().size();
+    }
+private:
+    AutoJoinThreads& operator=( const AutoJoinThreads& );
+
+    std::vector<std::thread>& m_threads;
+};
+
+/**
+ * Fetch and match the IDs of every stride'th device, starting with the
+ * first'th.  This runs on a worker thread:  it reads properties straight
+ * from the device nodes, does not log, and does not throw.  It stops
+ * early, with HRESULT_FROM_WIN32(ERROR_TIMEOUT), once the budget is
+ * spent; the calling thread logs that.
+ *
+ * @param devices The devices to be scanned.
+ * @param first The index of the first device for this worker.
+ * @param stride The number of workers.
+ * @param machine The machine handle of the device information set.
+ * @param targets The requested IDs.
+ * @param record True to record every device scanned in worker.snapshot.
+ * @param deadline The deadline of DoRemoveDevnode().
+ * @param worker Receives the matching devices.
+ */
+void ScanDeviceStride( __in const std::vector<SP_DEVINFO_DATA>& devices,
+                       __in size_t first,
+                       __in size_t stride,
+                       __in HMACHINE machine,
+                       __in const RemoveTargets& targets,
+                       __in bool record,
+                       __in const Deadline& deadline,
+                       __out ScanWorker& worker ) {
+
+    worker.hr = S_OK;
+    try
+    {
+        DevicePropertyBuffer propBuffer;
+        DevicePropertyList ids;
+        MatchScratch scratch;
+        std::vector<size_t> matches;
+        wchar_t devID[MAX_DEVICE_ID_LEN];
+
+        for ( size_t index = first; index < devices.size(); index += stride ) {
+            if ( deadline.Expired() ) {
+                worker.hr = HRESULT_FROM_WIN32( ERROR_TIMEOUT );
+                break;
+            }
+            bool recordDevice = record
+                && CR_SUCCESS == CM_Get_Device_ID_Ex( devices[index].DevInst, devID, MAX_DEVICE_ID_LEN, 0, machine );
+            if ( recordDevice ) {
+                worker.snapshot.BeginDevice( devID );
+            }
+            matches.clear();
+            propBuffer.GetDevNode( ids, devices[index].DevInst, CM_DRP_HARDWAREID, machine );
+            MatchDeviceIds( ids, targets, NULL, scratch, matches );
+            if ( recordDevice ) {
+                worker.snapshot.AddIds( ids );
+            }
+            propBuffer.GetDevNode( ids, devices[index].DevInst, CM_DRP_COMPATIBLEIDS, machine );
+            MatchDeviceIds( ids, targets, NULL, scratch, matches );
+            if ( recordDevice ) {
+                worker.snapshot.AddIds( ids );
+            }
+
+            if ( !matches.empty() ) {
+                DeviceMatch match;
+                match.device = index;
+                match.matches.swap( matches );
+                worker.found.push_back( match );
+            }
         }
-        break;
-    default:
-        // Invalid data type, there's nothing to do here.
-        LogResult( S_OK, "Invalid registry property data type %d, ignored.", dataType );
     }
+    catch( ... )
+    {
+        worker.hr = E_OUTOFMEMORY;
+    }
+} // void ScanDeviceStride(...)
 
+/**
+ * Order DeviceMatch records by device.
+ */
+bool DeviceMatchLess( const DeviceMatch& left, const DeviceMatch& right ) {
+    return left.device < right.device;
 }
 
+/**
+ * Remove the devices that a snapshot says match the requested IDs.
+ *
+ * Each device is opened by its instance ID, and its IDs are read and
+ * matched again, so that a device that has gone or changed since the
+ * snapshot was written is skipped.
+ *
+ * An exception will be thrown if the device information set cannot be created.
+ *
+ * @param snapshot The snapshot.
+ * @param targets The requested IDs.
+ * @param outcomes The outcome of each requested ID.
+ * @param deadline The deadline of DoRemoveDevnode().
+ * @param gone The instance IDs of the devices removed, or no longer
+ *             present, which the snapshot should no longer list.  They are appended.
+ */
+void RemoveSnapshotMatches( __in DeviceSnapshot& snapshot,
+                            __in const RemoveTargets& targets,
+                            __inout std::vector<RemoveOutcome>& outcomes,
+                            __in const Deadline& deadline,
+                            __inout std::vector<std::wstring>& gone ) {
+
+    AutoCloseDeviceInfoList devs;
+    std::vector<const wchar_t*> instanceIds;
+    DevicePropertyBuffer propBuffer;
+    DevicePropertyList ids;
+    MatchScratch scratch;
+    std::vector<size_t> matches;
+
+    devs = SetupDiCreateDeviceInfoList( NULL, NULL );
+    if ( INVALID_HANDLE_VALUE == devs ) {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        CheckResult(hr, "SetupDiCreateDeviceInfoList() failed.");
+    }
+
+    // The snapshot stores each instance ID once, so a device found
+    // through several IDs has a single pointer.
+    // A pattern finds every device with an ID that starts with its
+    // literal part; the match below weeds out the rest.  An ID is looked
+    // up as it is, even if it contains '*' or '?'.
+    for ( auto iter = outcomes.begin(); iter != outcomes.end(); ++iter ) {
+        if ( iter->pattern ) {
+            snapshot.FindPrefix( HwIdPatternSet::LiteralPrefix( iter->hwId.c_str() ).c_str(), instanceIds );
+        } else {
+            snapshot.Find( iter->hwId.c_str(), instanceIds );
+        }
+    }
+    std::sort( instanceIds.begin(), instanceIds.end() );
+    instanceIds.erase( std::unique( instanceIds.begin(), instanceIds.end() ), instanceIds.end() );
+
+    for ( auto iter = instanceIds.begin(); iter != instanceIds.end(); ++iter ) {
+        SP_DEVINFO_DATA devInfo = { sizeof(SP_DEVINFO_DATA) };
+        ULONG status = 0, problem = 0;
+        if ( !SetupDiOpenDeviceInfoW( devs, *iter, NULL, 0, &devInfo )
+            || CR_SUCCESS != CM_Get_DevNode_Status( &status, &problem, devInfo.DevInst, 0 ) ) {
+            LogResult( S_OK, "Device '%ls' from the snapshot is no longer present.", *iter );
+            gone.push_back( *iter );
+            continue;
+        }
+
+        matches.clear();
+        propBuffer.Get( ids, devs, devInfo, SPDRP_HARDWAREID );
+        MatchDeviceIds( ids, targets, "SPDRP_HARDWAREID", scratch, matches );
+        propBuffer.Get( ids, devs, devInfo, SPDRP_COMPATIBLEIDS );
+        MatchDeviceIds( ids, targets, "SPDRP_COMPATIBLEID", scratch, matches );
+
+        if ( matches.empty() ) {
+            LogResult( S_OK, "Device '%ls' from the snapshot no longer matches.", *iter );
+        } else if ( SUCCEEDED( RemoveMatchedDevice( devs, devInfo, *iter, matches, outcomes, deadline ) ) ) {
+            gone.push_back( *iter );
+        }
+    }
+} // void RemoveSnapshotMatches(...)
+
+/**
+ * Create the device information set that a plan reads.
+ *
+ * Devices named by instance ID that are not present are left out, as
+ * a scan would leave them out.
+ *
+ * An exception will be thrown if the set cannot be created.
+ *
+ * @param plan The plan.
+ * @param devs Set to the device information set.
+ */
+void OpenPlannedDevices( __in const ScanPlan& plan, __out AutoCloseDeviceInfoList& devs ) {
+
+    HRESULT hr = S_OK;
+    if ( plan.instanceIds.empty() ) {
+        devs = SetupDiGetClassDevsEx(
+            plan.hasClass ? &plan.classGuid : NULL,
+            plan.enumerator.empty() ? NULL : plan.enumerator.c_str(),
+            NULL,
+            ( plan.hasClass ? 0 : DIGCF_ALLCLASSES ) | DIGCF_PRESENT,
+            NULL, NULL, NULL);
+        if ( INVALID_HANDLE_VALUE == devs ) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            CheckResult(hr, "SetupDiGetClassDevsEx(DIGCF_PRESENT) failed.");
+        }
+        return;
+    }
+
+    devs = SetupDiCreateDeviceInfoList( NULL, NULL );
+    if ( INVALID_HANDLE_VALUE == devs ) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        CheckResult(hr, "SetupDiCreateDeviceInfoList() failed.");
+    }
+    for ( auto iter = plan.instanceIds.begin(); iter != plan.instanceIds.end(); ++iter ) {
+        SP_DEVINFO_DATA devInfo = { sizeof(SP_DEVINFO_DATA) };
+        ULONG status = 0, problem = 0;
+        if ( !SetupDiOpenDeviceInfoW( devs, *iter, NULL, 0, &devInfo ) ) {
+            LogResult( S_OK, "Device '%ls' not found.", *iter );
+        } else if ( CR_SUCCESS != CM_Get_DevNode_Status( &status, &problem, devInfo.DevInst, 0 ) ) {
+            LogResult( S_OK, "Device '%ls' is not present.", *iter );
+            SetupDiDeleteDeviceInfo( devs, &devInfo );
+        }
+    }
+} // void OpenPlannedDevices( const ScanPlan& plan, AutoCloseDeviceInfoList& devs )
+
 HRESULT DEVMSI_API DoRemoveDevnode( int argc, LPWSTR* argv )
 {
     HRESULT hr = E_FAIL;
 
     try
     {
+        TraceSpan functionSpan( "DoRemoveDevnode" );
         AutoCloseDeviceInfoList devs;    
         SP_DEVINFO_LIST_DETAIL_DATA devInfoListDetail = { sizeof(SP_DEVINFO_LIST_DETAIL_DATA)};
         SP_DEVINFO_DATA devInfo = { sizeof(SP_DEVINFO_DATA) };
         DWORD devIndex = 0;
         DWORD lastError= ERROR_SUCCESS;
-        ci_wstring devNodeName;
+        std::vector<RemoveOutcome> outcomes;
+        RemoveTargets targets;
+        std::unordered_map<ci_wstring, size_t, ci_wstring_hash> patternSlots;
+        std::vector<std::wstring> filePatterns;
+        LARGE_INTEGER frequency, scanStart, scanEnd;
+        DWORD threadCount = 1;
+        DWORD snapshotDevices = 0;
 
-        switch( argc )
-        {
-        case 1:
-            devNodeName = ( NULL == argv[0] ? L"" : argv[0] );
-            break;
-        case 0:
-            throw std::runtime_error( "DoRemoveDevnode() requires one parameter, zero provided" );
-        default:
-            throw std::runtime_error( "DoRemoveDevnode() requires one parameter, too many provided" );
+        // These are reused for every device, so that the scan does not
+        // allocate once they have grown to fit.
+        DevicePropertyBuffer propBuffer;
+        DevicePropertyList ids;
+        MatchScratch scratch;
+        std::vector<size_t> matches;
+
+        // IDs may be given as positional arguments, as repeated
+        // "hwid=" arguments, or both.  They are matched literally, even
+        // if they contain '*' or '?' (e.g. the ACPI ID "*PNP0303").
+        ArgList args( argc, argv );
+        Deadline deadline( args.NamedNumber( L"budget", 0 ) );
+        std::vector<LPCWSTR> hwIdArgs( args.Positional() );
+        args.NamedList( L"hwid", hwIdArgs );
+        for ( auto arg = hwIdArgs.begin(); arg != hwIdArgs.end(); ++arg ) {
+            LogResult( S_OK, "Entered RemoveDevnode('%ls').", *arg );
         }
-        LogResult( S_OK, "Entered RemoveDevnode('%ls').", devNodeName.c_str() );
 
-        devs = SetupDiGetClassDevsEx(
-            NULL, NULL, NULL, 
-            DIGCF_ALLCLASSES | DIGCF_PRESENT,
-            NULL, NULL, NULL);
-        if ( INVALID_HANDLE_VALUE == devs ) {
-            hr = HRESULT_FROM_WIN32(GetLastError());
-            CheckResult(hr, "SetupDiGetClassDevsEx(DIGCF_ALLCLASSES | DIGCF_PRESENT) failed.");
+        // Wildcard patterns are only taken from repeated "pattern="
+        // arguments and from "patterns=<path>", a file of them, one per line.
+        std::vector<LPCWSTR> patternArgs;
+        args.NamedList( L"pattern", patternArgs );
+        const wchar_t* patternsPath = args.Named( L"patterns" );
+        if ( NULL != patternsPath ) {
+            ReadPatternFile( patternsPath, filePatterns );
+            for ( auto iter = filePatterns.begin(); iter != filePatterns.end(); ++iter ) {
+                patternArgs.push_back( iter->c_str() );
+            }
+        }
+        for ( auto arg = patternArgs.begin(); arg != patternArgs.end(); ++arg ) {
+            LogResult( S_OK, "Entered RemoveDevnode(pattern '%ls').", *arg );
+        }
+        if ( hwIdArgs.empty() && patternArgs.empty() ) {
+            throw std::runtime_error( "DoRemoveDevnode() requires at least one parameter, zero provided" );
         }
 
-        if(!SetupDiGetDeviceInfoListDetail(devs,&devInfoListDetail)) {
-            hr = HRESULT_FROM_WIN32(GetLastError());
-            CheckResult(hr, "SetupDiGetDeviceInfoListDetail() failed.");
-        }
-
-        for ( devIndex = 0; SetupDiEnumDeviceInfo( devs, devIndex, &devInfo ); ++devIndex ) {
-            TCHAR devID[MAX_DEVICE_ID_LEN];
-            ci_wstringList hwIds, compatIds;
-            bool found = false;
-            //
-            // determine instance ID
-            //
-            if(CR_SUCCESS == CM_Get_Device_ID_Ex(devInfo.DevInst, devID, 
-                MAX_DEVICE_ID_LEN, 0, devInfoListDetail.RemoteMachineHandle) ) {
-                     GetDeviceRegistryProperty(hwIds, devs,devInfo,SPDRP_HARDWAREID);
-                     GetDeviceRegistryProperty(compatIds, devs,devInfo,SPDRP_COMPATIBLEIDS);
-
-                    if ( !hwIds.empty() ) {
-                        for ( auto iter = hwIds.begin(); iter != hwIds.end(); ++iter ) {
-                            if ( *iter == devNodeName ) {
-                                LogResult( S_OK, "Device '%ls' matched SPDRP_HARDWAREID '%ls'."
-                                    , devNodeName.c_str(), iter->c_str() );
-                                found = true;
-                            }
-                        }
+        // "threads=N" fetches and matches device IDs on N threads.
+        threadCount = args.NamedNumber( L"threads", 1 );
+        threadCount = std::max<DWORD>( 1, std::min<DWORD>( threadCount, 64 ) );
+
+        // "snapshot=<path>" looks the IDs up in a snapshot of the devices,
+        // if there is a recent one, rather than scanning; otherwise the
+        // scan writes one.
+        const wchar_t* snapshotPath = args.Named( L"snapshot" );
+        DWORD snapshotAge = args.NamedNumber( L"snapshotage", 600 );
+        DeviceSnapshot snapshot;
+        DeviceSnapshotWriter snapshotWriter;
+
+        // Index each requested ID and pattern.  IDs (or patterns) that
+        // differ only in case share a single outcome slot.  The patterns
+        // are compiled into one pattern set, so that each device ID is
+        // matched against all of them in a single pass.
+        for ( auto arg = hwIdArgs.begin(); arg != hwIdArgs.end(); ++arg ) {
+            const wchar_t* id = *arg;
+            if ( targets.ids.end() == targets.ids.find( id ) ) {
+                RemoveOutcome outcome = { id, false, 0, 0, S_OK };
+                targets.ids[id] = outcomes.size();
+                outcomes.push_back( outcome );
+            }
+        }
+        for ( auto arg = patternArgs.begin(); arg != patternArgs.end(); ++arg ) {
+            const wchar_t* pattern = *arg;
+            if ( patternSlots.end() == patternSlots.find( pattern ) ) {
+                RemoveOutcome outcome = { pattern, true, 0, 0, S_OK };
+                patternSlots[pattern] = outcomes.size();
+                targets.patterns.Add( pattern, outcomes.size() );
+                outcomes.push_back( outcome );
+            }
+        }
+
+        // Only the devices named by the hints are read; see PlanDeviceScan().
+        // A snapshot holds every device, so a narrowed plan neither reads
+        // nor writes it:  its hits could lie outside the hints, and a
+        // narrowed scan would leave devices out of it.
+        ScanPlan plan;
+        PlanDeviceScan( args, plan );
+        bool record = NULL != snapshotPath && !plan.Narrowed();
+
+        TraceSpan scanSpan( "Scan devices" );
+        QueryPerformanceFrequency( &frequency );
+        QueryPerformanceCounter( &scanStart );
+        bool fromSnapshot = record && snapshot.Open( snapshotPath, snapshotAge );
+        if ( fromSnapshot ) {
+            std::vector<std::wstring> gone;
+            RemoveSnapshotMatches( snapshot, targets, outcomes, deadline, gone );
+            snapshotDevices = snapshot.DeviceCount();
+
+            // Write the snapshot again without the devices that have gone,
+            // so that later actions do not find them.  It keeps the time it
+            // was first written, and so expires as it would have.  If it
+            // cannot be written, it is deleted rather than left stale.
+            if ( !gone.empty() ) {
+                TraceSpan rewriteSpan( "Rewrite snapshot" );
+                snapshot.CopyTo( snapshotWriter );
+                snapshot.Close();
+                for ( auto iter = gone.begin(); iter != gone.end(); ++iter ) {
+                    snapshotWriter.Exclude( iter->c_str() );
+                }
+                if ( FAILED( snapshotWriter.Write( snapshotPath ) ) ) {
+                    InvalidateDeviceSnapshot( snapshotPath );
+                }
+            }
+        } else {
+            TraceSpan getClassDevsSpan( "SetupDiGetClassDevsEx" );
+            OpenPlannedDevices( plan, devs );
+
+            if(!SetupDiGetDeviceInfoListDetail(devs,&devInfoListDetail)) {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                CheckResult(hr, "SetupDiGetDeviceInfoListDetail() failed.");
+            }
+            getClassDevsSpan.End();
+
+            // A single pass over the device tree serves every requested ID.
+            if ( 1 == threadCount ) {
+                for ( devIndex = 0; SetupDiEnumDeviceInfo( devs, devIndex, &devInfo ); ++devIndex ) {
+                    TCHAR devID[MAX_DEVICE_ID_LEN];
+                    matches.clear();
+                    hr = deadline.Check( "the rest of the devices will not be scanned" );
+                    if ( FAILED( hr ) ) {
+                        throw hr;
                     }
-                    if ( !compatIds.empty() ) {
-                        for ( auto iter = compatIds.begin(); iter != compatIds.end(); ++iter ) {
-                            if ( *iter == devNodeName ) {
-                                LogResult( S_OK, "Device '%ls' matched SPDRP_COMPATIBLEID '%ls'."
-                                    , devNodeName.c_str(), iter->c_str() );
-                                found = true;
+                    //
+                    // determine instance ID
+                    //
+                    if(CR_SUCCESS == CM_Get_Device_ID_Ex(devInfo.DevInst, devID, 
+                        MAX_DEVICE_ID_LEN, 0, devInfoListDetail.RemoteMachineHandle) ) {
+                            if ( record ) {
+                                snapshotWriter.BeginDevice( devID );
+                            }
+                            propBuffer.Get( ids, devs, devInfo, SPDRP_HARDWAREID );
+                            MatchDeviceIds( ids, targets, "SPDRP_HARDWAREID", scratch, matches );
+                            if ( record ) {
+                                snapshotWriter.AddIds( ids );
+                            }
+                            propBuffer.Get( ids, devs, devInfo, SPDRP_COMPATIBLEIDS );
+                            MatchDeviceIds( ids, targets, "SPDRP_COMPATIBLEID", scratch, matches );
+                            if ( record ) {
+                                snapshotWriter.AddIds( ids );
+                            }
+
+                            if ( !matches.empty()
+                                && SUCCEEDED(RemoveMatchedDevice( devs, devInfo, devID, matches, outcomes, deadline ))
+                                && record ) {
+                                snapshotWriter.Exclude( devID );
                             }
-                        }
                     }
+                } // for loop on devIndex
+                lastError = GetLastError();
+                if ( ERROR_NO_MORE_ITEMS != lastError ) {
+                    hr = HRESULT_FROM_WIN32(lastError);
+                    CheckResult(hr, "SetupDiEnumDeviceInfo() failed.");
+                }
+            } else {
+                // Listing the devices is quick; fetching their IDs is where
+                // the time goes.  Workers fetch and match IDs, reading each
+                // device node directly, since SetupAPI serializes calls on a
+                // device information set.  Removal stays on this thread.
+                std::vector<SP_DEVINFO_DATA> devices;
+                for ( devIndex = 0; SetupDiEnumDeviceInfo( devs, devIndex, &devInfo ); ++devIndex ) {
+                    devices.push_back( devInfo );
+                }
+                lastError = GetLastError();
+                if ( ERROR_NO_MORE_ITEMS != lastError ) {
+                    hr = HRESULT_FROM_WIN32(lastError);
+                    CheckResult(hr, "SetupDiEnumDeviceInfo() failed.");
+                }
+
+                threadCount = std::max<DWORD>( 1, std::min<DWORD>( threadCount, devIndex ) );
+                std::vector<ScanWorker> workers( threadCount );
+                std::vector<std::thread> threads;
+                HMACHINE machine = devInfoListDetail.RemoteMachineHandle;
 
-                    if ( found ) {
-                        SP_REMOVEDEVICE_PARAMS rmdParams;
-                        rmdParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
-                        rmdParams.ClassInstallHeader.InstallFunction = DIF_REMOVE;
-                        rmdParams.Scope = DI_REMOVEDEVICE_GLOBAL;
-                        rmdParams.HwProfile = 0;
-
-                        if(!SetupDiSetClassInstallParams(devs,&devInfo,&rmdParams.ClassInstallHeader,sizeof(rmdParams)) ) {
-                            hr = HRESULT_FROM_WIN32(GetLastError());
-                            CheckResult(hr, "SetupDiSetClassInstallParams() failed.");
-                        }
-                        if(!SetupDiCallClassInstaller(DIF_REMOVE,devs,&devInfo)) {
-                            hr = HRESULT_FROM_WIN32(GetLastError());
-                            CheckResult(hr, "SetupDiCallClassInstaller(DIF_REMOVE) failed.");
-                        }
-
-                        hr = S_OK;
-                        LogResult(hr, "Device '%ls' removed.", devNodeName.c_str() );
+                // Room for every thread is reserved first, so that adding
+                // a started thread cannot throw.  If starting one does throw,
+                // the threads already running are joined before it leaves.
+                threads.reserve( threadCount - 1 );
+                AutoJoinThreads joinThreads( threads );
+                for ( DWORD i = 1; i < threadCount; ++i ) {
+                    threads.push_back( std::thread( [&, i]() {
+                        ScanDeviceStride( devices, i, threadCount, machine, targets, record, deadline, workers[i] );
+                    } ) );
+                }
+                ScanDeviceStride( devices, 0, threadCount, machine, targets, record, deadline, workers[0] );
+                joinThreads.Join();
+
+                std::vector<DeviceMatch> found;
+                for ( auto iter = workers.begin(); iter != workers.end(); ++iter ) {
+                    if ( HRESULT_FROM_WIN32( ERROR_TIMEOUT ) == iter->hr ) {
+                        hr = deadline.Check( "the device scan was stopped, and no device will be removed" );
+                        throw iter->hr;
                     }
+                    CheckResult( iter->hr, "Device scan failed." );
+                    found.insert( found.end(), iter->found.begin(), iter->found.end() );
+                    snapshotWriter.Append( iter->snapshot );
+                }
+                std::sort( found.begin(), found.end(), DeviceMatchLess );
+
+                for ( auto match = found.begin(); match != found.end(); ++match ) {
+                    TCHAR devID[MAX_DEVICE_ID_LEN];
+                    SP_DEVINFO_DATA& device = devices[match->device];
+                    if(CR_SUCCESS == CM_Get_Device_ID_Ex(device.DevInst, devID, 
+                        MAX_DEVICE_ID_LEN, 0, devInfoListDetail.RemoteMachineHandle) ) {
+                            for ( auto iter = match->matches.begin(); iter != match->matches.end(); ++iter ) {
+                                LogResult( S_OK, "Device '%ls' matched '%ls'.", devID, outcomes[*iter].hwId.c_str() );
+                            }
+                            if ( SUCCEEDED(RemoveMatchedDevice( devs, device, devID, match->matches, outcomes, deadline ))
+                                && record ) {
+                                snapshotWriter.Exclude( devID );
+                            }
+                    }
+                }
+            }
+
+            if ( record ) {
+                snapshotWriter.Write( snapshotPath );
             }
-        } // for loop on devIndex
-        lastError = GetLastError();
-        if ( ERROR_NO_MORE_ITEMS == lastError ) {
-            LogResult ( HRESULT_FROM_WIN32( lastError ), "Matching device not found, no device(s) removed." );
-            hr = S_OK;
+        }
+        QueryPerformanceCounter( &scanEnd );
+        scanSpan.End();
+
+        double scanMs = 1000.0 * ( scanEnd.QuadPart - scanStart.QuadPart ) / frequency.QuadPart;
+        if ( fromSnapshot ) {
+            LogResult( S_OK, "Looked up %u hardware ID(s) in a snapshot of %u device(s) in %.1f ms."
+                , static_cast<DWORD>( outcomes.size() ), snapshotDevices, scanMs );
         } else {
-            hr = HRESULT_FROM_WIN32(lastError);
-            CheckResult(hr, "SetupDiEnumDeviceInfo() failed.");
+            LogResult( S_OK, "Scanned %u device(s) for %u hardware ID(s) on %u thread(s) in %.1f ms (%.0f devices/s)."
+                , devIndex, static_cast<DWORD>( outcomes.size() ), threadCount, scanMs
+                , ( scanMs > 0.0 ? devIndex * 1000.0 / scanMs : 0.0 ) );
+        }
+
+        // Report the outcome of each ID.  The overall result is
+        // the first failure, if any.
+        hr = S_OK;
+        for ( auto iter = outcomes.begin(); iter != outcomes.end(); ++iter ) {
+            if ( 0 == iter->matched ) {
+                LogResult( S_OK, "Device '%ls': matching device not found, no device(s) removed.", iter->hwId.c_str() );
+            } else if ( SUCCEEDED( iter->hr ) ) {
+                LogResult( S_OK, "Device '%ls': %u device(s) removed.", iter->hwId.c_str(), iter->removed );
+            } else {
+                LogResult( iter->hr, "Device '%ls': %u of %u device(s) removed.", iter->hwId.c_str(), iter->removed, iter->matched );
+                if ( SUCCEEDED( hr ) ) {
+                    hr = iter->hr;
+                }
+            }
         }
 
         LogResult( hr, "DoRemoveDevnode() Complete.");
@@ -0,0 +1,256 @@
+#include "stdafx.h"
+#include "ErrorText.h"
+#include <lmerr.h>
+#include <SetupAPI.h>
+#include <cfgmgr32.h>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+/**
+ * The text of an error code from the built-in table.
+ */
+struct ErrorTextEntry {
+    DWORD code;             //*< The Win32 or SetupAPI error code
+    const char* text;       //*< The message text
+};
+
+/**
+ * Common errors seen by this DLL, for when FormatMessage() has nothing.
+ */
+static const ErrorTextEntry s_errorTexts[] = {
+    { ERROR_FILE_NOT_FOUND,              "The system cannot find the file specified." },
+    { ERROR_PATH_NOT_FOUND,              "The system cannot find the path specified." },
+    { ERROR_ACCESS_DENIED,               "Access is denied." },
+    { ERROR_INVALID_HANDLE,              "The handle is invalid." },
+    { ERROR_NOT_ENOUGH_MEMORY,           "Not enough storage is available to process this command." },
+    { ERROR_INVALID_DATA,                "The data is invalid." },
+    { ERROR_OUTOFMEMORY,                 "Not enough storage is available to complete this operation." },
+    { ERROR_NOT_READY,                   "The device is not ready." },
+    { ERROR_SHARING_VIOLATION,           "The process cannot access the file because it is being used by another process." },
+    { ERROR_NOT_SUPPORTED,               "The request is not supported." },
+    { ERROR_INVALID_PARAMETER,           "The parameter is incorrect." },
+    { ERROR_INSUFFICIENT_BUFFER,         "The data area passed to a system call is too small." },
+    { ERROR_BUSY,                        "The requested resource is in use." },
+    { ERROR_ALREADY_EXISTS,              "Cannot create a file when that file already exists." },
+    { ERROR_MORE_DATA,                   "More data is available." },
+    { ERROR_NO_MORE_ITEMS,               "No more data is available." },
+    { ERROR_DEPENDENT_SERVICES_RUNNING,  "A stop control has been sent to a service that other running services are dependent on." },
+    { ERROR_INVALID_SERVICE_CONTROL,     "The requested control is not valid for this service." },
+    { ERROR_SERVICE_REQUEST_TIMEOUT,     "The service did not respond to the start or control request in a timely fashion." },
+    { ERROR_SERVICE_DATABASE_LOCKED,     "The service database is locked." },
+    { ERROR_SERVICE_DOES_NOT_EXIST,      "The specified service does not exist as an installed service." },
+    { ERROR_SERVICE_CANNOT_ACCEPT_CTRL,  "The service cannot accept control messages at this time." },
+    { ERROR_SERVICE_NOT_ACTIVE,          "The service has not been started." },
+    { ERROR_SERVICE_MARKED_FOR_DELETE,   "The specified service has been marked for deletion." },
+    { ERROR_NOT_FOUND,                   "Element not found." },
+    { ERROR_CANCELLED,                   "The operation was canceled by the user." },
+    { ERROR_TIMEOUT,                     "This operation returned because the timeout period expired." },
+    { ERROR_SECTION_NOT_FOUND,           "The INF file does not contain the requested section." },
+    { ERROR_LINE_NOT_FOUND,              "The INF section does not contain the requested line." },
+    { ERROR_NO_ASSOCIATED_CLASS,         "The INF or the device information set or element does not have an associated install class." },
+    { ERROR_CLASS_MISMATCH,              "The INF or the device information set or element does not match the specified install class." },
+    { ERROR_DUPLICATE_FOUND,             "An existing device was found that is a duplicate of the device being manually installed." },
+    { ERROR_NO_DRIVER_SELECTED,          "There is no driver selected for the device information set or element." },
+    { ERROR_KEY_DOES_NOT_EXIST,          "The requested device registry key does not exist." },
+    { ERROR_INVALID_DEVINST_NAME,        "The device instance name is invalid." },
+    { ERROR_DEVINST_ALREADY_EXISTS,      "The device instance cannot be created because it already exists." },
+    { ERROR_DEVINFO_NOT_REGISTERED,      "The operation cannot be performed on a device information element that has not been registered." },
+    { ERROR_NO_INF,                      "The INF from which a driver list is to be built does not exist." },
+    { ERROR_NO_SUCH_DEVINST,             "The device instance does not exist in the hardware tree." },
+    { ERROR_INVALID_CLASS_INSTALLER,     "The class installer has indicated that it is not valid." },
+    { ERROR_INVALID_HWPROFILE,           "The hardware profile is invalid." },
+    { ERROR_NO_DEVICE_SELECTED,          "There is no device information element currently selected for this device information set." },
+    { ERROR_NO_CATALOG_FOR_OEM_INF,      "The third-party INF does not contain digital signature information." },
+    { ERROR_NO_COMPAT_DRIVERS,           "There is no compatible driver for this device." },
+    { ERROR_DEVICE_INSTALLER_NOT_READY,  "The device installer is not ready to perform the operation." },
+};
+
+/**
+ * The names of configuration manager results.
+ */
+static const struct {
+    DWORD status;
+    const char* name;
+} s_configRetNames[] = {
+#define CONFIGRET_NAME(x) { x, #x }
+    CONFIGRET_NAME( CR_SUCCESS ),
+    CONFIGRET_NAME( CR_OUT_OF_MEMORY ),
+    CONFIGRET_NAME( CR_INVALID_POINTER ),
+    CONFIGRET_NAME( CR_INVALID_FLAG ),
+    CONFIGRET_NAME( CR_INVALID_DEVNODE ),
+    CONFIGRET_NAME( CR_NO_SUCH_DEVNODE ),
+    CONFIGRET_NAME( CR_ALREADY_SUCH_DEVNODE ),
+    CONFIGRET_NAME( CR_FAILURE ),
+    CONFIGRET_NAME( CR_REGISTRY_ERROR ),
+    CONFIGRET_NAME( CR_DEVICE_NOT_THERE ),
+    CONFIGRET_NAME( CR_BUFFER_SMALL ),
+    CONFIGRET_NAME( CR_NO_DEPENDENT ),
+    CONFIGRET_NAME( CR_INVALID_DEVICE_ID ),
+    CONFIGRET_NAME( CR_INVALID_DATA ),
+    CONFIGRET_NAME( CR_NOT_DISABLEABLE ),
+    CONFIGRET_NAME( CR_NO_SUCH_VALUE ),
+    CONFIGRET_NAME( CR_NO_REGISTRY_HANDLE ),
+    CONFIGRET_NAME( CR_NO_SUCH_REGISTRY_KEY ),
+    CONFIGRET_NAME( CR_INVALID_MACHINENAME ),
+    CONFIGRET_NAME( CR_ACCESS_DENIED ),
+    CONFIGRET_NAME( CR_CALL_NOT_IMPLEMENTED ),
+    CONFIGRET_NAME( CR_INVALID_PROPERTY ),
+    CONFIGRET_NAME( CR_NEED_RESTART ),
+    CONFIGRET_NAME( CR_REMOTE_COMM_FAILURE ),
+    CONFIGRET_NAME( CR_MACHINE_UNAVAILABLE ),
+    CONFIGRET_NAME( CR_NO_CM_SERVICES ),
+#undef CONFIGRET_NAME
+};
+
+//* Mask of the SetupAPI error codes in winerror.h form.
+#define SETUPAPI_ERROR_MASK ( APPLICATION_ERROR_MASK | ERROR_SEVERITY_ERROR )
+
+/**
+ * Looks up codes with FormatMessage().  MQUTIL.DLL and NETMSG.DLL are
+ * loaded the first time they are needed and kept until Release().
+ */
+class SystemErrorMessageProvider : public ErrorMessageProvider {
+public:
+    SystemErrorMessageProvider() : m_mqutil( NULL ), m_netmsg( NULL ), m_mqutilTried( false ), m_netmsgTried( false ) {}
+
+    virtual bool Lookup( __in DWORD code, __out std::string& text ) {
+        LPSTR pBuffer = NULL;
+        HMODULE hInst = NULL;
+        DWORD dwMessageId = code;
+        DWORD flags = FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_IGNORE_INSERTS;
+
+        if ( HRESULT_FACILITY(code) == FACILITY_MSMQ ) {
+            hInst = Module( m_mqutil, m_mqutilTried, TEXT("MQUTIL.DLL") );
+            flags |= FORMAT_MESSAGE_FROM_HMODULE;
+        } else if ( code >= NERR_BASE && code <= MAX_NERR ) {
+            hInst = Module( m_netmsg, m_netmsgTried, TEXT("NETMSG.DLL") );
+            flags |= FORMAT_MESSAGE_FROM_HMODULE;
+        } else {
+            if ( HRESULT_FACILITY(code) == FACILITY_WIN32 ) {
+                // A "GetLastError" error, drop the HRESULT_FACILITY
+                dwMessageId &= 0x0000FFFF;
+            }
+            flags |= FORMAT_MESSAGE_FROM_SYSTEM;
+        }
+
+        if ( ( flags & FORMAT_MESSAGE_FROM_HMODULE ) && NULL == hInst ) {
+            return false;
+        }
+
+        DWORD ret = FormatMessageA( flags, hInst, dwMessageId,
+            MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+            reinterpret_cast<LPSTR>( &pBuffer ), 0, NULL );
+        if ( 0 < ret && NULL != pBuffer ) {
+            text.assign( pBuffer, ret );
+        }
+        LocalFree( pBuffer );
+        return ( 0 < ret );
+    }
+
+    void Release() {
+        if ( NULL != m_mqutil ) {
+            FreeLibrary( m_mqutil );
+        }
+        if ( NULL != m_netmsg ) {
+            FreeLibrary( m_netmsg );
+        }
+        m_mqutil = m_netmsg = NULL;
+        m_mqutilTried = m_netmsgTried = false;
+    }
+
+private:
+    static HMODULE Module( __inout HMODULE& module, __inout bool& tried, __in LPCTSTR name ) {
+        if ( !tried ) {
+            tried = true;
+            module = LoadLibraryEx( name, NULL, LOAD_LIBRARY_AS_DATAFILE );
+        }
+        return module;
+    }
+
+    HMODULE m_mqutil;       //*< MQUTIL.DLL, for MSMQ errors
+    HMODULE m_netmsg;       //*< NETMSG.DLL, for network errors
+    bool m_mqutilTried;     //*< True once MQUTIL.DLL has been loaded, or failed to load
+    bool m_netmsgTried;     //*< True once NETMSG.DLL has been loaded, or failed to load
+};
+
+/**
+ * Looks up codes in s_errorTexts.
+ */
+class BuiltInErrorMessageProvider : public ErrorMessageProvider {
+public:
+    virtual bool Lookup( __in DWORD code, __out std::string& text ) {
+        if ( HRESULT_FACILITY(code) == FACILITY_WIN32 ) {
+            code &= 0x0000FFFF;
+        } else if ( HRESULT_FACILITY(code) == FACILITY_SETUPAPI ) {
+            // HRESULT_FROM_SETUPAPI() form
+            code = SETUPAPI_ERROR_MASK | ( code & 0x0000FFFF );
+        }
+        for ( size_t i = 0; i < _countof( s_errorTexts ); ++i ) {
+            if ( code == s_errorTexts[i].code ) {
+                text = s_errorTexts[i].text;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static std::mutex s_errorTextLock;
+static std::unordered_map<DWORD, std::string> s_errorTextCache;
+static std::vector<ErrorMessageProvider*> s_addedProviders;
+static SystemErrorMessageProvider s_systemProvider;
+static BuiltInErrorMessageProvider s_builtInProvider;
+
+const char* ErrorText( __in DWORD code )
+{
+    std::lock_guard<std::mutex> lock( s_errorTextLock );
+
+    auto cached = s_errorTextCache.find( code );
+    if ( s_errorTextCache.end() != cached ) {
+        return cached->second.c_str();
+    }
+
+    std::string text;
+    bool found = false;
+    for ( auto iter = s_addedProviders.begin(); !found && iter != s_addedProviders.end(); ++iter ) {
+        found = (*iter)->Lookup( code, text );
+    }
+    found = found || s_systemProvider.Lookup( code, text ) || s_builtInProvider.Lookup( code, text );
+
+    if ( found ) {
+        // Messages from FormatMessage() end with a newline.
+        while ( !text.empty() && ( '\n' == text.back() || '\r' == text.back() ) ) {
+            text.pop_back();
+        }
+    } else {
+        char buffer[32];
+        sprintf_s( buffer, "Error %d", ( HRESULT_FACILITY(code) == FACILITY_WIN32 ) ? ( code & 0x0000FFFF ) : code );
+        text = buffer;
+    }
+
+    // Entries are never removed, so the text stays put even when the map rehashes.
+    return s_errorTextCache.insert( std::make_pair( code, text ) ).first->second.c_str();
+} // const char* ErrorText( DWORD code )
+
+void ErrorTextAddProvider( __in ErrorMessageProvider* provider )
+{
+    std::lock_guard<std::mutex> lock( s_errorTextLock );
+    s_addedProviders.push_back( provider );
+}
+
+void ErrorTextRelease()
+{
+    std::lock_guard<std::mutex> lock( s_errorTextLock );
+    s_systemProvider.Release();
+}
+
+const char* ConfigRetName( __in DWORD status )
+{
+    for ( size_t i = 0; i < _countof( s_configRetNames ); ++i ) {
+        if ( status == s_configRetNames[i].status ) {
+            return s_configRetNames[i].name;
+        }
+    }
+    return "CR_UNKNOWN";
+} // const char* ConfigRetName( DWORD status )
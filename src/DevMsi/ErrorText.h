@@ -0,0 +1,66 @@
+/**
+ * Header file for looking up the text of error codes.
+ */
+#pragma once
+#include <string>
+
+/**
+ * A source of error message text.
+ *
+ * Providers are asked in turn by ErrorText() until one knows the code.
+ */
+class ErrorMessageProvider {
+public:
+    virtual ~ErrorMessageProvider() {}
+
+    /**
+     * Look up the text of an error code.
+     *
+     * @param code The error code, either an HRESULT or a Win32 error code.
+     * @param text Set to the message text.  Only set if the code is known.
+     * @return Returns true if the code is known.
+     */
+    virtual bool Lookup( __in DWORD code, __out std::string& text ) = 0;
+};
+
+/**
+ * Return the text of an error code.
+ *
+ * By default, the code is looked up with FormatMessage() (in the system
+ * message table, or in MQUTIL.DLL or NETMSG.DLL for MSMQ and network
+ * errors), and then in a table of common Win32, SetupAPI and service
+ * control errors built into the DLL.  Unknown codes are "Error <code>".
+ *
+ * The text is cached, so a failure that is logged over and over is
+ * only looked up once.  The message DLLs are loaded on first use and
+ * kept until ErrorTextRelease().
+ *
+ * @param code The error code, either an HRESULT or a Win32 error code.
+ * @return Returns the message text, without a trailing newline.  The
+ *         pointer remains valid for the life of the process.
+ */
+const char* ErrorText( __in DWORD code );
+
+/**
+ * Add a provider to be asked before the default ones.
+ *
+ * The provider is owned by the error text code from then on.  Codes
+ * that have already been looked up are not looked up again, so
+ * providers should be added before anything is logged.
+ *
+ * @param provider The provider to be added.
+ */
+void ErrorTextAddProvider( __in ErrorMessageProvider* provider );
+
+/**
+ * Unload any message DLLs loaded by ErrorText().  Cached text is kept.
+ */
+void ErrorTextRelease();
+
+/**
+ * Return the name of a configuration manager result, e.g. "CR_NO_SUCH_DEVNODE".
+ *
+ * @param status The CONFIGRET returned by a CM_xxx() function.
+ * @return Returns the name, or "CR_UNKNOWN" if the value is not known.
+ */
+const char* ConfigRetName( __in DWORD status );
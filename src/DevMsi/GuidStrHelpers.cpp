@@ -1,46 +1,162 @@
 #include "stdafx.h"
 #include "AutoClose.h"
 #include "CheckResult.h"
+#include "ciwstring.h"
 #include <string>
-#include <Objbase.h>
 #include <vector>
+#include <unordered_map>
+#include <mutex>
 #include <SetupAPI.h>
 #include <cfgmgr32.h>
 
 
+/**
+ * The value of each hex digit, indexed by character.  Characters that
+ * are not hex digits map to -1.
+ */
+static const signed char s_hexValue[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+//* Upper-case hex digits, indexed by value.
+static const wchar_t s_hexDigit[] = L"0123456789ABCDEF";
+
+/**
+ * The offset within "{XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX}" of each byte
+ * of a GUID, in memory order once Data1, Data2 and Data3 are treated as
+ * big-endian numbers.
+ */
+static const unsigned char s_guidByteOffset[16] = {
+    1, 3, 5, 7, 10, 12, 15, 17, 20, 22, 25, 27, 29, 31, 33, 35
+};
+
+//* The length of a GUID string with braces, not counting the terminator.
+static const size_t GUID_STRING_LENGTH = 38;
+
+/**
+ * Convert two hex digits to a byte.
+ *
+ * @param text The two digits to be converted.
+ * @param value The byte value.
+ * @return Returns false if either character is not a hex digit.
+ */
+static bool HexByte( __in const wchar_t* text, __out unsigned char& value ) {
+    if ( text[0] > 0xFF || text[1] > 0xFF ) {
+        return false;
+    }
+    int high = s_hexValue[ text[0] ];
+    int low = s_hexValue[ text[1] ];
+    if ( high < 0 || low < 0 ) {
+        return false;
+    }
+    value = static_cast<unsigned char>( ( high << 4 ) | low );
+    return true;
+}
+
 std::wstring GUID2Str( __in const GUID&  source )
 {
-    const int bufferSize(40);
-    wchar_t buffer[bufferSize]; // should be more than large enough.
-    ZeroMemory(buffer, sizeof(buffer) );
+    wchar_t buffer[GUID_STRING_LENGTH + 1];
+    unsigned char bytes[16] = {
+        static_cast<unsigned char>( source.Data1 >> 24 ), static_cast<unsigned char>( source.Data1 >> 16 ),
+        static_cast<unsigned char>( source.Data1 >> 8 ), static_cast<unsigned char>( source.Data1 ),
+        static_cast<unsigned char>( source.Data2 >> 8 ), static_cast<unsigned char>( source.Data2 ),
+        static_cast<unsigned char>( source.Data3 >> 8 ), static_cast<unsigned char>( source.Data3 ),
+        source.Data4[0], source.Data4[1], source.Data4[2], source.Data4[3],
+        source.Data4[4], source.Data4[5], source.Data4[6], source.Data4[7]
+    };
+
+    buffer[0] = L'{';
+    buffer[9] = buffer[14] = buffer[19] = buffer[24] = L'-';
+    buffer[37] = L'}';
+    buffer[38] = L'\0';
+    for ( int i = 0; i < 16; ++i ) {
+        buffer[ s_guidByteOffset[i] ] = s_hexDigit[ bytes[i] >> 4 ];
+        buffer[ s_guidByteOffset[i] + 1 ] = s_hexDigit[ bytes[i] & 0x0F ];
+    }
+    return std::wstring( buffer, GUID_STRING_LENGTH );
+}
+
+bool TryStr2GUID( __in const std::wstring& source, __out GUID& dest )
+{
+    if ( GUID_STRING_LENGTH != source.length()
+        || L'{' != source[0]
+        || L'-' != source[9] 
+        || L'-' != source[14] 
+        || L'-' != source[19] 
+        || L'-' != source[24] 
+        || L'}' != source[37]
+        ) {
+        return false;
+    }
+
+    unsigned char bytes[16];
+    for ( int i = 0; i < 16; ++i ) {
+        if ( !HexByte( &source[ s_guidByteOffset[i] ], bytes[i] ) ) {
+            return false;
+        }
+    }
 
-    int len = StringFromGUID2( source, buffer, bufferSize );
-    if ( 0 == len ) {
-        CheckResult( E_FAIL, "GUID2Str() reported buffer too small.");
+    dest.Data1 = ( static_cast<unsigned long>( bytes[0] ) << 24 ) | ( static_cast<unsigned long>( bytes[1] ) << 16 )
+        | ( static_cast<unsigned long>( bytes[2] ) << 8 ) | bytes[3];
+    dest.Data2 = static_cast<unsigned short>( ( bytes[4] << 8 ) | bytes[5] );
+    dest.Data3 = static_cast<unsigned short>( ( bytes[6] << 8 ) | bytes[7] );
+    for ( int i = 0; i < 8; ++i ) {
+        dest.Data4[i] = bytes[8 + i];
     }
-    return buffer;
+    return true;
 }
 
 GUID Str2GUID( __in const std::wstring&  source )
 {
     GUID dest;
-    static_assert( sizeof( GUID ) == sizeof( CLSID ), "GUID is not the samesize as a CLSID" );
-    HRESULT hr = CLSIDFromString(source.c_str(), (LPCLSID)&dest);
-    if ( FAILED( hr ) ) {
-        LogResult(hr, "CLSIDFromString(%ls) Failed.", source.c_str());
+    if ( !TryStr2GUID( source, dest ) ) {
+        HRESULT hr = E_INVALIDARG;
+        LogResult(hr, "Str2GUID(%ls) Failed, not a GUID.", source.c_str());
         throw hr;
     }
     return dest;
 }
 
-GUID ClassName2GUID( __in const std::wstring& ClassName ) {
+/**
+ * A process-wide index of setup class names to class GUIDs.
+ */
+typedef std::unordered_map<ci_wstring, GUID, ci_wstring_hash> ClassNameIndex;
 
-    GUID ClassGUID = GUID_NULL;
-    HRESULT hr = E_FAIL;
+static ClassNameIndex s_classNameIndex;
+static bool s_classNameIndexValid = false;
+static std::mutex s_classNameIndexLock;
 
-    if ( ClassName.empty() ) {
-        throw std::runtime_error( "Unable to convert empty string from class name to GUID" );
-    }
+/**
+ * Build the class name index from the registry.
+ *
+ * Walks every subkey of HKLM\SYSTEM\CurrentControlSet\Control\Class once
+ * and records the "Class" value of each one against the GUID named by
+ * the subkey.  Subkeys that cannot be read or that are not named by a
+ * GUID are skipped.
+ *
+ * An exception will be thrown if the Class key cannot be enumerated.
+ *
+ * @param index The index to be filled.  It will be cleared prior to use.
+ */
+static void BuildClassNameIndex( __out ClassNameIndex& index ) {
+
+    HRESULT hr = S_OK;
+    index.clear();
 
     AutoCloseHKey hKeyClass, hKey;
     LONG lResult = RegOpenKeyEx( HKEY_LOCAL_MACHINE, TEXT("SYSTEM\\CurrentControlSet\\Control\\Class"), 
@@ -54,19 +170,16 @@ GUID ClassName2GUID( __in const std::wstring& ClassName ) {
 
     wchar_t buffer[MAX_PATH];
     DWORD bufferSize = 0;
-    for ( DWORD i = 0; FAILED(hr); ++i ) {
+    for ( DWORD i = 0; ; ++i ) {
 
         bufferSize = MAX_PATH; // size of subkeyName in characters (not bytes)
         lResult = RegEnumKeyExW( hKeyClass, i, buffer, &bufferSize, NULL, NULL, NULL, NULL );
-        if ( ERROR_SUCCESS != lResult ) {
+        if ( ERROR_NO_MORE_ITEMS == lResult ) {
+            break;
+        } else if ( ERROR_SUCCESS != lResult ) {
             hr = HRESULT_FROM_WIN32( lResult );
-            if ( ERROR_NO_MORE_ITEMS == lResult ) {
-                LogResult( hr, "Class name not found in registry." );
-                throw hr;
-            } else {
-                LogResult( hr, "RegEnumKeyEx() Failed." );
-                throw hr;
-            }
+            LogResult( hr, "RegEnumKeyEx() Failed." );
+            throw hr;
         }
 
         lResult = RegOpenKeyExW( hKeyClass, buffer, 0, KEY_QUERY_VALUE, hKey );
@@ -75,43 +188,166 @@ GUID ClassName2GUID( __in const std::wstring& ClassName ) {
             LogResult( hr, "Registry key '%ls' could not be opened.", buffer );
         } else {
             wchar_t classBuffer[MAX_PATH];
-            DWORD classSize = sizeof(classBuffer); // size in bytes (not characters)
+            DWORD classSize = sizeof(classBuffer) - sizeof(wchar_t); // size in bytes (not characters)
             DWORD dataType = REG_SZ;
 
+            ZeroMemory( classBuffer, sizeof(classBuffer) );
             lResult = RegQueryValueExW( hKey, L"Class", NULL, &dataType,
                 (LPBYTE)classBuffer, &classSize );
-            if ( ERROR_SUCCESS == lResult 
-                && REG_SZ == dataType
-                && 0 == _wcsicmp( classBuffer, ClassName.c_str() ) 
-                ) {
-                    try
-                    {
-                        ClassGUID = Str2GUID( buffer );
-                        hr = S_OK;
-                    }
-                    catch( HRESULT err)
-                    {
-                        hr = err;
-                    }
+            if ( ERROR_SUCCESS == lResult && REG_SZ == dataType && L'\0' != classBuffer[0] ) {
+                GUID classGuid;
+                if ( TryStr2GUID( buffer, classGuid ) ) {
+                    index[ classBuffer ] = classGuid;
+                }
             }
             hKey.Close();
         }
 
     } // FOR loop incrementing i.
 
-    if ( FAILED( hr ) ) {
-        LogResult( hr, "Unable to find class GUID by name" );
+    LogResult( S_OK, "Indexed %u setup class name(s) from the registry.", static_cast<DWORD>( index.size() ) );
+} // BuildClassNameIndex
+
+GUID ClassName2GUID( __in const std::wstring& ClassName ) {
+
+    if ( ClassName.empty() ) {
+        throw std::runtime_error( "Unable to convert empty string from class name to GUID" );
     }
-    return ClassGUID;
+
+    ci_wstring key( ClassName.c_str(), ClassName.size() );
+    std::lock_guard<std::mutex> lock( s_classNameIndexLock );
+
+    // The index is built on first use and kept for the life of the
+    // process.  A miss may mean a class was installed since the index
+    // was built, so it is rebuilt once before giving up.
+    bool rebuilt = false;
+    if ( !s_classNameIndexValid ) {
+        BuildClassNameIndex( s_classNameIndex );
+        s_classNameIndexValid = true;
+        rebuilt = true;
+    }
+
+    ClassNameIndex::const_iterator iter = s_classNameIndex.find( key );
+    if ( s_classNameIndex.end() == iter && !rebuilt ) {
+        s_classNameIndexValid = false;
+        BuildClassNameIndex( s_classNameIndex );
+        s_classNameIndexValid = true;
+        iter = s_classNameIndex.find( key );
+    }
+
+    if ( s_classNameIndex.end() == iter ) {
+        HRESULT hr = HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS );
+        LogResult( hr, "Class name '%ls' not found in registry.", ClassName.c_str() );
+        throw hr;
+    }
+    return iter->second;
 } // ClassName2GUID
 
-GUID Inf2ClassGUID( __inout std::wstring& pathName, __out std::wstring& classStr ) {
+/**
+ * A setup class that is built into Windows.
+ */
+struct WellKnownClass {
+    const wchar_t* name;    //*< The class name, as spelled by Windows
+    GUID guid;              //*< The class GUID
+};
+
+/**
+ * The system-defined device setup classes.
+ *
+ * This table MUST stay sorted by name, case-insensitively, for the
+ * binary search in WellKnownClassName2GUID().
+ */
+static const WellKnownClass s_wellKnownClasses[] = {
+    { L"1394",                 { 0x6bdd1fc1, 0x810f, 0x11d0, { 0xbe, 0xc7, 0x08, 0x00, 0x2b, 0xe2, 0x09, 0x2f } } },
+    { L"1394Debug",            { 0x66f250d6, 0x7801, 0x4a64, { 0xb1, 0x39, 0xee, 0xa8, 0x0a, 0x45, 0x0b, 0x24 } } },
+    { L"61883",                { 0x7ebefbc0, 0x3200, 0x11d2, { 0xb4, 0xc2, 0x00, 0xa0, 0xc9, 0x69, 0x7d, 0x07 } } },
+    { L"Adapter",              { 0x4d36e964, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"AVC",                  { 0xc06ff265, 0xae09, 0x48f0, { 0x81, 0x2c, 0x16, 0x75, 0x3d, 0x7c, 0xba, 0x83 } } },
+    { L"Battery",              { 0x72631e54, 0x78a4, 0x11d0, { 0xbc, 0xf7, 0x00, 0xaa, 0x00, 0xb7, 0xb3, 0x2a } } },
+    { L"Biometric",            { 0x53d29ef7, 0x377c, 0x4d14, { 0x86, 0x4b, 0xeb, 0x3a, 0x85, 0x76, 0x93, 0x59 } } },
+    { L"Bluetooth",            { 0xe0cbf06c, 0xcd8b, 0x4647, { 0xbb, 0x8a, 0x26, 0x3b, 0x43, 0xf0, 0xf9, 0x74 } } },
+    { L"CDROM",                { 0x4d36e965, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Computer",             { 0x4d36e966, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Decoder",              { 0x6bdd1fc2, 0x810f, 0x11d0, { 0xbe, 0xc7, 0x08, 0x00, 0x2b, 0xe2, 0x09, 0x2f } } },
+    { L"DiskDrive",            { 0x4d36e967, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Display",              { 0x4d36e968, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Dot4",                 { 0x48721b56, 0x6795, 0x11d2, { 0xb1, 0xa8, 0x00, 0x80, 0xc7, 0x2e, 0x74, 0xa2 } } },
+    { L"Dot4Print",            { 0x49ce6ac8, 0x6f86, 0x11d2, { 0xb1, 0xe5, 0x00, 0x80, 0xc7, 0x2e, 0x74, 0xa2 } } },
+    { L"Enum1394",             { 0xc459df55, 0xdb08, 0x11d1, { 0xb0, 0x09, 0x00, 0xa0, 0xc9, 0x08, 0x1f, 0xf6 } } },
+    { L"Extension",            { 0xe2f84ce7, 0x8efa, 0x411c, { 0xaa, 0x69, 0x97, 0x45, 0x4c, 0xa4, 0xcb, 0x57 } } },
+    { L"FDC",                  { 0x4d36e969, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"FloppyDisk",           { 0x4d36e980, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"GPS",                  { 0x6bdd1fc3, 0x810f, 0x11d0, { 0xbe, 0xc7, 0x08, 0x00, 0x2b, 0xe2, 0x09, 0x2f } } },
+    { L"HDC",                  { 0x4d36e96a, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"HIDClass",             { 0x745a17a0, 0x74d3, 0x11d0, { 0xb6, 0xfe, 0x00, 0xa0, 0xc9, 0x0f, 0x57, 0xda } } },
+    { L"Image",                { 0x6bdd1fc6, 0x810f, 0x11d0, { 0xbe, 0xc7, 0x08, 0x00, 0x2b, 0xe2, 0x09, 0x2f } } },
+    { L"Infrared",             { 0x6bdd1fc5, 0x810f, 0x11d0, { 0xbe, 0xc7, 0x08, 0x00, 0x2b, 0xe2, 0x09, 0x2f } } },
+    { L"Keyboard",             { 0x4d36e96b, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"LegacyDriver",         { 0x8ecc055d, 0x047f, 0x11d1, { 0xa5, 0x37, 0x00, 0x00, 0xf8, 0x75, 0x3e, 0xd1 } } },
+    { L"Media",                { 0x4d36e96c, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"MediumChanger",        { 0xce5939ae, 0xebde, 0x11d0, { 0xb1, 0x81, 0x00, 0x00, 0xf8, 0x75, 0x3e, 0xc4 } } },
+    { L"Modem",                { 0x4d36e96d, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Monitor",              { 0x4d36e96e, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Mouse",                { 0x4d36e96f, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"MTD",                  { 0x4d36e970, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Multifunction",        { 0x4d36e971, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"MultiportSerial",      { 0x50906cb8, 0xba12, 0x11d1, { 0xbf, 0x5d, 0x00, 0x00, 0xf8, 0x05, 0xf5, 0x30 } } },
+    { L"Net",                  { 0x4d36e972, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"NetClient",            { 0x4d36e973, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"NetService",           { 0x4d36e974, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"NetTrans",             { 0x4d36e975, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"NoDriver",             { 0x4d36e976, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"PCMCIA",               { 0x4d36e977, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"PNPPrinters",          { 0x4658ee7e, 0xf050, 0x11d1, { 0xb6, 0xbd, 0x00, 0xc0, 0x4f, 0xa3, 0x72, 0xa7 } } },
+    { L"Ports",                { 0x4d36e978, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Printer",              { 0x4d36e979, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"PrinterUpgrade",       { 0x4d36e97a, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Processor",            { 0x50127dc3, 0x0f36, 0x415e, { 0xa6, 0xcc, 0x4c, 0xb3, 0xbe, 0x91, 0x0b, 0x65 } } },
+    { L"SCSIAdapter",          { 0x4d36e97b, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"SecurityAccelerator",  { 0x268c95a1, 0xedfe, 0x11d3, { 0x95, 0xc3, 0x00, 0x10, 0xdc, 0x40, 0x50, 0xa5 } } },
+    { L"Sensor",               { 0x5175d334, 0xc371, 0x4806, { 0xb3, 0xba, 0x71, 0xfd, 0x53, 0xc9, 0x25, 0x8d } } },
+    { L"SideShow",             { 0x997b5d8d, 0xc442, 0x4f2e, { 0xba, 0xf3, 0x9c, 0x8e, 0x67, 0x1e, 0x9e, 0x21 } } },
+    { L"SmartCardReader",      { 0x50dd5230, 0xba8a, 0x11d1, { 0xbf, 0x5d, 0x00, 0x00, 0xf8, 0x05, 0xf5, 0x30 } } },
+    { L"SoftwareComponent",    { 0x5c4c3332, 0x344d, 0x483c, { 0x87, 0x39, 0x25, 0x9e, 0x93, 0x4c, 0x9c, 0xc8 } } },
+    { L"SoftwareDevice",       { 0x62f9c741, 0xb25a, 0x46ce, { 0xb5, 0x4c, 0x9b, 0xcc, 0xce, 0x08, 0xb6, 0xf2 } } },
+    { L"Sound",                { 0x4d36e97c, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"System",               { 0x4d36e97d, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"TapeDrive",            { 0x6d807884, 0x7d21, 0x11cf, { 0x80, 0x1c, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"Unknown",              { 0x4d36e97e, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } } },
+    { L"USB",                  { 0x36fc9e60, 0xc465, 0x11cf, { 0x80, 0x56, 0x44, 0x45, 0x53, 0x54, 0x00, 0x00 } } },
+    { L"USBDevice",            { 0x88bae032, 0x5a81, 0x49f0, { 0xbc, 0x3d, 0xa4, 0xff, 0x13, 0x82, 0x16, 0xd6 } } },
+    { L"Volume",               { 0x71a27cdd, 0x812a, 0x11d0, { 0xbe, 0xc7, 0x08, 0x00, 0x2b, 0xe2, 0x09, 0x2f } } },
+    { L"VolumeSnapshot",       { 0x533c5b84, 0xec70, 0x11d2, { 0x95, 0x05, 0x00, 0xc0, 0x4f, 0x79, 0xde, 0xaf } } },
+    { L"WCEUSBS",              { 0x25dbce51, 0x6c8f, 0x4a72, { 0x8a, 0x6d, 0xb5, 0x4c, 0x2b, 0x4f, 0xc8, 0x35 } } },
+    { L"WPD",                  { 0xeec5ad98, 0x8080, 0x425f, { 0x92, 0x2a, 0xda, 0xbf, 0x3d, 0xe3, 0xf6, 0x9a } } }
+};
+
+bool WellKnownClassName2GUID( __in const std::wstring& ClassName, __out GUID& ClassGUID, __out const wchar_t** CanonicalName ) {
+
+    size_t low = 0;
+    size_t high = _countof( s_wellKnownClasses );
+    while ( low < high ) {
+        size_t mid = low + ( high - low ) / 2;
+        int order = _wcsicmp( ClassName.c_str(), s_wellKnownClasses[mid].name );
+        if ( 0 == order ) {
+            ClassGUID = s_wellKnownClasses[mid].guid;
+            if ( NULL != CanonicalName ) {
+                *CanonicalName = s_wellKnownClasses[mid].name;
+            }
+            return true;
+        } else if ( order < 0 ) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return false;
+} // WellKnownClassName2GUID
+
+std::wstring FullPathName( __in const std::wstring& pathName ) {
 
-    GUID ClassGUID;
-    wchar_t ClassName[1+MAX_CLASS_NAME_LEN];
     std::vector< wchar_t > InfPath( 0 );
     DWORD pathSize = MAX_PATH;
-    ClassName[MAX_CLASS_NAME_LEN] = L'\0';
 
     while ( pathSize > InfPath.size() ) {
 
@@ -126,17 +362,28 @@ GUID Inf2ClassGUID( __inout std::wstring& pathName, __out std::wstring& classStr
         }
     }
 
+    return &InfPath[0];
+
+} // std::wstring FullPathName( const std::wstring& pathName )
+
+GUID Inf2ClassGUID( __inout std::wstring& pathName, __out std::wstring& classStr ) {
+
+    GUID ClassGUID;
+    wchar_t ClassName[1+MAX_CLASS_NAME_LEN];
+    std::wstring InfPath( FullPathName( pathName ) );
+    ClassName[MAX_CLASS_NAME_LEN] = L'\0';
+
     //
     // Use the INF File to extract the Class GUID.
     //
-    if (!SetupDiGetINFClassW(&InfPath[0],&ClassGUID,ClassName,sizeof(ClassName)/sizeof(ClassName[0]),0))
+    if (!SetupDiGetINFClassW(InfPath.c_str(),&ClassGUID,ClassName,sizeof(ClassName)/sizeof(ClassName[0]),0))
     {
         HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
-        LogResult( hr, "SetupDiGetINFClass('%ls') Failed", &InfPath[0] );
+        LogResult( hr, "SetupDiGetINFClass('%ls') Failed", InfPath.c_str() );
         throw hr;
     }
 
-    pathName = &InfPath[0];
+    pathName = InfPath;
     classStr = ClassName;
     return ClassGUID;
 
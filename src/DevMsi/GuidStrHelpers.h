@@ -8,6 +8,9 @@
  * to find the GUID associated with the setup class.  The search will
  * be case-insensitive:  "System" is the same as "system".
  *
+ * The registry is read once per process into an index of class names.
+ * The index is only rebuilt when a class name is not found in it.
+ *
  * An exception will be thrown on error.
  *
  * @param ClassName The setup class name to be searched for (e.g. "system")
@@ -16,19 +19,51 @@
 GUID ClassName2GUID( __in const std::wstring& ClassName );
 
 
+/**
+ * Convert a built-in Windows setup class name to a GUID, without
+ * touching the registry.
+ *
+ * The class name is looked up in a static table of the system-defined
+ * device setup classes (e.g. "System", "Net", "USB", "HIDClass").  The
+ * search is case-insensitive.  Custom classes are not in the table; use
+ * ClassName2GUID() for those.
+ *
+ * @param ClassName The setup class name to be searched for (e.g. "system")
+ * @param ClassGUID The class GUID.  It is only set if the class is found.
+ * @param CanonicalName If not NULL, set to the class name as spelled by
+ *                      Windows (e.g. "System").  It is only set if the class is found.
+ * @return Returns true if the class is a built-in class.
+ */
+bool WellKnownClassName2GUID( __in const std::wstring& ClassName, __out GUID& ClassGUID, __out const wchar_t** CanonicalName );
+
+
 /**
  * Convert a GUID to a string.
  *
- * An exception will be thrown on error.
+ * The string is formatted with braces and upper-case hex digits,
+ * as StringFromGUID2() would.
  *
  * @param source The GUID to be converted (e.g. {BDD12CB1-D607-4A2A-82B5-F200B4FFAEF4})
  * @return Returns the data in string format.
  */
 std::wstring GUID2Str( __in const GUID&  source );
 
+/**
+ * Convert a string to a GUID, if it is one.
+ *
+ * The string must be exactly of the form "{XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX}",
+ * where every X is a hex digit in either case.
+ *
+ * @param source The string to be converted.
+ * @param dest The GUID.  It is only set if the conversion succeeds.
+ * @return Returns false if the string is not a GUID.
+ */
+bool TryStr2GUID( __in const std::wstring& source, __out GUID& dest );
+
 /**
  * Convert a string to a GUID.
  *
+ * The string must be in the form accepted by TryStr2GUID().
  * An exception will be thrown on error.
  *
  * @param source The string to be converted (e.g. "{BDD12CB1-D607-4A2A-82B5-F200B4FFAEF4}")
@@ -36,6 +71,16 @@ std::wstring GUID2Str( __in const GUID&  source );
  */
 GUID Str2GUID( __in const std::wstring&  source );
 
+/**
+ * Return the full path of a file.
+ *
+ * An exception will be thrown on error.
+ *
+ * @param pathName The path, which may be relative.
+ * @return Returns the full path.
+ */
+std::wstring FullPathName( __in const std::wstring& pathName );
+
 /**
  * Extracts the class GUID and string from an INF file.
  *
@@ -0,0 +1,158 @@
+#include "stdafx.h"
+#include "HwIdPattern.h"
+#include "ciwstring.h"
+#include <algorithm>
+
+HwIdPatternSet::HwIdPatternSet() : m_nodes( 1 ), m_patterns( 0 ) {
+    m_nodes[0].any = 0;
+    m_nodes[0].star = 0;
+    m_nodes[0].loops = false;
+}
+
+bool HwIdPatternSet::IsPattern( __in const wchar_t* text ) {
+    return NULL != wcspbrk( text, L"*?" );
+}
+
+std::wstring HwIdPatternSet::LiteralPrefix( __in const wchar_t* pattern ) {
+    return std::wstring( pattern, wcscspn( pattern, L"*?" ) );
+}
+
+DWORD HwIdPatternSet::Child( __in DWORD node, __in wchar_t c ) const {
+
+    // Literal edges are few per node, except near the root of a large
+    // set, so a binary search keeps the walk cheap either way.
+    const std::vector<Edge>& edges = m_nodes[node].edges;
+    size_t low = 0, high = edges.size();
+    while ( low < high ) {
+        size_t middle = low + ( high - low ) / 2;
+        if ( edges[middle].c < c ) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return ( low < edges.size() && edges[low].c == c ) ? edges[low].node : 0;
+}
+
+DWORD HwIdPatternSet::AddChild( __in DWORD node, __in wchar_t c ) {
+
+    DWORD child = Child( node, c );
+    if ( 0 != child ) {
+        return child;
+    }
+
+    Node added;
+    added.any = 0;
+    added.star = 0;
+    added.loops = false;
+    child = static_cast<DWORD>( m_nodes.size() );
+    m_nodes.push_back( added );
+
+    std::vector<Edge>& edges = m_nodes[node].edges;
+    auto iter = edges.begin();
+    while ( iter != edges.end() && iter->c < c ) {
+        ++iter;
+    }
+    Edge edge = { c, child };
+    edges.insert( iter, edge );
+    return child;
+} // DWORD HwIdPatternSet::AddChild( DWORD node, wchar_t c )
+
+void HwIdPatternSet::Add( __in const wchar_t* pattern, __in size_t slot ) {
+
+    DWORD node = 0;
+    for ( const wchar_t* p = pattern; L'\0' != *p; ++p ) {
+        if ( L'*' == *p ) {
+            // "**" is the same as "*".
+            if ( m_nodes[node].loops ) {
+                continue;
+            }
+            if ( 0 == m_nodes[node].star ) {
+                Node added;
+                added.any = 0;
+                added.star = 0;
+                added.loops = true;
+                m_nodes[node].star = static_cast<DWORD>( m_nodes.size() );
+                m_nodes.push_back( added );
+            }
+            node = m_nodes[node].star;
+        } else if ( L'?' == *p ) {
+            if ( 0 == m_nodes[node].any ) {
+                Node added;
+                added.any = 0;
+                added.star = 0;
+                added.loops = false;
+                m_nodes[node].any = static_cast<DWORD>( m_nodes.size() );
+                m_nodes.push_back( added );
+            }
+            node = m_nodes[node].any;
+        } else {
+            node = AddChild( node, ci_fold( *p ) );
+        }
+    }
+
+    std::vector<size_t>& slots = m_nodes[node].slots;
+    if ( slots.end() == std::find( slots.begin(), slots.end(), slot ) ) {
+        slots.push_back( slot );
+        ++m_patterns;
+    }
+} // void HwIdPatternSet::Add( const wchar_t* pattern, size_t slot )
+
+void HwIdPatternSet::Enter( __in DWORD node, __inout State& state, __inout std::vector<DWORD>& live ) const {
+
+    // A '*' may match no characters, so entering a node also enters the
+    // node its '*' leads to.  That node has no '*' of its own.
+    for ( ; 0 != node && state.m_seen[node] != state.m_generation; node = m_nodes[node].star ) {
+        state.m_seen[node] = state.m_generation;
+        live.push_back( node );
+    }
+}
+
+void HwIdPatternSet::Match( __in const wchar_t* id, __inout State& state, __inout std::vector<size_t>& slots ) const {
+
+    if ( 0 == m_patterns ) {
+        return;
+    }
+    if ( state.m_seen.size() < m_nodes.size() ) {
+        state.m_seen.assign( m_nodes.size(), 0 );
+        state.m_generation = 0;
+    }
+
+    // The root is always live, and is entered by hand since node 0 means "none".
+    state.m_live.clear();
+    state.m_live.push_back( 0 );
+    if ( 0 != m_nodes[0].star ) {
+        state.m_live.push_back( m_nodes[0].star );
+    }
+
+    for ( const wchar_t* p = id; L'\0' != *p && !state.m_live.empty(); ++p ) {
+        const wchar_t c = ci_fold( *p );
+
+        if ( 0 == ++state.m_generation ) {
+            std::fill( state.m_seen.begin(), state.m_seen.end(), 0 );
+            state.m_generation = 1;
+        }
+        state.m_next.clear();
+
+        for ( auto iter = state.m_live.begin(); iter != state.m_live.end(); ++iter ) {
+            const Node& node = m_nodes[*iter];
+            if ( node.loops ) {
+                Enter( *iter, state, state.m_next );
+            }
+            if ( !node.edges.empty() ) {
+                Enter( Child( *iter, c ), state, state.m_next );
+            }
+            Enter( node.any, state, state.m_next );
+        }
+        state.m_live.swap( state.m_next );
+    }
+
+    for ( auto iter = state.m_live.begin(); iter != state.m_live.end(); ++iter ) {
+        const std::vector<size_t>& matched = m_nodes[*iter].slots;
+        for ( auto slot = matched.begin(); slot != matched.end(); ++slot ) {
+            if ( slots.end() == std::find( slots.begin(), slots.end(), *slot ) ) {
+                slots.push_back( *slot );
+            }
+        }
+    }
+} // void HwIdPatternSet::Match( const wchar_t* id, State& state, std::vector<size_t>& slots ) const
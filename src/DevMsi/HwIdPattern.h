@@ -0,0 +1,104 @@
+/**
+ * Header file for matching hardware IDs against many wildcard patterns at once.
+ *
+ * A pattern may contain '*', which matches any run of characters
+ * (including none), and '?', which matches any one character.  Case is
+ * ignored, so "ROOT\OURVENDOR_*" matches every ID that starts with
+ * "root\ourvendor_".
+ *
+ * The patterns are compiled into a trie of folded characters, in which
+ * '*' and '?' are edges of their own.  An ID is matched against every
+ * pattern in one pass:  the set of live trie nodes is advanced one
+ * character at a time, so the cost depends on the length of the ID and
+ * on how many patterns are still live, not on how many were added.
+ */
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * A set of wildcard patterns, each with a caller-defined slot number.
+ */
+class HwIdPatternSet {
+public:
+    /**
+     * Scratch space for Match(), so that matching does not allocate once
+     * it has grown to fit.  Each thread that calls Match() needs its own.
+     */
+    class State {
+    public:
+        State() : m_generation( 0 ) {}
+    private:
+        friend class HwIdPatternSet;
+        std::vector<DWORD> m_live;      //*< The live nodes
+        std::vector<DWORD> m_next;      //*< The nodes live after the next character
+        std::vector<DWORD> m_seen;      //*< The generation in which each node was last made live
+        DWORD m_generation;             //*< The current generation
+    };
+
+    HwIdPatternSet();
+
+    /**
+     * Return true if text contains a wildcard, and so is a pattern
+     * rather than an ID.
+     */
+    static bool IsPattern( __in const wchar_t* text );
+
+    /**
+     * Return the part of a pattern before its first wildcard.  Every ID
+     * that matches the pattern starts with it, ignoring case.
+     */
+    static std::wstring LiteralPrefix( __in const wchar_t* pattern );
+
+    /**
+     * Add a pattern.  Several patterns may share a slot, and adding a
+     * pattern twice with the same slot has no effect.
+     *
+     * @param pattern The pattern.
+     * @param slot The number reported by Match() when the pattern matches.
+     */
+    void Add( __in const wchar_t* pattern, __in size_t slot );
+
+    //* Return true if no patterns have been added.
+    bool Empty() const { return 0 == m_patterns; }
+
+    //* Return the number of patterns added.
+    size_t Size() const { return m_patterns; }
+
+    /**
+     * Match an ID against every pattern.
+     *
+     * @param id The ID.
+     * @param state Scratch space for the match.
+     * @param slots The slots of the patterns that matched.  Slots are
+     *              appended if they are not already present.
+     */
+    void Match( __in const wchar_t* id, __inout State& state, __inout std::vector<size_t>& slots ) const;
+
+private:
+    /**
+     * A literal edge of the trie.
+     */
+    struct Edge {
+        wchar_t c;                  //*< The folded character
+        DWORD node;                 //*< The node it leads to
+    };
+
+    /**
+     * A node of the trie.  Node 0 is the root, so 0 also means "none".
+     */
+    struct Node {
+        std::vector<Edge> edges;    //*< Literal edges, sorted by character
+        DWORD any;                  //*< The node reached by '?', or 0
+        DWORD star;                 //*< The node reached by '*', or 0
+        bool loops;                 //*< True if the node was reached by '*', and so consumes any character
+        std::vector<size_t> slots;  //*< The slots of the patterns that end here
+    };
+
+    DWORD Child( __in DWORD node, __in wchar_t c ) const;
+    DWORD AddChild( __in DWORD node, __in wchar_t c );
+    void Enter( __in DWORD node, __inout State& state, __inout std::vector<DWORD>& live ) const;
+
+    std::vector<Node> m_nodes;      //*< The trie
+    size_t m_patterns;              //*< The number of patterns added
+};
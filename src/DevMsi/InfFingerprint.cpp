@@ -0,0 +1,207 @@
+#include "stdafx.h"
+#include "InfFingerprint.h"
+#include <wincrypt.h>
+#include <vector>
+
+/**
+ * The size of the blocks in which files are hashed.
+ */
+static const DWORD HASH_BLOCK_BYTES = 64 * 1024;
+
+/**
+ * The catalog database directory of the driver signing subsystem, under
+ * the system directory.
+ */
+static const wchar_t CATROOT_DRIVER_DIRECTORY[] = L"\\CatRoot\\{F750E6C3-38EE-11D1-85E5-00C04FC295EE}\\";
+
+/**
+ * Compute the SHA-1 hash of a file, reading it a block at a time.
+ *
+ * @param path The path of the file.
+ * @param hash Set to the hash.
+ * @return Returns S_OK, or the error from reading the file.
+ */
+static HRESULT HashFile( __in const std::wstring& path, __out BYTE hash[INF_FINGERPRINT_HASH_BYTES] )
+{
+    HRESULT hr = S_OK;
+    HCRYPTPROV provider = NULL;
+    HCRYPTHASH sha1 = NULL;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::vector<BYTE> block( HASH_BLOCK_BYTES );
+    DWORD read = 0;
+    DWORD hashBytes = INF_FINGERPRINT_HASH_BYTES;
+
+    if ( !CryptAcquireContextW( &provider, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT )
+        || !CryptCreateHash( provider, CALG_SHA1, 0, 0, &sha1 ) ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        goto LExit;
+    }
+
+    file = CreateFileW( path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if ( INVALID_HANDLE_VALUE == file ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        goto LExit;
+    }
+
+    for ( ;; ) {
+        if ( !ReadFile( file, &block[0], HASH_BLOCK_BYTES, &read, NULL ) ) {
+            hr = HRESULT_FROM_WIN32( GetLastError() );
+            goto LExit;
+        }
+        if ( 0 == read ) {
+            break;
+        }
+        if ( !CryptHashData( sha1, &block[0], read, 0 ) ) {
+            hr = HRESULT_FROM_WIN32( GetLastError() );
+            goto LExit;
+        }
+    }
+
+    if ( !CryptGetHashParam( sha1, HP_HASHVAL, hash, &hashBytes, 0 ) ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+LExit:
+    if ( INVALID_HANDLE_VALUE != file ) {
+        CloseHandle( file );
+    }
+    if ( NULL != sha1 ) {
+        CryptDestroyHash( sha1 );
+    }
+    if ( NULL != provider ) {
+        CryptReleaseContext( provider, 0 );
+    }
+    return hr;
+} // static HRESULT HashFile( const std::wstring& path, BYTE hash[] )
+
+/**
+ * Read a field of the first line with a key in the [Version] section of an INF.
+ *
+ * @return Returns true if the field was read.
+ */
+static bool GetVersionField( __in HINF inf, __in const wchar_t* key, __in DWORD field, __out std::wstring& value )
+{
+    INFCONTEXT context;
+    wchar_t buffer[MAX_PATH];
+    if ( !SetupFindFirstLineW( inf, L"Version", key, &context )
+        || !SetupGetStringFieldW( &context, field, buffer, _countof(buffer), NULL ) ) {
+        return false;
+    }
+    value = buffer;
+    return true;
+}
+
+/**
+ * Return the directory part of a path, including the trailing separator.
+ */
+static std::wstring DirectoryOf( __in const std::wstring& path )
+{
+    size_t separator = path.find_last_of( L"\\/" );
+    return ( std::wstring::npos == separator ) ? std::wstring() : path.substr( 0, separator + 1 );
+}
+
+HRESULT GetPackageFingerprint( __in const wchar_t* infPath, __out InfFingerprint& fingerprint )
+{
+    HRESULT hr = S_OK;
+    std::wstring catalog;
+    std::vector<std::wstring> catalogKeys;
+    SYSTEM_INFO system;
+
+    fingerprint.driverVersion.clear();
+    fingerprint.hasCatalog = false;
+
+    // The package is installed for the native platform, even from a 32-bit
+    // custom action on 64-bit Windows.
+    GetNativeSystemInfo( &system );
+    GetCatalogFileKeys( system.wProcessorArchitecture, catalogKeys );
+
+    HINF inf = SetupOpenInfFileW( infPath, NULL, INF_STYLE_WIN4, NULL );
+    if ( INVALID_HANDLE_VALUE == inf ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        LogResult( hr, "SetupOpenInfFile('%ls') failed.", infPath );
+        return hr;
+    }
+    // DriverVer = mm/dd/yyyy,w.x.y.z
+    GetVersionField( inf, L"DriverVer", 2, fingerprint.driverVersion );
+    for ( auto key = catalogKeys.begin(); !fingerprint.hasCatalog && key != catalogKeys.end(); ++key ) {
+        fingerprint.hasCatalog = GetVersionField( inf, key->c_str(), 1, catalog );
+    }
+    SetupCloseInfFile( inf );
+
+    hr = HashFile( infPath, fingerprint.infHash );
+    if ( FAILED( hr ) ) {
+        LogResult( hr, "Unable to hash '%ls'.", infPath );
+        return hr;
+    }
+    if ( fingerprint.hasCatalog ) {
+        catalog = DirectoryOf( infPath ) + catalog;
+        hr = HashFile( catalog, fingerprint.catalogHash );
+        if ( FAILED( hr ) ) {
+            LogResult( hr, "Unable to hash catalog '%ls'.", catalog.c_str() );
+            return hr;
+        }
+    }
+    return hr;
+} // HRESULT GetPackageFingerprint( const wchar_t* infPath, InfFingerprint& fingerprint )
+
+/**
+ * Read a string value from a registry key.
+ *
+ * @return Returns true if the value was read.
+ */
+static bool GetRegString( __in HKEY key, __in const wchar_t* name, __out std::wstring& value )
+{
+    wchar_t buffer[MAX_PATH + 1];
+    DWORD type = REG_NONE;
+    DWORD size = sizeof(buffer) - sizeof(wchar_t);
+    if ( ERROR_SUCCESS != RegQueryValueExW( key, name, NULL, &type, reinterpret_cast<LPBYTE>( buffer ), &size )
+        || REG_SZ != type ) {
+        return false;
+    }
+    buffer[size / sizeof(wchar_t)] = L'\0';
+    value = buffer;
+    return true;
+}
+
+HRESULT GetInstalledFingerprint( __in HDEVINFO devs, __in SP_DEVINFO_DATA& devInfo, __out InfFingerprint& fingerprint )
+{
+    HRESULT hr = S_OK;
+    std::wstring infName;
+    wchar_t directory[MAX_PATH];
+
+    fingerprint.driverVersion.clear();
+    fingerprint.hasCatalog = false;
+
+    // The driver key exists, and names the INF, only once a driver is installed.
+    HKEY driverKey = SetupDiOpenDevRegKey( devs, &devInfo, DICS_FLAG_GLOBAL, 0, DIREG_DRV, KEY_READ );
+    if ( INVALID_HANDLE_VALUE == driverKey ) {
+        return S_FALSE;
+    }
+    bool installed = GetRegString( driverKey, L"InfPath", infName );
+    GetRegString( driverKey, L"DriverVersion", fingerprint.driverVersion );
+    RegCloseKey( driverKey );
+    if ( !installed ) {
+        return S_FALSE;
+    }
+
+    if ( 0 == GetWindowsDirectoryW( directory, _countof(directory) ) ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        LogResult( hr, "GetWindowsDirectory() failed." );
+        return hr;
+    }
+    std::wstring infPath = std::wstring( directory ) + L"\\INF\\" + infName;
+    hr = HashFile( infPath, fingerprint.infHash );
+    if ( FAILED( hr ) ) {
+        LogResult( hr, "Unable to hash installed INF '%ls'.", infPath.c_str() );
+        return hr;
+    }
+
+    // The catalog is installed under the INF's name.  A package without
+    // one (or an inbox INF, whose catalog is named otherwise) has none here.
+    if ( 0 != GetSystemDirectoryW( directory, _countof(directory) ) ) {
+        std::wstring catalog = std::wstring( directory ) + CATROOT_DRIVER_DIRECTORY
+            + infName.substr( 0, infName.find_last_of( L'.' ) ) + L".cat";
+        fingerprint.hasCatalog = SUCCEEDED( HashFile( catalog, fingerprint.catalogHash ) );
+    }
+    return S_OK;
+} // HRESULT GetInstalledFingerprint( HDEVINFO devs, SP_DEVINFO_DATA& devInfo, InfFingerprint& fingerprint )
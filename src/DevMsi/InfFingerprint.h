@@ -0,0 +1,69 @@
+/**
+ * Header file for fingerprinting driver packages, so that a driver that
+ * is already installed need not be installed again.
+ *
+ * A package's fingerprint is the version from its DriverVer, and SHA-1
+ * hashes of its INF file (which lists the package's files) and of its
+ * catalog (which holds the hashes of those files).  When a package is
+ * installed, Windows keeps a copy of the INF as %windir%\INF\oemNN.inf,
+ * and of the catalog as oemNN.cat in the catalog database, so the
+ * fingerprint of the package installed for a device is computed from
+ * those copies in the same way.
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <SetupAPI.h>
+
+//* The size of a SHA-1 hash.
+#define INF_FINGERPRINT_HASH_BYTES 20
+
+/**
+ * The fingerprint of a driver package.
+ */
+struct InfFingerprint {
+    std::wstring driverVersion;                     //*< The version from DriverVer, e.g. "6.1.7600.16385"
+    BYTE infHash[INF_FINGERPRINT_HASH_BYTES];       //*< The SHA-1 hash of the INF file
+    BYTE catalogHash[INF_FINGERPRINT_HASH_BYTES];   //*< The SHA-1 hash of the catalog, if hasCatalog
+    bool hasCatalog;                                //*< True if the package has a catalog
+};
+
+/**
+ * Compute the fingerprint of a driver package from its INF file.
+ *
+ * Files are hashed a block at a time, rather than read whole.
+ *
+ * @param infPath The full path of the INF file.  The catalog, if the
+ *                INF names one, is in the same directory.
+ * @param fingerprint Set to the fingerprint.
+ * @return Returns S_OK, or the error from reading the files.  The error is also logged.
+ */
+HRESULT GetPackageFingerprint( __in const wchar_t* infPath, __out InfFingerprint& fingerprint );
+
+/**
+ * Compute the fingerprint of the driver package installed for a device.
+ *
+ * @param devs The device information set.
+ * @param devInfo The device.
+ * @param fingerprint Set to the fingerprint.
+ * @return Returns S_OK, S_FALSE if the device has no driver installed,
+ *         or the error from reading the installed files.  The error is also logged.
+ */
+HRESULT GetInstalledFingerprint( __in HDEVINFO devs, __in SP_DEVINFO_DATA& devInfo, __out InfFingerprint& fingerprint );
+
+/**
+ * List the [Version] keys that can name a package's catalog, in the order
+ * Windows looks for them:  CatalogFile.NT<platform> (e.g. CatalogFile.NTamd64),
+ * then CatalogFile.NT, then CatalogFile.
+ *
+ * @param processorArchitecture The platform, as a PROCESSOR_ARCHITECTURE_ value
+ *                              from GetNativeSystemInfo().  An unknown platform
+ *                              has no platform key.
+ * @param keys Set to the keys.
+ */
+void GetCatalogFileKeys( __in WORD processorArchitecture, __out std::vector<std::wstring>& keys );
+
+/**
+ * Return true if two fingerprints are of the same package.
+ */
+bool SameDriverPackage( __in const InfFingerprint& left, __in const InfFingerprint& right );
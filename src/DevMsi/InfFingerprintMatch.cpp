@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include "InfFingerprint.h"
+
+// The comparisons behind driver package fingerprints.  They read nothing
+// from SetupAPI, the registry or the disk, so DevMsiTest can test them alone.
+
+void GetCatalogFileKeys( __in WORD processorArchitecture, __out std::vector<std::wstring>& keys )
+{
+    keys.clear();
+
+    const wchar_t* platform = NULL;
+    switch ( processorArchitecture ) {
+    case PROCESSOR_ARCHITECTURE_INTEL:
+        platform = L"x86";
+        break;
+    case PROCESSOR_ARCHITECTURE_AMD64:
+        platform = L"amd64";
+        break;
+    case PROCESSOR_ARCHITECTURE_IA64:
+        platform = L"ia64";
+        break;
+    case PROCESSOR_ARCHITECTURE_ARM:
+        platform = L"arm";
+        break;
+    }
+
+    if ( NULL != platform ) {
+        keys.push_back( std::wstring( L"CatalogFile.NT" ) + platform );
+    }
+    keys.push_back( L"CatalogFile.NT" );
+    keys.push_back( L"CatalogFile" );
+} // void GetCatalogFileKeys( WORD processorArchitecture, std::vector<std::wstring>& keys )
+
+bool SameDriverPackage( __in const InfFingerprint& left, __in const InfFingerprint& right )
+{
+    return 0 == _wcsicmp( left.driverVersion.c_str(), right.driverVersion.c_str() )
+        && 0 == memcmp( left.infHash, right.infHash, INF_FINGERPRINT_HASH_BYTES )
+        && left.hasCatalog == right.hasCatalog
+        && ( !left.hasCatalog || 0 == memcmp( left.catalogHash, right.catalogHash, INF_FINGERPRINT_HASH_BYTES ) );
+}
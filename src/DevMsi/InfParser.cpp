@@ -0,0 +1,475 @@
+#include "stdafx.h"
+#include "InfParser.h"
+#include "ciwstring.h"
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * The kinds of section read by the first pass.
+ */
+typedef enum {
+    esOther,                //*< A section that is skipped
+    esVersion,              //*< [Version]
+    esManufacturer,         //*< [Manufacturer]
+    esStrings,              //*< [Strings]
+    esLocalizedStrings      //*< [Strings.<locale>]
+} etInfSectionKind;
+
+/**
+ * A section of the INF, as indexed by the first pass.  Offsets are in
+ * characters from the start of the text.
+ */
+struct InfSection {
+    std::wstring name;      //*< The folded section name
+    size_t begin;           //*< The offset of the line after the section header
+    size_t end;             //*< The offset of the next section header, or of the end of the text
+};
+
+/**
+ * The [Strings] keys of an INF, folded, and their values.
+ */
+struct InfStrings {
+    std::unordered_map<std::wstring, std::wstring> base;        //*< From [Strings]
+    std::unordered_map<std::wstring, std::wstring> localized;   //*< From [Strings.<locale>], used if not in [Strings]
+};
+
+//* Return true for the blanks that INF syntax ignores around tokens.
+static inline bool IsBlank( int c ) {
+    return ' ' == c || '\t' == c;
+}
+
+/**
+ * Append text to a string.  UTF-16 text is appended as it is.
+ */
+static void AppendText( __inout std::wstring& out, __in const unsigned short* begin, __in const unsigned short* end, __in UINT ) {
+    for ( ; begin != end; ++begin ) {
+        out.push_back( static_cast<wchar_t>( *begin ) );
+    }
+}
+
+/**
+ * Append text to a string.  ANSI (or UTF-8) text is converted in the given
+ * code page, apart from a leading run of ASCII, which is simply widened.
+ */
+static void AppendText( __inout std::wstring& out, __in const char* begin, __in const char* end, __in UINT codePage ) {
+    for ( ; begin != end && 0 == ( *begin & 0x80 ); ++begin ) {
+        out.push_back( static_cast<wchar_t>( *begin ) );
+    }
+    if ( begin != end ) {
+        int length = MultiByteToWideChar( codePage, 0, begin, static_cast<int>( end - begin ), NULL, 0 );
+        if ( 0 < length ) {
+            size_t at = out.size();
+            out.resize( at + length );
+            MultiByteToWideChar( codePage, 0, begin, static_cast<int>( end - begin ), &out[at], length );
+        }
+    }
+}
+
+/**
+ * Reads lines of INF text in place, in either character type.
+ */
+template <typename Char>
+class InfReader {
+public:
+    InfReader( __in const Char* text, __in size_t length, __in UINT codePage )
+        : m_text( text ), m_length( length ), m_codePage( codePage ) {}
+
+    size_t Length() const { return m_length; }
+
+    //* Return the character at an offset.
+    int At( __in size_t pos ) const { return m_text[pos]; }
+
+    //* Return the offset of the start of the next line.
+    size_t NextLine( __in size_t pos ) const {
+        while ( pos < m_length && '\n' != m_text[pos] ) {
+            ++pos;
+        }
+        return ( pos < m_length ) ? pos + 1 : m_length;
+    }
+
+    //* Return the offset of the first character on the line that is not a blank.
+    size_t SkipBlanks( __in size_t pos ) const {
+        while ( pos < m_length && IsBlank( m_text[pos] ) ) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    /**
+     * Read the name of a section from its header.
+     *
+     * @param pos The offset of the '['.
+     * @param name Set to the name, folded to upper case.
+     * @return Returns the offset of the next line.
+     */
+    size_t ReadSectionName( __in size_t pos, __out std::wstring& name ) const {
+        size_t next = NextLine( pos );
+        size_t end = ++pos;
+        while ( end < next && ']' != m_text[end] && '\n' != m_text[end] ) {
+            ++end;
+        }
+        name.clear();
+        AppendText( name, m_text + pos, m_text + end, m_codePage );
+        for ( auto iter = name.begin(); iter != name.end(); ++iter ) {
+            *iter = ci_fold( *iter );
+        }
+        return next;
+    }
+
+    /**
+     * Read a logical line:  comments are removed, and a line that ends
+     * with a backslash is joined to the next.
+     *
+     * @param pos The offset of the start of the line.
+     * @param line Set to the line, without trailing blanks.
+     * @return Returns the offset of the next line.
+     */
+    size_t ReadLine( __in size_t pos, __out std::wstring& line ) const {
+        line.clear();
+        for ( ;; ) {
+            size_t next = NextLine( pos );
+            size_t stop = pos;
+            bool quoted = false;
+            for ( ; stop < next && '\n' != m_text[stop] && '\r' != m_text[stop]; ++stop ) {
+                if ( '"' == m_text[stop] ) {
+                    quoted = !quoted;
+                } else if ( ';' == m_text[stop] && !quoted ) {
+                    break;
+                }
+            }
+            while ( stop > pos && IsBlank( m_text[stop - 1] ) ) {
+                --stop;
+            }
+            bool continued = stop > pos && '\\' == m_text[stop - 1] && next < m_length;
+            AppendText( line, m_text + pos, m_text + ( continued ? stop - 1 : stop ), m_codePage );
+            if ( !continued ) {
+                return next;
+            }
+            pos = next;
+        }
+    }
+
+private:
+    const Char* m_text;     //*< The text
+    size_t m_length;        //*< The length of the text, in characters
+    UINT m_codePage;        //*< The code page of ANSI text
+};
+
+/**
+ * Remove blanks from both ends of a string.
+ */
+static void TrimBlanks( __inout std::wstring& text ) {
+    size_t end = text.size();
+    while ( end > 0 && IsBlank( text[end - 1] ) ) {
+        --end;
+    }
+    size_t begin = 0;
+    while ( begin < end && IsBlank( text[begin] ) ) {
+        ++begin;
+    }
+    text = text.substr( begin, end - begin );
+}
+
+/**
+ * Split a line into its key (before an '=' that is not quoted) and value.
+ * The key is empty if there is no '='.
+ */
+static void SplitEntry( __in const std::wstring& line, __out std::wstring& key, __out std::wstring& value ) {
+    bool quoted = false;
+    for ( size_t i = 0; i < line.size(); ++i ) {
+        if ( L'"' == line[i] ) {
+            quoted = !quoted;
+        } else if ( L'=' == line[i] && !quoted ) {
+            key = line.substr( 0, i );
+            value = line.substr( i + 1 );
+            TrimBlanks( key );
+            return;
+        }
+    }
+    key.clear();
+    value = line;
+}
+
+/**
+ * Split a value into fields, removing the blanks around each field and
+ * the quotes within it ("" in quotes is a quote).
+ *
+ * @param value The value.
+ * @param commas True to split at commas that are not quoted, false for a single field.
+ * @param fields Set to the fields.
+ */
+static void SplitFields( __in const std::wstring& value, __in bool commas, __out std::vector<std::wstring>& fields ) {
+    fields.clear();
+    std::wstring field;
+    size_t keep = 0;        // the length of the field without trailing blanks
+    bool quoted = false;
+    for ( size_t i = 0; i <= value.size(); ++i ) {
+        if ( i == value.size() || ( commas && !quoted && L',' == value[i] ) ) {
+            field.resize( keep );
+            fields.push_back( field );
+            field.clear();
+            keep = 0;
+            continue;
+        }
+        wchar_t c = value[i];
+        if ( L'"' == c ) {
+            if ( quoted && i + 1 < value.size() && L'"' == value[i + 1] ) {
+                field.push_back( c );
+                keep = field.size();
+                ++i;
+            } else {
+                quoted = !quoted;
+            }
+        } else if ( !quoted && IsBlank( c ) ) {
+            if ( !field.empty() ) {
+                field.push_back( c );
+            }
+        } else {
+            field.push_back( c );
+            keep = field.size();
+        }
+    }
+}
+
+/**
+ * Replace each %strkey% with its value from [Strings], and %% with %.
+ * A key that is not defined is left as it is.
+ */
+static std::wstring Substitute( __in const std::wstring& text, __in const InfStrings& strings ) {
+    size_t percent = text.find( L'%' );
+    if ( std::wstring::npos == percent ) {
+        return text;
+    }
+
+    std::wstring result( text, 0, percent );
+    std::wstring key;
+    while ( std::wstring::npos != percent ) {
+        size_t close = text.find( L'%', percent + 1 );
+        if ( std::wstring::npos == close ) {
+            result.append( text, percent, std::wstring::npos );
+            return result;
+        }
+        if ( close == percent + 1 ) {
+            result.push_back( L'%' );
+        } else {
+            key.assign( text, percent + 1, close - percent - 1 );
+            for ( auto iter = key.begin(); iter != key.end(); ++iter ) {
+                *iter = ci_fold( *iter );
+            }
+            auto found = strings.base.find( key );
+            if ( strings.base.end() != found ) {
+                result.append( found->second );
+            } else if ( strings.localized.end() != ( found = strings.localized.find( key ) ) ) {
+                result.append( found->second );
+            } else {
+                result.append( text, percent, close - percent + 1 );
+            }
+        }
+        percent = text.find( L'%', close + 1 );
+        result.append( text, close + 1, ( std::wstring::npos == percent ? text.size() : percent ) - close - 1 );
+    }
+    return result;
+} // static std::wstring Substitute( const std::wstring& text, const InfStrings& strings )
+
+/**
+ * Read INF text in either character type.
+ */
+template <typename Char>
+static void ParseInf( __in const InfReader<Char>& reader, __out InfSummary& summary ) {
+
+    std::vector<InfSection> sections;
+    InfStrings strings;
+    std::vector<std::vector<std::wstring> > manufacturers;
+    std::vector<std::wstring> classFields, classGuidFields, driverVerFields;
+    std::wstring line, key, value, name;
+    std::vector<std::wstring> fields;
+    etInfSectionKind kind = esOther;
+
+    summary.className.clear();
+    summary.classGuid.clear();
+    summary.driverVer.clear();
+    summary.hardwareIds.clear();
+
+    // The one pass over the whole file:  index every section, and read
+    // the sections that everything else depends on.  [Strings] is usually
+    // last, so substitution waits until the pass is over.
+    for ( size_t pos = 0; pos < reader.Length(); ) {
+        size_t start = reader.SkipBlanks( pos );
+        if ( start < reader.Length() && '[' == reader.At( start ) ) {
+            if ( !sections.empty() ) {
+                sections.back().end = pos;
+            }
+            pos = reader.ReadSectionName( start, name );
+            InfSection section = { name, pos, reader.Length() };
+            sections.push_back( section );
+
+            if ( L"VERSION" == name ) {
+                kind = esVersion;
+            } else if ( L"MANUFACTURER" == name ) {
+                kind = esManufacturer;
+            } else if ( L"STRINGS" == name ) {
+                kind = esStrings;
+            } else if ( 0 == name.compare( 0, 8, L"STRINGS." ) ) {
+                kind = esLocalizedStrings;
+            } else {
+                kind = esOther;
+            }
+            continue;
+        }
+        if ( esOther == kind ) {
+            pos = reader.NextLine( start );
+            continue;
+        }
+
+        pos = reader.ReadLine( start, line );
+        SplitEntry( line, key, value );
+        for ( auto iter = key.begin(); iter != key.end(); ++iter ) {
+            *iter = ci_fold( *iter );
+        }
+        switch ( kind ) {
+        case esVersion:
+            if ( L"CLASS" == key ) {
+                SplitFields( value, true, classFields );
+            } else if ( L"CLASSGUID" == key ) {
+                SplitFields( value, true, classGuidFields );
+            } else if ( L"DRIVERVER" == key ) {
+                SplitFields( value, true, driverVerFields );
+            }
+            break;
+        case esManufacturer:
+            SplitFields( value, true, fields );
+            if ( !fields[0].empty() ) {
+                manufacturers.push_back( fields );
+            }
+            break;
+        case esStrings:
+        case esLocalizedStrings:
+            if ( !key.empty() ) {
+                SplitFields( value, false, fields );
+                ( esStrings == kind ? strings.base : strings.localized ).insert( std::make_pair( key, fields[0] ) );
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    if ( !classFields.empty() ) {
+        summary.className = Substitute( classFields[0], strings );
+    }
+    if ( !classGuidFields.empty() ) {
+        summary.classGuid = Substitute( classGuidFields[0], strings );
+    }
+    for ( auto iter = driverVerFields.begin(); iter != driverVerFields.end(); ++iter ) {
+        if ( iter != driverVerFields.begin() ) {
+            summary.driverVer.push_back( L',' );
+        }
+        summary.driverVer.append( Substitute( *iter, strings ) );
+    }
+
+    // Each manufacturer names a models section, and the target OS
+    // decorations that it also has, e.g. "Models, NTamd64" names both
+    // [Models] and [Models.NTamd64].
+    std::unordered_set<std::wstring> models;
+    for ( auto iter = manufacturers.begin(); iter != manufacturers.end(); ++iter ) {
+        std::wstring base = Substitute( (*iter)[0], strings );
+        for ( auto c = base.begin(); c != base.end(); ++c ) {
+            *c = ci_fold( *c );
+        }
+        models.insert( base );
+        for ( size_t i = 1; i < iter->size(); ++i ) {
+            std::wstring decorated = base + L"." + Substitute( (*iter)[i], strings );
+            for ( auto c = decorated.begin(); c != decorated.end(); ++c ) {
+                *c = ci_fold( *c );
+            }
+            models.insert( decorated );
+        }
+    }
+
+    // Model lines are "description = install-section, hw-id[, compatible-id...]".
+    for ( auto section = sections.begin(); section != sections.end(); ++section ) {
+        if ( models.end() == models.find( section->name ) ) {
+            continue;
+        }
+        for ( size_t pos = section->begin; pos < section->end; ) {
+            pos = reader.ReadLine( reader.SkipBlanks( pos ), line );
+            SplitEntry( line, key, value );
+            if ( key.empty() ) {
+                continue;
+            }
+            SplitFields( value, true, fields );
+            for ( size_t i = 1; i < fields.size(); ++i ) {
+                if ( !fields[i].empty() ) {
+                    summary.hardwareIds.push_back( Substitute( fields[i], strings ) );
+                }
+            }
+        }
+    }
+} // static void ParseInf( const InfReader<Char>& reader, InfSummary& summary )
+
+void ParseInfText( __in const void* data, __in size_t bytes, __out InfSummary& summary )
+{
+    const BYTE* text = static_cast<const BYTE*>( data );
+    if ( 2 <= bytes && 0xFF == text[0] && 0xFE == text[1] ) {
+        InfReader<unsigned short> reader( reinterpret_cast<const unsigned short*>( text + 2 ), ( bytes - 2 ) / 2, 0 );
+        ParseInf( reader, summary );
+    } else if ( 3 <= bytes && 0xEF == text[0] && 0xBB == text[1] && 0xBF == text[2] ) {
+        InfReader<char> reader( reinterpret_cast<const char*>( text + 3 ), bytes - 3, CP_UTF8 );
+        ParseInf( reader, summary );
+    } else {
+        InfReader<char> reader( reinterpret_cast<const char*>( text ), bytes, CP_ACP );
+        ParseInf( reader, summary );
+    }
+}
+
+HRESULT ParseInfFile( __in const wchar_t* path, __out InfSummary& summary )
+{
+    HRESULT hr = S_OK;
+    HANDLE mapping = NULL;
+    const void* view = NULL;
+
+    HANDLE file = CreateFileW( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if ( INVALID_HANDLE_VALUE == file ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        LogResult( hr, "Unable to open INF file '%ls'.", path );
+        return hr;
+    }
+
+    DWORD sizeHigh = 0;
+    DWORD size = GetFileSize( file, &sizeHigh );
+    if ( 0 != sizeHigh ) {
+        hr = HRESULT_FROM_WIN32( ERROR_FILE_TOO_LARGE );
+        LogResult( hr, "INF file '%ls' is too large.", path );
+    } else if ( 0 == size ) {
+        // An empty file cannot be mapped, and has nothing to read.
+        ParseInfText( NULL, 0, summary );
+    } else {
+        mapping = CreateFileMappingW( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if ( NULL != mapping ) {
+            view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+        }
+        if ( NULL == view ) {
+            hr = HRESULT_FROM_WIN32( GetLastError() );
+            LogResult( hr, "Unable to map INF file '%ls'.", path );
+        } else {
+            ParseInfText( view, size, summary );
+            UnmapViewOfFile( view );
+        }
+    }
+
+    if ( NULL != mapping ) {
+        CloseHandle( mapping );
+    }
+    CloseHandle( file );
+    return hr;
+} // HRESULT ParseInfFile( const wchar_t* path, InfSummary& summary )
+
+bool InfListsHardwareId( __in const InfSummary& summary, __in const wchar_t* hwid )
+{
+    for ( auto iter = summary.hardwareIds.begin(); iter != summary.hardwareIds.end(); ++iter ) {
+        if ( 0 == _wcsicmp( iter->c_str(), hwid ) ) {
+            return true;
+        }
+    }
+    return false;
+}
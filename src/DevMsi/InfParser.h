@@ -0,0 +1,47 @@
+/**
+ * Header file for reading what DevMsi needs from an INF file.
+ *
+ * The file is mapped into memory and read in place, as UTF-16 (with a
+ * byte order mark) or ANSI.  One pass over the file indexes its sections
+ * and reads the [Version], [Manufacturer] and [Strings] sections; the
+ * models sections named by [Manufacturer] are then read from the index.
+ * Comments, quoted strings, line continuations and %strkey% substitution
+ * are handled as SetupAPI handles them, for the lines that are read.
+ */
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * What is read from an INF file.  Values are after %strkey% substitution.
+ */
+struct InfSummary {
+    std::wstring className;                 //*< [Version] Class
+    std::wstring classGuid;                 //*< [Version] ClassGuid, as text
+    std::wstring driverVer;                 //*< [Version] DriverVer, e.g. "06/21/2006,6.1.7600.16385"
+    std::vector<std::wstring> hardwareIds;  //*< The hardware and compatible IDs of every model, in file order
+};
+
+/**
+ * Read an INF file.
+ *
+ * @param path The path of the INF file.
+ * @param summary Set to what was read.
+ * @return Returns S_OK, or the error from reading the file.  The error is also logged.
+ */
+HRESULT ParseInfFile( __in const wchar_t* path, __out InfSummary& summary );
+
+/**
+ * Read the text of an INF file, e.g. as mapped by ParseInfFile().
+ *
+ * @param data The text.  UTF-16 text must start with a byte order mark;
+ *             anything else is read as ANSI (or UTF-8, with a byte order mark).
+ * @param bytes The size of the text.
+ * @param summary Set to what was read.
+ */
+void ParseInfText( __in const void* data, __in size_t bytes, __out InfSummary& summary );
+
+/**
+ * Return true if a model of the INF has a hardware or compatible ID, ignoring case.
+ */
+bool InfListsHardwareId( __in const InfSummary& summary, __in const wchar_t* hwid );
@@ -1,77 +1,417 @@
 #include "stdafx.h"
+#include "LogResult.h"
+#include "ErrorText.h"
 #include <stdlib.h>
-#include <lmerr.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <new>
 
 // WiX Header Files:
 #include <wcautil.h>
 #include <strutil.h>
 
 
-//
-// This code modified from MSDN article 256348
-// "How to obtain error message descriptions using the FormatMessage API"
-// Currently found at http://support.microsoft.com/kb/256348/en-us
-
-#define ERRMSGBUFFERSIZE 256
-
 /**
- * Use FormatMessage() to look an error code and log the error text.
+ * Log the text of an error code.
  *
  * @param dwErrorMsgId The error code to be investigated.
  */
 void LogError( DWORD dwErrorMsgId )
 {
-    HLOCAL pBuffer = nullptr;   // Buffer to hold the textual error description.
-    DWORD ret = 0;    // Temp space to hold a return value.
-    HINSTANCE hInst = NULL;  // Instance handle for DLL.
-    BOOL doLookup = TRUE;
-    DWORD dwMessageId = dwErrorMsgId;
-    LPCSTR pMessage = "Error %d";
-    DWORD flags= FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_IGNORE_INSERTS;
-
-    if ( HRESULT_FACILITY(dwErrorMsgId) == FACILITY_MSMQ ) {
-        hInst = LoadLibrary( TEXT("MQUTIL.DLL") );
-        flags |= FORMAT_MESSAGE_FROM_HMODULE;
-        doLookup = ( NULL != hInst );
-    } else if ( dwErrorMsgId >= NERR_BASE && dwErrorMsgId <= MAX_NERR ) {
-        hInst = LoadLibrary( TEXT("NETMSG.DLL") );
-        flags |= FORMAT_MESSAGE_FROM_HMODULE;
-        doLookup = ( NULL != hInst );
-    } else if ( HRESULT_FACILITY(dwErrorMsgId) == FACILITY_WIN32 ) {
-        // A "GetLastError" error, drop the HRESULT_FACILITY
-        dwMessageId &= 0x0000FFFF;
-        flags |= FORMAT_MESSAGE_FROM_SYSTEM;
-    }
-
-    if ( doLookup ) {
-            ret = FormatMessageA( 
-                flags,
-                hInst, // Handle to the DLL.
-                dwMessageId, // Message identifier.
-                MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), // Default language.
-                (LPSTR)&pBuffer, // Buffer that will hold the text string.
-                ERRMSGBUFFERSIZE, // Allocate at least this many chars for pBuffer.
-                NULL // No insert values.
-                );
-    }
-
-    if ( 0 < ret && NULL != pBuffer ) {
-        pMessage = (LPSTR)pBuffer;
-    }
+    // The text is looked up once per code; see ErrorText().
+    const char* pMessage = ErrorText( dwErrorMsgId );
 
     // Display the string.
     if ( WcaIsInitialized() ) {
-        WcaLogError( dwErrorMsgId, pMessage, dwMessageId );
+        WcaLogError( dwErrorMsgId, "%s", pMessage );
     } else { 
         // Log to stdout/stderr
-        fprintf_s( stderr, pMessage, dwMessageId );
-        if ( '\n'!= pMessage[ strlen(pMessage) - 1 ] ) {
-            fprintf_s( stderr, "\n");
+        fprintf_s( stderr, "%s\n", pMessage );
+    }
+}
+
+/**
+ * The sink that has always been used:  the MSI log when running as a
+ * custom action, otherwise stdout/stderr.  Failures are followed by the
+ * text of the error code.
+ */
+class StandardLogSink : public LogSink {
+public:
+    virtual void Write( HRESULT hr, const char* text ) {
+        if ( WcaIsInitialized() )
+        {
+            if ( FAILED( hr ) )
+            {
+                WcaLogError( hr, "%s", text );
+                LogError( hr );
+            }
+            else
+            {
+                WcaLog( LOGMSG_STANDARD, "%s", text );
+            }
+        }
+        else // Log to stdout/stderr
+        {
+            if ( FAILED( hr ) )
+            {
+                fprintf_s( stderr, "%s\n", text );
+                LogError( hr );
+            }
+            else
+            {
+                fprintf_s( stdout, "%s\n", text );
+            }
+        }
+    }
+};
+
+/**
+ * A sink that appends to a text file, rolling the file over to
+ * "<path>.1" ... "<path>.<keep>" when it grows past a size limit.
+ */
+class RotatingFileLogSink : public LogSink {
+public:
+    RotatingFileLogSink( const wchar_t* path, DWORD maxBytes, DWORD keepFiles )
+        : m_path( path ), m_maxBytes( maxBytes ), m_keepFiles( keepFiles ), m_size( 0 ), m_file( INVALID_HANDLE_VALUE ) {
+        Open( OPEN_ALWAYS );
+    }
+    virtual ~RotatingFileLogSink() {
+        Close();
+    }
+
+    virtual void Write( HRESULT hr, const char* text ) {
+        char prefix[32] = "";
+        if ( FAILED( hr ) ) {
+            sprintf_s( prefix, "[0x%08X] ", static_cast<unsigned int>( hr ) );
+        }
+        WriteText( prefix );
+        WriteText( text );
+        WriteText( "\r\n" );
+        if ( m_size >= m_maxBytes ) {
+            Rotate();
+        }
+    }
+
+    virtual void Flush() {
+        if ( INVALID_HANDLE_VALUE != m_file ) {
+            FlushFileBuffers( m_file );
+        }
+    }
+
+private:
+    void Open( DWORD disposition ) {
+        m_file = CreateFileW( m_path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+            disposition, FILE_ATTRIBUTE_NORMAL, NULL );
+        m_size = 0;
+        if ( INVALID_HANDLE_VALUE != m_file ) {
+            m_size = SetFilePointer( m_file, 0, NULL, FILE_END );
+        }
+    }
+
+    void Close() {
+        if ( INVALID_HANDLE_VALUE != m_file ) {
+            CloseHandle( m_file );
+            m_file = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    std::wstring RotatedName( DWORD index ) const {
+        wchar_t suffix[16];
+        swprintf_s( suffix, L".%u", index );
+        return m_path + suffix;
+    }
+
+    void Rotate() {
+        Close();
+        if ( 0 == m_keepFiles ) {
+            DeleteFileW( m_path.c_str() );
+        } else {
+            DeleteFileW( RotatedName( m_keepFiles ).c_str() );
+            for ( DWORD i = m_keepFiles - 1; i > 0; --i ) {
+                MoveFileExW( RotatedName( i ).c_str(), RotatedName( i + 1 ).c_str(), MOVEFILE_REPLACE_EXISTING );
+            }
+            MoveFileExW( m_path.c_str(), RotatedName( 1 ).c_str(), MOVEFILE_REPLACE_EXISTING );
+        }
+        Open( CREATE_ALWAYS );
+    }
+
+    void WriteText( const char* text ) {
+        DWORD length = static_cast<DWORD>( strlen( text ) );
+        DWORD written = 0;
+        if ( INVALID_HANDLE_VALUE != m_file && 0 < length
+            && WriteFile( m_file, text, length, &written, NULL ) ) {
+            m_size += written;
         }
     }
 
-    // Free the buffer.
-    LocalFree( pBuffer );
+    std::wstring m_path;
+    DWORD m_maxBytes;
+    DWORD m_keepFiles;
+    DWORD m_size;
+    HANDLE m_file;
+};
+
+LogSink* CreateRotatingFileLogSink( __in const wchar_t* path, __in DWORD maxBytes, __in DWORD keepFiles )
+{
+    return new RotatingFileLogSink( path, maxBytes, keepFiles );
+}
+
+//* The number of records in the queue.  MUST be a power of two.
+#define LOG_QUEUE_SIZE 256
+
+/**
+ * One slot in the log queue.
+ *
+ * The sequence number says who owns the slot:  it equals the enqueue
+ * position when the slot is free to be written, and the enqueue position
+ * plus one once the record is ready to be read.
+ */
+struct LogRecord {
+    std::atomic<size_t> sequence;
+    HRESULT hr;
+    char* spill;                    //*< The whole message, if it did not fit in text, or NULL
+    char text[LOG_RECORD_TEXT];
+};
+
+/**
+ * The state of the logging pipeline.
+ *
+ * Any number of threads may add records to the queue without taking a
+ * lock (see "Bounded MPMC queue" by Dmitry Vyukov); a single flusher
+ * thread takes them off and hands them to the added sinks.  The standard
+ * sink is always written by the thread that called LogResult(), since
+ * WcaLog() must only be called from the custom action's own threads.
+ */
+static LogRecord s_queue[LOG_QUEUE_SIZE];
+static std::atomic<size_t> s_enqueuePos;
+static std::atomic<size_t> s_dequeuePos;
+static std::atomic<unsigned long> s_dropped;
+static std::atomic<long> s_producers;  // LogResult() calls in progress
+static std::vector<LogSink*> s_sinks;
+static std::mutex s_sinkLock;          // Held while writing to, or deleting, the added sinks
+static StandardLogSink s_standardSink;
+static std::atomic<bool> s_standardSinkEnabled( true );
+static etLogOverflow s_overflow = evLogOverflowBlock;
+static std::thread s_flusher;
+static HANDLE s_wakeFlusher = NULL;
+static std::atomic<bool> s_async( false );
+static std::atomic<bool> s_stopping( false );
+
+/**
+ * Format a message into a LOG_RECORD_TEXT buffer.
+ *
+ * @return Returns false if the message did not fit and was cut short.
+ */
+static bool FormatLogText( char* buffer, PCSTR fmt, va_list args )
+{
+    return 0 <= _vsnprintf_s( buffer, LOG_RECORD_TEXT, _TRUNCATE, fmt, args );
+}
+
+/**
+ * Mark a message that was cut short, so that it is not mistaken for the whole message.
+ */
+static void MarkLogTextTruncated( char* buffer )
+{
+    strcpy_s( buffer + LOG_RECORD_TEXT - 4, 4, "..." );
+}
+
+/**
+ * Hand a record to every added sink.  The caller holds s_sinkLock.
+ */
+static void WriteAddedSinks( HRESULT hr, const char* text )
+{
+    for ( auto iter = s_sinks.begin(); iter != s_sinks.end(); ++iter ) {
+        (*iter)->Write( hr, text );
+    }
+}
+
+/**
+ * Claim a free slot in the queue for a new record.
+ *
+ * @param pos The queue position claimed, to be passed to PublishLogRecord().
+ * @return Returns the slot, or NULL if the queue is full.
+ */
+static LogRecord* ClaimLogRecord( size_t& pos )
+{
+    pos = s_enqueuePos.load( std::memory_order_relaxed );
+    for ( ;; ) {
+        LogRecord* record = &s_queue[ pos & ( LOG_QUEUE_SIZE - 1 ) ];
+        size_t sequence = record->sequence.load( std::memory_order_acquire );
+        intptr_t diff = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( pos );
+        if ( 0 == diff ) {
+            if ( s_enqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+                return record;
+            }
+        } else if ( diff < 0 ) {
+            return NULL;
+        } else {
+            pos = s_enqueuePos.load( std::memory_order_relaxed );
+        }
+    }
+}
+
+/**
+ * Make a claimed and filled slot visible to the flusher thread.
+ */
+static void PublishLogRecord( LogRecord* record, size_t pos )
+{
+    record->sequence.store( pos + 1, std::memory_order_release );
+    SetEvent( s_wakeFlusher );
+}
+
+/**
+ * Deliver every record that is ready.  The caller holds s_sinkLock, so
+ * only one thread at a time takes records off the queue.
+ */
+static void DrainLogQueue()
+{
+    for ( ;; ) {
+        size_t pos = s_dequeuePos.load( std::memory_order_relaxed );
+        LogRecord& record = s_queue[ pos & ( LOG_QUEUE_SIZE - 1 ) ];
+        if ( record.sequence.load( std::memory_order_acquire ) != pos + 1 ) {
+            return;
+        }
+        WriteAddedSinks( record.hr, ( NULL != record.spill ) ? record.spill : record.text );
+        delete [] record.spill;
+        record.spill = NULL;
+        s_dequeuePos.store( pos + 1, std::memory_order_relaxed );
+        record.sequence.store( pos + LOG_QUEUE_SIZE, std::memory_order_release );
+    }
+}
+
+/**
+ * The flusher thread:  deliver records as they arrive until told to stop.
+ */
+static void LogFlusherThread()
+{
+    while ( !s_stopping ) {
+        WaitForSingleObject( s_wakeFlusher, 100 );
+        std::lock_guard<std::mutex> lock( s_sinkLock );
+        DrainLogQueue();
+    }
+    std::lock_guard<std::mutex> lock( s_sinkLock );
+    DrainLogQueue();
+}
+
+/**
+ * Queue a formatted message for the added sinks, or count it as dropped.
+ *
+ * @param spill The whole message on the heap, or NULL if it is in text.
+ *   The record takes it over if the message is queued.
+ * @return Returns true if the record took over the spill.
+ */
+static bool QueueLogRecord( HRESULT hr, const char* text, char* spill )
+{
+    size_t pos = 0;
+    LogRecord* record = ClaimLogRecord( pos );
+    while ( NULL == record && evLogOverflowBlock == s_overflow ) {
+        // The queue is full; give the flusher a chance to catch up.
+        SetEvent( s_wakeFlusher );
+        Sleep( 1 );
+        record = ClaimLogRecord( pos );
+    }
+
+    if ( NULL == record ) {
+        ++s_dropped;
+        return false;
+    }
+
+    record->hr = hr;
+    record->spill = spill;
+    if ( NULL == spill ) {
+        strcpy_s( record->text, text );
+    } else {
+        record->text[0] = '\0';
+    }
+    PublishLogRecord( record, pos );
+    return true;
+}
+
+void LogAddSink( __in LogSink* sink )
+{
+    std::lock_guard<std::mutex> lock( s_sinkLock );
+    s_sinks.push_back( sink );
+}
+
+void LogEnableStandardSink( __in bool enabled )
+{
+    s_standardSinkEnabled = enabled;
+}
+
+void LogStartAsync( __in etLogOverflow overflow )
+{
+    if ( s_async ) {
+        return;
+    }
+    s_wakeFlusher = CreateEvent( NULL, FALSE, FALSE, NULL );
+    if ( NULL == s_wakeFlusher ) {
+        LogResult( HRESULT_FROM_WIN32( GetLastError() ), "Unable to start asynchronous logging; logging synchronously." );
+        return;
+    }
+
+    for ( size_t i = 0; i < LOG_QUEUE_SIZE; ++i ) {
+        s_queue[i].sequence.store( i, std::memory_order_relaxed );
+        s_queue[i].spill = NULL;
+    }
+    s_enqueuePos.store( 0 );
+    s_dequeuePos.store( 0 );
+    s_dropped.store( 0 );
+    s_overflow = overflow;
+    s_stopping = false;
+    s_flusher = std::thread( LogFlusherThread );
+    s_async = true;
+}
+
+void LogStopAsync()
+{
+    if ( s_async ) {
+        // Close the queue:  calls from now on write to the sinks themselves.
+        // Calls that already saw it open are let finish queuing; the flusher
+        // is still running, so one that is waiting for room will get it.
+        s_async = false;
+        while ( 0 != s_producers.load() ) {
+            SetEvent( s_wakeFlusher );
+            Sleep( 1 );
+        }
+
+        s_stopping = true;
+        SetEvent( s_wakeFlusher );
+        s_flusher.join();
+        CloseHandle( s_wakeFlusher );
+        s_wakeFlusher = NULL;
+
+        unsigned long dropped = s_dropped.load();
+        if ( 0 < dropped ) {
+            LogResult( S_OK, "%lu log record(s) were dropped from the added log sinks because the log queue was full.", dropped );
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( s_sinkLock );
+        for ( auto iter = s_sinks.begin(); iter != s_sinks.end(); ++iter ) {
+            (*iter)->Flush();
+            delete *iter;
+        }
+        s_sinks.clear();
+    }
+
+    // The custom action is over; do not hold on to the message DLLs.
+    ErrorTextRelease();
+}
+
+void LogFormat(
+    __out_ecount(LOG_RECORD_TEXT) char* buffer,
+    __in_z __format_string PCSTR fmt, ...
+    )
+{
+    va_list args;
+    va_start( args, fmt );
+    if ( !FormatLogText( buffer, fmt, args ) ) {
+        MarkLogTextTruncated( buffer );
+    }
+    va_end( args );
 }
 
 void LogResult(
@@ -79,53 +419,52 @@ void LogResult(
     __in_z __format_string PCSTR fmt, ...
     )
 {
-    // This code taken from MSDN vsprintf example found currently at
-    // http://msdn.microsoft.com/en-us/library/28d5ce15(v=vs.71).aspx
-    // ...and then modified... because it doesn't seem to work!
+    // Counted so that LogStopAsync() can wait for a call that saw the queue open.
+    ++s_producers;
+
+    char buffer[LOG_RECORD_TEXT];
+    char* spill = NULL;
     va_list args;
-    int len;
-    char * buffer;
 
     va_start( args, fmt );
-#pragma warning( push )
-#pragma warning( disable : 4996 )
-    len = _vsnprintf( NULL, 0, fmt, args ) + 1;
-#pragma warning( pop )
-    buffer = (char*)malloc( len * sizeof(char) );
-
-#ifdef _DEBUG
-    ::ZeroMemory(buffer, len);
-#endif // _DEBUG
-    _vsnprintf_s( buffer, len, len-1, fmt, args );
-
-    // (MSDN code complete)
-
-    // Now that the buffer holds the formatted string, send it to
-    // the appropriate output.
-    if ( WcaIsInitialized() )
-    {
-        if ( FAILED( hr ) )
-        {
-            WcaLogError( hr, buffer );
-            LogError( hr );
+    bool fits = FormatLogText( buffer, fmt, args );
+    va_end( args );
+    if ( !fits ) {
+        // Too long for a record; format the whole message again on the heap.
+        // (There is no va_copy, so the arguments are walked once per pass.)
+        va_start( args, fmt );
+        int length = _vscprintf( fmt, args );
+        va_end( args );
+        if ( 0 < length ) {
+            spill = new (std::nothrow) char[length + 1];
         }
-        else
-        {
-            WcaLog( LOGMSG_STANDARD, buffer );
+        if ( NULL != spill ) {
+            va_start( args, fmt );
+            _vsnprintf_s( spill, length + 1, _TRUNCATE, fmt, args );
+            va_end( args );
+        } else {
+            MarkLogTextTruncated( buffer );
         }
     }
-    else // Log to stdout/stderr
-    {
-        if ( FAILED( hr ) )
-        {
-            fprintf_s( stderr, "%s\n", buffer );
-            LogError( hr );
-        }
-        else
-        {
-            fprintf_s( stdout, "%s\n", buffer );
+    const char* text = ( NULL != spill ) ? spill : buffer;
+
+    if ( s_standardSinkEnabled ) {
+        s_standardSink.Write( hr, text );
+    }
+
+    if ( s_async ) {
+        // The sinks are not added or removed while the queue is open.
+        if ( !s_sinks.empty() && QueueLogRecord( hr, text, spill ) ) {
+            spill = NULL;
         }
+    } else {
+        // Anything this thread queued before LogStopAsync() closed the
+        // queue is written first.
+        std::lock_guard<std::mutex> lock( s_sinkLock );
+        DrainLogQueue();
+        WriteAddedSinks( hr, text );
     }
 
-    free( buffer );
+    delete [] spill;
+    --s_producers;
 }
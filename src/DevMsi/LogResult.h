@@ -16,7 +16,14 @@
  *  text version of the error code and place it in the log.  For example,
  *  if the error code means ERROR_FILE_NOT_FOUND, it will look up the appropriate
  *  message ( via FormatMessage() ) and add "The system cannot find the file specified."
- *  to the log.
+ *  to the log.  The text of each code is only looked up once; see ErrorText().
+ *
+ *  Messages are also sent to any sinks added with LogAddSink().  After
+ *  LogStartAsync(), LogResult() only queues the message for those sinks
+ *  and returns; a background thread writes them.  The MSI log and
+ *  stdout/stderr are always written by the calling thread.
+ *
+ *  A message of any length is logged whole.
  *
  * @param hr The HRESULT to be interrogated for success or failure.
  * @param fmt The string format for a user-specified error message.
@@ -25,3 +32,98 @@ void LogResult(
     __in HRESULT hr,
     __in_z __format_string PCSTR fmt, ...
     );
+
+//* The longest message held in a log record, including the terminator.  Longer messages are put on the heap.
+#define LOG_RECORD_TEXT 1024
+
+/**
+ *  Format a message as LogResult() would, without logging it.
+ *
+ *  A message that does not fit is cut short and ends in "...".
+ *
+ * @param buffer Set to the message.  It must hold LOG_RECORD_TEXT characters.
+ * @param fmt The string format for the message.
+ */
+void LogFormat(
+    __out_ecount(LOG_RECORD_TEXT) char* buffer,
+    __in_z __format_string PCSTR fmt, ...
+    );
+
+/**
+ *  A destination for log messages, in addition to the MSI log or stdout/stderr.
+ *
+ *  Write() is called for one message at a time, from the logging thread
+ *  when logging is asynchronous.
+ */
+class LogSink {
+public:
+    virtual ~LogSink() {}
+
+    /**
+     * @param hr The HRESULT passed to LogResult().
+     * @param text The formatted message, without a trailing newline.
+     */
+    virtual void Write( HRESULT hr, const char* text ) = 0;
+
+    //* Push any buffered output to its destination.
+    virtual void Flush() {}
+};
+
+/**
+ *  What LogResult() does when the asynchronous log queue is full.
+ */
+typedef enum {
+    evLogOverflowBlock,     //*< Wait for the logging thread to make room
+    evLogOverflowDrop       //*< Drop the message and count it
+} etLogOverflow;
+
+/**
+ *  Add a log sink.
+ *
+ *  The sink is owned by the logging code from then on, and is deleted
+ *  by LogStopAsync().  Sinks must be added before LogStartAsync().
+ *
+ * @param sink The sink to be added.
+ */
+void LogAddSink( __in LogSink* sink );
+
+/**
+ *  Turn the MSI log or stdout/stderr on or off.  It is on unless turned off.
+ *
+ * @param enabled Whether LogResult() writes to it.
+ */
+void LogEnableStandardSink( __in bool enabled );
+
+/**
+ *  Create a sink that appends to a text file.
+ *
+ *  When the file grows past maxBytes, it is renamed to "<path>.1" (and
+ *  older files to "<path>.2" and so on, keeping keepFiles of them) and
+ *  a new file is started.
+ *
+ * @param path The path of the log file.
+ * @param maxBytes The size at which the file is rolled over.
+ * @param keepFiles The number of rolled-over files to keep.
+ * @return Returns the sink, to be passed to LogAddSink().
+ */
+LogSink* CreateRotatingFileLogSink( __in const wchar_t* path, __in DWORD maxBytes, __in DWORD keepFiles );
+
+/**
+ *  Start delivering log messages from a background thread.
+ *
+ *  LogResult() then queues messages for the added sinks without taking
+ *  a lock, and never waits on their I/O unless the queue is full and
+ *  overflow is evLogOverflowBlock.
+ *
+ * @param overflow What to do when the queue is full.
+ */
+void LogStartAsync( __in etLogOverflow overflow );
+
+/**
+ *  Stop queuing, deliver every queued message, stop the background thread, flush
+ *  and delete the added sinks, and unload any message DLLs loaded to
+ *  look up error text.  Logging is synchronous again afterwards.
+ *
+ *  This MUST be called before the custom action returns.
+ */
+void LogStopAsync();
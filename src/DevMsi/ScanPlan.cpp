@@ -0,0 +1,39 @@
+#include "stdafx.h"
+#include "ScanPlan.h"
+#include "LogResult.h"
+#include "GuidStrHelpers.h"
+
+void PlanDeviceScan( __in const ArgList& args, __out ScanPlan& plan ) {
+
+    plan.instanceIds.clear();
+    args.NamedList( L"instance", plan.instanceIds );
+    plan.enumerator.clear();
+    plan.hasClass = false;
+    if ( !plan.instanceIds.empty() ) {
+        LogResult( S_OK, "Plan: open %u device(s) by instance ID.", static_cast<DWORD>( plan.instanceIds.size() ) );
+        return;
+    }
+
+    const wchar_t* enumerator = args.Named( L"enumerator" );
+    if ( NULL != enumerator ) {
+        plan.enumerator = enumerator;
+    }
+
+    const wchar_t* classArg = args.Named( L"class" );
+    if ( NULL != classArg ) {
+        if ( !WellKnownClassName2GUID( classArg, plan.classGuid, NULL )
+            && !TryStr2GUID( classArg, plan.classGuid ) ) {
+            plan.classGuid = ClassName2GUID( classArg );
+        }
+        plan.hasClass = true;
+    }
+
+    if ( plan.hasClass ) {
+        LogResult( S_OK, "Plan: scan the devices of class %ls%s%ls.", GUID2Str( plan.classGuid ).c_str()
+            , plan.enumerator.empty() ? "" : " enumerated by ", plan.enumerator.c_str() );
+    } else if ( !plan.enumerator.empty() ) {
+        LogResult( S_OK, "Plan: scan the devices enumerated by %ls.", plan.enumerator.c_str() );
+    } else {
+        LogResult( S_OK, "Plan: scan all devices; no hint narrows them." );
+    }
+} // void PlanDeviceScan( const ArgList& args, ScanPlan& plan )
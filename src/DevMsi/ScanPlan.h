@@ -0,0 +1,43 @@
+/**
+ * Header file for choosing which devices DoRemoveDevnode() reads.
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include "ArgList.h"
+
+/**
+ * Which devices DoRemoveDevnode() reads to find the requested IDs.
+ */
+struct ScanPlan {
+    std::vector<LPCWSTR> instanceIds;   //*< If not empty, open just these devices
+    std::wstring enumerator;            //*< If not empty, only the devices of this enumerator
+    GUID classGuid;                     //*< The class of the devices, if hasClass
+    bool hasClass;                      //*< True to read only the devices of classGuid
+
+    /**
+     * @return Returns true if the plan reads fewer than every present device.
+     */
+    bool Narrowed() const { return !instanceIds.empty() || !enumerator.empty() || hasClass; }
+};
+
+/**
+ * Choose the devices to read from the hints given, and log the choice.
+ *
+ * 1)  "instance=<instance ID>" (repeatable) opens just those devices.
+ * 2)  "enumerator=<name>" reads only the devices of that enumerator
+ *     (e.g. "ROOT", "PCI", "USB").
+ * 3)  "class=<name or GUID>" reads only the devices of that setup class.
+ * 4)  Otherwise, every present device is read.
+ *
+ * Nothing is inferred from the requested IDs:  an ID does not say which
+ * enumerator reported it (e.g. a software device may carry a "ROOT\" ID
+ * as a compatible ID).  The hints are trusted:  a device outside them is
+ * not found.
+ *
+ * An exception will be thrown if the class hint cannot be resolved.
+ *
+ * @param args The arguments of DoRemoveDevnode().
+ * @param plan Set to the chosen plan.
+ */
+void PlanDeviceScan( __in const ArgList& args, __out ScanPlan& plan );
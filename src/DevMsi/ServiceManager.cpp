@@ -0,0 +1,203 @@
+#include "stdafx.h"
+#include "ServiceManager.h"
+#include "CheckResult.h"
+#include "AutoClose.h"
+#include "Trace.h"
+
+/**
+ * A ServiceManager for the Service Control Manager, over one SCM handle.
+ */
+class ScmServiceManager : public ServiceManager {
+public:
+    ScmServiceManager();
+
+    virtual HRESULT ListServices( __out std::vector<std::wstring>& names );
+    virtual HRESULT Delete( __in const wchar_t* name );
+    virtual HRESULT ListDependents( __in const wchar_t* name, __out std::vector<std::wstring>& names );
+    virtual HRESULT Stop( __in const wchar_t* name, __out SERVICE_STATUS& status );
+    virtual HRESULT QueryStatus( __in const wchar_t* name, __out SERVICE_STATUS& status );
+
+private:
+    HRESULT OpenServiceHandle( __in const wchar_t* name, __in DWORD access, __out AutoCloseServiceHandle& service );
+
+    AutoCloseServiceHandle m_scm;   //*< The SCM database
+};
+
+ScmServiceManager::ScmServiceManager()
+{
+    // This code largely taken from the MSDN article "Deleting a Service"
+    // http://msdn.microsoft.com/en-us/library/windows/desktop/ms682571(v=vs.85).aspx
+
+    // Get a handle to the SCM database, with only the access needed to
+    // open services and list them.
+    TraceSpan openSpan( "OpenSCManager" );
+    m_scm = OpenSCManager(
+        NULL,                    // local computer
+        NULL,                    // ServicesActive database
+        SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE );
+
+    if ( NULL == m_scm ) {
+        HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
+        CheckResult( hr, "OpenSCManager() failed." );
+    }
+}
+
+HRESULT ScmServiceManager::ListServices( __out std::vector<std::wstring>& names )
+{
+    TraceSpan span( "EnumServicesStatusEx" );
+    std::vector<BYTE> buffer( 64 * 1024 );
+    DWORD resume = 0;
+
+    names.clear();
+    for ( ;; ) {
+        DWORD needed = 0, returned = 0;
+        BOOL done = EnumServicesStatusExW( m_scm, SC_ENUM_PROCESS_INFO, SERVICE_WIN32 | SERVICE_DRIVER, SERVICE_STATE_ALL,
+            &buffer[0], static_cast<DWORD>( buffer.size() ), &needed, &returned, &resume, NULL );
+        DWORD lastError = done ? ERROR_SUCCESS : GetLastError();
+        if ( !done && ERROR_MORE_DATA != lastError ) {
+            HRESULT hr = HRESULT_FROM_WIN32( lastError );
+            LogResult( hr, "EnumServicesStatusEx() failed." );
+            return hr;
+        }
+
+        const ENUM_SERVICE_STATUS_PROCESSW* services = reinterpret_cast<const ENUM_SERVICE_STATUS_PROCESSW*>( &buffer[0] );
+        for ( DWORD i = 0; i < returned; ++i ) {
+            names.push_back( services[i].lpServiceName );
+        }
+        if ( done ) {
+            return S_OK;
+        }
+        // The resume handle carries on after the services returned.
+        if ( needed > buffer.size() ) {
+            buffer.resize( needed );
+        }
+    }
+} // HRESULT ScmServiceManager::ListServices( std::vector<std::wstring>& names )
+
+/**
+ * Open a service with the given access.  A failure is logged, unless
+ * the service does not exist.
+ */
+HRESULT ScmServiceManager::OpenServiceHandle( __in const wchar_t* name, __in DWORD access, __out AutoCloseServiceHandle& service )
+{
+    TraceSpan openServiceSpan( "OpenService" );
+    service = ::OpenServiceW( m_scm, name, access );
+    if ( NULL == service ) {
+        HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
+        if ( HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST ) != hr ) {
+            LogResult( hr, "OpenService('%ls') failed.", name );
+        }
+        return hr;
+    }
+    return S_OK;
+}
+
+HRESULT ScmServiceManager::Delete( __in const wchar_t* name )
+{
+    AutoCloseServiceHandle service;
+
+    HRESULT hr = OpenServiceHandle( name, DELETE, service );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    TraceSpan deleteSpan( "DeleteService" );
+    if ( !DeleteService( service ) ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        if ( HRESULT_FROM_WIN32( ERROR_SERVICE_MARKED_FOR_DELETE ) == hr ) {
+            // An earlier run deleted it; it goes once it stops.
+            LogResult( S_OK, "Service '%ls' is already marked for deletion.", name );
+            return S_OK;
+        }
+        LogResult( hr, "DeleteService('%ls') failed.", name );
+    }
+    return hr;
+} // HRESULT ScmServiceManager::Delete( const wchar_t* name )
+
+HRESULT ScmServiceManager::ListDependents( __in const wchar_t* name, __out std::vector<std::wstring>& names )
+{
+    AutoCloseServiceHandle service;
+
+    names.clear();
+    HRESULT hr = OpenServiceHandle( name, SERVICE_ENUMERATE_DEPENDENTS, service );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    // Most services have no running dependents; ask with an empty buffer first.
+    TraceSpan span( "EnumDependentServices" );
+    std::vector<BYTE> buffer;
+    DWORD needed = 0, returned = 0;
+    while ( !EnumDependentServicesW( service, SERVICE_ACTIVE,
+                buffer.empty() ? NULL : reinterpret_cast<LPENUM_SERVICE_STATUSW>( &buffer[0] ),
+                static_cast<DWORD>( buffer.size() ), &needed, &returned ) ) {
+        DWORD lastError = GetLastError();
+        if ( ERROR_MORE_DATA != lastError || needed <= buffer.size() ) {
+            hr = HRESULT_FROM_WIN32( lastError );
+            LogResult( hr, "EnumDependentServices('%ls') failed.", name );
+            return hr;
+        }
+        buffer.resize( needed );
+    }
+
+    const ENUM_SERVICE_STATUSW* dependents = buffer.empty() ? NULL : reinterpret_cast<const ENUM_SERVICE_STATUSW*>( &buffer[0] );
+    for ( DWORD i = 0; i < returned; ++i ) {
+        names.push_back( dependents[i].lpServiceName );
+    }
+    return S_OK;
+} // HRESULT ScmServiceManager::ListDependents( const wchar_t* name, std::vector<std::wstring>& names )
+
+HRESULT ScmServiceManager::Stop( __in const wchar_t* name, __out SERVICE_STATUS& status )
+{
+    AutoCloseServiceHandle service;
+
+    ZeroMemory( &status, sizeof( status ) );
+    HRESULT hr = OpenServiceHandle( name, SERVICE_STOP | SERVICE_QUERY_STATUS, service );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    TraceSpan span( "ControlService" );
+    if ( ControlService( service, SERVICE_CONTROL_STOP, &status ) ) {
+        return S_OK;
+    }
+
+    hr = HRESULT_FROM_WIN32( GetLastError() );
+    if ( HRESULT_FROM_WIN32( ERROR_SERVICE_NOT_ACTIVE ) == hr ) {
+        status.dwCurrentState = SERVICE_STOPPED;
+        return S_OK;
+    }
+    if ( HRESULT_FROM_WIN32( ERROR_SERVICE_CANNOT_ACCEPT_CTRL ) == hr ) {
+        // ControlService() fills in the status for this error, but read
+        // it again to be sure of it.
+        if ( !QueryServiceStatus( service, &status ) ) {
+            hr = HRESULT_FROM_WIN32( GetLastError() );
+            LogResult( hr, "QueryServiceStatus('%ls') failed.", name );
+        }
+        return hr;
+    }
+    LogResult( hr, "ControlService('%ls', SERVICE_CONTROL_STOP) failed.", name );
+    return hr;
+} // HRESULT ScmServiceManager::Stop( const wchar_t* name, SERVICE_STATUS& status )
+
+HRESULT ScmServiceManager::QueryStatus( __in const wchar_t* name, __out SERVICE_STATUS& status )
+{
+    AutoCloseServiceHandle service;
+
+    ZeroMemory( &status, sizeof( status ) );
+    HRESULT hr = OpenServiceHandle( name, SERVICE_QUERY_STATUS, service );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    if ( !QueryServiceStatus( service, &status ) ) {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+        LogResult( hr, "QueryServiceStatus('%ls') failed.", name );
+    }
+    return hr;
+} // HRESULT ScmServiceManager::QueryStatus( const wchar_t* name, SERVICE_STATUS& status )
+
+ServiceManager* CreateScmServiceManager()
+{
+    return new ScmServiceManager();
+}
@@ -0,0 +1,78 @@
+/**
+ * Header file for the service control operations used by DoRemoveService().
+ *
+ * The operations are behind an interface, so that the removal logic
+ * does not depend on the Service Control Manager itself, and one
+ * connection to it is shared by every service in a batch.
+ */
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * A connection to a service manager.
+ */
+class ServiceManager {
+public:
+    virtual ~ServiceManager() {}
+
+    /**
+     * List the names of the installed services.
+     *
+     * @param names Set to the service names.
+     * @return Returns S_OK, or the error from listing the services.
+     */
+    virtual HRESULT ListServices( __out std::vector<std::wstring>& names ) = 0;
+
+    /**
+     * Delete a service.  A running service is only deleted once it stops.
+     *
+     * @param name The service name.
+     * @return Returns S_OK, HRESULT_FROM_WIN32(ERROR_SERVICE_DOES_NOT_EXIST)
+     *         if there is no such service, or the error from deleting it.
+     */
+    virtual HRESULT Delete( __in const wchar_t* name ) = 0;
+
+    /**
+     * List the running services that depend on a service, directly or
+     * through other services.
+     *
+     * @param name The service name.
+     * @param names Set to the names of the dependent services.
+     * @return Returns S_OK, HRESULT_FROM_WIN32(ERROR_SERVICE_DOES_NOT_EXIST)
+     *         if there is no such service, or the error from listing them.
+     */
+    virtual HRESULT ListDependents( __in const wchar_t* name, __out std::vector<std::wstring>& names ) = 0;
+
+    /**
+     * Ask a service to stop.  This does not wait for it to stop.
+     *
+     * @param name The service name.
+     * @param status Set to the status of the service after the request.
+     *               A service that is not running is reported as SERVICE_STOPPED.
+     * @return Returns S_OK, HRESULT_FROM_WIN32(ERROR_SERVICE_CANNOT_ACCEPT_CTRL)
+     *         if the service is starting or already stopping (status is still set),
+     *         HRESULT_FROM_WIN32(ERROR_SERVICE_DOES_NOT_EXIST) if there is no
+     *         such service, or the error from stopping it.
+     */
+    virtual HRESULT Stop( __in const wchar_t* name, __out SERVICE_STATUS& status ) = 0;
+
+    /**
+     * Read the status of a service.
+     *
+     * @param name The service name.
+     * @param status Set to the status of the service.
+     * @return Returns S_OK, HRESULT_FROM_WIN32(ERROR_SERVICE_DOES_NOT_EXIST)
+     *         if there is no such service, or the error from querying it.
+     */
+    virtual HRESULT QueryStatus( __in const wchar_t* name, __out SERVICE_STATUS& status ) = 0;
+};
+
+/**
+ * Connect to the Service Control Manager of the local computer.
+ *
+ * An exception will be thrown if it cannot be opened.
+ *
+ * @return Returns the connection, which the caller must delete.
+ */
+ServiceManager* CreateScmServiceManager();
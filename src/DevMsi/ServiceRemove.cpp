@@ -0,0 +1,212 @@
+#include "stdafx.h"
+#include "ServiceRemove.h"
+#include "CheckResult.h"
+#include "ciwstring.h"
+#include "ArgList.h"
+#include "Trace.h"
+#include "HwIdPattern.h"
+#include "ServiceStop.h"
+#include "Deadline.h"
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+/**
+ * The outcome of removing the service(s) matching one name.
+ */
+struct ServiceOutcome {
+    std::wstring name;      //*< The service name or pattern as provided by the caller
+    DWORD matched;          //*< The number of existing services that matched the name
+    DWORD deleted;          //*< The number of matched services that were deleted
+    HRESULT hr;             //*< The first failure seen while deleting, or S_OK
+};
+
+/**
+ * A service to be deleted, and the names it matched.
+ */
+struct ServiceTarget {
+    std::wstring name;              //*< The service name
+    std::vector<size_t> matches;    //*< The outcome slots of the names that matched
+};
+
+HRESULT RemoveServices( __in int argc, __in LPWSTR* argv, __in_opt ServiceManager* scm )
+{
+    HRESULT hr = S_OK;
+
+    try
+    {
+        TraceSpan functionSpan( "DoRemoveService" );
+        std::vector<ServiceOutcome> outcomes;
+        std::unordered_map<ci_wstring, size_t, ci_wstring_hash> slots;
+        std::unordered_map<ci_wstring, size_t, ci_wstring_hash> patternSlots;
+        std::vector<ServiceTarget> targets;
+        std::unordered_map<ci_wstring, size_t, ci_wstring_hash> targetIndex;
+        HwIdPatternSet patterns;
+
+        // Names may be given as positional arguments, as repeated
+        // "service=" arguments, or both.  They are matched literally, even
+        // if they contain '*' or '?':  a mistyped name must not delete
+        // every service that it happens to match.  Wildcard patterns are
+        // only taken from repeated "pattern=" arguments.
+        ArgList args( argc, argv );
+        Deadline deadline( args.NamedNumber( L"budget", 0 ) );
+        std::vector<LPCWSTR> nameArgs( args.Positional() );
+        args.NamedList( L"service", nameArgs );
+        std::vector<LPCWSTR> patternArgs;
+        args.NamedList( L"pattern", patternArgs );
+        if ( nameArgs.empty() && patternArgs.empty() ) {
+            throw std::runtime_error( "DoRemoveService() requires at least one parameter, zero provided" );
+        }
+
+        // Each service is deleted once, however many names match it.
+        auto addTarget = [&]( const wchar_t* name, size_t slot ) {
+            auto found = targetIndex.find( name );
+            if ( targetIndex.end() == found ) {
+                ServiceTarget target;
+                target.name = name;
+                found = targetIndex.insert( std::make_pair( ci_wstring( name ), targets.size() ) ).first;
+                targets.push_back( target );
+            }
+            targets[found->second].matches.push_back( slot );
+        };
+
+        // Names (or patterns) that differ only in case share a single
+        // outcome slot.  Patterns are matched against the installed services.
+        for ( auto arg = nameArgs.begin(); arg != nameArgs.end(); ++arg ) {
+            const wchar_t* name = *arg;
+            LogResult( S_OK, "Entered DoRemoveService('%ls').", name );
+
+            if ( slots.end() == slots.find( name ) ) {
+                ServiceOutcome outcome = { name, 0, 0, S_OK };
+                slots[name] = outcomes.size();
+                addTarget( name, outcomes.size() );
+                outcomes.push_back( outcome );
+            }
+        }
+        for ( auto arg = patternArgs.begin(); arg != patternArgs.end(); ++arg ) {
+            const wchar_t* pattern = *arg;
+            LogResult( S_OK, "Entered DoRemoveService(pattern '%ls').", pattern );
+
+            if ( patternSlots.end() == patternSlots.find( pattern ) ) {
+                ServiceOutcome outcome = { pattern, 0, 0, S_OK };
+                patternSlots[pattern] = outcomes.size();
+                patterns.Add( pattern, outcomes.size() );
+                outcomes.push_back( outcome );
+            }
+        }
+
+        // "stop=1" stops the services, and whatever depends on them, before
+        // deleting them, giving each up to "timeout=" milliseconds to stop.
+        bool stop = args.NamedFlag( L"stop" );
+        DWORD timeoutMs = args.NamedNumber( L"timeout", 30000 );
+
+        // One connection to the SCM serves every service, unless the
+        // caller supplied the service manager.
+        std::unique_ptr<ServiceManager> ownedScm;
+        if ( NULL == scm ) {
+            hr = RetryTransient( "OpenSCManager", deadline, [&]() -> HRESULT {
+                try {
+                    ownedScm.reset( CreateScmServiceManager() );
+                    return S_OK;
+                }
+                catch( HRESULT& _error ) {
+                    return _error;
+                }
+            } );
+            if ( FAILED( hr ) ) {
+                throw hr;
+            }
+            scm = ownedScm.get();
+        }
+
+        if ( !patterns.Empty() ) {
+            std::vector<std::wstring> installed;
+            std::vector<size_t> matches;
+            HwIdPatternSet::State patternState;
+            hr = RetryTransient( "EnumServicesStatusEx", deadline, [&]() -> HRESULT {
+                return scm->ListServices( installed );
+            } );
+            CheckResult( hr, "Unable to list the services." );
+            for ( auto iter = installed.begin(); iter != installed.end(); ++iter ) {
+                matches.clear();
+                patterns.Match( iter->c_str(), patternState, matches );
+                for ( auto slot = matches.begin(); slot != matches.end(); ++slot ) {
+                    LogResult( S_OK, "Service '%ls' matched '%ls'.", iter->c_str(), outcomes[*slot].name.c_str() );
+                    addTarget( iter->c_str(), *slot );
+                }
+            }
+        }
+
+        // A service that fails to stop is still deleted; it goes once it stops.
+        if ( stop && !targets.empty() ) {
+            std::vector<std::wstring> names;
+            for ( auto target = targets.begin(); target != targets.end(); ++target ) {
+                names.push_back( target->name );
+            }
+            HRESULT stopHr = StopServices( *scm, names, timeoutMs, deadline );
+            if ( FAILED( stopHr ) ) {
+                LogResult( stopHr, "Not every service stopped; those that did not will be deleted when they stop." );
+            }
+        }
+
+        // A failure on one service does not stop the batch;
+        // it is recorded against every name that matched.
+        // Once the time budget is spent, the rest are not deleted.
+        for ( auto target = targets.begin(); target != targets.end(); ++target ) {
+            HRESULT deleteHr = deadline.Check( "the service will not be deleted" );
+            if ( SUCCEEDED( deleteHr ) ) {
+                deleteHr = RetryTransient( "DeleteService", deadline, [&]() -> HRESULT {
+                    return scm->Delete( target->name.c_str() );
+                } );
+            }
+            if ( HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST ) == deleteHr ) {
+                LogResult( deleteHr, "Service '%ls' does not exist, so it will not be deleted.", target->name.c_str() );
+                continue;
+            }
+            if ( SUCCEEDED( deleteHr ) ) {
+                LogResult( S_OK, "Service '%ls' deleted.", target->name.c_str() );
+            }
+            for ( auto slot = target->matches.begin(); slot != target->matches.end(); ++slot ) {
+                ServiceOutcome& outcome = outcomes[*slot];
+                ++outcome.matched;
+                if ( SUCCEEDED( deleteHr ) ) {
+                    ++outcome.deleted;
+                } else if ( SUCCEEDED( outcome.hr ) ) {
+                    outcome.hr = deleteHr;
+                }
+            }
+        }
+
+        // Report the outcome of each name.  The overall result is
+        // the first failure, if any.
+        hr = S_OK;
+        for ( auto iter = outcomes.begin(); iter != outcomes.end(); ++iter ) {
+            if ( SUCCEEDED( iter->hr ) ) {
+                LogResult( S_OK, "Service '%ls': %u service(s) deleted.", iter->name.c_str(), iter->deleted );
+            } else {
+                LogResult( iter->hr, "Service '%ls': %u of %u service(s) deleted.", iter->name.c_str(), iter->deleted, iter->matched );
+                if ( SUCCEEDED( hr ) ) {
+                    hr = iter->hr;
+                }
+            }
+        }
+
+        LogResult( hr, "DoRemoveService() Complete.");
+    }
+    catch( HRESULT& _error )
+    {
+        hr = _error;
+    }
+    catch( const std::exception& _error )
+    {
+        hr = E_FAIL;
+        LogResult( hr, _error.what() );
+    }
+    catch( ... )
+    {
+        hr = E_FAIL;
+        LogResult( hr, "Unhandled C++ exception" );
+    }
+
+    return hr;
+} // HRESULT RemoveServices( int argc, LPWSTR* argv, ServiceManager* scm )
@@ -0,0 +1,18 @@
+/**
+ * Header file for the service removal behind DoRemoveService().
+ */
+#pragma once
+#include "ServiceManager.h"
+
+/**
+ * Remove services, as DoRemoveService() does, through the given service
+ * manager.  This is not exported; it lets DevMsiTest run the removal
+ * against a service manager of its own.
+ *
+ * @param argc  The count of valid arguments in argv, as for DoRemoveService().
+ * @param argv  The arguments, as for DoRemoveService().
+ * @param scm   The service manager, or NULL to connect to the Service
+ *              Control Manager of the local computer.
+ * @return Returns an HRESULT indicating success or failure.
+ */
+HRESULT RemoveServices( __in int argc, __in LPWSTR* argv, __in_opt ServiceManager* scm );
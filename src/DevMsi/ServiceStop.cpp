@@ -0,0 +1,260 @@
+#include "stdafx.h"
+#include "ServiceStop.h"
+#include "ciwstring.h"
+#include "Trace.h"
+#include <algorithm>
+#include <unordered_map>
+
+/**
+ * Where a service is in being stopped.
+ */
+typedef enum {
+    evStopWaiting,      //*< Waiting for its dependents to stop
+    evStopPending,      //*< Asked to stop, and being polled
+    evStopDone          //*< Stopped, or failed to
+} etStopState;
+
+/**
+ * A service in the dependency graph.
+ */
+struct StopNode {
+    std::wstring name;              //*< The service name
+    bool target;                    //*< false for a dependent of a target
+    std::vector<size_t> blocks;     //*< The services that wait for this one to stop
+    DWORD dependents;               //*< The dependents that have not stopped yet
+    bool dependentFailed;           //*< true if a dependent failed to stop
+    etStopState state;              //*< Where the service is in being stopped
+    bool accepted;                  //*< false until the service accepts the stop request
+    DWORD started;                  //*< GetTickCount() when the service was first asked to stop
+    DWORD polled;                   //*< GetTickCount() when the service was last polled
+    DWORD interval;                 //*< How long to wait before the next poll, in milliseconds
+    DWORD stopAttempts;             //*< The stop requests in a row that failed with a transient error
+    HRESULT hr;                     //*< The outcome, once done
+};
+
+/**
+ * How long to wait before polling a stopping service again:  a tenth of
+ * its wait hint, as the SCM documentation suggests, within limits that
+ * keep a quick service from waiting on a slow poll.
+ */
+static DWORD PollInterval( __in const SERVICE_STATUS& status )
+{
+    return std::max<DWORD>( 25, std::min<DWORD>( status.dwWaitHint / 10, 1000 ) );
+}
+
+HRESULT StopServices( __in ServiceManager& scm, __in const std::vector<std::wstring>& names, __in DWORD timeoutMs, __in const Deadline& deadline )
+{
+    TraceSpan span( "StopServices" );
+    std::vector<StopNode> nodes;
+    std::unordered_map<ci_wstring, size_t, ci_wstring_hash> index;
+
+    auto addNode = [&]( const std::wstring& name, bool target ) -> size_t {
+        auto found = index.find( name.c_str() );
+        if ( index.end() != found ) {
+            return found->second;
+        }
+        StopNode node;
+        node.name = name;
+        node.target = target;
+        node.dependents = 0;
+        node.dependentFailed = false;
+        node.state = evStopWaiting;
+        node.accepted = false;
+        node.started = node.polled = 0;
+        node.interval = 0;
+        node.stopAttempts = 0;
+        node.hr = S_OK;
+        index.insert( std::make_pair( ci_wstring( name.c_str() ), nodes.size() ) );
+        nodes.push_back( node );
+        return nodes.size() - 1;
+    };
+
+    for ( auto iter = names.begin(); iter != names.end(); ++iter ) {
+        addNode( *iter, true );
+    }
+
+    // Build the graph.  The dependents of a service are listed with their
+    // own dependents, so each new node is asked for its dependents in turn;
+    // the edges this adds between them order the stops within a branch.
+    std::vector<std::wstring> dependents;
+    for ( size_t i = 0; i < nodes.size(); ++i ) {
+        HRESULT hr = RetryTransient( "EnumDependentServices", deadline, [&]() -> HRESULT {
+            return scm.ListDependents( nodes[i].name.c_str(), dependents );
+        } );
+        if ( FAILED( hr ) ) {
+            // Stopping the service will fail for the same reason, if it exists.
+            continue;
+        }
+        for ( auto iter = dependents.begin(); iter != dependents.end(); ++iter ) {
+            size_t dependent = addNode( *iter, false );
+            if ( dependent != i ) {
+                nodes[dependent].blocks.push_back( i );
+                ++nodes[i].dependents;
+            }
+        }
+    }
+    if ( nodes.size() > names.size() ) {
+        LogResult( S_OK, "Stopping %u service(s), and %u running service(s) that depend on them."
+            , static_cast<DWORD>( names.size() ), static_cast<DWORD>( nodes.size() - names.size() ) );
+    }
+
+    std::vector<size_t> ready;
+    for ( size_t i = 0; i < nodes.size(); ++i ) {
+        if ( 0 == nodes[i].dependents ) {
+            ready.push_back( i );
+        }
+    }
+
+    // Record the outcome of a service and free the services it blocked.
+    auto finish = [&]( size_t i, HRESULT hr ) {
+        StopNode& node = nodes[i];
+        node.state = evStopDone;
+        node.hr = hr;
+        DWORD elapsed = GetTickCount() - node.started;
+        if ( SUCCEEDED( hr ) && !node.accepted ) {
+            LogResult( S_OK, "Service '%ls' is not running.", node.name.c_str() );
+        } else if ( SUCCEEDED( hr ) ) {
+            LogResult( S_OK, "Service '%ls'%s stopped after %u ms.", node.name.c_str()
+                , node.target ? "" : " (a dependent)", elapsed );
+        } else if ( HRESULT_FROM_WIN32( ERROR_SERVICE_REQUEST_TIMEOUT ) == hr ) {
+            LogResult( hr, "Service '%ls' did not stop within %u ms.", node.name.c_str(), elapsed );
+        } else {
+            LogResult( hr, "Service '%ls' could not be stopped.", node.name.c_str() );
+        }
+        for ( auto iter = node.blocks.begin(); iter != node.blocks.end(); ++iter ) {
+            StopNode& blocked = nodes[*iter];
+            blocked.dependentFailed = blocked.dependentFailed || FAILED( hr );
+            if ( 0 == --blocked.dependents ) {
+                ready.push_back( *iter );
+            }
+        }
+    };
+
+    // Send a stop request, and note whether there is anything to wait for.
+    // This thread polls every stopping service, so a request that fails
+    // with a transient error is not retried here, which would hold up the
+    // others:  the service is left pending, and asked again at a later poll.
+    auto requestStop = [&]( size_t i ) {
+        StopNode& node = nodes[i];
+        SERVICE_STATUS status;
+        HRESULT hr = scm.Stop( node.name.c_str(), status );
+        node.polled = GetTickCount();
+        if ( IsTransientError( hr ) ) {
+            DWORD delay = RetryDelay( ++node.stopAttempts, deadline );
+            if ( RETRY_MAX_ATTEMPTS > node.stopAttempts && 0 != delay ) {
+                LogResult( hr, "Stopping service '%ls' failed on attempt %u; asking again in %u ms."
+                    , node.name.c_str(), node.stopAttempts, delay );
+                node.state = evStopPending;
+                node.interval = delay;
+                return;
+            }
+            LogResult( hr, "Stopping service '%ls' failed after %u attempt(s); giving up%s.", node.name.c_str()
+                , node.stopAttempts, deadline.Expired() ? " as the time budget is spent" : "" );
+        }
+        node.stopAttempts = 0;
+        if ( HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST ) == hr ) {
+            finish( i, S_OK );
+        } else if ( SUCCEEDED( hr ) && SERVICE_STOPPED == status.dwCurrentState ) {
+            finish( i, S_OK );
+        } else if ( SUCCEEDED( hr ) || HRESULT_FROM_WIN32( ERROR_SERVICE_CANNOT_ACCEPT_CTRL ) == hr ) {
+            // A service that is still starting is asked again once it has started.
+            node.state = evStopPending;
+            node.accepted = node.accepted || SUCCEEDED( hr ) || SERVICE_STOP_PENDING == status.dwCurrentState;
+            node.interval = PollInterval( status );
+        } else {
+            finish( i, hr );
+        }
+    };
+
+    size_t pending = 0;
+    for ( ;; ) {
+        while ( !ready.empty() ) {
+            size_t i = ready.back();
+            ready.pop_back();
+            nodes[i].started = GetTickCount();
+            if ( nodes[i].dependentFailed ) {
+                finish( i, HRESULT_FROM_WIN32( ERROR_DEPENDENT_SERVICES_RUNNING ) );
+                continue;
+            }
+            HRESULT hr = deadline.Check( "the service will not be stopped" );
+            if ( FAILED( hr ) ) {
+                finish( i, hr );
+                continue;
+            }
+            requestStop( i );
+            if ( evStopPending == nodes[i].state ) {
+                ++pending;
+            }
+        }
+        if ( 0 == pending ) {
+            break;
+        }
+
+        // Sleep until the next service is due to be polled.
+        DWORD now = GetTickCount();
+        DWORD wait = 1000;
+        for ( auto iter = nodes.begin(); iter != nodes.end(); ++iter ) {
+            if ( evStopPending == iter->state ) {
+                DWORD since = now - iter->polled;
+                wait = std::min<DWORD>( wait, since >= iter->interval ? 0 : iter->interval - since );
+            }
+        }
+        wait = std::min<DWORD>( wait, deadline.Remaining() );
+        if ( 0 != wait ) {
+            Sleep( wait );
+        }
+
+        now = GetTickCount();
+        for ( size_t i = 0; i < nodes.size(); ++i ) {
+            StopNode& node = nodes[i];
+            // Once the deadline passes, every stopping service is polled for the last time.
+            if ( evStopPending != node.state || ( now - node.polled < node.interval && !deadline.Expired() ) ) {
+                continue;
+            }
+
+            SERVICE_STATUS status;
+            HRESULT hr = scm.QueryStatus( node.name.c_str(), status );
+            node.polled = GetTickCount();
+            if ( HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST ) == hr ) {
+                // It was deleted, and has stopped.
+                hr = S_OK;
+                status.dwCurrentState = SERVICE_STOPPED;
+            }
+            bool timedOut = node.polled - node.started >= timeoutMs || deadline.Expired();
+            if ( IsTransientError( hr ) && !timedOut ) {
+                // Ask again at the next poll.
+                continue;
+            }
+            if ( FAILED( hr ) ) {
+                --pending;
+                finish( i, hr );
+            } else if ( SERVICE_STOPPED == status.dwCurrentState ) {
+                --pending;
+                finish( i, S_OK );
+            } else if ( timedOut ) {
+                --pending;
+                finish( i, HRESULT_FROM_WIN32( ERROR_SERVICE_REQUEST_TIMEOUT ) );
+            } else if ( !node.accepted && SERVICE_START_PENDING != status.dwCurrentState ) {
+                requestStop( i );
+                if ( evStopPending != node.state ) {
+                    --pending;
+                }
+            } else {
+                node.interval = PollInterval( status );
+            }
+        }
+    }
+
+    // Every service is done, unless the dependencies had a cycle.
+    HRESULT hr = S_OK;
+    for ( size_t i = 0; i < nodes.size(); ++i ) {
+        if ( evStopDone != nodes[i].state ) {
+            nodes[i].hr = HRESULT_FROM_WIN32( ERROR_CIRCULAR_DEPENDENCY );
+            LogResult( nodes[i].hr, "Service '%ls' was not stopped.", nodes[i].name.c_str() );
+        }
+        if ( SUCCEEDED( hr ) && FAILED( nodes[i].hr ) ) {
+            hr = nodes[i].hr;
+        }
+    }
+    return hr;
+} // HRESULT StopServices( ServiceManager& scm, const std::vector<std::wstring>& names, DWORD timeoutMs, const Deadline& deadline )
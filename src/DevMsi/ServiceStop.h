@@ -0,0 +1,33 @@
+/**
+ * Header file for stopping services in dependency order.
+ */
+#pragma once
+#include "ServiceManager.h"
+#include "Deadline.h"
+#include <string>
+#include <vector>
+
+/**
+ * Stop services, and the running services that depend on them.
+ *
+ * A service is asked to stop only once every service that depends on it
+ * has stopped.  Services in independent branches of the dependency graph
+ * are stopping at the same time:  stop requests are sent as soon as a
+ * service is free to stop, and every stopping service is polled from this
+ * thread, as often as its wait hint suggests, until it stops or runs out
+ * of time.  Progress is logged.
+ *
+ * A service that does not exist, or is not running, counts as stopped.
+ * If a service fails to stop, the services it depends on are not stopped.
+ * Requests that fail with a transient error are retried at a later
+ * poll, so that they do not hold up the other services.  Once the
+ * deadline passes, services still stopping count as timed out, and the
+ * rest are not asked to stop.
+ *
+ * @param scm The service manager.
+ * @param names The names of the services to stop.
+ * @param timeoutMs How long each service may take to stop, in milliseconds.
+ * @param deadline The deadline of the calling function.
+ * @return Returns S_OK if every service stopped, otherwise the first failure.
+ */
+HRESULT StopServices( __in ServiceManager& scm, __in const std::vector<std::wstring>& names, __in DWORD timeoutMs, __in const Deadline& deadline );
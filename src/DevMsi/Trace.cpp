@@ -0,0 +1,156 @@
+#include "stdafx.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+/**
+ * A finished span.
+ */
+struct TraceEvent {
+    const char* name;       //*< The name of the step
+    LONGLONG start;         //*< QueryPerformanceCounter() when the span began
+    LONGLONG end;           //*< QueryPerformanceCounter() when the span ended
+};
+
+/**
+ * The spans recorded by one thread.  Only that thread adds to it.
+ */
+struct TraceThreadBuffer {
+    DWORD threadId;                 //*< The thread that recorded the spans
+    std::vector<TraceEvent> events; //*< The spans, in the order they ended
+};
+
+static std::atomic<bool> s_tracing( false );
+static DWORD s_traceSlot = TLS_OUT_OF_INDEXES;
+static std::mutex s_traceLock;
+static std::vector<TraceThreadBuffer*> s_traceBuffers;
+static std::wstring s_tracePath;
+static LARGE_INTEGER s_traceFrequency;
+static LARGE_INTEGER s_traceOrigin;
+
+/**
+ * Return the calling thread's buffer, creating it on first use.
+ */
+static TraceThreadBuffer* CurrentTraceBuffer()
+{
+    TraceThreadBuffer* buffer = static_cast<TraceThreadBuffer*>( TlsGetValue( s_traceSlot ) );
+    if ( NULL == buffer ) {
+        buffer = new TraceThreadBuffer;
+        buffer->threadId = GetCurrentThreadId();
+        buffer->events.reserve( 64 );
+        TlsSetValue( s_traceSlot, buffer );
+
+        std::lock_guard<std::mutex> lock( s_traceLock );
+        s_traceBuffers.push_back( buffer );
+    }
+    return buffer;
+}
+
+TraceSpan::TraceSpan( __in const char* name ) : m_name( NULL ), m_start( 0 )
+{
+    if ( s_tracing.load( std::memory_order_relaxed ) ) {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter( &now );
+        m_name = name;
+        m_start = now.QuadPart;
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    End();
+}
+
+void TraceSpan::End()
+{
+    if ( NULL != m_name ) {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter( &now );
+        TraceEvent event = { m_name, m_start, now.QuadPart };
+        CurrentTraceBuffer()->events.push_back( event );
+        m_name = NULL;
+    }
+}
+
+void TraceStart( __in const wchar_t* path )
+{
+    if ( s_tracing ) {
+        return;
+    }
+
+    // A new slot each time, so that no thread sees a buffer from an
+    // earlier trace.
+    s_traceSlot = TlsAlloc();
+    if ( TLS_OUT_OF_INDEXES == s_traceSlot ) {
+        LogResult( HRESULT_FROM_WIN32( GetLastError() ), "TlsAlloc() failed, tracing is disabled." );
+        return;
+    }
+
+    s_tracePath = path;
+    QueryPerformanceFrequency( &s_traceFrequency );
+    QueryPerformanceCounter( &s_traceOrigin );
+    s_tracing = true;
+    LogResult( S_OK, "Tracing to '%ls'.", path );
+} // void TraceStart( const wchar_t* path )
+
+/**
+ * Convert a QueryPerformanceCounter() value to microseconds since TraceStart().
+ */
+static double TraceMicroseconds( __in LONGLONG ticks )
+{
+    return 1000000.0 * ( ticks - s_traceOrigin.QuadPart ) / s_traceFrequency.QuadPart;
+}
+
+HRESULT TraceStop()
+{
+    HRESULT hr = S_OK;
+
+    if ( !s_tracing ) {
+        return hr;
+    }
+    s_tracing = false;
+
+    std::lock_guard<std::mutex> lock( s_traceLock );
+    FILE* file = NULL;
+    size_t spans = 0;
+
+    if ( 0 != _wfopen_s( &file, s_tracePath.c_str(), L"w" ) ) {
+        hr = E_FAIL;
+        LogResult( hr, "Unable to open trace file '%ls'.", s_tracePath.c_str() );
+    } else {
+        // Chrome trace-event format; "X" events nest by time on each thread.
+        const DWORD processId = GetCurrentProcessId();
+        const char* separator = "";
+        fprintf_s( file, "{\"traceEvents\":[" );
+        for ( auto buffer = s_traceBuffers.begin(); buffer != s_traceBuffers.end(); ++buffer ) {
+            for ( auto event = (*buffer)->events.begin(); event != (*buffer)->events.end(); ++event ) {
+                fprintf_s( file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u}"
+                    , separator, event->name
+                    , TraceMicroseconds( event->start )
+                    , TraceMicroseconds( event->end ) - TraceMicroseconds( event->start )
+                    , processId, (*buffer)->threadId );
+                separator = ",";
+                ++spans;
+            }
+        }
+        fprintf_s( file, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+        if ( 0 != fclose( file ) ) {
+            hr = E_FAIL;
+            LogResult( hr, "Unable to write trace file '%ls'.", s_tracePath.c_str() );
+        } else {
+            LogResult( S_OK, "Wrote %u span(s) to trace file '%ls'.", static_cast<DWORD>( spans ), s_tracePath.c_str() );
+        }
+    }
+
+    for ( auto buffer = s_traceBuffers.begin(); buffer != s_traceBuffers.end(); ++buffer ) {
+        delete *buffer;
+    }
+    s_traceBuffers.clear();
+    TlsFree( s_traceSlot );
+    s_traceSlot = TLS_OUT_OF_INDEXES;
+
+    return hr;
+} // HRESULT TraceStop()
@@ -0,0 +1,62 @@
+/**
+ * Header file for timing the steps of a custom action.
+ *
+ * A TraceSpan records how long a step took.  Spans may be nested, and
+ * may be recorded from any thread.  When tracing is started, spans are
+ * kept in memory (one buffer per thread, so recording takes no lock)
+ * and written out by TraceStop() as a Chrome trace-event file, which
+ * can be viewed with chrome://tracing or https://ui.perfetto.dev.
+ *
+ * When tracing is not started, a span costs a single flag test.
+ */
+#pragma once
+
+/**
+ * Times a step from construction until End() or destruction.
+ *
+ * Typical use is:
+ *
+ *     TraceSpan span( "SetupDiCallClassInstaller" );
+ *     ... do the step ...
+ *     span.End();
+ *
+ * or, for a step that makes up a whole block, to let the destructor
+ * end the span.  A span ended by an exception is still recorded.
+ */
+class TraceSpan {
+public:
+    /**
+     * @param name The name of the step.  Only the pointer is kept, so
+     *             it must be a string literal or otherwise outlive the trace.
+     */
+    explicit TraceSpan( __in const char* name );
+    ~TraceSpan();
+
+    //* End the span now, rather than on destruction.
+    void End();
+
+private:
+    TraceSpan( const TraceSpan& );
+    TraceSpan& operator=( const TraceSpan& );
+
+    const char* m_name;     //*< The name of the step, or NULL if not tracing
+    LONGLONG m_start;       //*< QueryPerformanceCounter() when the span began
+};
+
+/**
+ * Start recording spans.
+ *
+ * @param path The trace file to be written by TraceStop().
+ */
+void TraceStart( __in const wchar_t* path );
+
+/**
+ * Stop recording spans and write them to the trace file.
+ *
+ * Threads that recorded spans must have finished before this is called.
+ * Does nothing if tracing was not started.
+ *
+ * @return Returns S_OK, or the error from writing the file.  The error is
+ *         also logged, but it should not fail the custom action.
+ */
+HRESULT TraceStop();
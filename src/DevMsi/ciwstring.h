@@ -5,30 +5,141 @@
  * "Case insensitive string comparison in C++"
  *
  * See http://stackoverflow.com/questions/11635/case-insensitive-string-comparison-in-c
+ *
+ * Hardware IDs are almost always ASCII, so compare() and find() fold
+ * and compare eight characters at a time with SSE2 when the compiler
+ * targets it.  Any block holding a non-ASCII character falls back to
+ * ci_fold(), which uses the system upper-case table.
  */
 //
 #pragma once
 #include <string>
 
+#if defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#  define CI_WSTRING_SSE2
+#  include <emmintrin.h>
+#endif
+
+/**
+ * Fold a wide character to upper case.
+ *
+ * ASCII characters are folded inline.  Other characters are folded
+ * with the system upper-case table via CharUpperW().
+ *
+ * @param c The character to be folded.
+ * @return Returns the upper-case version of the character.
+ */
+inline wchar_t ci_fold( wchar_t c ) {
+    if ( c < 0x80 ) {
+        return ( c >= L'a' && c <= L'z' ) ? static_cast<wchar_t>( c - ( L'a' - L'A' ) ) : c;
+    }
+    // CharUpperW() folds a single character when the high word is zero.
+    return static_cast<wchar_t>( reinterpret_cast<ULONG_PTR>(
+        CharUpperW( reinterpret_cast<LPWSTR>( static_cast<ULONG_PTR>( c ) ) ) ) );
+}
+
+#ifdef CI_WSTRING_SSE2
+/**
+ * Fold eight ASCII characters to upper case.
+ *
+ * @param v The characters to be folded.
+ * @param ascii Set to false if any character is not ASCII, in which
+ *              case the result must not be used.
+ * @return Returns the upper-case characters.
+ */
+inline __m128i ci_fold8( __m128i v, bool& ascii ) {
+    // Every bit above the low seven of each character must be clear.
+    ascii = ( 0xFFFF == _mm_movemask_epi8( _mm_cmpeq_epi16(
+        _mm_and_si128( v, _mm_set1_epi16( static_cast<short>( 0xFF80 ) ) ), _mm_setzero_si128() ) ) );
+    __m128i lower = _mm_and_si128(
+        _mm_cmpgt_epi16( v, _mm_set1_epi16( L'a' - 1 ) ),
+        _mm_cmplt_epi16( v, _mm_set1_epi16( L'z' + 1 ) ) );
+    return _mm_sub_epi16( v, _mm_and_si128( lower, _mm_set1_epi16( L'a' - L'A' ) ) );
+}
+
+/**
+ * Return the index of the first set 16-bit lane in a byte mask
+ * from _mm_movemask_epi8().
+ */
+inline size_t ci_first_lane( int mask ) {
+    size_t lane = 0;
+    while ( 0 == ( mask & 3 ) ) {
+        mask >>= 2;
+        ++lane;
+    }
+    return lane;
+}
+#endif // CI_WSTRING_SSE2
+
 struct ci_wchar_t_traits : public std::char_traits<wchar_t> {
-    static bool eq(wchar_t c1, wchar_t c2) { return toupper(c1) == toupper(c2); }
-    static bool ne(wchar_t c1, wchar_t c2) { return toupper(c1) != toupper(c2); }
-    static bool lt(wchar_t c1, wchar_t c2) { return toupper(c1) <  toupper(c2); }
+    static bool eq(wchar_t c1, wchar_t c2) { return ci_fold(c1) == ci_fold(c2); }
+    static bool ne(wchar_t c1, wchar_t c2) { return ci_fold(c1) != ci_fold(c2); }
+    static bool lt(wchar_t c1, wchar_t c2) { return ci_fold(c1) <  ci_fold(c2); }
     static int compare(const wchar_t* s1, const wchar_t* s2, size_t n) {
+#ifdef CI_WSTRING_SSE2
+        while( n >= 8 ) {
+            bool ascii1, ascii2;
+            __m128i v1 = ci_fold8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( s1 ) ), ascii1 );
+            __m128i v2 = ci_fold8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( s2 ) ), ascii2 );
+            if ( !ascii1 || !ascii2 ) {
+                break;
+            }
+            int diff = 0xFFFF & ~_mm_movemask_epi8( _mm_cmpeq_epi16( v1, v2 ) );
+            if ( 0 != diff ) {
+                size_t lane = ci_first_lane( diff );
+                return ( ci_fold( s1[lane] ) < ci_fold( s2[lane] ) ) ? -1 : 1;
+            }
+            s1 += 8; s2 += 8; n -= 8;
+        }
+#endif // CI_WSTRING_SSE2
         while( n-- != 0 ) {
-            if( toupper(*s1) < toupper(*s2) ) return -1;
-            if( toupper(*s1) > toupper(*s2) ) return 1;
+            wchar_t c1 = ci_fold(*s1), c2 = ci_fold(*s2);
+            if( c1 < c2 ) return -1;
+            if( c1 > c2 ) return 1;
             ++s1; ++s2;
         }
         return 0;
     }
-    static const wchar_t* find(const wchar_t* s, int n, wchar_t a) {
-        while( n-- > 0 && toupper(*s) != toupper(a) ) {
-            ++s;
+    static const wchar_t* find(const wchar_t* s, size_t n, wchar_t a) {
+        const wchar_t folded = ci_fold(a);
+#ifdef CI_WSTRING_SSE2
+        const __m128i target = _mm_set1_epi16( static_cast<short>( folded ) );
+        while( n >= 8 ) {
+            bool ascii;
+            __m128i v = ci_fold8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( s ) ), ascii );
+            if ( !ascii ) {
+                break;
+            }
+            int hits = _mm_movemask_epi8( _mm_cmpeq_epi16( v, target ) );
+            if ( 0 != hits ) {
+                return s + ci_first_lane( hits );
+            }
+            s += 8; n -= 8;
+        }
+#endif // CI_WSTRING_SSE2
+        for( ; n > 0; --n, ++s ) {
+            if ( ci_fold(*s) == folded ) {
+                return s;
+            }
         }
-        return (n >= 0 ? s : NULL);
+        return NULL;
     }
 };
 
 //* Wide string class with case-insensitive compares.
 typedef std::basic_string<wchar_t, ci_wchar_t_traits> ci_wstring;
+
+/**
+ * Case-insensitive hash for ci_wstring, so that it can be used as a key
+ * in unordered containers.  Strings that compare equal hash equally.
+ */
+struct ci_wstring_hash {
+    size_t operator()( const ci_wstring& s ) const {
+        // 32-bit FNV-1a over the folded characters.
+        size_t hash = 2166136261U;
+        for ( ci_wstring::const_iterator iter = s.begin(); iter != s.end(); ++iter ) {
+            hash = ( hash ^ static_cast<size_t>( ci_fold( *iter ) ) ) * 16777619U;
+        }
+        return hash;
+    }
+};
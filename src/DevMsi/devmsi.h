@@ -6,6 +6,23 @@
  * The former routes through "C" interface functions defined in 
  * CustomAction.def.  The latter uses the interfaces defined here.
  *
+ * Arguments of the form "key=value" are named arguments.  They are
+ * not counted in the argc requirements below, and functions ignore
+ * named arguments they do not use.
+ *
+ * Every function that changes the system takes budget=<milliseconds>,
+ * the time it may take.  Steps that fail because the PnP manager or the
+ * Service Control Manager is busy (e.g. ERROR_SERVICE_DATABASE_LOCKED)
+ * are retried with a randomized, growing delay, a few times and while
+ * the budget lasts.  Once the budget is spent, the devices or services
+ * not yet handled are left alone and reported as failed with
+ * ERROR_TIMEOUT, and a device scan stops where it is.  Without budget=,
+ * there is no limit, but retries are still made.
+ *
+ * When called as a MSI custom action, the "logfile", "logfilesize",
+ * "logfiles", "logoverflow" and "trace" named arguments also control
+ * logging and tracing; see StartCustomActionLogging() in CustomAction.cpp.
+ *
  * This header is suitable for inclusion by a project wanting to
  * call these methods.  Note that _DEVMSI_EXPORTS should not be
  * defined for the accessing application source code.
@@ -34,6 +51,37 @@
  *
  * argv[1] is the device name to be created, e.g. "\root\foo"
  *
+ * If an INF file is given and none of its models lists the device name
+ * as a hardware or compatible ID, a warning is logged, but the device
+ * is still created.
+ *
+ * Unless an INF file is given, the device tree is then re-enumerated
+ * so that the new device gets a driver.  This is controlled by the
+ * named arguments:
+ *
+ * reenum=tree       Re-enumerate the whole device tree, and wait for it.
+ *                   This is the default.
+ * reenum=subtree    Re-enumerate only the new device itself, and wait for it.
+ * wait=<ms>         Then wait up to this long for the new device to start.
+ *                   How long it took, or the state of the device if it did
+ *                   not start, is logged.  A device that does not start in
+ *                   time is not an error.
+ * snapshot=<path>   Delete the device snapshot written by DoRemoveDevnode()
+ *                   if a device is created, since it does not list it.
+ * ensure=1          Do not create a device if one of the class with the
+ *                   hardware ID is already present (e.g. from an earlier
+ *                   install), and log it as already present.  Its driver is
+ *                   still installed and the device tree re-enumerated, as
+ *                   for a new device, so a repair or upgrade that carries a
+ *                   new driver still updates it.  Without this, a repair or
+ *                   upgrade creates another ROOT\<class>\000N device each time.
+ * force=1           Install the driver from the INF file even if it is
+ *                   already installed.  Otherwise, if every device with the
+ *                   hardware ID that has a driver has this package (the
+ *                   same DriverVer, INF and catalog), the driver is not
+ *                   installed again, and the new device gets it from the
+ *                   driver store when the device tree is re-enumerated.
+ *
  * @param argc  The count of valid arguments in argv.
  * @param argv  An array of string arguments for the function.
  * @return Returns an HRESULT indicating success or failure.
@@ -41,18 +89,89 @@
 HRESULT DEVMSI_API DoCreateDevnode( int argc, LPWSTR* argv );
 
 
+/**
+ * Create several new device nodes in device manager.
+ *
+ * This does the work of several calls to DoCreateDevnode(), but each
+ * class is looked up once, devices of the same class share one device
+ * information set, and the device tree is re-enumerated at most once,
+ * after all of the devices have been created.
+ *
+ * For this function, the following are valid values for
+ * the argv and argc parameters:
+ *
+ * argc MUST be a non-zero multiple of 2.
+ *
+ * argv[0], argv[2], ... are the classes of the devices, as for
+ * argv[0] of DoCreateDevnode().
+ *
+ * argv[1], argv[3], ... are the device names to be created, e.g.
+ * "\root\foo".  A device may be given several hardware IDs, separated
+ * by semicolons, e.g. "\root\foo;\root\foo_v2".  An INF driver is
+ * installed for the first of them.
+ *
+ * The reenum, wait, snapshot, ensure and force named arguments are as for DoCreateDevnode(),
+ * and apply to all of the new devices that have no INF file.
+ *
+ * The outcome for each device is written to the log.  A failure to
+ * create one device does not stop the creation of the others; the
+ * first failure is returned.
+ *
+ * @param argc  The count of valid arguments in argv.
+ * @param argv  An array of string arguments for the function.
+ * @return Returns an HRESULT indicating success or failure.
+ */
+HRESULT DEVMSI_API DoCreateDevnodes( int argc, LPWSTR* argv );
+
+
 /**
  * Remove device node(s) from device manager.
  *
  * This method will search and remove any matching device nodes
- * from the system (e.g. Device Manager).
+ * from the system (e.g. Device Manager).  The device tree is
+ * enumerated once, no matter how many device names are given.
  *
  * For this function, the following are valid values for
  * the argv and argc parameters:
  *
- * argc MUST be 1.
- *
- * argv[0] is the device name to be removed, e.g. "\root\foo"
+ * argc MUST be 1 or more.
+ *
+ * argv[0..argc-1] are the device names to be removed, e.g. "\root\foo"
+ *
+ * Device names may also be given as named arguments, which may be
+ * repeated:  hwid=\root\foo hwid=\root\bar
+ *
+ * Device names are matched exactly (ignoring case), even if they contain
+ * '*' or '?', as the ACPI ID "*PNP0303" does.  Wildcard patterns are
+ * given with pattern=, which may be repeated, e.g. pattern=ROOT\OURVENDOR_*,
+ * where '*' matches any run of characters and '?' any one character.
+ * patterns=<path> adds the patterns listed in a file, one per line;
+ * blank lines and lines starting with ';' are skipped.  However many
+ * patterns are given, each ID of each device is matched in one pass.
+ *
+ * The devices read can be narrowed by hints, and the plan chosen is
+ * written to the log.  instance=<instance ID> (repeatable) opens just
+ * those devices.  enumerator=<name> (e.g. "ROOT" or "PCI") reads only the
+ * devices of that enumerator.  class=<name or GUID> reads only the devices
+ * of that setup class.  These hints are trusted:  a matching device outside
+ * them is not removed.  Nothing is inferred from the device names; without
+ * hints, every present device is read.
+ *
+ * threads=N fetches and matches the IDs of the devices on N threads
+ * (default 1, at most 64).  Devices are still removed one at a time.
+ *
+ * snapshot=<path> shares the scan between the custom actions of an
+ * install.  If the file holds a snapshot no older than snapshotage=<seconds>
+ * (default 600), the device names are looked up in it instead of scanning
+ * the device tree, and each device found is checked before it is removed.
+ * The devices removed, or found to be gone, are then taken out of the
+ * snapshot, which keeps its age.  Otherwise, the devices scanned are
+ * written to it, less those removed, if every device was read.
+ * instance=, enumerator= and class= do not use the snapshot.
+ *
+ * The outcome for each device name is written to the log.  A failure
+ * to remove one device does not stop the removal of the others; the
+ * first failure is returned.
  *
  * @param argc  The count of valid arguments in argv.
  * @param argv  An array of string arguments for the function.
@@ -62,17 +181,36 @@ HRESULT DEVMSI_API DoRemoveDevnode( int argc, LPWSTR* argv );
 
 
 /**
- * Remove a service from the system.
+ * Remove service(s) from the system.
  *
- * This method will search and remove a matching
- * service from the system, based on name.
+ * This method will search and remove the matching
+ * services from the system, based on name.  One connection to the
+ * Service Control Manager is used for all of them.
  *
  * For this function, the following are valid values for
  * the argv and argc parameters:
  *
- * argc MUST be 1.
+ * argc MUST be 1 or more.
+ *
+ * argv[0..argc-1] are the service names to be deleted.  Names may also
+ * be given as named arguments, which may be repeated:
+ * service=foo service=bar
+ *
+ * Names are matched exactly (ignoring case), even if they contain '*'
+ * or '?'.  Wildcard patterns are given with pattern=, which may be
+ * repeated, e.g. pattern=OurVendor*, to delete every installed service
+ * that matches; '*' matches any run of characters and '?' any one
+ * character.
+ *
+ * With stop=1, the services are stopped before they are deleted.  Any
+ * running service that depends on one of them is stopped first (but not
+ * deleted).  Services that do not depend on each other stop at the same
+ * time; each is given timeout=<milliseconds> to stop, 30000 by default.
+ * A service that does not stop is still deleted, once it stops.
  *
- * argv[0] is the service name to be deleted.
+ * A service that does not exist is not an error.  The outcome for each
+ * name is written to the log.  A failure to delete one service does not
+ * stop the deletion of the others; the first failure is returned.
  *
  * @param argc  The count of valid arguments in argv.
  * @param argv  An array of string arguments for the function.
@@ -12,7 +12,6 @@
 #include <windows.h>
 #include <strsafe.h>
 #include <msiquery.h>
-#include <Shellapi.h>
 
 
 void LogResult(
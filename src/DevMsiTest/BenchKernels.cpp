@@ -0,0 +1,253 @@
+#include "stdafx.h"
+#include "BenchKernels.h"
+#include "../DevMsi/LogResult.h"
+#include "../DevMsi/CheckResult.h"
+#include "../DevMsi/ciwstring.h"
+#include "../DevMsi/ArgList.h"
+#include "../DevMsi/ClassArg.h"
+#include "../DevMsi/DeviceProperty.h"
+#include "../DevMsi/ErrorText.h"
+#include "../DevMsi/GuidStrHelpers.h"
+#include <vector>
+#include <string>
+#include <stdio.h>
+#ifdef _DEBUG
+#  include <crtdbg.h>
+#endif // _DEBUG
+
+/**
+ * The measurements of one kernel.
+ */
+struct KernelResult {
+    const char* name;       //*< The kernel name, as written to the JSON
+    double nsPerOp;         //*< The mean time per call, in nanoseconds
+    double allocsPerOp;     //*< The mean heap allocations per call, or -1 if not counted
+};
+
+/**
+ * Folded into by every kernel, so that the compiler cannot drop the work.
+ */
+static volatile size_t s_sink = 0;
+
+#ifdef _DEBUG
+/**
+ * The number of heap allocations seen by KernelAllocHook().
+ */
+static volatile LONG s_allocCount = 0;
+
+/**
+ * Count heap allocations made through the debug CRT.
+ */
+static int __cdecl KernelAllocHook( int allocType, void*, size_t, int, long, const unsigned char*, int )
+{
+    if ( _HOOK_ALLOC == allocType || _HOOK_REALLOC == allocType ) {
+        InterlockedIncrement( &s_allocCount );
+    }
+    return TRUE;
+}
+#endif // _DEBUG
+
+/**
+ * Time a kernel over a number of calls, after a warm-up pass that lets
+ * caches and reused buffers reach their steady state.
+ *
+ * Heap allocations are only counted in debug builds, which have the
+ * allocation hook; release builds report -1.
+ *
+ * @param name The kernel name.
+ * @param iterations The number of timed calls.
+ * @param kernel Called with the call number; returns a value for s_sink.
+ */
+template<typename Kernel>
+KernelResult RunKernel( __in const char* name, __in DWORD iterations, __in Kernel kernel )
+{
+    KernelResult result = { name, 0.0, -1.0 };
+    LARGE_INTEGER frequency, start, end;
+    size_t sink = 0;
+
+    for ( DWORD i = 0; i < iterations / 10 + 1; ++i ) {
+        sink += kernel( i );
+    }
+
+#ifdef _DEBUG
+    s_allocCount = 0;
+    _CRT_ALLOC_HOOK previousHook = _CrtSetAllocHook( KernelAllocHook );
+#endif // _DEBUG
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &start );
+    for ( DWORD i = 0; i < iterations; ++i ) {
+        sink += kernel( i );
+    }
+    QueryPerformanceCounter( &end );
+#ifdef _DEBUG
+    _CrtSetAllocHook( previousHook );
+    result.allocsPerOp = static_cast<double>( s_allocCount ) / iterations;
+#endif // _DEBUG
+
+    s_sink += sink;
+    result.nsPerOp = 1e9 * ( end.QuadPart - start.QuadPart ) / frequency.QuadPart / iterations;
+    if ( 0.0 > result.allocsPerOp ) {
+        LogResult( S_OK, "%-24s %10.1f ns/op", name, result.nsPerOp );
+    } else {
+        LogResult( S_OK, "%-24s %10.1f ns/op %8.2f allocs/op", name, result.nsPerOp, result.allocsPerOp );
+    }
+    return result;
+} // KernelResult RunKernel( const char* name, DWORD iterations, Kernel kernel )
+
+/**
+ * Write the results as JSON.
+ */
+static HRESULT WriteKernelJson( __in const wchar_t* path, __in DWORD iterations, __in const std::vector<KernelResult>& results )
+{
+    FILE* file = NULL;
+    if ( 0 != _wfopen_s( &file, path, L"wt" ) ) {
+        HRESULT hr = HRESULT_FROM_WIN32( ERROR_OPEN_FAILED );
+        LogResult( hr, "Unable to create '%ls'.", path );
+        return hr;
+    }
+
+    fprintf( file, "{\n  \"iterations\": %u,\n", iterations );
+#ifdef _DEBUG
+    fprintf( file, "  \"build\": \"debug\",\n" );
+#else
+    fprintf( file, "  \"build\": \"release\",\n" );
+#endif // _DEBUG
+    fprintf( file, "  \"kernels\": [\n" );
+    for ( size_t i = 0; i < results.size(); ++i ) {
+        fprintf( file, "    { \"name\": \"%s\", \"ns_per_op\": %.2f, \"allocs_per_op\": ", results[i].name, results[i].nsPerOp );
+        if ( 0.0 > results[i].allocsPerOp ) {
+            fprintf( file, "null }" );
+        } else {
+            fprintf( file, "%.2f }", results[i].allocsPerOp );
+        }
+        fprintf( file, "%s\n", i + 1 < results.size() ? "," : "" );
+    }
+    fprintf( file, "  ]\n}\n" );
+
+    HRESULT hr = ferror( file ) ? HRESULT_FROM_WIN32( ERROR_WRITE_FAULT ) : S_OK;
+    fclose( file );
+    if ( FAILED( hr ) ) {
+        LogResult( hr, "Unable to write '%ls'.", path );
+    }
+    return hr;
+} // HRESULT WriteKernelJson( const wchar_t* path, DWORD iterations, const std::vector<KernelResult>& results )
+
+HRESULT BenchmarkKernels( __in int argc, __in LPWSTR* argv )
+{
+    HRESULT hr = S_OK;
+
+    try
+    {
+        ArgList args( argc, argv );
+        DWORD iterations = args.NamedNumber( L"iterations", 100000 );
+        const wchar_t* jsonPath = args.Named( L"json" );
+        if ( 0 == iterations ) {
+            throw std::runtime_error( "BenchmarkKernels() requires iterations= to be at least 1" );
+        }
+
+        // Inputs are what the actions see on a typical machine:  PCI and
+        // root-enumerated hardware IDs, the three kinds of class argument,
+        // and CustomActionData as WiX passes it.
+        static const wchar_t* const hardwareIds[] = {
+            L"PCI\\VEN_8086&DEV_1C3A&SUBSYS_1C3A8086&REV_04",
+            L"PCI\\VEN_8086&DEV_1C3A&SUBSYS_1C3A8086",
+            L"PCI\\VEN_8086&DEV_1C3A&CC_078000",
+            L"PCI\\VEN_8086&DEV_1C3A&CC_0780",
+            L"PCI\\VEN_8086&DEV_1C3A",
+        };
+        const size_t hardwareIdCount = sizeof( hardwareIds ) / sizeof( hardwareIds[0] );
+        const ci_wstring targetId( L"pci\\ven_8086&dev_1c3a&subsys_1c3a8086&rev_04" );
+        const ci_wstring rootId( L"ROOT\\OurVendorVirtualBus" );
+        const std::wstring classArgs[] = {
+            L"System",
+            L"{4d36e97d-e325-11ce-bfc1-08002be10318}",
+            L"C:\\Program Files\\OurVendor\\Drivers\\ourbus.inf",
+        };
+        const GUID classGuid = { 0x4d36e97d, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } };
+        const std::wstring classGuidStr( classArgs[1] );
+        const std::wstring customActionData(
+            L"\"C:\\Program Files\\OurVendor\\Drivers\\ourbus.inf\" ROOT\\OurVendorVirtualBus"
+            L" ensure=1 logfile=\"C:\\Windows\\Temp\\OurVendor Setup.log\"" );
+
+        // The hardware IDs as the REG_MULTI_SZ value SetupAPI returns.
+        std::vector<wchar_t> multiSz;
+        for ( size_t i = 0; i < hardwareIdCount; ++i ) {
+            multiSz.insert( multiSz.end(), hardwareIds[i], hardwareIds[i] + wcslen( hardwareIds[i] ) + 1 );
+        }
+        multiSz.push_back( L'\0' );
+
+        // Scratch that lives for the whole run, as it does for a device scan.
+        DevicePropertyBuffer propertyBuffer;
+        DevicePropertyList items;
+        std::vector<wchar_t> dataCopy( customActionData.size() + 1 );
+        std::vector<LPWSTR> splitArgs;
+        char logBuffer[LOG_RECORD_TEXT];
+        GUID parsedGuid;
+        const wchar_t* canonicalName = NULL;
+
+        LogResult( S_OK, "Benchmarking kernels, %u iteration(s) each.", iterations );
+        std::vector<KernelResult> results;
+
+        results.push_back( RunKernel( "ci_compare", iterations, [&]( DWORD ) -> size_t {
+            return 0 == targetId.compare( hardwareIds[0] ) ? 1 : 0;
+        } ) );
+        results.push_back( RunKernel( "ci_compare_mismatch", iterations, [&]( DWORD i ) -> size_t {
+            return static_cast<size_t>( rootId.compare( hardwareIds[i % hardwareIdCount] ) );
+        } ) );
+        results.push_back( RunKernel( "ci_find", iterations, [&]( DWORD ) -> size_t {
+            return targetId.find( L"&SUBSYS_" );
+        } ) );
+        results.push_back( RunKernel( "multi_sz_split", iterations, [&]( DWORD ) -> size_t {
+            propertyBuffer.Assign( items, &multiSz[0], static_cast<DWORD>( multiSz.size() * sizeof( wchar_t ) ), REG_MULTI_SZ );
+            return items.size();
+        } ) );
+        results.push_back( RunKernel( "class_arg_type", iterations, [&]( DWORD i ) -> size_t {
+            return GetClassArgType( classArgs[i % 3] );
+        } ) );
+        results.push_back( RunKernel( "guid_to_str", iterations, [&]( DWORD ) -> size_t {
+            return GUID2Str( classGuid ).size();
+        } ) );
+        results.push_back( RunKernel( "str_to_guid", iterations, [&]( DWORD ) -> size_t {
+            return TryStr2GUID( classGuidStr, parsedGuid ) ? parsedGuid.Data1 : 0;
+        } ) );
+        results.push_back( RunKernel( "well_known_class_guid", iterations, [&]( DWORD ) -> size_t {
+            return WellKnownClassName2GUID( classArgs[0], parsedGuid, &canonicalName ) ? parsedGuid.Data1 : 0;
+        } ) );
+        results.push_back( RunKernel( "split_custom_action_data", iterations, [&]( DWORD ) -> size_t {
+            // The split works in place, so it starts from a fresh copy each time.
+            memcpy( &dataCopy[0], customActionData.c_str(), dataCopy.size() * sizeof( wchar_t ) );
+            SplitCustomActionData( &dataCopy[0], splitArgs );
+            return splitArgs.size();
+        } ) );
+        results.push_back( RunKernel( "log_format", iterations, [&]( DWORD i ) -> size_t {
+            LogFormat( logBuffer, "Device '%ls' matched hardware ID '%ls' (%u of %u).", hardwareIds[0], hardwareIds[i % hardwareIdCount], i, iterations );
+            return static_cast<size_t>( logBuffer[0] );
+        } ) );
+        results.push_back( RunKernel( "error_text", iterations, [&]( DWORD ) -> size_t {
+            return reinterpret_cast<size_t>( ErrorText( HRESULT_FROM_WIN32( ERROR_FILE_NOT_FOUND ) ) );
+        } ) );
+
+        if ( NULL != jsonPath ) {
+            hr = WriteKernelJson( jsonPath, iterations, results );
+            CheckResult( hr, "Unable to write the benchmark results." );
+            LogResult( S_OK, "Wrote the benchmark results to '%ls'.", jsonPath );
+        }
+        LogResult( hr, "BenchmarkKernels() Complete." );
+    }
+    catch( HRESULT& _error )
+    {
+        hr = _error;
+    }
+    catch( const std::exception& _error )
+    {
+        hr = E_FAIL;
+        LogResult( hr, _error.what() );
+    }
+    catch( ... )
+    {
+        hr = E_FAIL;
+        LogResult( hr, "Unhandled C++ exception" );
+    }
+
+    return hr;
+} // HRESULT BenchmarkKernels( int argc, LPWSTR* argv )
@@ -0,0 +1,25 @@
+/**
+ * Header file for the kernel benchmark run by "DevMsiTest kernels".
+ */
+#pragma once
+
+/**
+ * Time the string and parsing helpers that the DevMsi functions rely on,
+ * to track their cost between releases.  Each helper is called with
+ * typical inputs (case-insensitive hardware ID compares, REG_MULTI_SZ
+ * splitting, class argument and GUID parsing, CustomActionData splitting,
+ * log message formatting and error text lookup), and the mean time per
+ * call is logged.  Debug builds also count the heap allocations per call.
+ *
+ * The helpers are DevMsi's own sources, compiled into DevMsiTest.
+ *
+ * All arguments are named:
+ * iterations=<count> The number of timed calls of each helper, 100000 by default.
+ * json=<path> Also write the results to a JSON file, with "ns_per_op" and
+ *             "allocs_per_op" (null for release builds) for each helper.
+ *
+ * @param argc  The count of arguments following "kernels".
+ * @param argv  The arguments following "kernels".
+ * @return Returns an HRESULT indicating success or failure.
+ */
+HRESULT BenchmarkKernels( __in int argc, __in LPWSTR* argv );
@@ -0,0 +1,189 @@
+#include "stdafx.h"
+#include "BenchSnapshot.h"
+#include "../DevMsi/LogResult.h"
+#include "../DevMsi/CheckResult.h"
+#include "../DevMsi/ciwstring.h"
+#include "../DevMsi/AutoClose.h"
+#include "../DevMsi/DeviceProperty.h"
+#include "../DevMsi/DeviceSnapshot.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+
+/**
+ * The instance IDs of the devices with each requested ID, sorted.
+ */
+typedef std::vector<std::vector<std::wstring> > DeviceSets;
+
+/**
+ * Return the milliseconds between two performance counter readings.
+ */
+static double ElapsedMs( __in const LARGE_INTEGER& start, __in const LARGE_INTEGER& end )
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency( &frequency );
+    return 1000.0 * ( end.QuadPart - start.QuadPart ) / frequency.QuadPart;
+}
+
+/**
+ * Scan the present devices for the requested IDs, and record every
+ * device in a snapshot writer, as DoRemoveDevnode() does.
+ */
+static DWORD ScanDevices( __in const std::vector<LPCWSTR>& hwIds, __out DeviceSets& found, __inout DeviceSnapshotWriter& writer )
+{
+    AutoCloseDeviceInfoList devs;
+    SP_DEVINFO_DATA devInfo = { sizeof(SP_DEVINFO_DATA) };
+    DevicePropertyBuffer propBuffer;
+    DevicePropertyList ids;
+    static const DWORD props[] = { SPDRP_HARDWAREID, SPDRP_COMPATIBLEIDS };
+    DWORD devIndex = 0;
+
+    found.assign( hwIds.size(), std::vector<std::wstring>() );
+    devs = SetupDiGetClassDevsEx( NULL, NULL, NULL, DIGCF_ALLCLASSES | DIGCF_PRESENT, NULL, NULL, NULL );
+    if ( INVALID_HANDLE_VALUE == devs ) {
+        HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
+        CheckResult( hr, "SetupDiGetClassDevsEx(DIGCF_PRESENT) failed." );
+    }
+    for ( devIndex = 0; SetupDiEnumDeviceInfo( devs, devIndex, &devInfo ); ++devIndex ) {
+        wchar_t devID[MAX_DEVICE_ID_LEN];
+        if ( CR_SUCCESS != CM_Get_Device_ID( devInfo.DevInst, devID, MAX_DEVICE_ID_LEN, 0 ) ) {
+            continue;
+        }
+        writer.BeginDevice( devID );
+        for ( size_t prop = 0; prop < _countof(props); ++prop ) {
+            propBuffer.Get( ids, devs, devInfo, props[prop] );
+            writer.AddIds( ids );
+            for ( auto id = ids.begin(); id != ids.end(); ++id ) {
+                for ( size_t i = 0; i < hwIds.size(); ++i ) {
+                    if ( 0 == ci_wstring( *id ).compare( hwIds[i] ) ) {
+                        found[i].push_back( devID );
+                    }
+                }
+            }
+        }
+    }
+    for ( auto iter = found.begin(); iter != found.end(); ++iter ) {
+        std::sort( iter->begin(), iter->end() );
+        iter->erase( std::unique( iter->begin(), iter->end() ), iter->end() );
+    }
+    return devIndex;
+} // static DWORD ScanDevices(...)
+
+/**
+ * Look the requested IDs up in a snapshot.
+ */
+static void LookUpDevices( __in DeviceSnapshot& snapshot, __in const std::vector<LPCWSTR>& hwIds, __out DeviceSets& found )
+{
+    std::vector<const wchar_t*> instanceIds;
+    found.assign( hwIds.size(), std::vector<std::wstring>() );
+    for ( size_t i = 0; i < hwIds.size(); ++i ) {
+        instanceIds.clear();
+        snapshot.Find( hwIds[i], instanceIds );
+        found[i].assign( instanceIds.begin(), instanceIds.end() );
+        std::sort( found[i].begin(), found[i].end() );
+        found[i].erase( std::unique( found[i].begin(), found[i].end() ), found[i].end() );
+    }
+}
+
+/**
+ * Log every device that one set has and the other does not.
+ *
+ * @return Returns the number of such devices.
+ */
+static DWORD CompareDevices( __in const std::vector<LPCWSTR>& hwIds, __in const DeviceSets& expected, __in const DeviceSets& actual, __in const char* what )
+{
+    DWORD differences = 0;
+    for ( size_t i = 0; i < hwIds.size(); ++i ) {
+        std::vector<std::wstring> missing, extra;
+        std::set_difference( expected[i].begin(), expected[i].end(), actual[i].begin(), actual[i].end(), std::back_inserter( missing ) );
+        std::set_difference( actual[i].begin(), actual[i].end(), expected[i].begin(), expected[i].end(), std::back_inserter( extra ) );
+        for ( auto iter = missing.begin(); iter != missing.end(); ++iter ) {
+            LogResult( E_FAIL, "%s: '%ls' does not find device '%ls'.", what, hwIds[i], iter->c_str() );
+        }
+        for ( auto iter = extra.begin(); iter != extra.end(); ++iter ) {
+            LogResult( E_FAIL, "%s: '%ls' finds device '%ls', which it should not.", what, hwIds[i], iter->c_str() );
+        }
+        differences += static_cast<DWORD>( missing.size() + extra.size() );
+    }
+    return differences;
+}
+
+HRESULT CheckSnapshotAgainstScan( __in int argc, __in LPWSTR* argv )
+{
+    HRESULT hr = E_FAIL;
+
+    try
+    {
+        if ( argc < 2 ) {
+            throw std::runtime_error( "snapshot requires a snapshot path and at least one hardware ID" );
+        }
+        const wchar_t* path = argv[0];
+        std::vector<LPCWSTR> hwIds( argv + 1, argv + argc );
+        DeviceSets scanned, looked, expected;
+        DeviceSnapshotWriter writer;
+        DeviceSnapshot snapshot;
+        LARGE_INTEGER start, scanEnd, lookupEnd;
+
+        QueryPerformanceCounter( &start );
+        DWORD devices = ScanDevices( hwIds, scanned, writer );
+        QueryPerformanceCounter( &scanEnd );
+        CheckResult( writer.Write( path ), "Unable to write the snapshot." );
+        if ( !snapshot.Open( path, 600 ) ) {
+            throw std::runtime_error( "The snapshot just written could not be opened." );
+        }
+        LARGE_INTEGER lookupStart;
+        QueryPerformanceCounter( &lookupStart );
+        LookUpDevices( snapshot, hwIds, looked );
+        QueryPerformanceCounter( &lookupEnd );
+        DWORD differences = CompareDevices( hwIds, scanned, looked, "Snapshot" );
+        LogResult( S_OK, "Scanned %u device(s) in %.2f ms; looked up %u ID(s) in the snapshot in %.3f ms."
+            , devices, ElapsedMs( start, scanEnd ), static_cast<DWORD>( hwIds.size() ), ElapsedMs( lookupStart, lookupEnd ) );
+
+        // Take the devices of the first ID out, as a removal would.
+        DeviceSnapshotWriter rewriter;
+        snapshot.CopyTo( rewriter );
+        snapshot.Close();
+        const std::vector<std::wstring> removed( scanned[0] );
+        for ( auto iter = removed.begin(); iter != removed.end(); ++iter ) {
+            rewriter.Exclude( iter->c_str() );
+        }
+        CheckResult( rewriter.Write( path ), "Unable to write the snapshot again." );
+        if ( !snapshot.Open( path, 600 ) ) {
+            throw std::runtime_error( "The snapshot written again could not be opened." );
+        }
+        LookUpDevices( snapshot, hwIds, looked );
+        expected.assign( hwIds.size(), std::vector<std::wstring>() );
+        for ( size_t i = 0; i < hwIds.size(); ++i ) {
+            std::set_difference( scanned[i].begin(), scanned[i].end(), removed.begin(), removed.end(), std::back_inserter( expected[i] ) );
+        }
+        differences += CompareDevices( hwIds, expected, looked, "Snapshot less removed devices" );
+        if ( snapshot.DeviceCount() + removed.size() != devices ) {
+            ++differences;
+            LogResult( E_FAIL, "The snapshot written again holds %u device(s), not %u."
+                , snapshot.DeviceCount(), static_cast<DWORD>( devices - removed.size() ) );
+        }
+        snapshot.Close();
+        DeleteFileW( path );
+
+        hr = ( 0 == differences ) ? S_OK : E_FAIL;
+        LogResult( hr, "The snapshot %s the scan; %u device(s) taken out of it.", 0 == differences ? "agrees with" : "does not agree with"
+            , static_cast<DWORD>( removed.size() ) );
+    }
+    catch( HRESULT& _error )
+    {
+        hr = _error;
+    }
+    catch( const std::exception& _error )
+    {
+        hr = E_FAIL;
+        LogResult( hr, _error.what() );
+    }
+    catch( ... )
+    {
+        hr = E_FAIL;
+        LogResult( hr, "Unhandled C++ exception" );
+    }
+
+    return hr;
+} // HRESULT CheckSnapshotAgainstScan( int argc, LPWSTR* argv )
@@ -0,0 +1,27 @@
+/**
+ * Header file for the snapshot check run by "DevMsiTest snapshot".
+ */
+#pragma once
+
+/**
+ * Check the device snapshot that DoRemoveDevnode() shares between custom
+ * actions against a scan of the devices of this machine, and time both.
+ *
+ * The present devices are scanned, as DoRemoveDevnode() scans them, and
+ * written to a snapshot.  Each hardware ID is then looked up in the
+ * snapshot, which must find the same devices as the scan.  Last, the
+ * snapshot is written again without the devices of the first ID, as
+ * DoRemoveDevnode() does once it has removed them, and the IDs are
+ * looked up again:  the first must find nothing, and the others must
+ * find what the scan found, less those devices.  Nothing is removed.
+ *
+ * The scan and lookup times, and any device that does not agree, are
+ * logged.  Run under "bench" to time repeated checks.
+ *
+ * Usage: DevMsiTest snapshot <snapshot path> <hardware ID>...
+ *
+ * @param argc  The count of arguments following "snapshot".
+ * @param argv  The arguments following "snapshot".
+ * @return Returns S_OK if the snapshot agrees with the scan, otherwise a failure.
+ */
+HRESULT CheckSnapshotAgainstScan( __in int argc, __in LPWSTR* argv );
@@ -3,21 +3,55 @@
 
 #include "stdafx.h"
 #include "..\DevMsi\devmsi.h"
+#include "UnitTest.h"
+#include "SimServiceManager.h"
+#include "BenchKernels.h"
+#include "BenchSnapshot.h"
+#include <vector>
+#include <algorithm>
+#include <crtdbg.h>
 
+#ifdef _DEBUG
+/**
+ * The number of heap allocations seen by AllocCountHook().
+ */
+volatile LONG g_allocCount = 0;
 
-int _tmain(int argc, _TCHAR* argv[])
+/**
+ * Count heap allocations made through the shared debug CRT.
+ *
+ * Both this program and DevMsi.dll use the DLL version of the CRT, so
+ * allocations made inside the DLL are counted as well.
+ */
+int __cdecl AllocCountHook( int allocType, void*, size_t, int, long, const unsigned char*, int )
 {
-    int result = -1;
-    if ( argc < 2 ) {
-        return result;
+    if ( _HOOK_ALLOC == allocType || _HOOK_REALLOC == allocType ) {
+        InterlockedIncrement( &g_allocCount );
     }
-    LPCTSTR opName  = argv[1];
-    argc -=2;
-    argv +=2;
+    return TRUE;
+}
+#endif // _DEBUG
+
+/**
+ * Run the named DevMsi operation.
+ *
+ * @param opName The name of the operation ("create", "createMany", "remove", "remService",
+ *               "remServiceSim", "kernels" or "snapshot").
+ * @param argc  The count of arguments for the operation.
+ * @param argv  The arguments for the operation.
+ * @return Returns 0 on success, -1 on failure or an unknown operation.
+ */
+int RunOperation( LPCTSTR opName, int argc, _TCHAR* argv[] )
+{
+    int result = -1;
     if ( !_tcsicmp( opName, TEXT("create") ) ) {
         result = SUCCEEDED( DoCreateDevnode( argc, argv ) )
             ? 0 : -1;
     }
+    if ( !_tcsicmp( opName, TEXT("createMany") ) ) {
+        result = SUCCEEDED( DoCreateDevnodes( argc, argv ) )
+            ? 0 : -1;
+    }
     if ( !_tcsicmp( opName, TEXT("remove") ) ) {
         result = SUCCEEDED( DoRemoveDevnode( argc, argv ) )
             ? 0 : -1;
@@ -26,6 +60,98 @@ int _tmain(int argc, _TCHAR* argv[])
         result = SUCCEEDED( DoRemoveService( argc, argv ) )
             ? 0 : -1;
     }
-	return result;
+    if ( !_tcsicmp( opName, TEXT("remServiceSim") ) ) {
+        result = SUCCEEDED( RemoveSimulatedServices( argc, argv ) )
+            ? 0 : -1;
+    }
+    if ( !_tcsicmp( opName, TEXT("kernels") ) ) {
+        result = SUCCEEDED( BenchmarkKernels( argc, argv ) )
+            ? 0 : -1;
+    }
+    if ( !_tcsicmp( opName, TEXT("snapshot") ) ) {
+        result = SUCCEEDED( CheckSnapshotAgainstScan( argc, argv ) )
+            ? 0 : -1;
+    }
+    return result;
+}
+
+/**
+ * Run an operation repeatedly and report its latency.
+ *
+ * Usage: DevMsiTest bench <iterations> <operation> [arguments...]
+ *
+ * For example, "DevMsiTest bench 20 remove \root\nosuchdevice" measures
+ * the cost of a full device scan on this machine without removing anything,
+ * and "DevMsiTest bench 20 snapshot devs.snap PCI\VEN_8086&DEV_1C3A" compares
+ * a device snapshot with a scan, and the time of each; see
+ * CheckSnapshotAgainstScan().
+ * The p50 and p99 latencies are printed, along with the heap allocations
+ * per iteration for debug builds.
+ *
+ * @param argc  The count of arguments following "bench".
+ * @param argv  The arguments following "bench".
+ * @return Returns 0 if every iteration succeeded, otherwise -1.
+ */
+int RunBenchmark( int argc, _TCHAR* argv[] )
+{
+    if ( argc < 2 ) {
+        return -1;
+    }
+    int iterations = _ttoi( argv[0] );
+    LPCTSTR opName = argv[1];
+    if ( iterations <= 0 ) {
+        return -1;
+    }
+
+    std::vector<double> samples;
+    LARGE_INTEGER frequency, start, end;
+    int result = 0;
+    QueryPerformanceFrequency( &frequency );
+#ifdef _DEBUG
+    _CRT_ALLOC_HOOK previousHook = _CrtSetAllocHook( AllocCountHook );
+#endif // _DEBUG
+
+    for ( int i = 0; i < iterations; ++i ) {
+        QueryPerformanceCounter( &start );
+        if ( 0 != RunOperation( opName, argc - 2, argv + 2 ) ) {
+            result = -1;
+        }
+        QueryPerformanceCounter( &end );
+        samples.push_back( 1000.0 * ( end.QuadPart - start.QuadPart ) / frequency.QuadPart );
+    }
+
+#ifdef _DEBUG
+    _CrtSetAllocHook( previousHook );
+#endif // _DEBUG
+
+    std::sort( samples.begin(), samples.end() );
+    _tprintf( TEXT("%s: %d iteration(s), min %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n"),
+        opName, iterations,
+        samples.front(),
+        samples[ samples.size() / 2 ],
+        samples[ ( samples.size() * 99 ) / 100 ],
+        samples.back() );
+#ifdef _DEBUG
+    _tprintf( TEXT("%s: %.1f heap allocation(s) per iteration\n"),
+        opName, static_cast<double>( g_allocCount ) / iterations );
+#endif // _DEBUG
+    return result;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+    if ( argc < 2 ) {
+        return -1;
+    }
+    LPCTSTR opName  = argv[1];
+    argc -=2;
+    argv +=2;
+    if ( !_tcsicmp( opName, TEXT("bench") ) ) {
+        return RunBenchmark( argc, argv );
+    }
+    if ( !_tcsicmp( opName, TEXT("test") ) ) {
+        return RunUnitTests( argc, argv );
+    }
+    return RunOperation( opName, argc, argv );
 }
 
@@ -0,0 +1,350 @@
+#include "stdafx.h"
+#include "SimServiceManager.h"
+#include "../DevMsi/LogResult.h"
+#include "../DevMsi/ciwstring.h"
+#include "../DevMsi/ArgList.h"
+#include "../DevMsi/ServiceRemove.h"
+#include <stdio.h>
+#include <map>
+#include <memory>
+#include <algorithm>
+
+/**
+ * A service in the simulated service database.
+ */
+struct SimService {
+    std::wstring name;                  //*< The service name, as listed
+    std::vector<std::wstring> depends;  //*< The services this one depends on
+    DWORD stopMs;                       //*< How long the service takes to stop
+    DWORD state;                        //*< SERVICE_RUNNING, SERVICE_STOP_PENDING or SERVICE_STOPPED
+    DWORD stopAt;                       //*< GetTickCount() when a pending stop completes
+    bool markedForDelete;               //*< true once deleted while not stopped
+};
+
+/**
+ * A ServiceManager over an in-memory service database, for running the
+ * service removal without the Service Control Manager (or rights to it).
+ *
+ * Stops take the simulated time of each service, as measured by
+ * GetTickCount().  Every call can be slowed by a fixed latency, and can
+ * fail with ERROR_SERVICE_DATABASE_LOCKED, as the SCM does while another
+ * installer holds its lock.  Failures come from a fixed pseudo-random
+ * sequence, so that a run can be repeated.  Not thread-safe.
+ */
+class SimServiceManager : public ServiceManager {
+public:
+    SimServiceManager( __in DWORD latencyMs, __in DWORD failPercent );
+
+    void Load( __in const wchar_t* path );
+    void LoadText( __in const wchar_t* text );
+
+    virtual HRESULT ListServices( __out std::vector<std::wstring>& names );
+    virtual HRESULT Delete( __in const wchar_t* name );
+    virtual HRESULT ListDependents( __in const wchar_t* name, __out std::vector<std::wstring>& names );
+    virtual HRESULT Stop( __in const wchar_t* name, __out SERVICE_STATUS& status );
+    virtual HRESULT QueryStatus( __in const wchar_t* name, __out SERVICE_STATUS& status );
+
+private:
+    typedef std::map<ci_wstring, SimService> ServiceMap;
+
+    void AddService( __inout LPWSTR line );
+    HRESULT BeginCall( __in const char* call, __in const wchar_t* name );
+    SimService* Find( __in const wchar_t* name );
+    void Advance( __inout SimService& service );
+    void FillStatus( __in const SimService& service, __out SERVICE_STATUS& status );
+    void AddDependents( __in const wchar_t* name, __inout std::vector<std::wstring>& names );
+
+    ServiceMap m_services;  //*< The services, by name
+    DWORD m_latencyMs;      //*< The time every call takes
+    DWORD m_failPercent;    //*< The share of calls that fail, in percent
+    DWORD m_random;         //*< The state of the failure sequence
+};
+
+SimServiceManager::SimServiceManager( __in DWORD latencyMs, __in DWORD failPercent )
+    : m_latencyMs( latencyMs ), m_failPercent( failPercent ), m_random( 1 )
+{
+}
+
+/**
+ * Load the services from a text file, one service per line:
+ *
+ *     name [stop=<ms>] [running=0] [depends=<name>]...
+ *
+ * Lines that are blank or start with ';' are ignored.  Services run
+ * unless running=0 is given, and take stop=<ms> (0 by default) to stop.
+ */
+void SimServiceManager::Load( __in const wchar_t* path )
+{
+    FILE* file = NULL;
+    if ( 0 != _wfopen_s( &file, path, L"rt, ccs=UNICODE" ) ) {
+        HRESULT hr = E_FAIL;
+        LogResult( hr, "Unable to open simulated service file '%ls'.", path );
+        throw hr;
+    }
+
+    wchar_t line[1024];
+    while ( NULL != fgetws( line, _countof(line), file ) ) {
+        AddService( line );
+    }
+    bool failed = 0 != ferror( file );
+    fclose( file );
+    if ( failed ) {
+        HRESULT hr = E_FAIL;
+        LogResult( hr, "Unable to read simulated service file '%ls'.", path );
+        throw hr;
+    }
+
+    LogResult( S_OK, "Simulating %u service(s) from '%ls', with %u ms latency and %u%% failures."
+        , static_cast<DWORD>( m_services.size() ), path, m_latencyMs, m_failPercent );
+} // void SimServiceManager::Load( const wchar_t* path )
+
+/**
+ * Load the services from a string, laid out as for Load() with the lines
+ * separated by '\n'.
+ */
+void SimServiceManager::LoadText( __in const wchar_t* text )
+{
+    std::vector<wchar_t> lines( text, text + wcslen( text ) + 1 );
+    LPWSTR line = &lines[0];
+    for ( ;; ) {
+        LPWSTR end = wcschr( line, L'\n' );
+        if ( NULL != end ) {
+            *end = L'\0';
+        }
+        AddService( line );
+        if ( NULL == end ) {
+            break;
+        }
+        line = end + 1;
+    }
+}
+
+/**
+ * Add the service described by one line of a service file.  The line is
+ * split in place.
+ */
+void SimServiceManager::AddService( __inout LPWSTR line )
+{
+    std::vector<LPWSTR> argv;
+    SplitCustomActionData( line, argv );
+    if ( argv.empty() || L';' == argv[0][0] ) {
+        return;
+    }
+
+    ArgList args( static_cast<int>( argv.size() ), &argv[0] );
+    if ( args.Positional().empty() ) {
+        return;
+    }
+    SimService service;
+    std::vector<LPCWSTR> depends;
+    service.name = args.Positional()[0];
+    args.NamedList( L"depends", depends );
+    service.depends.assign( depends.begin(), depends.end() );
+    service.stopMs = args.NamedNumber( L"stop", 0 );
+    service.state = args.NamedNumber( L"running", 1 ) ? SERVICE_RUNNING : SERVICE_STOPPED;
+    service.stopAt = 0;
+    service.markedForDelete = false;
+    m_services[service.name.c_str()] = service;
+} // void SimServiceManager::AddService( LPWSTR line )
+
+/**
+ * Apply the latency, and fail the call if its turn has come.
+ */
+HRESULT SimServiceManager::BeginCall( __in const char* call, __in const wchar_t* name )
+{
+    if ( 0 < m_latencyMs ) {
+        Sleep( m_latencyMs );
+    }
+    // A 32-bit linear congruential generator (Numerical Recipes).
+    m_random = m_random * 1664525 + 1013904223;
+    if ( ( m_random >> 16 ) % 100 < m_failPercent ) {
+        HRESULT hr = HRESULT_FROM_WIN32( ERROR_SERVICE_DATABASE_LOCKED );
+        LogResult( hr, "Simulated %s('%ls') failed.", call, name );
+        return hr;
+    }
+    return S_OK;
+}
+
+SimService* SimServiceManager::Find( __in const wchar_t* name )
+{
+    ServiceMap::iterator found = m_services.find( name );
+    if ( m_services.end() == found ) {
+        return NULL;
+    }
+    Advance( found->second );
+    return &found->second;
+}
+
+/**
+ * Bring a service up to date:  complete a stop whose time has come.
+ */
+void SimServiceManager::Advance( __inout SimService& service )
+{
+    if ( SERVICE_STOP_PENDING == service.state && static_cast<LONG>( GetTickCount() - service.stopAt ) >= 0 ) {
+        service.state = SERVICE_STOPPED;
+    }
+}
+
+void SimServiceManager::FillStatus( __in const SimService& service, __out SERVICE_STATUS& status )
+{
+    ZeroMemory( &status, sizeof( status ) );
+    status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
+    status.dwCurrentState = service.state;
+    status.dwControlsAccepted = SERVICE_RUNNING == service.state ? SERVICE_ACCEPT_STOP : 0;
+    status.dwWaitHint = SERVICE_STOP_PENDING == service.state ? service.stopMs : 0;
+}
+
+/**
+ * Add the running services that depend on a service, directly or not.
+ */
+void SimServiceManager::AddDependents( __in const wchar_t* name, __inout std::vector<std::wstring>& names )
+{
+    for ( ServiceMap::iterator iter = m_services.begin(); iter != m_services.end(); ++iter ) {
+        SimService& service = iter->second;
+        Advance( service );
+        if ( SERVICE_STOPPED == service.state ) {
+            continue;
+        }
+        for ( auto depend = service.depends.begin(); depend != service.depends.end(); ++depend ) {
+            if ( 0 == _wcsicmp( depend->c_str(), name )
+                && names.end() == std::find( names.begin(), names.end(), service.name ) ) {
+                names.push_back( service.name );
+                AddDependents( service.name.c_str(), names );
+                break;
+            }
+        }
+    }
+}
+
+HRESULT SimServiceManager::ListServices( __out std::vector<std::wstring>& names )
+{
+    names.clear();
+    HRESULT hr = BeginCall( "EnumServicesStatusEx", L"" );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+    for ( ServiceMap::iterator iter = m_services.begin(); iter != m_services.end(); ++iter ) {
+        names.push_back( iter->second.name );
+    }
+    return S_OK;
+}
+
+HRESULT SimServiceManager::Delete( __in const wchar_t* name )
+{
+    HRESULT hr = BeginCall( "DeleteService", name );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+    SimService* service = Find( name );
+    if ( NULL == service ) {
+        return HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+    }
+    if ( SERVICE_STOPPED == service->state ) {
+        m_services.erase( name );
+    } else {
+        // As with the SCM, it goes once it stops.
+        service->markedForDelete = true;
+    }
+    return S_OK;
+}
+
+HRESULT SimServiceManager::ListDependents( __in const wchar_t* name, __out std::vector<std::wstring>& names )
+{
+    names.clear();
+    HRESULT hr = BeginCall( "EnumDependentServices", name );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+    if ( NULL == Find( name ) ) {
+        return HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+    }
+    AddDependents( name, names );
+    return S_OK;
+}
+
+HRESULT SimServiceManager::Stop( __in const wchar_t* name, __out SERVICE_STATUS& status )
+{
+    ZeroMemory( &status, sizeof( status ) );
+    HRESULT hr = BeginCall( "ControlService", name );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+    SimService* service = Find( name );
+    if ( NULL == service ) {
+        return HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+    }
+
+    std::vector<std::wstring> dependents;
+    AddDependents( name, dependents );
+    if ( !dependents.empty() ) {
+        hr = HRESULT_FROM_WIN32( ERROR_DEPENDENT_SERVICES_RUNNING );
+        LogResult( hr, "Simulated ControlService('%ls', SERVICE_CONTROL_STOP) failed.", name );
+        return hr;
+    }
+
+    if ( SERVICE_RUNNING == service->state ) {
+        service->state = SERVICE_STOP_PENDING;
+        service->stopAt = GetTickCount() + service->stopMs;
+        Advance( *service );
+    } else if ( SERVICE_STOP_PENDING == service->state ) {
+        hr = HRESULT_FROM_WIN32( ERROR_SERVICE_CANNOT_ACCEPT_CTRL );
+    }
+    FillStatus( *service, status );
+    return hr;
+}
+
+HRESULT SimServiceManager::QueryStatus( __in const wchar_t* name, __out SERVICE_STATUS& status )
+{
+    ZeroMemory( &status, sizeof( status ) );
+    HRESULT hr = BeginCall( "QueryServiceStatus", name );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+    SimService* service = Find( name );
+    if ( NULL == service ) {
+        return HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+    }
+    FillStatus( *service, status );
+    if ( SERVICE_STOPPED == service->state && service->markedForDelete ) {
+        m_services.erase( name );
+    }
+    return S_OK;
+}
+
+ServiceManager* CreateSimulatedServiceManager( __in const wchar_t* path, __in DWORD latencyMs, __in DWORD failPercent )
+{
+    std::unique_ptr<SimServiceManager> manager( new SimServiceManager( latencyMs, failPercent ) );
+    manager->Load( path );
+    return manager.release();
+}
+
+ServiceManager* CreateSimulatedServiceManagerFromText( __in const wchar_t* services, __in DWORD latencyMs, __in DWORD failPercent )
+{
+    std::unique_ptr<SimServiceManager> manager( new SimServiceManager( latencyMs, failPercent ) );
+    manager->LoadText( services );
+    return manager.release();
+}
+
+HRESULT RemoveSimulatedServices( __in int argc, __in LPWSTR* argv )
+{
+    if ( argc < 1 ) {
+        return E_INVALIDARG;
+    }
+
+    try
+    {
+        ArgList args( argc - 1, argv + 1 );
+        std::unique_ptr<ServiceManager> manager( CreateSimulatedServiceManager( argv[0],
+            args.NamedNumber( L"simlatency", 0 ), args.NamedNumber( L"simfail", 0 ) ) );
+        return RemoveServices( argc - 1, argv + 1, manager.get() );
+    }
+    catch( HRESULT& _error )
+    {
+        return _error;
+    }
+    catch( const std::exception& _error )
+    {
+        LogResult( E_FAIL, _error.what() );
+        return E_FAIL;
+    }
+} // HRESULT RemoveSimulatedServices( int argc, LPWSTR* argv )
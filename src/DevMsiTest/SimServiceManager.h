@@ -0,0 +1,56 @@
+/**
+ * Header file for the simulated service manager used by DevMsiTest.
+ */
+#pragma once
+#include "../DevMsi/ServiceManager.h"
+
+/**
+ * Create a service manager over an in-memory service database, so that
+ * the service removal can be run, profiled and load-tested without the
+ * Service Control Manager or the rights to change it.
+ *
+ * The services are read from a text file, one per line:
+ *
+ *     name [stop=<ms>] [running=0] [depends=<name>]...
+ *
+ * A service runs unless running=0 is given, and takes stop=<ms> to stop
+ * once asked.  depends= may be repeated.  Lines that are blank or start
+ * with ';' are ignored.
+ *
+ * An exception will be thrown if the file cannot be read.
+ *
+ * @param path The path of the service file.
+ * @param latencyMs How long every call takes, in milliseconds.
+ * @param failPercent The share of calls, in percent, that fail with
+ *                    ERROR_SERVICE_DATABASE_LOCKED.  The failures follow
+ *                    a fixed sequence, so that a run can be repeated.
+ * @return Returns the service manager, which the caller must delete.
+ */
+ServiceManager* CreateSimulatedServiceManager( __in const wchar_t* path, __in DWORD latencyMs, __in DWORD failPercent );
+
+/**
+ * Create a simulated service manager over services given in a string,
+ * one per line ('\n'), as for CreateSimulatedServiceManager().
+ *
+ * @param services The services.
+ * @param latencyMs As for CreateSimulatedServiceManager().
+ * @param failPercent As for CreateSimulatedServiceManager().
+ * @return Returns the service manager, which the caller must delete.
+ */
+ServiceManager* CreateSimulatedServiceManagerFromText( __in const wchar_t* services, __in DWORD latencyMs, __in DWORD failPercent );
+
+/**
+ * Remove services from a simulated service database, as DoRemoveService()
+ * would from the Service Control Manager.
+ *
+ * Usage: DevMsiTest remServiceSim <service file> [DoRemoveService arguments...]
+ *
+ * simlatency=<milliseconds> slows every call, and simfail=<percent> makes
+ * that share of calls fail as if the database were locked; see
+ * CreateSimulatedServiceManager().
+ *
+ * @param argc  The count of arguments following "remServiceSim".
+ * @param argv  The arguments following "remServiceSim".
+ * @return Returns an HRESULT indicating success or failure.
+ */
+HRESULT RemoveSimulatedServices( __in int argc, __in LPWSTR* argv );
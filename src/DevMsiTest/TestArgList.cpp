@@ -0,0 +1,130 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/ArgList.h"
+#include <string>
+#include <vector>
+
+/**
+ * Split CustomActionData, and return the arguments as strings.
+ */
+static std::vector<std::wstring> Split( __in const wchar_t* data )
+{
+    std::wstring buffer( data );
+    std::vector<LPWSTR> argv;
+    SplitCustomActionData( &buffer[0], argv );
+    return std::vector<std::wstring>( argv.begin(), argv.end() );
+}
+
+/**
+ * Return true if a value is present and equal to the expected text.
+ */
+static bool Equals( __in_opt LPCWSTR value, __in LPCWSTR expected )
+{
+    return NULL != value && 0 == wcscmp( value, expected );
+}
+
+/**
+ * SplitCustomActionData() and ArgList:  separators, quotes, literal
+ * backslashes, and the lookup of named arguments.
+ */
+void TestArgList()
+{
+    // Any run of separators splits arguments; none are empty.
+    std::vector<std::wstring> split = Split( L"  one\ttwo\r\nthree  " );
+    TEST_CHECK( 3 == split.size() );
+    if ( 3 == split.size() ) {
+        TEST_CHECK( L"one" == split[0] && L"two" == split[1] && L"three" == split[2] );
+    }
+    TEST_CHECK( Split( L"" ).empty() );
+    TEST_CHECK( Split( L" \t\r\n" ).empty() );
+
+    // Quotes group separators into one argument, can start mid-argument,
+    // and a doubled quote inside quotes is a literal quote.  Backslashes
+    // are always literal, even before a quote.
+    split = Split( L"\"C:\\Program Files\\foo.inf\" name=\"a b\" \"say \"\"hi\"\"\" \\root\\foo \"\" end\\\"x y\"" );
+    TEST_CHECK( 6 == split.size() );
+    if ( 6 == split.size() ) {
+        TEST_CHECK( L"C:\\Program Files\\foo.inf" == split[0] );
+        TEST_CHECK( L"name=a b" == split[1] );
+        TEST_CHECK( L"say \"hi\"" == split[2] );
+        TEST_CHECK( L"\\root\\foo" == split[3] );
+        TEST_CHECK( L"" == split[4] );
+        TEST_CHECK( L"end\\x y" == split[5] );
+    }
+
+    // NULL data has no arguments.
+    std::vector<LPWSTR> argv( 1, NULL );
+    SplitCustomActionData( NULL, argv );
+    TEST_CHECK( argv.empty() );
+
+    // Positional and named arguments are separated, in order.  A key
+    // starts with a letter and is made of letters, digits and
+    // underscores; anything else with an '=' is positional.
+    std::wstring data( L"first wait=100 Wait=200 id=a 9key=x _key=y =z key-1=w Flag_2=off ID=b last" );
+    SplitCustomActionData( &data[0], argv );
+    ArgList args( static_cast<int>( argv.size() ), &argv[0] );
+    TEST_CHECK( 6 == args.Positional().size() );
+    if ( 6 == args.Positional().size() ) {
+        TEST_CHECK( Equals( args.Positional()[0], L"first" ) );
+        TEST_CHECK( Equals( args.Positional()[1], L"9key=x" ) );
+        TEST_CHECK( Equals( args.Positional()[2], L"_key=y" ) );
+        TEST_CHECK( Equals( args.Positional()[3], L"=z" ) );
+        TEST_CHECK( Equals( args.Positional()[4], L"key-1=w" ) );
+        TEST_CHECK( Equals( args.Positional()[5], L"last" ) );
+    }
+
+    // Keys ignore case, and the last value wins.
+    TEST_CHECK( Equals( args.Named( L"WAIT" ), L"200" ) );
+    TEST_CHECK( NULL == args.Named( L"wai" ) );
+    TEST_CHECK( NULL == args.Named( L"waitx" ) );
+    TEST_CHECK( NULL == args.Named( L"key" ) );
+
+    // Every value of a repeated key, in order, appended.
+    std::vector<LPCWSTR> values( 1, L"kept" );
+    args.NamedList( L"id", values );
+    TEST_CHECK( 3 == values.size() );
+    if ( 3 == values.size() ) {
+        TEST_CHECK( Equals( values[0], L"kept" ) && Equals( values[1], L"a" ) && Equals( values[2], L"b" ) );
+    }
+
+    // Numbers, with a default if absent.
+    TEST_CHECK( 200 == args.NamedNumber( L"wait", 7 ) );
+    TEST_CHECK( 7 == args.NamedNumber( L"timeout", 7 ) );
+
+    // Flags:  absent, or "0", "no", "false" or "off" in any case, are off.
+    TEST_CHECK( !args.NamedFlag( L"flag_2" ) );
+    TEST_CHECK( !args.NamedFlag( L"missing" ) );
+    TEST_CHECK( args.NamedFlag( L"id" ) );
+
+    // A value that is not a whole number throws E_INVALIDARG.
+    wchar_t notNumbers[][8] = { L"n=", L"n=12ms", L"n=-", L"n=x1" };
+    for ( size_t i = 0; i < _countof( notNumbers ); ++i ) {
+        LPWSTR arg = notNumbers[i];
+        ArgList bad( 1, &arg );
+        HRESULT hr = S_OK;
+        try
+        {
+            bad.NamedNumber( L"n", 0 );
+        }
+        catch( HRESULT& _error )
+        {
+            hr = _error;
+        }
+        TEST_CHECK( E_INVALIDARG == hr );
+    }
+
+    // Flag values that are off, in any case.
+    wchar_t offFlags[][10] = { L"f=0", L"f=NO", L"f=False", L"f=oFF" };
+    for ( size_t i = 0; i < _countof( offFlags ); ++i ) {
+        LPWSTR arg = offFlags[i];
+        TEST_CHECK( !ArgList( 1, &arg ).NamedFlag( L"f" ) );
+    }
+    wchar_t onFlag[] = L"f=1";
+    LPWSTR onArg = onFlag;
+    TEST_CHECK( ArgList( 1, &onArg ).NamedFlag( L"f" ) );
+
+    // A NULL argument is an empty positional argument.
+    LPWSTR nullArg = NULL;
+    ArgList withNull( 1, &nullArg );
+    TEST_CHECK( 1 == withNull.Positional().size() && Equals( withNull.Positional()[0], L"" ) );
+}
@@ -0,0 +1,33 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/ciwstring.h"
+
+/**
+ * Case-insensitive compare and find, including IDs long enough to take
+ * the eight-character SSE2 blocks, with and without non-ASCII characters.
+ */
+void TestCiWstring()
+{
+    // ASCII, over more than one block.
+    const ci_wstring pciId( L"PCI\\VEN_8086&DEV_1C3A&SUBSYS_1C3A8086&REV_04" );
+    TEST_CHECK( 0 == pciId.compare( L"pci\\ven_8086&dev_1c3a&subsys_1c3a8086&rev_04" ) );
+    TEST_CHECK( 0 > pciId.compare( L"pci\\ven_8086&dev_1c3a&subsys_1c3a8086&rev_05" ) );
+    TEST_CHECK( 0 < pciId.compare( L"PCI\\VEN_8086&DEV_1C3A&SUBSYS_1C3A8086&REV_03" ) );
+    TEST_CHECK( 21 == pciId.find( L"&subsys_" ) );
+    TEST_CHECK( ci_wstring::npos == pciId.find( L"&CC_" ) );
+
+    // Characters above U+007F with bit 7 of both bytes clear (U+0100,
+    // U+0101, U+0410, U+0430) must not be taken for ASCII.
+    const ci_wstring latinId( L"ROOT\\DEV_\x0101\x0101\x0101\x0101\x0101\x0101\x0101\x0101" );
+    TEST_CHECK( 0 == latinId.compare( L"root\\dev_\x0100\x0100\x0100\x0100\x0100\x0100\x0100\x0100" ) );
+    TEST_CHECK( 0 != latinId.compare( L"root\\dev_\x0100\x0100\x0100\x0100\x0100\x0100\x0100\x0102" ) );
+    const ci_wstring cyrillicId( L"USB\\\x0430\x0431\x0432_DEVICE&REV_0001" );
+    TEST_CHECK( 0 == cyrillicId.compare( L"usb\\\x0410\x0411\x0412_device&rev_0001" ) );
+    TEST_CHECK( 4 == cyrillicId.find( L'\x0410' ) );
+    TEST_CHECK( 5 == cyrillicId.find( L"\x0411\x0412_DEV" ) );
+
+    // Equal strings hash equally, whatever their case.
+    ci_wstring_hash hash;
+    TEST_CHECK( hash( latinId ) == hash( ci_wstring( L"root\\dev_\x0100\x0100\x0100\x0100\x0100\x0100\x0100\x0100" ) ) );
+    TEST_CHECK( hash( pciId ) == hash( ci_wstring( L"pci\\ven_8086&dev_1c3a&subsys_1c3a8086&rev_04" ) ) );
+}
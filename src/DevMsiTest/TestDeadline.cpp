@@ -0,0 +1,133 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/LogResult.h"
+#include "../DevMsi/Deadline.h"
+#include <algorithm>
+
+/**
+ * A step for RetryTransient() that fails with an error a number of
+ * times, then succeeds, and counts its attempts.
+ */
+struct FlakyStep {
+    HRESULT error;      //*< What the failing attempts return
+    DWORD failures;     //*< The attempts still to fail
+    DWORD attempts;     //*< The attempts made
+
+    HRESULT operator()() {
+        ++attempts;
+        if ( 0 < failures ) {
+            --failures;
+            return error;
+        }
+        return S_OK;
+    }
+};
+
+/**
+ * Retry a FlakyStep, and return its result.
+ */
+static HRESULT Retry( __in const Deadline& deadline, __inout FlakyStep& step )
+{
+    return RetryTransient( "FlakyStep", deadline, [&]() -> HRESULT {
+        return step();
+    } );
+}
+
+/**
+ * Deadline, IsTransientError(), RetryDelay() and RetryTransient():  the
+ * budget, which errors are retried, the backoff, and the attempt cap.
+ * The backoff is shortened so that the retries take milliseconds.
+ */
+void TestDeadline()
+{
+    const HRESULT locked = HRESULT_FROM_WIN32( ERROR_SERVICE_DATABASE_LOCKED );
+    const HRESULT denied = HRESULT_FROM_WIN32( ERROR_ACCESS_DENIED );
+    const HRESULT timeout = HRESULT_FROM_WIN32( ERROR_TIMEOUT );
+
+    // Without a budget, nothing expires.
+    Deadline noLimit( 0 );
+    TEST_CHECK( !noLimit.Expired() );
+    TEST_CHECK( INFINITE == noLimit.Remaining() );
+    TEST_CHECK( S_OK == noLimit.Check( "nothing" ) );
+
+    // A spent budget fails the check with ERROR_TIMEOUT.
+    Deadline spent( 1 );
+    Sleep( 20 );
+    TEST_CHECK( spent.Expired() );
+    TEST_CHECK( 0 == spent.Remaining() );
+    TEST_CHECK( timeout == spent.Check( "nothing more will be done" ) );
+    Deadline ahead( 60000 );
+    TEST_CHECK( !ahead.Expired() && S_OK == ahead.Check( "nothing" ) );
+    TEST_CHECK( 0 < ahead.Remaining() && ahead.Remaining() <= 60000 );
+
+    // Only errors that go away by themselves are transient.
+    TEST_CHECK( IsTransientError( locked ) );
+    TEST_CHECK( IsTransientError( HRESULT_FROM_WIN32( ERROR_BUSY ) ) );
+    TEST_CHECK( IsTransientError( HRESULT_FROM_WIN32( ERROR_SHARING_VIOLATION ) ) );
+    TEST_CHECK( IsTransientError( HRESULT_FROM_WIN32( ERROR_DEVICE_INSTALLER_NOT_READY ) ) );
+    TEST_CHECK( !IsTransientError( denied ) );
+    TEST_CHECK( !IsTransientError( HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST ) ) );
+    TEST_CHECK( !IsTransientError( E_FAIL ) );
+    TEST_CHECK( !IsTransientError( S_OK ) );
+
+    // The backoff doubles up to its longest delay, and half of it is
+    // jitter:  each delay is from half the backoff to all of it.
+    bool inRange = true;
+    for ( DWORD attempt = 1; attempt <= 10; ++attempt ) {
+        DWORD backoff = std::min<DWORD>( RETRY_FIRST_DELAY_MS << std::min<DWORD>( attempt - 1, 5 ), RETRY_MAX_DELAY_MS );
+        for ( int draw = 0; draw < 50; ++draw ) {
+            DWORD delay = RetryDelay( attempt, noLimit );
+            inRange = inRange && backoff / 2 <= delay && delay <= backoff;
+        }
+    }
+    TEST_CHECK( inRange );
+    TEST_CHECK( RETRY_MAX_DELAY_MS / 2 <= RetryDelay( 30, noLimit ) );
+
+    // The same seed gives the same delays.
+    Deadline first( 0 ), second( 0 );
+    first.Seed( 42 );
+    second.Seed( 42 );
+    bool same = true;
+    for ( DWORD attempt = 1; attempt <= 8; ++attempt ) {
+        same = same && RetryDelay( attempt, first ) == RetryDelay( attempt, second );
+    }
+    TEST_CHECK( same );
+
+    // Delays are cut short to what is left of the budget, and are 0
+    // once it is spent.
+    Deadline shortBudget( 50 );
+    TEST_CHECK( RetryDelay( 6, shortBudget ) <= 50 );
+    TEST_CHECK( 0 == RetryDelay( 1, spent ) );
+
+    // The shortest backoff that still waits:  a delay of 0 would mean
+    // that the budget is spent.
+    Deadline quick( 0 );
+    quick.SetBackoff( 2, 8 );
+
+    // A step that succeeds, or fails for good, runs once.
+    FlakyStep works = { locked, 0, 0 };
+    TEST_CHECK( S_OK == Retry( quick, works ) && 1 == works.attempts );
+    FlakyStep refused = { denied, 5, 0 };
+    TEST_CHECK( denied == Retry( quick, refused ) && 1 == refused.attempts );
+
+    // A transient failure is retried until the step succeeds.
+    FlakyStep busy = { locked, 2, 0 };
+    TEST_CHECK( S_OK == Retry( quick, busy ) && 3 == busy.attempts );
+
+    // A step that keeps failing runs RETRY_MAX_ATTEMPTS times.
+    FlakyStep stuck = { locked, 1000, 0 };
+    TEST_CHECK( locked == Retry( quick, stuck ) );
+    TEST_CHECK( RETRY_MAX_ATTEMPTS == stuck.attempts );
+
+    // Once the budget is spent, the step is not retried again.
+    FlakyStep late = { locked, 1000, 0 };
+    TEST_CHECK( locked == Retry( spent, late ) && 1 == late.attempts );
+    Deadline budget( 60 );
+    budget.SetBackoff( 40, 40 );
+    FlakyStep slow = { locked, 1000, 0 };
+    DWORD start = GetTickCount();
+    TEST_CHECK( locked == Retry( budget, slow ) );
+    TEST_CHECK( 1 < slow.attempts && slow.attempts < RETRY_MAX_ATTEMPTS );
+    TEST_CHECK( budget.Expired() );
+    TEST_CHECK( GetTickCount() - start < 1000 );
+}
@@ -0,0 +1,124 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/LogResult.h"
+#include "../DevMsi/DeviceProperty.h"
+#include <vector>
+#include <string>
+
+/**
+ * Build a REG_MULTI_SZ value from strings.
+ */
+static std::vector<wchar_t> MultiSz( __in const wchar_t* const* strings, __in size_t count )
+{
+    std::vector<wchar_t> value;
+    for ( size_t i = 0; i < count; ++i ) {
+        value.insert( value.end(), strings[i], strings[i] + wcslen( strings[i] ) + 1 );
+    }
+    value.push_back( L'\0' );
+    return value;
+}
+
+//* The size of a value in bytes, as a DWORD.
+static DWORD ByteSize( __in const std::vector<wchar_t>& value )
+{
+    return static_cast<DWORD>( value.size() * sizeof(wchar_t) );
+}
+
+/**
+ * DevicePropertyBuffer:  how REG_SZ and REG_MULTI_SZ data is split, data
+ * that is not properly terminated, and that splitting into a warm buffer
+ * and list, or reading into it from a device, makes no heap allocations
+ * (debug builds, which can count them).
+ */
+void TestDeviceProperty()
+{
+    const wchar_t* hardwareIds[] = {
+        L"PCI\\VEN_8086&DEV_1C3A&SUBSYS_04A31028&REV_04",
+        L"PCI\\VEN_8086&DEV_1C3A&SUBSYS_04A31028",
+        L"PCI\\VEN_8086&DEV_1C3A&CC_078000",
+        L"PCI\\VEN_8086&DEV_1C3A",
+    };
+    std::vector<wchar_t> ids = MultiSz( hardwareIds, _countof(hardwareIds) );
+
+    DevicePropertyBuffer buffer;
+    DevicePropertyList items;
+
+    buffer.Assign( items, &ids[0], ByteSize( ids ), REG_MULTI_SZ );
+    bool same = _countof(hardwareIds) == items.size();
+    for ( size_t i = 0; same && i < items.size(); ++i ) {
+        same = 0 == wcscmp( hardwareIds[i], items[i] );
+    }
+    TEST_CHECK( same );
+
+    const wchar_t single[] = L"ROOT\\SYSTEM\\0000";
+    buffer.Assign( items, single, sizeof(single), REG_SZ );
+    TEST_CHECK( 1 == items.size() && 0 == wcscmp( single, items[0] ) );
+    buffer.Assign( items, L"", sizeof(wchar_t), REG_SZ );
+    TEST_CHECK( items.empty() );
+    buffer.Assign( items, NULL, 0, REG_MULTI_SZ );
+    TEST_CHECK( items.empty() );
+
+    // Data missing its terminators is cut off at the end of the value.
+    buffer.Assign( items, L"ABCD", 2 * sizeof(wchar_t), REG_MULTI_SZ );
+    TEST_CHECK( 1 == items.size() && 0 == wcscmp( L"AB", items[0] ) );
+    buffer.Assign( items, L"AB\0CD", 5 * sizeof(wchar_t), REG_MULTI_SZ );
+    TEST_CHECK( 2 == items.size() && 0 == wcscmp( L"CD", items[1] ) );
+
+    // Other data types have no strings.
+    DWORD number = 1;
+    LogEnableStandardSink( false );
+    buffer.Assign( items, &number, sizeof(number), REG_DWORD );
+    LogEnableStandardSink( true );
+    TEST_CHECK( items.empty() );
+
+    // A value larger than the buffer grows it.
+    std::wstring longId( 2000, L'X' );
+    const wchar_t* longIds[] = { longId.c_str(), hardwareIds[0] };
+    std::vector<wchar_t> longValue = MultiSz( longIds, _countof(longIds) );
+    buffer.Assign( items, &longValue[0], ByteSize( longValue ), REG_MULTI_SZ );
+    TEST_CHECK( 2 == items.size() && longId == items[0] );
+
+#ifdef _DEBUG
+    // Warm, the buffer and the list are reused as they are:  splitting
+    // a property of each device touches the heap no more.
+    _CRT_ALLOC_HOOK previousHook = _CrtSetAllocHook( AllocCountHook );
+    LONG before = g_allocCount;
+    size_t found = 0;
+    for ( int i = 0; i < 1000; ++i ) {
+        buffer.Assign( items, &ids[0], ByteSize( ids ), REG_MULTI_SZ );
+        found += items.size();
+        buffer.Assign( items, &longValue[0], ByteSize( longValue ), REG_MULTI_SZ );
+        found += items.size();
+    }
+    LONG allocations = g_allocCount - before;
+    _CrtSetAllocHook( previousHook );
+    TEST_CHECK( 0 == allocations );
+    TEST_CHECK( 1000 * ( _countof(hardwareIds) + 2 ) == found );
+
+    // The same holds when reading from a device, once the first read has
+    // sized the buffer.  SetupAPI's own allocations are not made through
+    // the CRT, so they are not counted.
+    HDEVINFO devs = SetupDiGetClassDevs( NULL, NULL, NULL, DIGCF_ALLCLASSES | DIGCF_PRESENT );
+    SP_DEVINFO_DATA devInfo;
+    devInfo.cbSize = sizeof(devInfo);
+    if ( INVALID_HANDLE_VALUE != devs && SetupDiEnumDeviceInfo( devs, 0, &devInfo ) ) {
+        DevicePropertyBuffer deviceBuffer;
+        deviceBuffer.Get( items, devs, devInfo, SPDRP_HARDWAREID );
+        size_t count = items.size();
+        previousHook = _CrtSetAllocHook( AllocCountHook );
+        before = g_allocCount;
+        bool stable = true;
+        for ( int i = 0; i < 100; ++i ) {
+            deviceBuffer.Get( items, devs, devInfo, SPDRP_HARDWAREID );
+            stable = stable && count == items.size();
+        }
+        allocations = g_allocCount - before;
+        _CrtSetAllocHook( previousHook );
+        TEST_CHECK( stable );
+        TEST_CHECK( 0 == allocations );
+    }
+    if ( INVALID_HANDLE_VALUE != devs ) {
+        SetupDiDestroyDeviceInfoList( devs );
+    }
+#endif // _DEBUG
+} // void TestDeviceProperty()
@@ -0,0 +1,161 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/DeviceSnapshot.h"
+#include <algorithm>
+#include <stdio.h>
+
+/**
+ * Read a whole file.
+ */
+static std::vector<BYTE> ReadImage( __in const wchar_t* path )
+{
+    std::vector<BYTE> image;
+    FILE* file = NULL;
+    if ( 0 == _wfopen_s( &file, path, L"rb" ) && NULL != file ) {
+        BYTE buffer[4096];
+        size_t count = 0;
+        while ( 0 < ( count = fread( buffer, 1, sizeof(buffer), file ) ) ) {
+            image.insert( image.end(), buffer, buffer + count );
+        }
+        fclose( file );
+    }
+    return image;
+}
+
+/**
+ * Replace a file with the given bytes.
+ */
+static void WriteImage( __in const wchar_t* path, __in const std::vector<BYTE>& image, __in size_t size )
+{
+    FILE* file = NULL;
+    if ( 0 == _wfopen_s( &file, path, L"wb" ) && NULL != file ) {
+        if ( 0 < size ) {
+            fwrite( &image[0], 1, size, file );
+        }
+        fclose( file );
+    }
+}
+
+/**
+ * Write a changed copy of a good snapshot, and report whether it opens.
+ */
+static bool OpensChanged( __in const wchar_t* path, __in const std::vector<BYTE>& good, __in size_t size, __in void (*change)( DeviceSnapshotHeader& ) )
+{
+    std::vector<BYTE> image( good );
+    if ( NULL != change ) {
+        change( *reinterpret_cast<DeviceSnapshotHeader*>( &image[0] ) );
+    }
+    WriteImage( path, image, size );
+    DeviceSnapshot snapshot;
+    return snapshot.Open( path, 600 );
+}
+
+/**
+ * Return the found instance IDs, sorted, so that they compare regardless of order.
+ */
+static std::vector<std::wstring> Sorted( __in const std::vector<const wchar_t*>& instanceIds )
+{
+    std::vector<std::wstring> sorted( instanceIds.begin(), instanceIds.end() );
+    std::sort( sorted.begin(), sorted.end() );
+    return sorted;
+}
+
+/**
+ * DeviceSnapshotWriter and DeviceSnapshot:  a snapshot written to a
+ * temporary file is found by ID and by prefix ignoring case, excluded
+ * devices are left out, and a damaged, truncated, foreign or out of
+ * date file is not opened.
+ */
+void TestDeviceSnapshot()
+{
+    wchar_t tempDir[MAX_PATH] = L"";
+    GetTempPathW( _countof(tempDir), tempDir );
+    std::wstring path( tempDir );
+    path += L"DevMsiTest.snap";
+
+    DeviceSnapshotWriter writer;
+    DevicePropertyList ids;
+    writer.BeginDevice( L"ROOT\\FOO\\0000" );
+    ids.push_back( L"Root\\Foo" );
+    ids.push_back( L"PCI\\VEN_8086&DEV_1234" );
+    writer.AddIds( ids );
+    writer.BeginDevice( L"ROOT\\FOO\\0001" );
+    ids.clear();
+    ids.push_back( L"root\\foo" );
+    ids.push_back( L"pci\\ven_8086&dev_5678" );
+    writer.AddIds( ids );
+    writer.BeginDevice( L"ROOT\\GONE\\0000" );
+    ids.clear();
+    ids.push_back( L"Root\\Gone" );
+    writer.AddIds( ids );
+    writer.Exclude( L"ROOT\\GONE\\0000" );
+    TEST_CHECK( 3 == writer.DeviceCount() );
+    TEST_CHECK( S_OK == writer.Write( path.c_str() ) );
+
+    std::vector<const wchar_t*> found;
+    std::vector<std::wstring> both;
+    both.push_back( L"ROOT\\FOO\\0000" );
+    both.push_back( L"ROOT\\FOO\\0001" );
+    {
+        DeviceSnapshot snapshot;
+        TEST_CHECK( snapshot.Open( path.c_str(), 600 ) );
+        TEST_CHECK( 2 == snapshot.DeviceCount() );
+
+        // IDs are found ignoring case, once for each device.
+        snapshot.Find( L"ROOT\\foo", found );
+        TEST_CHECK( both == Sorted( found ) );
+        found.clear();
+        snapshot.Find( L"PCI\\VEN_8086&DEV_5678", found );
+        TEST_CHECK( 1 == found.size() && 0 == wcscmp( L"ROOT\\FOO\\0001", found[0] ) );
+        found.clear();
+        snapshot.Find( L"Root\\Gone", found );
+        snapshot.Find( L"Root\\Fo", found );
+        TEST_CHECK( found.empty() );
+
+        // A prefix finds every matching ID; an empty one finds them all.
+        snapshot.FindPrefix( L"pci\\VEN_8086&", found );
+        TEST_CHECK( both == Sorted( found ) );
+        found.clear();
+        snapshot.FindPrefix( L"", found );
+        TEST_CHECK( 4 == found.size() );
+        found.clear();
+
+        // Written again less a device, the snapshot keeps the rest.
+        DeviceSnapshotWriter rewriter;
+        snapshot.CopyTo( rewriter );
+        snapshot.Close();
+        rewriter.Exclude( L"ROOT\\FOO\\0000" );
+        TEST_CHECK( S_OK == rewriter.Write( path.c_str() ) );
+        TEST_CHECK( snapshot.Open( path.c_str(), 600 ) );
+        TEST_CHECK( 1 == snapshot.DeviceCount() );
+        snapshot.Find( L"Root\\Foo", found );
+        TEST_CHECK( 1 == found.size() && 0 == wcscmp( L"ROOT\\FOO\\0001", found[0] ) );
+        found.clear();
+    }
+
+    // Damaged files are rejected rather than read.
+    TEST_CHECK( S_OK == writer.Write( path.c_str() ) );
+    std::vector<BYTE> good = ReadImage( path.c_str() );
+    TEST_CHECK( sizeof(DeviceSnapshotHeader) < good.size() );
+    if ( sizeof(DeviceSnapshotHeader) < good.size() ) {
+        TEST_CHECK( OpensChanged( path.c_str(), good, good.size(), NULL ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size() - sizeof(wchar_t), NULL ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, sizeof(DeviceSnapshotHeader) - 1, NULL ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.magic = 0; } ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.version += 1; } ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.idCount += 1000; } ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.deviceCount = 0x40000000; } ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.idsOffset += 1; } ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.stringsBytes += sizeof(wchar_t); } ) );
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.stringsBytes = 0; } ) );
+        // Written in the future, e.g. before the clock was set back.
+        TEST_CHECK( !OpensChanged( path.c_str(), good, good.size(), []( DeviceSnapshotHeader& header ) { header.created.dwHighDateTime += 0x100000; } ) );
+    }
+
+    DeleteFileW( path.c_str() );
+    DeviceSnapshot missing;
+    TEST_CHECK( !missing.Open( path.c_str(), 600 ) );
+    TEST_CHECK( 0 == missing.DeviceCount() );
+    missing.Find( L"Root\\Foo", found );
+    TEST_CHECK( found.empty() );
+} // void TestDeviceSnapshot()
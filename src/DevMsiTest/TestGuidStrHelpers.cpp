@@ -0,0 +1,119 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/GuidStrHelpers.h"
+#include <string>
+
+//* {4D36E97D-E325-11CE-BFC1-08002BE10318}, the System class.
+static const GUID s_systemGuid = { 0x4d36e97d, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } };
+
+/**
+ * Return true if a string converts to the expected GUID.
+ */
+static bool ParsesAs( __in const wchar_t* text, __in const GUID& expected )
+{
+    GUID guid = { 0 };
+    return TryStr2GUID( text, guid ) && expected == guid;
+}
+
+/**
+ * Return true if a string is rejected, and the GUID left as it was.
+ */
+static bool Rejects( __in const std::wstring& text )
+{
+    GUID guid = s_systemGuid;
+    return !TryStr2GUID( text, guid ) && s_systemGuid == guid;
+}
+
+/**
+ * Return true if a class name is well known, with the expected GUID
+ * and spelling.
+ */
+static bool WellKnown( __in const wchar_t* name, __in const wchar_t* canonical, __in const wchar_t* guidText )
+{
+    GUID guid = { 0 };
+    const wchar_t* spelling = NULL;
+    return WellKnownClassName2GUID( name, guid, &spelling )
+        && NULL != spelling && 0 == wcscmp( spelling, canonical )
+        && guidText == GUID2Str( guid );
+}
+
+/**
+ * GUID2Str(), TryStr2GUID() and Str2GUID(), and the table of built-in
+ * setup classes.
+ */
+void TestGuidStrHelpers()
+{
+    // Braces and upper case, with every field in the right order.
+    TEST_CHECK( L"{4D36E97D-E325-11CE-BFC1-08002BE10318}" == GUID2Str( s_systemGuid ) );
+    GUID zero = { 0 };
+    TEST_CHECK( L"{00000000-0000-0000-0000-000000000000}" == GUID2Str( zero ) );
+    GUID ones = { 0xffffffff, 0xffff, 0xffff, { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } };
+    TEST_CHECK( L"{FFFFFFFF-FFFF-FFFF-FFFF-FFFFFFFFFFFF}" == GUID2Str( ones ) );
+    GUID bytes = { 0x01234567, 0x89ab, 0xcdef, { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef } };
+    TEST_CHECK( L"{01234567-89AB-CDEF-0123-456789ABCDEF}" == GUID2Str( bytes ) );
+
+    // Hex digits in either case, and round trips.
+    TEST_CHECK( ParsesAs( L"{4D36E97D-E325-11CE-BFC1-08002BE10318}", s_systemGuid ) );
+    TEST_CHECK( ParsesAs( L"{4d36e97d-e325-11ce-bfc1-08002be10318}", s_systemGuid ) );
+    TEST_CHECK( ParsesAs( L"{4d36E97d-e325-11Ce-bFC1-08002bE10318}", s_systemGuid ) );
+    TEST_CHECK( ParsesAs( GUID2Str( bytes ).c_str(), bytes ) );
+    TEST_CHECK( ParsesAs( GUID2Str( ones ).c_str(), ones ) );
+    TEST_CHECK( s_systemGuid == Str2GUID( L"{4D36E97D-E325-11CE-BFC1-08002BE10318}" ) );
+
+    // Anything but the exact form is rejected.
+    TEST_CHECK( Rejects( L"" ) );
+    TEST_CHECK( Rejects( L"4D36E97D-E325-11CE-BFC1-08002BE10318" ) );
+    TEST_CHECK( Rejects( L"{4D36E97D-E325-11CE-BFC1-08002BE10318" ) );
+    TEST_CHECK( Rejects( L"{4D36E97D-E325-11CE-BFC1-08002BE10318} " ) );
+    TEST_CHECK( Rejects( L" {4D36E97D-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( Rejects( L"(4D36E97D-E325-11CE-BFC1-08002BE10318)" ) );
+    TEST_CHECK( Rejects( L"{4D36E97D-E325-11CE-BFC1-08002BE1031}" ) );
+    TEST_CHECK( Rejects( L"{4D36E97DE-325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( Rejects( L"{4D36E97D-E325-11CE-BFC108002BE10318-}" ) );
+    TEST_CHECK( Rejects( L"{4D36E97G-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( Rejects( L"{4D36E97D-E325-11CE-BFC1-08002BE1031 }" ) );
+    TEST_CHECK( Rejects( L"{4D36E97D-E325-11CE-BFC1-08002BE1031\x0130}" ) );
+    TEST_CHECK( Rejects( L"System" ) );
+
+    // Str2GUID() throws E_INVALIDARG for a string that is not a GUID.
+    HRESULT hr = S_OK;
+    try
+    {
+        Str2GUID( L"{not-a-guid}" );
+    }
+    catch( HRESULT& _error )
+    {
+        hr = _error;
+    }
+    TEST_CHECK( E_INVALIDARG == hr );
+
+    // Built-in classes are found in any case, across the whole table
+    // (which is binary searched), with Windows' spelling.
+    TEST_CHECK( WellKnown( L"System", L"System", L"{4D36E97D-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( WellKnown( L"SYSTEM", L"System", L"{4D36E97D-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( WellKnown( L"1394", L"1394", L"{6BDD1FC1-810F-11D0-BEC7-08002BE2092F}" ) );
+    TEST_CHECK( WellKnown( L"1394debug", L"1394Debug", L"{66F250D6-7801-4A64-B139-EEA80A450B24}" ) );
+    TEST_CHECK( WellKnown( L"adapter", L"Adapter", L"{4D36E964-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( WellKnown( L"avc", L"AVC", L"{C06FF265-AE09-48F0-812C-16753D7CBA83}" ) );
+    TEST_CHECK( WellKnown( L"hidclass", L"HIDClass", L"{745A17A0-74D3-11D0-B6FE-00A0C90F57DA}" ) );
+    TEST_CHECK( WellKnown( L"Net", L"Net", L"{4D36E972-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( WellKnown( L"netclient", L"NetClient", L"{4D36E973-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( WellKnown( L"mtd", L"MTD", L"{4D36E970-E325-11CE-BFC1-08002BE10318}" ) );
+    TEST_CHECK( WellKnown( L"usb", L"USB", L"{36FC9E60-C465-11CF-8056-444553540000}" ) );
+    TEST_CHECK( WellKnown( L"UsbDevice", L"USBDevice", L"{88BAE032-5A81-49F0-BC3D-A4FF138216D6}" ) );
+    TEST_CHECK( WellKnown( L"wpd", L"WPD", L"{EEC5AD98-8080-425F-922A-DABF3DE3F69A}" ) );
+
+    // Unknown classes are not found, and leave the outputs alone.
+    const wchar_t* unknownNames[] = { L"", L"Sys", L"Systems", L"0000", L"Zzz", L"MyCustomClass" };
+    for ( size_t i = 0; i < _countof( unknownNames ); ++i ) {
+        GUID guid = s_systemGuid;
+        const wchar_t* spelling = L"unchanged";
+        TEST_CHECK( !WellKnownClassName2GUID( unknownNames[i], guid, &spelling ) );
+        TEST_CHECK( s_systemGuid == guid && 0 == wcscmp( spelling, L"unchanged" ) );
+    }
+
+    // The spelling is optional.
+    GUID guid = { 0 };
+    TEST_CHECK( WellKnownClassName2GUID( L"ports", guid, NULL ) );
+    TEST_CHECK( L"{4D36E978-E325-11CE-BFC1-08002BE10318}" == GUID2Str( guid ) );
+}
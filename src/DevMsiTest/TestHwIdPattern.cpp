@@ -0,0 +1,134 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/HwIdPattern.h"
+#include "../DevMsi/ciwstring.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+ * Match an ID against one pattern by backtracking, as a reference for
+ * the trie.
+ */
+static bool ReferenceMatch( __in const wchar_t* pattern, __in const wchar_t* id )
+{
+    if ( L'\0' == *pattern ) {
+        return L'\0' == *id;
+    }
+    if ( L'*' == *pattern ) {
+        return ReferenceMatch( pattern + 1, id ) || ( L'\0' != *id && ReferenceMatch( pattern, id + 1 ) );
+    }
+    if ( L'\0' == *id ) {
+        return false;
+    }
+    if ( L'?' == *pattern || ci_fold( *pattern ) == ci_fold( *id ) ) {
+        return ReferenceMatch( pattern + 1, id + 1 );
+    }
+    return false;
+}
+
+/**
+ * Return the slots of a pattern set that match an ID, in order.
+ */
+static std::vector<size_t> MatchSlots( __in const HwIdPatternSet& patterns, __in const wchar_t* id, __inout HwIdPatternSet::State& state )
+{
+    std::vector<size_t> slots;
+    patterns.Match( id, state, slots );
+    std::sort( slots.begin(), slots.end() );
+    return slots;
+}
+
+/**
+ * The wildcard pattern set used by RemoveDevnode's pattern= arguments.
+ */
+void TestHwIdPattern()
+{
+    TEST_CHECK( HwIdPatternSet::IsPattern( L"ROOT\\OURVENDOR_*" ) );
+    TEST_CHECK( HwIdPatternSet::IsPattern( L"USB\\VID_045E&PID_07??" ) );
+    TEST_CHECK( !HwIdPatternSet::IsPattern( L"PCI\\VEN_8086&DEV_1C3A" ) );
+    TEST_CHECK( L"ROOT\\OURVENDOR_" == HwIdPatternSet::LiteralPrefix( L"ROOT\\OURVENDOR_*" ) );
+    TEST_CHECK( L"" == HwIdPatternSet::LiteralPrefix( L"*PNP0303" ) );
+
+    HwIdPatternSet patterns;
+    HwIdPatternSet::State state;
+    std::vector<size_t> none;
+    TEST_CHECK( patterns.Empty() );
+    TEST_CHECK( MatchSlots( patterns, L"ROOT\\ANYTHING", state ) == none );
+
+    patterns.Add( L"ROOT\\OURVENDOR_*", 0 );
+    patterns.Add( L"USB\\VID_045E&PID_07??", 1 );
+    patterns.Add( L"*PNP0303", 2 );
+    patterns.Add( L"PCI\\VEN_8086&*&REV_0?", 3 );
+    patterns.Add( L"root\\ourvendor_bus", 4 );
+    patterns.Add( L"ROOT\\OURVENDOR_*", 0 );
+    TEST_CHECK( 5 == patterns.Size() );
+
+    std::vector<size_t> expected;
+    expected.push_back( 0 );
+    TEST_CHECK( MatchSlots( patterns, L"root\\OurVendor_Filter", state ) == expected );
+    TEST_CHECK( MatchSlots( patterns, L"ROOT\\OURVENDOR_", state ) == expected );
+    expected.push_back( 4 );
+    TEST_CHECK( MatchSlots( patterns, L"ROOT\\OURVENDOR_BUS", state ) == expected );
+    TEST_CHECK( MatchSlots( patterns, L"ROOT\\OURVENDOR", state ) == none );
+
+    // '?' matches exactly one character.
+    expected.assign( 1, 1 );
+    TEST_CHECK( MatchSlots( patterns, L"USB\\VID_045E&PID_0745", state ) == expected );
+    TEST_CHECK( MatchSlots( patterns, L"USB\\VID_045E&PID_074", state ) == none );
+    TEST_CHECK( MatchSlots( patterns, L"USB\\VID_045E&PID_07456", state ) == none );
+
+    // A leading '*' matches IDs of any enumerator; patterns are anchored
+    // at both ends.
+    expected.assign( 1, 2 );
+    TEST_CHECK( MatchSlots( patterns, L"ACPI\\PNP0303", state ) == expected );
+    TEST_CHECK( MatchSlots( patterns, L"*PNP0303", state ) == expected );
+    TEST_CHECK( MatchSlots( patterns, L"ACPI\\PNP0303X", state ) == none );
+
+    // '*' in the middle has to give back characters to what follows it.
+    expected.assign( 1, 3 );
+    TEST_CHECK( MatchSlots( patterns, L"PCI\\VEN_8086&DEV_1C3A&SUBSYS_1C3A8086&REV_04", state ) == expected );
+    TEST_CHECK( MatchSlots( patterns, L"PCI\\VEN_8086&REV_04&DEV_1C3A&REV_05", state ) == expected );
+    TEST_CHECK( MatchSlots( patterns, L"PCI\\VEN_8086&DEV_1C3A", state ) == none );
+
+    // Slots already present are not added again.
+    std::vector<size_t> slots( 1, 0 );
+    patterns.Match( L"ROOT\\OURVENDOR_BUS", state, slots );
+    TEST_CHECK( 2 == slots.size() );
+
+    // Every pattern in one set agrees with the reference matcher, over
+    // pseudo-random patterns and IDs from a small alphabet.  One State
+    // serves every match, as it does during a device scan.
+    static const wchar_t patternChars[] = L"aB\\*?";
+    static const wchar_t idChars[] = L"Ab\\";
+    std::vector<std::wstring> added;
+    HwIdPatternSet randomSet;
+    DWORD random = 1;
+    for ( size_t i = 0; i < 200; ++i ) {
+        std::wstring pattern;
+        random = random * 1664525 + 1013904223;
+        for ( DWORD length = ( random >> 16 ) % 7; length > 0; --length ) {
+            random = random * 1664525 + 1013904223;
+            pattern += patternChars[( random >> 16 ) % 5];
+        }
+        randomSet.Add( pattern.c_str(), added.size() );
+        added.push_back( pattern );
+    }
+    HwIdPatternSet::State randomState;
+    int disagreements = 0;
+    for ( size_t i = 0; i < 500; ++i ) {
+        std::wstring id;
+        random = random * 1664525 + 1013904223;
+        for ( DWORD length = ( random >> 16 ) % 9; length > 0; --length ) {
+            random = random * 1664525 + 1013904223;
+            id += idChars[( random >> 16 ) % 3];
+        }
+        std::vector<size_t> matched = MatchSlots( randomSet, id.c_str(), randomState );
+        for ( size_t slot = 0; slot < added.size(); ++slot ) {
+            bool inSet = std::binary_search( matched.begin(), matched.end(), slot );
+            if ( inSet != ReferenceMatch( added[slot].c_str(), id.c_str() ) ) {
+                ++disagreements;
+            }
+        }
+    }
+    TEST_CHECK( 0 == disagreements );
+}
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/InfFingerprint.h"
+
+/**
+ * Make a fingerprint whose hashes are filled with the given bytes.
+ */
+static InfFingerprint MakeFingerprint( __in const wchar_t* version, __in BYTE inf, __in bool hasCatalog, __in BYTE catalog )
+{
+    InfFingerprint fingerprint;
+    fingerprint.driverVersion = version;
+    memset( fingerprint.infHash, inf, sizeof(fingerprint.infHash) );
+    memset( fingerprint.catalogHash, catalog, sizeof(fingerprint.catalogHash) );
+    fingerprint.hasCatalog = hasCatalog;
+    return fingerprint;
+}
+
+/**
+ * GetCatalogFileKeys() and SameDriverPackage():  which [Version] keys
+ * name the catalog on each platform, and which differences make two
+ * fingerprints different packages.
+ */
+void TestInfFingerprint()
+{
+    // The platform key comes first, then the generic ones.
+    std::vector<std::wstring> keys;
+    GetCatalogFileKeys( PROCESSOR_ARCHITECTURE_AMD64, keys );
+    TEST_CHECK( 3 == keys.size() && L"CatalogFile.NTamd64" == keys[0] && L"CatalogFile.NT" == keys[1] && L"CatalogFile" == keys[2] );
+    GetCatalogFileKeys( PROCESSOR_ARCHITECTURE_INTEL, keys );
+    TEST_CHECK( 3 == keys.size() && L"CatalogFile.NTx86" == keys[0] );
+    GetCatalogFileKeys( PROCESSOR_ARCHITECTURE_IA64, keys );
+    TEST_CHECK( 3 == keys.size() && L"CatalogFile.NTia64" == keys[0] );
+    GetCatalogFileKeys( PROCESSOR_ARCHITECTURE_ARM, keys );
+    TEST_CHECK( 3 == keys.size() && L"CatalogFile.NTarm" == keys[0] );
+    // An unknown platform still finds an undecorated catalog.
+    GetCatalogFileKeys( PROCESSOR_ARCHITECTURE_UNKNOWN, keys );
+    TEST_CHECK( 2 == keys.size() && L"CatalogFile.NT" == keys[0] && L"CatalogFile" == keys[1] );
+
+    InfFingerprint package = MakeFingerprint( L"6.1.7600.16385", 0x11, true, 0x22 );
+    TEST_CHECK( SameDriverPackage( package, package ) );
+    TEST_CHECK( SameDriverPackage( package, MakeFingerprint( L"6.1.7600.16385", 0x11, true, 0x22 ) ) );
+
+    // Any difference in the version, the INF or the catalog is another package.
+    TEST_CHECK( !SameDriverPackage( package, MakeFingerprint( L"6.1.7600.16386", 0x11, true, 0x22 ) ) );
+    TEST_CHECK( !SameDriverPackage( package, MakeFingerprint( L"", 0x11, true, 0x22 ) ) );
+    TEST_CHECK( !SameDriverPackage( package, MakeFingerprint( L"6.1.7600.16385", 0x12, true, 0x22 ) ) );
+    TEST_CHECK( !SameDriverPackage( package, MakeFingerprint( L"6.1.7600.16385", 0x11, true, 0x23 ) ) );
+    TEST_CHECK( !SameDriverPackage( package, MakeFingerprint( L"6.1.7600.16385", 0x11, false, 0x22 ) ) );
+    TEST_CHECK( !SameDriverPackage( MakeFingerprint( L"6.1.7600.16385", 0x11, false, 0x22 ), package ) );
+
+    // A single byte of a hash is enough.
+    InfFingerprint lastByte = package;
+    lastByte.infHash[INF_FINGERPRINT_HASH_BYTES - 1] ^= 1;
+    TEST_CHECK( !SameDriverPackage( package, lastByte ) );
+
+    // The version is compared ignoring case, and without a catalog its
+    // hash is not compared.
+    TEST_CHECK( SameDriverPackage( MakeFingerprint( L"1.0.A", 0x11, true, 0x22 ), MakeFingerprint( L"1.0.a", 0x11, true, 0x22 ) ) );
+    TEST_CHECK( SameDriverPackage( MakeFingerprint( L"1.0", 0x11, false, 0x22 ), MakeFingerprint( L"1.0", 0x11, false, 0x33 ) ) );
+} // void TestInfFingerprint()
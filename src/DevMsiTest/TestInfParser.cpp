@@ -0,0 +1,138 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/InfParser.h"
+#include <string>
+#include <vector>
+
+/**
+ * Read ANSI INF text.
+ */
+static void ParseAnsi( __in const char* text, __out InfSummary& summary )
+{
+    ParseInfText( text, strlen( text ), summary );
+}
+
+/**
+ * Read INF text as UTF-16, with a byte order mark.  The text is ASCII.
+ */
+static void ParseUtf16( __in const char* text, __out InfSummary& summary )
+{
+    std::vector<BYTE> bytes;
+    bytes.push_back( 0xFF );
+    bytes.push_back( 0xFE );
+    for ( ; '\0' != *text; ++text ) {
+        bytes.push_back( static_cast<BYTE>( *text ) );
+        bytes.push_back( 0 );
+    }
+    ParseInfText( &bytes[0], bytes.size(), summary );
+}
+
+/**
+ * An INF that uses the syntax the parser must follow:  decorated models
+ * sections, %strkey% substitution from [Strings] (which comes last),
+ * comments, quoted strings and line continuations.
+ */
+static const char s_inf[] =
+    "; A comment before any section\r\n"
+    "[Version]\r\n"
+    "Signature = \"$Windows NT$\"\r\n"
+    "Class     = %ClassName%   ; a comment after a value\r\n"
+    "ClassGuid = {4D36E97D-E325-11CE-BFC1-08002BE10318}\r\n"
+    "DriverVer = 06/21/2006, \\\r\n"
+    "            6.1.7600.16385\r\n"
+    "\r\n"
+    "[Manufacturer]\r\n"
+    "%Mfg% = Models, NTamd64\r\n"
+    "\r\n"
+    "[Models]\r\n"
+    "%Desc% = Install, ROOT\\Plain\r\n"
+    "\r\n"
+    "[Models.NTamd64]\r\n"
+    "%Desc% = Install, %HwId%, ROOT\\Compatible\r\n"
+    "\"Quoted; not a comment\" = Install, \"ROOT\\Quoted;Id\"\r\n"
+    "\r\n"
+    "[Models.NTia64]\r\n"
+    "%Desc% = Install, ROOT\\NotNamed\r\n"
+    "\r\n"
+    "[Install]\r\n"
+    "CopyFiles = ROOT\\NotAModel\r\n"
+    "\r\n"
+    "[Strings]\r\n"
+    "ClassName = \"System\"\r\n"
+    "Mfg       = \"Example\"\r\n"
+    "Desc      = \"Example Device\"\r\n"
+    "HWID      = \"ROOT\\Substituted\"\r\n";
+
+/**
+ * ParseInfText() and InfListsHardwareId() on INF text held in memory.
+ */
+void TestInfParser()
+{
+    InfSummary summary;
+
+    // The same text reads the same as ANSI and as UTF-16.
+    for ( int utf16 = 0; utf16 < 2; ++utf16 ) {
+        if ( utf16 ) {
+            ParseUtf16( s_inf, summary );
+        } else {
+            ParseAnsi( s_inf, summary );
+        }
+        TEST_CHECK( L"System" == summary.className );
+        TEST_CHECK( L"{4D36E97D-E325-11CE-BFC1-08002BE10318}" == summary.classGuid );
+        TEST_CHECK( L"06/21/2006,6.1.7600.16385" == summary.driverVer );
+
+        // Only the models sections named by [Manufacturer] are read, in
+        // file order, and compatible IDs are listed too.
+        TEST_CHECK( 4 == summary.hardwareIds.size() );
+        if ( 4 == summary.hardwareIds.size() ) {
+            TEST_CHECK( L"ROOT\\Plain" == summary.hardwareIds[0] );
+            TEST_CHECK( L"ROOT\\Substituted" == summary.hardwareIds[1] );
+            TEST_CHECK( L"ROOT\\Compatible" == summary.hardwareIds[2] );
+            TEST_CHECK( L"ROOT\\Quoted;Id" == summary.hardwareIds[3] );
+        }
+
+        // IDs match ignoring case.
+        TEST_CHECK( InfListsHardwareId( summary, L"root\\substituted" ) );
+        TEST_CHECK( InfListsHardwareId( summary, L"ROOT\\Compatible" ) );
+        TEST_CHECK( !InfListsHardwareId( summary, L"ROOT\\NotNamed" ) );
+        TEST_CHECK( !InfListsHardwareId( summary, L"ROOT\\NotAModel" ) );
+        TEST_CHECK( !InfListsHardwareId( summary, L"ROOT\\Plain\\0000" ) );
+    }
+
+    // Localized strings are used for keys that [Strings] lacks, and %%
+    // is a percent sign.  Section names and keys ignore case.
+    ParseAnsi(
+        "[version]\n"
+        "CLASS=%Name%\n"
+        "[MANUFACTURER]\n"
+        "%Mfg%=%ModelsName%\n"
+        "[models]\n"
+        "Device=Install,ROOT\\100%%\n"
+        "[Strings.0409]\n"
+        "name=Localized\n"
+        "ModelsName=Models\n"
+        "[strings]\n"
+        "Mfg=Example\n"
+        "Name=Base\n",
+        summary );
+    TEST_CHECK( L"Base" == summary.className );
+    TEST_CHECK( InfListsHardwareId( summary, L"ROOT\\100%" ) );
+
+    // A key that is not defined is left as it is, and a line that ends
+    // with a backslash at the end of the text is not joined to anything.
+    ParseAnsi(
+        "[Manufacturer]\n"
+        "Example=Models\n"
+        "[Models]\n"
+        "Device=Install,%Undefined%,ROOT\\Last\\",
+        summary );
+    TEST_CHECK( InfListsHardwareId( summary, L"%Undefined%" ) );
+    TEST_CHECK( InfListsHardwareId( summary, L"ROOT\\Last\\" ) );
+
+    // Empty text, and text without a [Manufacturer], have no IDs.
+    ParseInfText( NULL, 0, summary );
+    TEST_CHECK( summary.className.empty() && summary.hardwareIds.empty() );
+    ParseAnsi( "[Version]\nClass=System\n[Models]\nDevice=Install,ROOT\\Orphan\n", summary );
+    TEST_CHECK( L"System" == summary.className );
+    TEST_CHECK( summary.hardwareIds.empty() );
+}
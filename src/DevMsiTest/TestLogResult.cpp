@@ -0,0 +1,179 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/LogResult.h"
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+
+/**
+ * What a CaptureLogSink has been sent.  It outlives the sink, which
+ * LogStopAsync() deletes.
+ */
+struct CapturedLog {
+    std::mutex lock;
+    std::vector<std::string> texts;     //*< The messages, in the order they were written
+    HANDLE release;                     //*< If not NULL, each write waits for this event first
+
+    CapturedLog() : release( NULL ) {}
+
+    //* The number of "dropped" records that LogStopAsync() reported, or 0.
+    unsigned long Dropped() {
+        unsigned long dropped = 0;
+        for ( auto iter = texts.begin(); iter != texts.end(); ++iter ) {
+            if ( NULL != strstr( iter->c_str(), "log record(s) were dropped" ) ) {
+                sscanf_s( iter->c_str(), "%lu", &dropped );
+            }
+        }
+        return dropped;
+    }
+};
+
+/**
+ * A sink that keeps every message it is sent.
+ */
+class CaptureLogSink : public LogSink {
+public:
+    CaptureLogSink( __in CapturedLog& log ) : m_log( log ) {}
+
+    virtual void Write( HRESULT /*hr*/, const char* text ) {
+        if ( NULL != m_log.release ) {
+            WaitForSingleObject( m_log.release, INFINITE );
+        }
+        std::lock_guard<std::mutex> lock( m_log.lock );
+        m_log.texts.push_back( text );
+    }
+
+private:
+    CaptureLogSink& operator=( const CaptureLogSink& );
+
+    CapturedLog& m_log;
+};
+
+/**
+ * Log "<thread> <index>" count times.
+ */
+static void LogNumbered( __in int thread, __in int count )
+{
+    for ( int i = 0; i < count; ++i ) {
+        LogResult( S_OK, "%d %d", thread, i );
+    }
+}
+
+/**
+ * Check that every thread's numbered messages arrived whole and in order.
+ */
+static bool AllInOrder( __in const CapturedLog& log, __in int threads, __in int count )
+{
+    std::vector<int> next( threads, 0 );
+    for ( auto iter = log.texts.begin(); iter != log.texts.end(); ++iter ) {
+        int thread = -1, index = -1;
+        if ( 2 == sscanf_s( iter->c_str(), "%d %d", &thread, &index ) ) {
+            if ( thread < 0 || threads <= thread || index != next[thread] ) {
+                return false;
+            }
+            ++next[thread];
+        }
+    }
+    for ( int i = 0; i < threads; ++i ) {
+        if ( count != next[i] ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * LogResult() with added sinks, synchronous and through the log queue:
+ * long messages, many threads filling the queue, the overflow modes,
+ * and a call that is still queuing when LogStopAsync() is called.
+ */
+void TestLogResult()
+{
+    // Keep the checks' messages off the console.
+    LogEnableStandardSink( false );
+
+    // A long message is delivered whole, with or without the queue.
+    std::string longText( 5000, 'x' );
+    {
+        CapturedLog log;
+        LogAddSink( new CaptureLogSink( log ) );
+        LogResult( S_OK, "%s", longText.c_str() );
+        LogStartAsync( evLogOverflowBlock );
+        LogResult( S_OK, "%s", longText.c_str() );
+        LogResult( S_OK, "short" );
+        LogStopAsync();
+        TEST_CHECK( 3 == log.texts.size() && longText == log.texts[0] && longText == log.texts[1] && "short" == log.texts[2] );
+    }
+
+    // LogFormat() still cuts a long message short.
+    {
+        char buffer[LOG_RECORD_TEXT];
+        LogFormat( buffer, "%s", longText.c_str() );
+        TEST_CHECK( LOG_RECORD_TEXT - 1 == strlen( buffer ) );
+        TEST_CHECK( 0 == strcmp( buffer + LOG_RECORD_TEXT - 4, "..." ) );
+    }
+
+    // Several threads, each logging more than the queue holds:  when the
+    // queue is full they wait, and nothing is lost or reordered.
+    {
+        const int threads = 4, count = 1000;
+        CapturedLog log;
+        LogAddSink( new CaptureLogSink( log ) );
+        LogStartAsync( evLogOverflowBlock );
+        std::vector<std::thread> producers;
+        for ( int i = 0; i < threads; ++i ) {
+            producers.push_back( std::thread( LogNumbered, i, count ) );
+        }
+        for ( auto iter = producers.begin(); iter != producers.end(); ++iter ) {
+            iter->join();
+        }
+        LogStopAsync();
+        TEST_CHECK( threads * count == log.texts.size() );
+        TEST_CHECK( AllInOrder( log, threads, count ) );
+        TEST_CHECK( 0 == log.Dropped() );
+    }
+
+    // With evLogOverflowDrop, a stalled sink costs messages rather than
+    // time, and every one of them is either delivered or counted.
+    {
+        const int count = 1000;
+        CapturedLog log;
+        log.release = CreateEvent( NULL, TRUE, FALSE, NULL );
+        LogAddSink( new CaptureLogSink( log ) );
+        LogStartAsync( evLogOverflowDrop );
+        DWORD start = GetTickCount();
+        LogNumbered( 0, count );
+        TEST_CHECK( GetTickCount() - start < 1000 );
+        SetEvent( log.release );
+        LogStopAsync();
+        CloseHandle( log.release );
+        unsigned long dropped = log.Dropped();
+        TEST_CHECK( 0 < dropped );
+        TEST_CHECK( count + 1 == log.texts.size() + dropped );
+    }
+
+    // A call that is waiting for room when LogStopAsync() is called still
+    // gets its message delivered before the sinks are deleted, and the
+    // calls after it, which no longer queue, come after it.
+    {
+        const int count = 600;
+        CapturedLog log;
+        log.release = CreateEvent( NULL, TRUE, FALSE, NULL );
+        LogAddSink( new CaptureLogSink( log ) );
+        LogStartAsync( evLogOverflowBlock );
+        std::thread producer( LogNumbered, 0, count );
+        Sleep( 50 );
+        std::thread stopper( LogStopAsync );
+        Sleep( 50 );
+        SetEvent( log.release );
+        producer.join();
+        stopper.join();
+        CloseHandle( log.release );
+        TEST_CHECK( count == log.texts.size() );
+        TEST_CHECK( AllInOrder( log, 1, count ) );
+    }
+
+    LogEnableStandardSink( true );
+} // void TestLogResult()
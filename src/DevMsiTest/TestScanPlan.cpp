@@ -0,0 +1,71 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/ScanPlan.h"
+#include "../DevMsi/GuidStrHelpers.h"
+#include <string>
+#include <vector>
+
+/**
+ * Plan a scan for the given arguments.
+ */
+static void Plan( __in const wchar_t* const* arguments, __in int count, __out ScanPlan& plan )
+{
+    std::vector<std::wstring> copies( arguments, arguments + count );
+    std::vector<LPWSTR> argv;
+    for ( auto iter = copies.begin(); iter != copies.end(); ++iter ) {
+        argv.push_back( &( *iter )[0] );
+    }
+    ArgList args( count, argv.empty() ? NULL : &argv[0] );
+    PlanDeviceScan( args, plan );
+}
+
+/**
+ * The devices that DoRemoveDevnode() reads for each set of hints.
+ */
+void TestScanPlan()
+{
+    ScanPlan plan;
+
+    // IDs alone never narrow the scan, even if every one starts with
+    // "ROOT\":  a software device may carry one as a compatible ID.
+    const wchar_t* rootIds[] = { L"ROOT\\OURVENDOR_BUS", L"pattern=ROOT\\OURVENDOR_*", L"snapshot=devs.snap" };
+    Plan( rootIds, _countof(rootIds), plan );
+    TEST_CHECK( !plan.Narrowed() );
+    TEST_CHECK( plan.enumerator.empty() );
+    TEST_CHECK( plan.instanceIds.empty() );
+    TEST_CHECK( !plan.hasClass );
+
+    // An explicit enumerator narrows it.
+    const wchar_t* enumerated[] = { L"ROOT\\OURVENDOR_BUS", L"enumerator=ROOT" };
+    Plan( enumerated, _countof(enumerated), plan );
+    TEST_CHECK( plan.Narrowed() );
+    TEST_CHECK( L"ROOT" == plan.enumerator );
+    TEST_CHECK( !plan.hasClass );
+
+    // A class may be a built-in name or a GUID, with or without an enumerator.
+    GUID net;
+    TEST_CHECK( TryStr2GUID( L"{4D36E972-E325-11CE-BFC1-08002BE10318}", net ) );
+    const wchar_t* named[] = { L"PCI\\VEN_8086&DEV_1C3A", L"class=net", L"enumerator=PCI" };
+    Plan( named, _countof(named), plan );
+    TEST_CHECK( plan.Narrowed() );
+    TEST_CHECK( plan.hasClass && net == plan.classGuid );
+    TEST_CHECK( L"PCI" == plan.enumerator );
+    const wchar_t* guid[] = { L"PCI\\VEN_8086&DEV_1C3A", L"class={4d36e972-e325-11ce-bfc1-08002be10318}" };
+    Plan( guid, _countof(guid), plan );
+    TEST_CHECK( plan.hasClass && net == plan.classGuid );
+    TEST_CHECK( plan.enumerator.empty() );
+
+    // Instance IDs take precedence over every other hint.
+    const wchar_t* instances[] = { L"ROOT\\OURVENDOR_BUS", L"instance=ROOT\\SYSTEM\\0001"
+        , L"enumerator=ROOT", L"instance=ROOT\\SYSTEM\\0002", L"class=System" };
+    Plan( instances, _countof(instances), plan );
+    TEST_CHECK( plan.Narrowed() );
+    TEST_CHECK( 2 == plan.instanceIds.size() );
+    TEST_CHECK( 2 == plan.instanceIds.size() && 0 == wcscmp( L"ROOT\\SYSTEM\\0002", plan.instanceIds[1] ) );
+    TEST_CHECK( plan.enumerator.empty() );
+    TEST_CHECK( !plan.hasClass );
+
+    // A plan is reset by the next one.
+    Plan( rootIds, _countof(rootIds), plan );
+    TEST_CHECK( !plan.Narrowed() );
+}
@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "SimServiceManager.h"
+#include "../DevMsi/ArgList.h"
+#include "../DevMsi/ServiceRemove.h"
+#include <memory>
+
+/**
+ * Run RemoveServices() against a service manager, with the arguments
+ * given as one string and split as CustomActionData is.
+ */
+static HRESULT Remove( __in ServiceManager& scm, __in const wchar_t* arguments )
+{
+    std::vector<wchar_t> text( arguments, arguments + wcslen( arguments ) + 1 );
+    std::vector<LPWSTR> argv;
+    SplitCustomActionData( &text[0], argv );
+    return RemoveServices( static_cast<int>( argv.size() ), argv.empty() ? NULL : &argv[0], &scm );
+}
+
+/**
+ * Return a service's state, SERVICE_STOPPED if it is marked for delete
+ * and has gone since it stopped, or 0 if it does not exist.  Simulated
+ * failures are retried.
+ */
+static DWORD StateOf( __in ServiceManager& scm, __in const wchar_t* name )
+{
+    SERVICE_STATUS status;
+    HRESULT hr = S_OK;
+    do {
+        hr = scm.QueryStatus( name, status );
+    } while ( HRESULT_FROM_WIN32( ERROR_SERVICE_DATABASE_LOCKED ) == hr );
+    return SUCCEEDED( hr ) ? status.dwCurrentState : 0;
+}
+
+/**
+ * RemoveServices() through SimServiceManager:  the outcome for each
+ * service of a missing name, a running service, stop=1, names versus
+ * pattern=, and calls that fail as if the database were locked.
+ */
+void TestServiceRemove()
+{
+    const wchar_t* services =
+        L"OurA running=0\n"
+        L"OurB running=0\n"
+        L"OurRunning stop=10\n"
+        L"OurServer stop=10\n"
+        L"OurClient depends=OurServer stop=10\n"
+        L"Other running=0\n";
+
+    // A name that matches no service is not a failure, and the others
+    // are still deleted.
+    {
+        std::unique_ptr<ServiceManager> scm( CreateSimulatedServiceManagerFromText( services, 0, 0 ) );
+        TEST_CHECK( S_OK == Remove( *scm, L"Missing OurA" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"OurA" ) );
+        TEST_CHECK( SERVICE_STOPPED == StateOf( *scm, L"OurB" ) );
+        TEST_CHECK( SERVICE_STOPPED == StateOf( *scm, L"Other" ) );
+    }
+
+    // A running service is marked for delete, and goes once it stops.
+    {
+        std::unique_ptr<ServiceManager> scm( CreateSimulatedServiceManagerFromText( services, 0, 0 ) );
+        TEST_CHECK( S_OK == Remove( *scm, L"service=OurRunning" ) );
+        TEST_CHECK( SERVICE_RUNNING == StateOf( *scm, L"OurRunning" ) );
+        SERVICE_STATUS status;
+        TEST_CHECK( SUCCEEDED( scm->Stop( L"OurRunning", status ) ) );
+        Sleep( 30 );
+        TEST_CHECK( SERVICE_STOPPED == StateOf( *scm, L"OurRunning" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"OurRunning" ) );
+    }
+
+    // stop=1 stops the service, and what depends on it, before deleting
+    // it.  The dependent is stopped but kept.
+    {
+        std::unique_ptr<ServiceManager> scm( CreateSimulatedServiceManagerFromText( services, 0, 0 ) );
+        TEST_CHECK( S_OK == Remove( *scm, L"OurServer stop=1 timeout=1000" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"OurServer" ) );
+        TEST_CHECK( SERVICE_STOPPED == StateOf( *scm, L"OurClient" ) );
+    }
+
+    // A name is taken literally; only pattern= matches wildcards.
+    {
+        std::unique_ptr<ServiceManager> scm( CreateSimulatedServiceManagerFromText( services, 0, 0 ) );
+        TEST_CHECK( S_OK == Remove( *scm, L"Our*" ) );
+        TEST_CHECK( SERVICE_STOPPED == StateOf( *scm, L"OurA" ) );
+        TEST_CHECK( S_OK == Remove( *scm, L"pattern=our? pattern=OurA" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"OurA" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"OurB" ) );
+        TEST_CHECK( SERVICE_RUNNING == StateOf( *scm, L"OurRunning" ) );
+        TEST_CHECK( SERVICE_STOPPED == StateOf( *scm, L"Other" ) );
+    }
+
+    // Calls that fail as if the database were locked are retried.  The
+    // fixed failure sequence fails the first DeleteService() of OurA and
+    // two of Other.
+    {
+        std::unique_ptr<ServiceManager> scm( CreateSimulatedServiceManagerFromText( services, 0, 30 ) );
+        TEST_CHECK( S_OK == Remove( *scm, L"OurA OurB pattern=Other" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"OurA" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"OurB" ) );
+        TEST_CHECK( 0 == StateOf( *scm, L"Other" ) );
+    }
+
+    // A lock that is never released fails the service once the budget
+    // is spent, rather than once every attempt has been made.
+    {
+        std::unique_ptr<ServiceManager> scm( CreateSimulatedServiceManagerFromText( services, 0, 100 ) );
+        DWORD start = GetTickCount();
+        TEST_CHECK( HRESULT_FROM_WIN32( ERROR_SERVICE_DATABASE_LOCKED ) == Remove( *scm, L"OurA budget=300" ) );
+        TEST_CHECK( GetTickCount() - start < 2000 );
+    }
+} // void TestServiceRemove()
@@ -0,0 +1,252 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+#include "../DevMsi/ServiceStop.h"
+#include <map>
+#include <algorithm>
+
+/**
+ * A service in FakeServiceManager.
+ */
+struct FakeService {
+    std::vector<std::wstring> depends;  //*< The services this one depends on
+    DWORD stopMs;                       //*< How long the service takes to stop once asked
+    HRESULT stopError;                  //*< If a failure, what every stop request returns
+    DWORD lockedStops;                  //*< The stop requests still to fail as if the database were locked
+    DWORD state;                        //*< SERVICE_RUNNING, SERVICE_STOP_PENDING or SERVICE_STOPPED
+    DWORD stopAt;                       //*< GetTickCount() when a pending stop completes
+};
+
+/**
+ * A ServiceManager over a handful of services, which records the stop
+ * requests it is sent and checks that no service is asked to stop while
+ * a service that depends on it is still running.
+ */
+class FakeServiceManager : public ServiceManager {
+public:
+    FakeServiceManager() : outOfOrder( false ) {}
+
+    //* Add a running service.
+    void Add( __in const wchar_t* name, __in DWORD stopMs, __in_opt const wchar_t* dependsOn = NULL ) {
+        FakeService service;
+        if ( NULL != dependsOn ) {
+            service.depends.push_back( dependsOn );
+        }
+        service.stopMs = stopMs;
+        service.stopError = S_OK;
+        service.lockedStops = 0;
+        service.state = SERVICE_RUNNING;
+        service.stopAt = 0;
+        m_services[name] = service;
+    }
+
+    //* Make every stop request of a service fail.
+    void FailStop( __in const wchar_t* name, __in HRESULT hr ) {
+        m_services[name].stopError = hr;
+    }
+
+    //* Make the next stop requests of a service fail as if the database were locked.
+    void LockStops( __in const wchar_t* name, __in DWORD count ) {
+        m_services[name].lockedStops = count;
+    }
+
+    //* Return the state of a service.
+    DWORD State( __in const wchar_t* name ) {
+        return Find( name )->state;
+    }
+
+    //* Return the position of a service's first stop request, or -1.
+    int StopOrder( __in const wchar_t* name ) const {
+        return StopOrder( name, 1 );
+    }
+
+    //* Return the position of a service's nth stop request, or -1.
+    int StopOrder( __in const wchar_t* name, __in DWORD nth ) const {
+        for ( size_t i = 0; i < stops.size(); ++i ) {
+            if ( name == stops[i] && 0 == --nth ) {
+                return static_cast<int>( i );
+            }
+        }
+        return -1;
+    }
+
+    virtual HRESULT ListServices( __out std::vector<std::wstring>& names ) {
+        names.clear();
+        for ( auto iter = m_services.begin(); iter != m_services.end(); ++iter ) {
+            names.push_back( iter->first );
+        }
+        return S_OK;
+    }
+
+    virtual HRESULT Delete( __in const wchar_t* name ) {
+        return m_services.erase( name ) ? S_OK : HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+    }
+
+    virtual HRESULT ListDependents( __in const wchar_t* name, __out std::vector<std::wstring>& names ) {
+        names.clear();
+        if ( NULL == Find( name ) ) {
+            return HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+        }
+        AddDependents( name, names );
+        return S_OK;
+    }
+
+    virtual HRESULT Stop( __in const wchar_t* name, __out SERVICE_STATUS& status ) {
+        ZeroMemory( &status, sizeof( status ) );
+        stops.push_back( name );
+        FakeService* service = Find( name );
+        if ( NULL == service ) {
+            return HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+        }
+        std::vector<std::wstring> dependents;
+        AddDependents( name, dependents );
+        if ( !dependents.empty() ) {
+            outOfOrder = true;
+            return HRESULT_FROM_WIN32( ERROR_DEPENDENT_SERVICES_RUNNING );
+        }
+        if ( FAILED( service->stopError ) ) {
+            return service->stopError;
+        }
+        if ( 0 < service->lockedStops ) {
+            --service->lockedStops;
+            return HRESULT_FROM_WIN32( ERROR_SERVICE_DATABASE_LOCKED );
+        }
+        HRESULT hr = S_OK;
+        if ( SERVICE_RUNNING == service->state ) {
+            service->state = SERVICE_STOP_PENDING;
+            service->stopAt = GetTickCount() + service->stopMs;
+            Advance( *service );
+        } else if ( SERVICE_STOP_PENDING == service->state ) {
+            hr = HRESULT_FROM_WIN32( ERROR_SERVICE_CANNOT_ACCEPT_CTRL );
+        }
+        FillStatus( *service, status );
+        return hr;
+    }
+
+    virtual HRESULT QueryStatus( __in const wchar_t* name, __out SERVICE_STATUS& status ) {
+        ZeroMemory( &status, sizeof( status ) );
+        FakeService* service = Find( name );
+        if ( NULL == service ) {
+            return HRESULT_FROM_WIN32( ERROR_SERVICE_DOES_NOT_EXIST );
+        }
+        FillStatus( *service, status );
+        return S_OK;
+    }
+
+    std::vector<std::wstring> stops;    //*< The names sent stop requests, in order
+    bool outOfOrder;                    //*< true if a service was asked to stop before its dependents
+
+private:
+    FakeService* Find( __in const wchar_t* name ) {
+        auto found = m_services.find( name );
+        if ( m_services.end() == found ) {
+            return NULL;
+        }
+        Advance( found->second );
+        return &found->second;
+    }
+
+    void Advance( __inout FakeService& service ) {
+        if ( SERVICE_STOP_PENDING == service.state && static_cast<LONG>( GetTickCount() - service.stopAt ) >= 0 ) {
+            service.state = SERVICE_STOPPED;
+        }
+    }
+
+    void FillStatus( __in const FakeService& service, __out SERVICE_STATUS& status ) {
+        status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
+        status.dwCurrentState = service.state;
+        status.dwWaitHint = SERVICE_STOP_PENDING == service.state ? service.stopMs : 0;
+    }
+
+    // The running services that depend on a service, directly or not, as
+    // EnumDependentServices() lists them.
+    void AddDependents( __in const wchar_t* name, __inout std::vector<std::wstring>& names ) {
+        for ( auto iter = m_services.begin(); iter != m_services.end(); ++iter ) {
+            Advance( iter->second );
+            if ( SERVICE_STOPPED != iter->second.state
+                && iter->second.depends.end() != std::find( iter->second.depends.begin(), iter->second.depends.end(), std::wstring( name ) )
+                && names.end() == std::find( names.begin(), names.end(), iter->first ) ) {
+                names.push_back( iter->first );
+                AddDependents( iter->first.c_str(), names );
+            }
+        }
+    }
+
+    std::map<std::wstring, FakeService> m_services;    //*< The services, by name
+};
+
+/**
+ * StopServices() against a fake service manager:  dependency order,
+ * overlapping stops, and what happens when a service does not stop.
+ */
+void TestServiceStop()
+{
+    Deadline noLimit( 0 );
+
+    // Dependents stop before the services they depend on, and are found
+    // through the services named.  Independent services are stopping at
+    // the same time:  "Other" is asked to stop before "Top" has stopped.
+    {
+        FakeServiceManager scm;
+        scm.Add( L"Base", 0 );
+        scm.Add( L"Mid", 50, L"Base" );
+        scm.Add( L"Top", 100, L"Mid" );
+        scm.Add( L"Other", 100 );
+        std::vector<std::wstring> names;
+        names.push_back( L"Base" );
+        names.push_back( L"Other" );
+        names.push_back( L"Missing" );
+        TEST_CHECK( S_OK == StopServices( scm, names, 5000, noLimit ) );
+        TEST_CHECK( !scm.outOfOrder );
+        TEST_CHECK( SERVICE_STOPPED == scm.State( L"Base" ) );
+        TEST_CHECK( SERVICE_STOPPED == scm.State( L"Mid" ) );
+        TEST_CHECK( SERVICE_STOPPED == scm.State( L"Top" ) );
+        TEST_CHECK( SERVICE_STOPPED == scm.State( L"Other" ) );
+        TEST_CHECK( 0 <= scm.StopOrder( L"Top" ) );
+        TEST_CHECK( scm.StopOrder( L"Top" ) < scm.StopOrder( L"Mid" ) );
+        TEST_CHECK( scm.StopOrder( L"Mid" ) < scm.StopOrder( L"Base" ) );
+        TEST_CHECK( 0 <= scm.StopOrder( L"Other" ) && scm.StopOrder( L"Other" ) < scm.StopOrder( L"Mid" ) );
+    }
+
+    // If a dependent fails to stop, the services it depends on are not
+    // asked to stop, and fail with ERROR_DEPENDENT_SERVICES_RUNNING.
+    {
+        FakeServiceManager scm;
+        scm.Add( L"Base", 0 );
+        scm.Add( L"Stubborn", 0, L"Base" );
+        scm.FailStop( L"Stubborn", HRESULT_FROM_WIN32( ERROR_ACCESS_DENIED ) );
+        std::vector<std::wstring> names( 1, L"Base" );
+        TEST_CHECK( HRESULT_FROM_WIN32( ERROR_DEPENDENT_SERVICES_RUNNING ) == StopServices( scm, names, 5000, noLimit ) );
+        TEST_CHECK( 0 <= scm.StopOrder( L"Stubborn" ) );
+        TEST_CHECK( -1 == scm.StopOrder( L"Base" ) );
+        TEST_CHECK( SERVICE_RUNNING == scm.State( L"Base" ) );
+    }
+
+    // A stop request that fails with a transient error is sent again at a
+    // later poll, without holding up the other services:  "Other" is asked
+    // to stop before "Locked" is asked again.
+    {
+        FakeServiceManager scm;
+        scm.Add( L"Other", 0 );
+        scm.Add( L"Locked", 0 );
+        scm.LockStops( L"Locked", 2 );
+        std::vector<std::wstring> names;
+        names.push_back( L"Other" );
+        names.push_back( L"Locked" );
+        TEST_CHECK( S_OK == StopServices( scm, names, 5000, noLimit ) );
+        TEST_CHECK( SERVICE_STOPPED == scm.State( L"Locked" ) );
+        TEST_CHECK( 0 == scm.StopOrder( L"Locked" ) );
+        TEST_CHECK( 1 == scm.StopOrder( L"Other" ) );
+        TEST_CHECK( 0 <= scm.StopOrder( L"Locked", 3 ) );
+    }
+
+    // A service that does not stop in time times out.
+    {
+        FakeServiceManager scm;
+        scm.Add( L"Slow", 60000 );
+        std::vector<std::wstring> names( 1, L"Slow" );
+        DWORD start = GetTickCount();
+        TEST_CHECK( HRESULT_FROM_WIN32( ERROR_SERVICE_REQUEST_TIMEOUT ) == StopServices( scm, names, 100, noLimit ) );
+        TEST_CHECK( GetTickCount() - start < 5000 );
+        TEST_CHECK( SERVICE_STOP_PENDING == scm.State( L"Slow" ) );
+    }
+}
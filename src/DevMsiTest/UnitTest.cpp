@@ -0,0 +1,64 @@
+#include "stdafx.h"
+#include "UnitTest.h"
+
+/**
+ * A test suite, as named on the command line.
+ */
+struct TestSuite {
+    LPCTSTR name;           //*< The suite name
+    void (*run)();          //*< The suite
+};
+
+static const TestSuite s_suites[] = {
+    { TEXT("arglist"), TestArgList },
+    { TEXT("ciwstring"), TestCiWstring },
+    { TEXT("deadline"), TestDeadline },
+    { TEXT("deviceproperty"), TestDeviceProperty },
+    { TEXT("devicesnapshot"), TestDeviceSnapshot },
+    { TEXT("guidstrhelpers"), TestGuidStrHelpers },
+    { TEXT("hwidpattern"), TestHwIdPattern },
+    { TEXT("inffingerprint"), TestInfFingerprint },
+    { TEXT("infparser"), TestInfParser },
+    { TEXT("logresult"), TestLogResult },
+    { TEXT("scanplan"), TestScanPlan },
+    { TEXT("serviceremove"), TestServiceRemove },
+    { TEXT("servicestop"), TestServiceStop },
+};
+
+static int s_checks = 0;    //*< The checks made by the running suite
+static int s_failures = 0;  //*< The checks that failed in the running suite
+
+void TestCheck( __in bool passed, __in const char* expression, __in const char* file, __in int line )
+{
+    ++s_checks;
+    if ( !passed ) {
+        ++s_failures;
+        printf( "%s(%d): check failed: %s\n", file, line, expression );
+    }
+}
+
+int RunUnitTests( int argc, _TCHAR* argv[] )
+{
+    int result = 0;
+    int run = 0;
+    for ( size_t i = 0; i < _countof(s_suites); ++i ) {
+        bool named = ( 0 == argc );
+        for ( int arg = 0; arg < argc && !named; ++arg ) {
+            named = !_tcsicmp( argv[arg], s_suites[i].name );
+        }
+        if ( !named ) {
+            continue;
+        }
+
+        s_checks = 0;
+        s_failures = 0;
+        s_suites[i].run();
+        ++run;
+        _tprintf( TEXT("%s: %d check(s), %d failed\n"), s_suites[i].name, s_checks, s_failures );
+        if ( 0 != s_failures ) {
+            result = -1;
+        }
+    }
+    // A misspelt suite name must not pass by running nothing.
+    return ( 0 == run ) ? -1 : result;
+}
@@ -0,0 +1,56 @@
+/**
+ * Header file for the unit tests run by "DevMsiTest test".
+ *
+ * Each suite is a function that makes its checks with TEST_CHECK().
+ * A failed check is reported and counted, and the suite carries on.
+ */
+#pragma once
+
+/**
+ * Record the result of one check, and report it if it failed.
+ *
+ * @param passed True if the check passed.
+ * @param expression The text of the check, for the report.
+ * @param file The source file of the check.
+ * @param line The line of the check.
+ */
+void TestCheck( __in bool passed, __in const char* expression, __in const char* file, __in int line );
+
+//* Check that an expression is true.
+#define TEST_CHECK( expression ) TestCheck( ( expression ) ? true : false, #expression, __FILE__, __LINE__ )
+
+/**
+ * Run the named test suites, or every suite if none is named.
+ *
+ * Usage: DevMsiTest test [suite...]
+ *
+ * @param argc  The count of arguments following "test".
+ * @param argv  The arguments following "test".
+ * @return Returns 0 if every check passed, otherwise -1.
+ */
+int RunUnitTests( int argc, _TCHAR* argv[] );
+
+#ifdef _DEBUG
+#  include <crtdbg.h>
+
+//* The number of heap allocations seen by AllocCountHook(), which "DevMsiTest bench" also uses.
+extern volatile LONG g_allocCount;
+
+//* Count heap allocations; installed with _CrtSetAllocHook().  Debug builds only.
+int __cdecl AllocCountHook( int allocType, void*, size_t, int, long, const unsigned char*, int );
+#endif // _DEBUG
+
+// The suites, one per source file.
+void TestArgList();
+void TestCiWstring();
+void TestDeadline();
+void TestDeviceProperty();
+void TestDeviceSnapshot();
+void TestGuidStrHelpers();
+void TestHwIdPattern();
+void TestInfFingerprint();
+void TestInfParser();
+void TestLogResult();
+void TestScanPlan();
+void TestServiceRemove();
+void TestServiceStop();